@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "vk_asset.h"
+#include "vk_environment.h"
+#include "vk_jobs.h"
+#include "vk_light_bake.h"
+#include "vk_mesh.h"
+#include "vk_pack.h"
+
+#include "derived_data_cache.h"
+#include "pack_writer.h"
+#include "texture_cooker.h"
+
+// bump when the cooked formats or the cooking steps change, every output is rebuilt
+constexpr uint32_t COOKER_VERSION = 1;
+
+namespace fs = std::filesystem;
+
+enum class CookKind
+{
+	Mesh,
+	Texture,
+	// a scene written by the engine, its static lights are baked into probes
+	Lighting,
+	// an HDR environment, filtered into the maps of image based lighting
+	Environment,
+};
+
+struct CookJob
+{
+	std::string source;
+	std::string output;
+	CookKind kind;
+};
+
+static bool cookMesh(const CookJob& job, const uint64_t sourceHash)
+{
+	Mesh mesh{};
+	const fs::path extension = fs::path(job.source).extension();
+	const bool loaded = (extension == ".obj") ? mesh.loadFromObj(job.source.c_str()) : mesh.loadFromGltf(job.source.c_str());
+	if (!loaded || mesh.m_vertices.empty())
+		return false;
+
+	mesh.buildIndices();
+	mesh.optimize();
+	return mesh.saveCooked(job.output.c_str(), sourceHash);
+}
+
+static bool cookTexture(const CookJob& job, const uint64_t sourceHash)
+{
+	vkutil::CookedTexture texture;
+	return cooker::cookTexture(job.source.c_str(), sourceHash, texture)
+		&& vkutil::saveCookedTexture(job.output.c_str(), texture);
+}
+
+// the probes are keyed by the hash of the scene file, the engine hashes the same bytes before writing it
+static bool cookLighting(const CookJob& job, const uint64_t sourceHash, JobSystem& jobSystem)
+{
+	vkutil::FileData fileData;
+	vkutil::BakeScene scene;
+	if (!vkutil::readFile(job.source.c_str(), fileData) || !vkutil::parseBakeScene(fileData.data(), fileData.size(), scene))
+		return false;
+
+	LightBaker baker;
+	vkutil::BakedProbeGrid grid;
+	baker.bake(jobSystem, scene, grid);
+	grid.sourceHash = sourceHash;
+
+	const LightBakeStats& stats = baker.getStats();
+	std::cout << "Baked " << stats.lightCount << " lights over " << stats.triangleCount << " triangles into " << stats.probeCount
+		<< " probes : " << stats.rayCount << " rays (" << LightBaker::getInstructionSet() << ") in " << stats.buildMilliseconds + stats.bakeMilliseconds << " ms" << std::endl;
+	return vkutil::saveProbeGrid(job.output.c_str(), grid);
+}
+
+static bool cookEnvironment(const CookJob& job, const uint64_t sourceHash, JobSystem& jobSystem)
+{
+	vkutil::FileData fileData;
+	std::vector<float> pixels;
+	uint32_t width, height;
+	if (!vkutil::readFile(job.source.c_str(), fileData) || !EnvironmentFilter::decode(fileData.data(), fileData.size(), pixels, width, height))
+		return false;
+
+	EnvironmentFilter filter;
+	vkutil::CookedEnvironment environment;
+	filter.filter(jobSystem, pixels.data(), width, height, environment);
+	environment.sourceHash = sourceHash;
+
+	const EnvironmentFilterStats& stats = filter.getStats();
+	std::cout << "Filtered " << width << "x" << height << " (" << EnvironmentFilter::getInstructionSet() << ") : irradiance " << stats.irradianceMilliseconds
+		<< " ms, specular " << stats.specularMilliseconds << " ms, BRDF " << stats.brdfMilliseconds << " ms" << std::endl;
+	return vkutil::saveCookedEnvironment(job.output.c_str(), environment);
+}
+
+// packs the whole directory tree into "<directory>.vkpak", sources already cooked are left out
+static bool packDirectory(const fs::path& directory, const std::vector<CookJob>& jobs)
+{
+	std::vector<std::string> excluded = { vkutil::normalizePackPath((directory / "cooked" / "ddc.txt").string()) };
+	for (const CookJob& job : jobs)
+		if (fs::exists(job.output))
+			excluded.push_back(vkutil::normalizePackPath(job.source));
+
+	std::vector<cooker::PackInput> inputs;
+	for (const auto& entry : fs::recursive_directory_iterator(directory))
+	{
+		const std::string path = entry.path().string();
+		if (!entry.is_regular_file() || std::find(excluded.begin(), excluded.end(), vkutil::normalizePackPath(path)) != excluded.end())
+			continue;
+		inputs.push_back({ fs::relative(entry.path(), directory).generic_string(), path });
+	}
+
+	//"../assets/" and "../assets" both give "../assets.vkpak"
+	const std::string packPath = vkutil::normalizePackPath(directory.string()) + vkutil::PACK_EXTENSION;
+	cooker::PackStats stats;
+	if (!cooker::writePack(packPath, inputs, stats))
+	{
+		std::cout << "Failed to write " << packPath << std::endl;
+		return false;
+	}
+
+	std::cout << "Packed " << stats.entryCount << " files (" << stats.compressedCount << " compressed) into " << packPath
+		<< " : " << stats.rawBytes << " -> " << stats.storedBytes << " bytes" << std::endl;
+	return true;
+}
+
+static void printUsage()
+{
+	std::cout << "usage: AssetCooker <asset directory> [-j threads] [--force] [--pack]" << std::endl;
+	std::cout << "cooks every .obj/.gltf/.glb/.png/.jpg/.tga of the directory into <asset directory>/cooked" << std::endl;
+	std::cout << "and bakes the static lights of every .vkbake scene the engine wrote there into irradiance probes" << std::endl;
+	std::cout << "every .hdr environment is filtered into the irradiance, specular and BRDF maps of image based lighting" << std::endl;
+	std::cout << "--pack then archives the directory into <asset directory>.vkpak, mounted by the engine at startup" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string inputDirectory;
+	uint32_t threadCount = 0;
+	bool force = false;
+	bool pack = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc)
+		{
+			try
+			{
+				threadCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+			}
+			catch (const std::logic_error&)
+			{
+				printUsage();
+				return 1;
+			}
+		}
+		else if (arg == "--force")
+			force = true;
+		else if (arg == "--pack")
+			pack = true;
+		else if (inputDirectory.empty())
+			inputDirectory = arg;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (inputDirectory.empty() || !fs::is_directory(inputDirectory))
+	{
+		printUsage();
+		return 1;
+	}
+
+	const fs::path outputDirectory = fs::path(inputDirectory) / "cooked";
+
+	//the cooked path is the one the engine looks for next to the source
+	std::vector<CookJob> jobs;
+	for (const auto& entry : fs::directory_iterator(inputDirectory))
+	{
+		if (!entry.is_regular_file())
+			continue;
+
+		std::string extension = entry.path().extension().string();
+		for (char& c : extension)
+			c = static_cast<char>(tolower(c));
+
+		const std::string source = entry.path().string();
+		if (extension == ".obj" || extension == ".gltf" || extension == ".glb")
+			jobs.push_back({ source, vkutil::getCookedPath(source, vkutil::COOKED_MESH_EXTENSION), CookKind::Mesh });
+		else if (extension == ".png" || extension == ".jpg" || extension == ".tga")
+			jobs.push_back({ source, vkutil::getCookedPath(source, vkutil::COOKED_TEXTURE_EXTENSION), CookKind::Texture });
+		else if (extension == vkutil::BAKE_SCENE_EXTENSION)
+			jobs.push_back({ source, vkutil::getCookedPath(source, vkutil::COOKED_PROBES_EXTENSION), CookKind::Lighting });
+		else if (extension == ".hdr")
+			jobs.push_back({ source, vkutil::getCookedPath(source, vkutil::COOKED_ENVIRONMENT_EXTENSION), CookKind::Environment });
+	}
+
+	//a directory with nothing to cook (compiled shaders) can still be packed
+	if (!jobs.empty())
+		fs::create_directories(outputDirectory);
+
+	const std::string cachePath = (outputDirectory / "ddc.txt").string();
+	//forcing starts from an empty cache, it is still saved with the version of the cooker
+	cooker::DerivedDataCache cache(COOKER_VERSION);
+	if (force)
+		cache.clear();
+	else
+		cache.load(cachePath);
+
+	JobSystem jobSystem;
+	jobSystem.init(threadCount);
+
+	std::atomic<uint32_t> cooked{ 0 }, skipped{ 0 }, failed{ 0 };
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	//one asset per job, the biggest files are not worth splitting further. A light bake or an environment spreads its
+	//texels over the same threads, the nested loop runs on whichever of them are free
+	jobSystem.parallelFor(static_cast<uint32_t>(jobs.size()), 1, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const CookJob& job = jobs[i];
+
+				std::vector<cooker::Dependency> dependencies;
+				if (!cooker::collectDependencies(job.source, dependencies))
+				{
+					failed++;
+					continue;
+				}
+
+				if (cache.isUpToDate(job.output, dependencies))
+				{
+					skipped++;
+					continue;
+				}
+
+				bool success = false;
+				switch (job.kind)
+				{
+				case CookKind::Mesh:
+					success = cookMesh(job, dependencies[0].hash);
+					break;
+				case CookKind::Texture:
+					success = cookTexture(job, dependencies[0].hash);
+					break;
+				case CookKind::Lighting:
+					success = cookLighting(job, dependencies[0].hash, jobSystem);
+					break;
+				case CookKind::Environment:
+					success = cookEnvironment(job, dependencies[0].hash, jobSystem);
+					break;
+				}
+				if (!success)
+				{
+					std::cout << "Failed to cook " << job.source << std::endl;
+					failed++;
+					continue;
+				}
+
+				cache.record(job.output, dependencies);
+				std::cout << "Cooked " << job.source << " -> " << job.output << std::endl;
+				cooked++;
+			}
+		});
+
+	const uint32_t usedThreads = jobSystem.getThreadCount();
+	jobSystem.cleanup();
+	if (!jobs.empty())
+		cache.save(cachePath);
+
+	const std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+	std::cout << cooked << " cooked, " << skipped << " up to date, " << failed << " failed in " << elapsed.count() << " s on " << usedThreads << " threads" << std::endl;
+
+	if (pack && !packDirectory(inputDirectory, jobs))
+		return 1;
+
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+#include "derived_data_cache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+#include "vk_hash.h"
+
+// file layout : the cooker version on the first line, then one line per output
+// output<TAB>dependency<TAB>hash<TAB>dependency<TAB>hash...
+bool cooker::DerivedDataCache::load(const std::string& filePath)
+{
+	m_entries.clear();
+
+	std::ifstream file(filePath);
+	if (!file.is_open())
+		return false;
+
+	//everything is rebuilt by a new cooker, or when the file is truncated or corrupt
+	try
+	{
+		std::string line;
+		if (!std::getline(file, line) || std::stoul(line) != m_cookerVersion)
+			return false;
+
+		while (std::getline(file, line))
+		{
+			std::istringstream fields(line);
+			std::string output, path, hash;
+			if (!std::getline(fields, output, '\t'))
+				continue;
+
+			std::vector<Dependency>& dependencies = m_entries[output];
+			while (std::getline(fields, path, '\t') && std::getline(fields, hash, '\t'))
+				dependencies.push_back({ path, std::stoull(hash, nullptr, 16) });
+		}
+	}
+	catch (const std::logic_error&)
+	{
+		m_entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool cooker::DerivedDataCache::save(const std::string& filePath) const
+{
+	std::ofstream file(filePath, std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	file << m_cookerVersion << '\n';
+	for (const auto& [output, dependencies] : m_entries)
+	{
+		file << output;
+		for (const Dependency& dependency : dependencies)
+			file << '\t' << dependency.path << '\t' << std::hex << dependency.hash << std::dec;
+		file << '\n';
+	}
+	return file.good();
+}
+
+void cooker::DerivedDataCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+}
+
+bool cooker::DerivedDataCache::isUpToDate(const std::string& output, const std::vector<Dependency>& dependencies) const
+{
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(output, error))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const auto it = m_entries.find(output);
+	if (it == m_entries.end() || it->second.size() != dependencies.size())
+		return false;
+
+	for (size_t i = 0; i < dependencies.size(); i++)
+	{
+		if (it->second[i].path != dependencies[i].path || it->second[i].hash != dependencies[i].hash)
+			return false;
+	}
+	return true;
+}
+
+void cooker::DerivedDataCache::record(const std::string& output, const std::vector<Dependency>& dependencies)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries[output] = dependencies;
+}
+
+bool cooker::collectDependencies(const std::string& sourcePath, std::vector<Dependency>& outDependencies)
+{
+	outDependencies.clear();
+
+	uint64_t hash;
+	if (!vkutil::hashFile(sourcePath.c_str(), hash))
+		return false;
+	outDependencies.push_back({ sourcePath, hash });
+
+	const std::filesystem::path source(sourcePath);
+	const std::filesystem::path extension = source.extension();
+	std::vector<std::string> references;
+
+	std::ifstream file(sourcePath);
+	if (extension == ".obj")
+	{
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.rfind("mtllib ", 0) == 0)
+			{
+				std::string reference = line.substr(7);
+				reference.erase(reference.find_last_not_of(" \t\r") + 1);
+				references.push_back(reference);
+			}
+		}
+	}
+	else if (extension == ".gltf")
+	{
+		//external buffers and images, embedded data: uris are part of the file itself
+		const std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		const std::regex uriPattern("\"uri\"\\s*:\\s*\"([^\"]+)\"");
+		for (auto it = std::sregex_iterator(json.begin(), json.end(), uriPattern); it != std::sregex_iterator(); ++it)
+		{
+			const std::string uri = (*it)[1].str();
+			if (uri.rfind("data:", 0) != 0)
+				references.push_back(uri);
+		}
+	}
+
+	for (const std::string& reference : references)
+	{
+		const std::string path = (source.parent_path() / reference).string();
+		//a missing reference still counts, it is hashed as 0 until it shows up
+		if (!vkutil::hashFile(path.c_str(), hash))
+			hash = 0;
+		outDependencies.push_back({ path, hash });
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cooker
+{
+	struct Dependency
+	{
+		std::string path;
+		uint64_t hash;
+	};
+
+	// Remembers which inputs (with their content hash) produced each cooked output,
+	// so an output is only rebuilt when one of its dependencies or the cooker itself changed.
+	class DerivedDataCache
+	{
+	public:
+		// the version written by save, a cache loaded from another version is empty
+		explicit DerivedDataCache(uint32_t cookerVersion) : m_cookerVersion(cookerVersion) {}
+
+		bool load(const std::string& filePath);
+		bool save(const std::string& filePath) const;
+		// forgets every output, they are all rebuilt
+		void clear();
+
+		// true when the output exists and was built from exactly these dependencies
+		bool isUpToDate(const std::string& output, const std::vector<Dependency>& dependencies) const;
+		// thread safe, called by the cooking jobs
+		void record(const std::string& output, const std::vector<Dependency>& dependencies);
+
+	private:
+		uint32_t m_cookerVersion;
+		std::unordered_map<std::string, std::vector<Dependency>> m_entries;
+		mutable std::mutex m_mutex;
+	};
+
+	// the source itself plus the files it references (OBJ material libraries, external glTF buffers and images)
+	bool collectDependencies(const std::string& sourcePath, std::vector<Dependency>& outDependencies);
+}
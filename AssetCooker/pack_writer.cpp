@@ -0,0 +1,179 @@
+#include "pack_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "vk_pack.h"
+
+namespace
+{
+	//LZ4 block format limits : a match is at least 4 bytes, the last 5 bytes are always literals
+	//and no match can start in the last 12 bytes
+	constexpr size_t MIN_MATCH = 4;
+	constexpr size_t LAST_LITERALS = 5;
+	constexpr size_t MATCH_FIND_LIMIT = 12;
+	constexpr size_t MAX_OFFSET = 65535;
+	constexpr uint32_t HASH_BITS = 16;
+
+	//compressed entries have to be worth the decoding time
+	constexpr double MIN_COMPRESSION_GAIN = 0.1;
+
+	void writeLength(std::vector<uint8_t>& out, size_t length)
+	{
+		while (length >= 255)
+		{
+			out.push_back(255);
+			length -= 255;
+		}
+		out.push_back(static_cast<uint8_t>(length));
+	}
+
+	void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, const size_t literalLength, const size_t offset, const size_t matchLength)
+	{
+		const size_t matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+		out.push_back(static_cast<uint8_t>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15)));
+		if (literalLength >= 15)
+			writeLength(out, literalLength - 15);
+		out.insert(out.end(), literals, literals + literalLength);
+
+		if (matchLength == 0)
+			return;
+		out.push_back(static_cast<uint8_t>(offset & 0xFF));
+		out.push_back(static_cast<uint8_t>(offset >> 8));
+		if (matchCode >= 15)
+			writeLength(out, matchCode - 15);
+	}
+
+	void pad(std::ofstream& file, const uint64_t alignment)
+	{
+		static const char zeros[vkutil::PACK_ALIGNMENT] = {};
+		const uint64_t position = static_cast<uint64_t>(file.tellp());
+		const uint64_t padding = (alignment - position % alignment) % alignment;
+		file.write(zeros, static_cast<std::streamsize>(padding));
+	}
+}
+
+std::vector<uint8_t> cooker::lz4Compress(const uint8_t* src, const size_t size)
+{
+	std::vector<uint8_t> out;
+	out.reserve(size + size / 255 + 16);
+
+	//positions + 1 of the last occurrence of each 4-byte sequence, 0 when empty
+	std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+
+	size_t anchor = 0;
+	size_t ip = 0;
+	if (size > MATCH_FIND_LIMIT)
+	{
+		const size_t matchEnd = size - LAST_LITERALS;
+		while (ip + MATCH_FIND_LIMIT <= size)
+		{
+			uint32_t sequence;
+			memcpy(&sequence, src + ip, sizeof(sequence));
+			const uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+			size_t candidate = table[hash];
+			table[hash] = static_cast<uint32_t>(ip + 1);
+
+			if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || memcmp(src + candidate - 1, src + ip, MIN_MATCH) != 0)
+			{
+				//skip faster through data that does not compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			candidate--;
+
+			size_t matchLength = MIN_MATCH;
+			while (ip + matchLength < matchEnd && src[candidate + matchLength] == src[ip + matchLength])
+				matchLength++;
+
+			//the match may also extend backwards over pending literals
+			while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1])
+			{
+				ip--;
+				candidate--;
+				matchLength++;
+			}
+
+			writeSequence(out, src + anchor, ip - anchor, ip - candidate, matchLength);
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	writeSequence(out, src + anchor, size - anchor, 0, 0);
+	return out;
+}
+
+bool cooker::writePack(const std::string& packPath, const std::vector<PackInput>& inputs, PackStats& outStats)
+{
+	std::ofstream file(packPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	vkutil::PackHeader header{};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<vkutil::PackEntry> entries;
+	entries.reserve(inputs.size());
+	std::string names;
+	outStats = {};
+
+	for (const PackInput& input : inputs)
+	{
+		std::ifstream source(input.path, std::ios::ate | std::ios::binary);
+		if (!source.is_open())
+		{
+			std::cout << "Failed to read " << input.path << std::endl;
+			return false;
+		}
+		std::vector<uint8_t> bytes(static_cast<size_t>(source.tellg()));
+		source.seekg(0);
+		source.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+		const std::string name = vkutil::normalizePackPath(input.name);
+
+		vkutil::PackEntry entry{};
+		entry.nameHash = vkutil::hashPackPath(name);
+		entry.nameOffset = static_cast<uint32_t>(names.size());
+		entry.nameLength = static_cast<uint32_t>(name.size());
+		entry.size = bytes.size();
+		names += name;
+
+		std::vector<uint8_t> compressed = lz4Compress(bytes.data(), bytes.size());
+		if (!bytes.empty() && compressed.size() < bytes.size() * (1.0 - MIN_COMPRESSION_GAIN))
+		{
+			entry.flags |= vkutil::PACK_ENTRY_LZ4;
+			bytes.swap(compressed);
+			outStats.compressedCount++;
+		}
+		entry.storedSize = bytes.size();
+
+		//entries start on a page so they can be used straight from the mapping
+		pad(file, vkutil::PACK_ALIGNMENT);
+		entry.offset = static_cast<uint64_t>(file.tellp());
+		file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+		outStats.rawBytes += entry.size;
+		outStats.storedBytes += entry.storedSize;
+		entries.push_back(entry);
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const vkutil::PackEntry& a, const vkutil::PackEntry& b) { return a.nameHash < b.nameHash; });
+
+	pad(file, alignof(vkutil::PackEntry));
+	header.entryCount = static_cast<uint32_t>(entries.size());
+	header.tocOffset = static_cast<uint64_t>(file.tellp());
+	file.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(vkutil::PackEntry)));
+
+	header.namesOffset = static_cast<uint64_t>(file.tellp());
+	header.namesSize = names.size();
+	file.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	outStats.entryCount = header.entryCount;
+	return file.good();
+}
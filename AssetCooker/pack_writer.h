@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cooker
+{
+	struct PackInput
+	{
+		std::string name; // entry name, relative to the mount point
+		std::string path; // file read from disk
+	};
+
+	struct PackStats
+	{
+		uint32_t entryCount{ 0 };
+		uint32_t compressedCount{ 0 };
+		uint64_t rawBytes{ 0 };
+		uint64_t storedBytes{ 0 };
+	};
+
+	// raw LZ4 block (no frame header), decoded by vkutil::lz4Decompress
+	std::vector<uint8_t> lz4Compress(const uint8_t* src, size_t size);
+
+	// writes every input into a vkutil pack, each entry is LZ4 compressed when it saves enough space
+	bool writePack(const std::string& packPath, const std::vector<PackInput>& inputs, PackStats& outStats);
+}
@@ -0,0 +1,250 @@
+#include "texture_cooker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+namespace
+{
+	struct LinearImage
+	{
+		uint32_t width;
+		uint32_t height;
+		std::vector<float> pixels; //linear RGBA
+	};
+
+	float srgbToLinear(const float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(const float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+	}
+
+	// 2x2 box filter in linear space, odd sizes clamp on the last row/column
+	LinearImage downsample(const LinearImage& source)
+	{
+		LinearImage result;
+		result.width = std::max(1u, source.width / 2);
+		result.height = std::max(1u, source.height / 2);
+		result.pixels.resize(static_cast<size_t>(result.width) * result.height * 4);
+
+		for (uint32_t y = 0; y < result.height; y++)
+		{
+			for (uint32_t x = 0; x < result.width; x++)
+			{
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					float sum = 0.f;
+					for (uint32_t dy = 0; dy < 2; dy++)
+					{
+						for (uint32_t dx = 0; dx < 2; dx++)
+						{
+							const uint32_t sx = std::min(x * 2 + dx, source.width - 1);
+							const uint32_t sy = std::min(y * 2 + dy, source.height - 1);
+							sum += source.pixels[(static_cast<size_t>(sy) * source.width + sx) * 4 + c];
+						}
+					}
+					result.pixels[(static_cast<size_t>(y) * result.width + x) * 4 + c] = sum * 0.25f;
+				}
+			}
+		}
+		return result;
+	}
+
+	uint16_t packRgb565(const int r, const int g, const int b)
+	{
+		return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+	}
+
+	void unpackRgb565(const uint16_t c, int rgb[3])
+	{
+		const int r = (c >> 11) & 31;
+		const int g = (c >> 5) & 63;
+		const int b = c & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	// BC3 block : BC4-like 8 bytes of alpha followed by 8 bytes of BC1 color
+	void encodeBC3Block(const uint8_t block[16][4], uint8_t* out)
+	{
+		//alpha endpoints are the block extremes, 8 interpolated values
+		uint8_t alphaMin = 255, alphaMax = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			alphaMin = std::min(alphaMin, block[i][3]);
+			alphaMax = std::max(alphaMax, block[i][3]);
+		}
+
+		out[0] = alphaMax;
+		out[1] = alphaMin;
+		uint64_t alphaBits = 0;
+		if (alphaMax != alphaMin)
+		{
+			int palette[8];
+			palette[0] = alphaMax;
+			palette[1] = alphaMin;
+			for (int k = 1; k < 7; k++)
+				palette[k + 1] = ((7 - k) * alphaMax + k * alphaMin) / 7;
+
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestError = 1 << 30;
+				for (int k = 0; k < 8; k++)
+				{
+					const int error = std::abs(palette[k] - block[i][3]);
+					if (error < bestError)
+					{
+						bestError = error;
+						best = k;
+					}
+				}
+				alphaBits |= static_cast<uint64_t>(best) << (3 * i);
+			}
+		}
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = static_cast<uint8_t>(alphaBits >> (8 * i));
+
+		//color endpoints from the RGB bounding box, inset to reduce the error on the extremes
+		int minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				minColor[c] = std::min(minColor[c], static_cast<int>(block[i][c]));
+				maxColor[c] = std::max(maxColor[c], static_cast<int>(block[i][c]));
+			}
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			const int inset = (maxColor[c] - minColor[c]) / 16;
+			minColor[c] += inset;
+			maxColor[c] -= inset;
+		}
+
+		uint16_t color0 = packRgb565(maxColor[0], maxColor[1], maxColor[2]);
+		uint16_t color1 = packRgb565(minColor[0], minColor[1], minColor[2]);
+		//color0 > color1 selects the 4 colors mode
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		uint32_t colorBits = 0;
+		if (color0 != color1)
+		{
+			int palette[4][3];
+			unpackRgb565(color0, palette[0]);
+			unpackRgb565(color1, palette[1]);
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestError = 1 << 30;
+				for (int k = 0; k < 4; k++)
+				{
+					int error = 0;
+					for (int c = 0; c < 3; c++)
+					{
+						const int d = palette[k][c] - block[i][c];
+						error += d * d;
+					}
+					if (error < bestError)
+					{
+						bestError = error;
+						best = k;
+					}
+				}
+				colorBits |= static_cast<uint32_t>(best) << (2 * i);
+			}
+		}
+
+		out[8] = static_cast<uint8_t>(color0);
+		out[9] = static_cast<uint8_t>(color0 >> 8);
+		out[10] = static_cast<uint8_t>(color1);
+		out[11] = static_cast<uint8_t>(color1 >> 8);
+		for (int i = 0; i < 4; i++)
+			out[12 + i] = static_cast<uint8_t>(colorBits >> (8 * i));
+	}
+
+	void encodeBC3(const LinearImage& image, std::vector<uint8_t>& out)
+	{
+		const uint32_t blocksX = (image.width + 3) / 4;
+		const uint32_t blocksY = (image.height + 3) / 4;
+		const size_t base = out.size();
+		out.resize(base + static_cast<size_t>(blocksX) * blocksY * 16);
+
+		for (uint32_t by = 0; by < blocksY; by++)
+		{
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				//levels smaller than a block repeat their border pixels
+				uint8_t block[16][4];
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					const uint32_t x = std::min(bx * 4 + i % 4, image.width - 1);
+					const uint32_t y = std::min(by * 4 + i / 4, image.height - 1);
+					const float* pixel = &image.pixels[(static_cast<size_t>(y) * image.width + x) * 4];
+					for (int c = 0; c < 3; c++)
+						block[i][c] = static_cast<uint8_t>(std::clamp(linearToSrgb(pixel[c]), 0.f, 1.f) * 255.f + 0.5f);
+					block[i][3] = static_cast<uint8_t>(std::clamp(pixel[3], 0.f, 1.f) * 255.f + 0.5f);
+				}
+				encodeBC3Block(block, &out[base + (static_cast<size_t>(by) * blocksX + bx) * 16]);
+			}
+		}
+	}
+}
+
+bool cooker::cookTexture(const char* sourcePath, const uint64_t sourceHash, vkutil::CookedTexture& outTexture)
+{
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load(sourcePath, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture file " << sourcePath << std::endl;
+		return false;
+	}
+
+	LinearImage level;
+	level.width = static_cast<uint32_t>(texWidth);
+	level.height = static_cast<uint32_t>(texHeight);
+	level.pixels.resize(static_cast<size_t>(texWidth) * texHeight * 4);
+	for (size_t i = 0; i < level.pixels.size(); i++)
+	{
+		const float value = pixels[i] / 255.f;
+		level.pixels[i] = (i % 4 == 3) ? value : srgbToLinear(value);
+	}
+	stbi_image_free(pixels);
+
+	outTexture.format = VK_FORMAT_BC3_SRGB_BLOCK;
+	outTexture.width = level.width;
+	outTexture.height = level.height;
+	outTexture.sourceHash = sourceHash;
+	outTexture.mips.clear();
+	outTexture.data.clear();
+
+	while (true)
+	{
+		vkutil::CookedMipLevel mip;
+		mip.width = level.width;
+		mip.height = level.height;
+		mip.offset = outTexture.data.size();
+		encodeBC3(level, outTexture.data);
+		mip.size = outTexture.data.size() - mip.offset;
+		outTexture.mips.push_back(mip);
+
+		if (level.width == 1 && level.height == 1)
+			break;
+		level = downsample(level);
+	}
+	return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "vk_asset.h"
+
+namespace cooker
+{
+	// decodes an image, builds its full mip chain and compresses every level to BC3 (sRGB)
+	bool cookTexture(const char* sourcePath, uint64_t sourceHash, vkutil::CookedTexture& outTexture);
+}
@@ -0,0 +1,100 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+layout (location = 0) in vec2 inUV;
+
+layout(set = 0, binding = 0) uniform CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+	mat4 inverseViewproj;
+} cameraData;
+
+layout(set = 0, binding = 1) uniform  SceneData{
+    vec3 lightDirection; 
+	int lightNb;
+	vec3 lightColor;
+	float metallic; 
+	vec3 albedo;
+	float roughness;
+	//x the intensity of the environment, 0 without any, y the mip of the roughest specular level
+	vec4 environment;
+} sceneData;
+
+#include "include/lighting.glsl"
+
+layout(std430, set = 1, binding = 1) readonly buffer LightBuffer
+{
+	Light lights[];
+} lightBuffer;
+
+//same clusters as the forward pass
+layout(std430, set = 1, binding = 2) readonly buffer ClusterBuffer
+{
+	uvec4 size;
+	vec4 screen;
+	uvec2 ranges[];
+} clusterBuffer;
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndexBuffer
+{
+	uint ids[];
+} lightIndexBuffer;
+
+//written by the geometry subpass, read at the same pixel without leaving tile memory
+layout(input_attachment_index = 0, set = 2, binding = 0) uniform subpassInput albedoMetallicInput;
+layout(input_attachment_index = 1, set = 2, binding = 1) uniform subpassInput normalRoughnessInput;
+layout(input_attachment_index = 2, set = 2, binding = 2) uniform subpassInput depthInput;
+
+layout (location = 0) out vec4 outFragColor;
+
+/* ****************************************************** */
+
+void main()
+{
+	//nothing was drawn there, the clear color of the forward pass
+	float depth = subpassLoad(depthInput).r;
+	if (depth >= 1.)
+	{
+		outFragColor = vec4(0.01, 0.01, 0.01, 1.);
+		return;
+	}
+
+	vec4 world = cameraData.inverseViewproj * vec4(inUV * 2. - 1., depth, 1.);
+	vec3 worldPosition = world.xyz / world.w;
+
+	vec4 albedoMetallic = subpassLoad(albedoMetallicInput);
+	vec4 normalRoughness = subpassLoad(normalRoughnessInput);
+	vec3 albedo = albedoMetallic.rgb;
+	float metallic = albedoMetallic.a;
+	float roughness = normalRoughness.w;
+
+	vec3 n = normalize(normalRoughness.xyz);
+	vec3 v = normalize(cameraData.cameraPosition.xyz - worldPosition);
+
+	vec3 l0 = vec3(0.);
+
+	uvec3 size = clusterBuffer.size.xyz;
+	float viewDepth = -(cameraData.view * vec4(worldPosition, 1.)).z;
+	uvec2 tile = uvec2(min(gl_FragCoord.xy / clusterBuffer.screen.xy * vec2(size.xy), vec2(size.xy) - 1.));
+	uint slice = uint(clamp(log(viewDepth) * clusterBuffer.screen.z + clusterBuffer.screen.w, 0., float(size.z - 1)));
+	uvec2 range = clusterBuffer.ranges[(slice * size.y + tile.y) * size.x + tile.x];
+
+	//the lights of the cluster, with the parameters of the G-buffer
+	for(uint i = 0; i < range.y; ++i) 
+	{	
+		uint lightIndex = lightIndexBuffer.ids[range.x + i];
+		Light light = lightBuffer.lights[lightIndex];
+		l0 += shadePointLight(light, worldPosition, n, v, albedo, metallic, roughness)
+			* pointShadow(lightIndex, light.position, worldPosition, n);
+	}
+	l0 += shadeSun(worldPosition, n, v, albedo, metallic, roughness);
+	l0 += shadeBaked(worldPosition, n, albedo, metallic);
+	l0 += shadeEnvironment(n, v, albedo, metallic, roughness);
+	l0 = l0 / (l0 + vec3(1.));
+	l0 = pow(l0, vec3(1./2.2));
+
+	outFragColor = vec4(l0, 1.);
+}
@@ -0,0 +1,247 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+layout (location = 0) in vec2 inUV;
+
+layout(set = 0, binding = 0) uniform CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+	mat4 inverseViewproj;
+} cameraData;
+
+layout(set = 0, binding = 1) uniform  SceneData{
+    vec3 lightDirection; 
+	int lightNb;
+	vec3 lightColor;
+	float metallic; 
+	vec3 albedo;
+	float roughness;
+	//x the intensity of the environment, 0 without any, y the mip of the roughest specular level
+	vec4 environment;
+} sceneData;
+
+#include "include/lighting.glsl"
+
+layout(std430, set = 1, binding = 1) readonly buffer LightBuffer
+{
+	Light lights[];
+} lightBuffer;
+
+//same clusters as the forward pass
+layout(std430, set = 1, binding = 2) readonly buffer ClusterBuffer
+{
+	uvec4 size;
+	vec4 screen;
+	uvec2 ranges[];
+} clusterBuffer;
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndexBuffer
+{
+	uint ids[];
+} lightIndexBuffer;
+
+//written by the geometry subpass, read at the same pixel without leaving tile memory
+layout(input_attachment_index = 0, set = 2, binding = 0) uniform subpassInput albedoMetallicInput;
+layout(input_attachment_index = 1, set = 2, binding = 1) uniform subpassInput normalRoughnessInput;
+layout(input_attachment_index = 2, set = 2, binding = 2) uniform subpassInput depthInput;
+
+struct Reservoir{
+	uint light;
+	float weight;
+	float sampleCount;
+	float depth;
+};
+
+layout(set = 3, binding = 0) uniform SamplingData
+{
+	mat4 previousViewproj;
+	uint frame;
+	uint historyValid;
+	uint candidateCount;
+	uint exhaustiveLightCount;
+	uint spatialSampleCount;
+	float spatialRadius;
+	float maxHistory;
+} samplingData;
+
+//one reservoir per pixel, written last frame and this frame
+layout(std430, set = 3, binding = 1) readonly buffer PreviousReservoirBuffer
+{
+	Reservoir reservoirs[];
+} previousReservoirBuffer;
+
+layout(std430, set = 3, binding = 2) writeonly buffer ReservoirBuffer
+{
+	Reservoir reservoirs[];
+} reservoirBuffer;
+
+//current index of the lights of the previous frame, ~0 when they were culled
+layout(std430, set = 3, binding = 3) readonly buffer RemapBuffer
+{
+	uint lights[];
+} remapBuffer;
+
+layout (location = 0) out vec4 outFragColor;
+
+/* ****************************************************** */
+
+#define INVALID_LIGHT 0xffffffffu
+
+//what the reservoirs sample proportionally to: the unshadowed irradiance, without the BRDF
+float targetFunction(uint lightIndex, vec3 worldPosition, vec3 n)
+{
+	Light light = lightBuffer.lights[lightIndex];
+	vec3 toLight = light.position - worldPosition;
+	float distance = length(toLight);
+	float window = clamp(1. - pow(distance / light.radius, 4.), 0., 1.);
+	float luminance = dot(light.color, vec3(0.2126, 0.7152, 0.0722)) * light.intensity;
+	return luminance * window * window / (distance * distance) * max(dot(n, toLight / distance), 0.);
+}
+
+uint nextRandom(inout uint state)
+{
+	state = state * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+float random(inout uint state)
+{
+	return float(nextRandom(state) >> 8) / 16777216.;
+}
+
+//weighted reservoir sampling, a sample replaces the picked one with a probability of its share of the total weight
+struct Stream{
+	uint light;
+	float weightSum;
+	float sampleCount;
+	float targetPdf;
+};
+
+void streamSample(inout Stream stream, uint light, float weight, float sampleCount, float targetPdf, inout uint rng)
+{
+	stream.weightSum += weight;
+	stream.sampleCount += sampleCount;
+	if (weight > 0. && random(rng) * stream.weightSum <= weight)
+	{
+		stream.light = light;
+		stream.targetPdf = targetPdf;
+	}
+}
+
+//merges a reservoir of the previous frame, with its light moved to the current indices and its pdf for this pixel.
+//previousDepth is the view depth the surface had in the previous frame
+void streamPrevious(inout Stream stream, vec2 pixel, float previousDepth, vec3 worldPosition, vec3 n, inout uint rng)
+{
+	uvec2 size = uvec2(clusterBuffer.screen.xy);
+	if (any(lessThan(pixel, vec2(0.))) || any(greaterThanEqual(pixel, vec2(size))))
+		return;
+
+	Reservoir previous = previousReservoirBuffer.reservoirs[uint(pixel.y) * size.x + uint(pixel.x)];
+	if (previous.sampleCount <= 0. || abs(previous.depth - previousDepth) > 0.1 * previousDepth)
+		return;
+
+	uint light = remapBuffer.lights[previous.light];
+	if (light == INVALID_LIGHT)
+		return;
+
+	//the history is clamped so that the reservoirs keep adapting to the lights moving
+	float sampleCount = min(previous.sampleCount, samplingData.maxHistory * float(samplingData.candidateCount));
+	float targetPdf = targetFunction(light, worldPosition, n);
+	streamSample(stream, light, targetPdf * previous.weight * sampleCount, sampleCount, targetPdf, rng);
+}
+
+void main()
+{
+	uvec2 size = uvec2(clusterBuffer.screen.xy);
+	uint pixelIndex = uint(gl_FragCoord.y) * size.x + uint(gl_FragCoord.x);
+	Reservoir reservoir = Reservoir(INVALID_LIGHT, 0., 0., 0.);
+
+	//nothing was drawn there, the clear color of the forward pass
+	float depth = subpassLoad(depthInput).r;
+	if (depth >= 1.)
+	{
+		reservoirBuffer.reservoirs[pixelIndex] = reservoir;
+		outFragColor = vec4(0.01, 0.01, 0.01, 1.);
+		return;
+	}
+
+	vec4 world = cameraData.inverseViewproj * vec4(inUV * 2. - 1., depth, 1.);
+	vec3 worldPosition = world.xyz / world.w;
+
+	vec4 albedoMetallic = subpassLoad(albedoMetallicInput);
+	vec4 normalRoughness = subpassLoad(normalRoughnessInput);
+	vec3 albedo = albedoMetallic.rgb;
+	float metallic = albedoMetallic.a;
+	float roughness = normalRoughness.w;
+
+	vec3 n = normalize(normalRoughness.xyz);
+	vec3 v = normalize(cameraData.cameraPosition.xyz - worldPosition);
+
+	vec3 l0 = vec3(0.);
+
+	uvec3 clusterSize = clusterBuffer.size.xyz;
+	float viewDepth = -(cameraData.view * vec4(worldPosition, 1.)).z;
+	uvec2 tile = uvec2(min(gl_FragCoord.xy / clusterBuffer.screen.xy * vec2(clusterSize.xy), vec2(clusterSize.xy) - 1.));
+	uint slice = uint(clamp(log(viewDepth) * clusterBuffer.screen.z + clusterBuffer.screen.w, 0., float(clusterSize.z - 1)));
+	uvec2 range = clusterBuffer.ranges[(slice * clusterSize.y + tile.y) * clusterSize.x + tile.x];
+
+	//few enough lights to shade them all, without any noise
+	if (range.y <= samplingData.exhaustiveLightCount)
+	{
+		for(uint i = 0; i < range.y; ++i) 
+		{
+			uint light = lightIndexBuffer.ids[range.x + i];
+			l0 += shadePointLight(lightBuffer.lights[light], worldPosition, n, v, albedo, metallic, roughness)
+				* pointShadow(light, lightBuffer.lights[light].position, worldPosition, n);
+		}
+	}
+	else
+	{
+		uint rng = pixelIndex * 9781u + samplingData.frame * 6271u;
+		nextRandom(rng);
+
+		//the candidates are drawn uniformly from the cluster, their weight is the target over that pdf
+		Stream stream = Stream(INVALID_LIGHT, 0., 0., 0.);
+		for (uint i = 0; i < samplingData.candidateCount; ++i)
+		{
+			uint candidate = min(uint(random(rng) * float(range.y)), range.y - 1);
+			uint light = lightIndexBuffer.ids[range.x + candidate];
+			float targetPdf = targetFunction(light, worldPosition, n);
+			streamSample(stream, light, targetPdf * float(range.y), 1., targetPdf, rng);
+		}
+
+		//temporal reuse at the reprojected pixel, then spatial reuse around it
+		if (samplingData.historyValid != 0)
+		{
+			vec4 previousClip = samplingData.previousViewproj * vec4(worldPosition, 1.);
+			vec2 previousPixel = (previousClip.xy / previousClip.w * 0.5 + 0.5) * clusterBuffer.screen.xy;
+			streamPrevious(stream, previousPixel, previousClip.w, worldPosition, n, rng);
+			for (uint i = 0; i < samplingData.spatialSampleCount; ++i)
+			{
+				vec2 offset = (vec2(random(rng), random(rng)) * 2. - 1.) * samplingData.spatialRadius;
+				streamPrevious(stream, previousPixel + offset, previousClip.w, worldPosition, n, rng);
+			}
+		}
+
+		if (stream.targetPdf > 0.)
+		{
+			reservoir = Reservoir(stream.light, stream.weightSum / (stream.sampleCount * stream.targetPdf), stream.sampleCount, viewDepth);
+			//the target ignores the shadows, the sample is shadowed once it was picked
+			l0 = shadePointLight(lightBuffer.lights[stream.light], worldPosition, n, v, albedo, metallic, roughness) * reservoir.weight
+				* pointShadow(stream.light, lightBuffer.lights[stream.light].position, worldPosition, n);
+		}
+	}
+	reservoirBuffer.reservoirs[pixelIndex] = reservoir;
+
+	l0 += shadeSun(worldPosition, n, v, albedo, metallic, roughness);
+	l0 += shadeBaked(worldPosition, n, albedo, metallic);
+	l0 += shadeEnvironment(n, v, albedo, metallic, roughness);
+	l0 = l0 / (l0 + vec3(1.));
+	l0 = pow(l0, vec3(1./2.2));
+
+	outFragColor = vec4(l0, 1.);
+}
@@ -0,0 +1,33 @@
+#version 460
+
+//position only, the vertex input of the prepass pipeline has no other attribute
+layout (location = 0) in vec3 vPosition;
+
+//same expression as tri_mesh.vert, so that the shading pass passes the equal depth test
+invariant gl_Position;
+
+layout(set = 0, binding = 0) uniform  CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+} cameraData;
+
+struct ObjectData{
+	mat4 model;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+
+void main()
+{
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+	mat4 mvMatrix = cameraData.view * modelMatrix;
+	mat4 transformMatrix = cameraData.proj * mvMatrix;
+	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+}
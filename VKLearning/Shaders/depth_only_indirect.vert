@@ -0,0 +1,44 @@
+#version 460
+
+//position only, the vertex input of the prepass pipeline has no other attribute
+layout (location = 0) in vec3 vPosition;
+
+//same expression as tri_mesh_indirect.vert, so that the shading pass passes the equal depth test
+invariant gl_Position;
+
+layout(set = 0, binding = 0) uniform  CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+} cameraData;
+
+struct InstanceData
+{
+	mat4 model;
+	vec4 sphere;
+	uint group;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer InstanceBuffer
+{
+	InstanceData instances[];
+} instanceBuffer;
+
+layout(std430, set = 2, binding = 3) readonly buffer VisibleBuffer
+{
+	uint ids[];
+} visibleBuffer;
+
+
+void main()
+{
+	mat4 modelMatrix = instanceBuffer.instances[visibleBuffer.ids[gl_InstanceIndex]].model;
+	mat4 mvMatrix = cameraData.view * modelMatrix;
+	mat4 transformMatrix = cameraData.proj * mvMatrix;
+	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+}
@@ -0,0 +1,10 @@
+#version 460
+
+layout (location = 0) out vec2 outUV;
+
+void main()
+{
+	//a single triangle covering the screen, its uv are (0, 0), (2, 0) and (0, 2)
+	outUV = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(outUV * 2. - 1., 0., 1.);
+}
@@ -0,0 +1,24 @@
+#version 460
+
+layout (location = 1) in vec3 inNormal;
+
+layout(set = 0, binding = 1) uniform  SceneData{
+    vec3 lightDirection; 
+	int lightNb;
+	vec3 lightColor;
+	float metallic; 
+	vec3 albedo;
+	float roughness;
+	//x the intensity of the environment, 0 without any, y the mip of the roughest specular level
+	vec4 environment;
+} sceneData;
+
+//the material parameters the deferred lighting needs, the same ones tri_mesh.frag shades with
+layout (location = 0) out vec4 outAlbedoMetallic;
+layout (location = 1) out vec4 outNormalRoughness;
+
+void main()
+{
+	outAlbedoMetallic = vec4(sceneData.albedo, sceneData.metallic);
+	outNormalRoughness = vec4(normalize(inNormal), sceneData.roughness);
+}
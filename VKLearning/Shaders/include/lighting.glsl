@@ -0,0 +1,232 @@
+//the shading shared by the forward pass and the lighting passes: the lights of set 0 after the scene data, the
+//GGX BRDF, the point and sun lights, the shadows, the baked and the environment light. Included after the SceneData
+//block, read by shadeSun and shadeEnvironment. In a subfolder so that compile_shaders.bat does not compile it on its own
+
+#define PI 3.1415926538
+#define EPSILON 0.0001
+
+//a point light of the light buffer, see GPULightData
+struct Light{
+	vec3 color;
+	float intensity;
+	vec3 position;
+	float radius;
+};
+
+//the cascades of the sun, see GPUShadowData
+layout(set = 0, binding = 2) uniform ShadowData
+{
+	mat4 cascadeViewproj[4];
+	vec4 texelSizes;
+	vec4 params;
+} shadowData;
+
+layout(set = 0, binding = 3) uniform sampler2DArrayShadow shadowMap;
+
+//the cubes of the point lights in the atlas, see GPUPointShadow, then the cube of every light of the light buffer
+struct PointShadow
+{
+	mat4 faceViewproj[6];
+	vec4 faceRects[6];
+};
+
+layout(std430, set = 0, binding = 4) readonly buffer PointShadowBuffer
+{
+	PointShadow shadows[64];
+	uint lightShadows[];
+} pointShadowBuffer;
+
+layout(set = 0, binding = 5) uniform sampler2DShadow pointShadowMap;
+
+struct Probe
+{
+	vec4 irradiance[3];
+};
+
+//the irradiance of the baked lights, size.w is 0 while the lights are evaluated per pixel
+layout(std430, set = 0, binding = 6) readonly buffer ProbeBuffer
+{
+	uvec4 size;
+	vec4 origin;
+	Probe probes[];
+} probeBuffer;
+
+//the environment around the scene, see EnvironmentLighting
+layout(set = 0, binding = 7) uniform samplerCube irradianceMap;
+layout(set = 0, binding = 8) uniform samplerCube specularMap;
+layout(set = 0, binding = 9) uniform sampler2D brdfLut;
+
+vec3 fresnelSchlick(float cosTheta, vec3 f0)
+{
+	return f0 + (1. - f0) * pow(clamp(1.0 - cosTheta, 0., 1.), 5.);
+}
+
+float distributionGGX(vec3 n, vec3 h, float roughness)
+{
+	float a = roughness * roughness;
+	float a2 = a * a;
+	float nDoth = max(dot(n, h), 0.);
+	float nDoth2 = nDoth * nDoth;
+
+	float f = (nDoth2 * (a2 - 1.) + 1.);
+	return a2 / (PI * f * f);
+}
+
+float geometrySchlickGGX(float nDotv, float roughness)
+{
+	float r = roughness + 1.;
+	float k = r * r / 8.;
+	
+	return nDotv / (nDotv * (1. - k) + k);
+}
+
+float geometrySmith(vec3 n, vec3 v, vec3 l, float roughness)
+{
+	float nDotv = max(dot(n, v), 0.);
+	float nDotl = max(dot(n, l), 0.);
+	
+	return geometrySchlickGGX(nDotl, roughness) * geometrySchlickGGX(nDotv, roughness);
+}
+
+//visibility of the sun from the first cascade containing the point, pushed along the normal by a few of its texels.
+//3x3 compared texels soften the edges, the cascades never rendered are skipped
+float sunShadow(vec3 worldPosition, vec3 n)
+{
+	uint cascadeCount = uint(shadowData.params.x);
+	float texelUv = shadowData.params.z;
+	for (uint i = 0; i < cascadeCount; ++i)
+	{
+		float texelSize = shadowData.texelSizes[i];
+		if (texelSize == 0.)
+			continue;
+
+		vec4 clip = shadowData.cascadeViewproj[i] * vec4(worldPosition + n * texelSize * shadowData.params.y, 1.);
+		vec2 uv = clip.xy * 0.5 + 0.5;
+		if (any(lessThan(uv, vec2(2. * texelUv))) || any(greaterThan(uv, vec2(1. - 2. * texelUv))))
+			continue;
+
+		//in front of the cascade near plane nothing can cast
+		float depth = clamp(clip.z, 0., 1.);
+		float lit = 0.;
+		for (int y = -1; y <= 1; ++y)
+			for (int x = -1; x <= 1; ++x)
+				lit += texture(shadowMap, vec4(uv + vec2(x, y) * texelUv, float(i), depth));
+		return lit / 9.;
+	}
+	return 1.;
+}
+
+//the Cook-Torrance BRDF for the radiance arriving from the direction l
+vec3 shadeBRDF(vec3 l, vec3 radiance, vec3 n, vec3 v, vec3 albedo, float metallic, float roughness)
+{
+	vec3 h = normalize(v + l);
+	vec3 f0 = mix(vec3(0.04), albedo, metallic); 
+
+	// Cook-Terrance BRDF
+	float ndf = distributionGGX(n, h, roughness);
+	float g = geometrySmith(n, v, l, roughness);
+	vec3 f = fresnelSchlick(max(dot(h, v), 0.), f0);
+
+	vec3 num = ndf * g * f;
+	float nDotl = max(dot(n, l), 0.);
+	float denom = 4. * max(dot(n, v), 0.) * nDotl + EPSILON;
+	vec3 specular = num / denom;
+
+	vec3 kS = f;
+	vec3 kD = vec3(1.) - kS;
+	kD *= 1. - metallic;
+
+	return (kD * albedo / PI + specular) * radiance * nDotl;
+}
+
+//the sun, a directional light without falloff
+vec3 shadeSun(vec3 worldPosition, vec3 n, vec3 v, vec3 albedo, float metallic, float roughness)
+{
+	vec3 l = normalize(sceneData.lightDirection);
+	if (dot(n, l) <= 0. || dot(sceneData.lightColor, sceneData.lightColor) == 0.)
+		return vec3(0.);
+
+	return shadeBRDF(l, sceneData.lightColor * sunShadow(worldPosition, n), n, v, albedo, metallic, roughness);
+}
+
+//a point light, inverse square windowed so that it reaches zero at its radius. Without its shadow, see pointShadow
+vec3 shadePointLight(Light light, vec3 worldPosition, vec3 n, vec3 v, vec3 albedo, float metallic, float roughness)
+{
+	vec3 toLight = light.position - worldPosition;
+	float distance = length(toLight);
+	float window = clamp(1. - pow(distance / light.radius, 4.), 0., 1.);
+	float attenuation = window * window / (distance * distance);
+	return shadeBRDF(toLight / distance, light.color * attenuation * light.intensity, n, v, albedo, metallic, roughness);
+}
+
+//visibility of the light from the face of its cube the point is in, pushed along the normal by a texel and a half
+//of that face. A single compared tap, kept inside the face so that the filter never reads its neighbours
+float pointShadow(uint lightSlot, vec3 lightPosition, vec3 worldPosition, vec3 n)
+{
+	uint shadow = pointShadowBuffer.lightShadows[lightSlot];
+	if (shadow == 0xFFFFFFFFu)
+		return 1.;
+
+	vec3 d = worldPosition - lightPosition;
+	vec3 a = abs(d);
+	uint face = a.x >= a.y && a.x >= a.z ? (d.x > 0. ? 0u : 1u) : a.y >= a.z ? (d.y > 0. ? 2u : 3u) : (d.z > 0. ? 4u : 5u);
+	vec4 rect = pointShadowBuffer.shadows[shadow].faceRects[face];
+	if (rect.w == 0.)
+		return 1.;
+
+	//a texel of the face is twice the distance along its axis over its resolution
+	float texelSize = 2. * max(a.x, max(a.y, a.z)) * rect.w;
+	vec4 clip = pointShadowBuffer.shadows[shadow].faceViewproj[face] * vec4(worldPosition + n * texelSize * 1.5, 1.);
+	vec3 ndc = clip.xyz / clip.w;
+	float texelUv = rect.z * rect.w;
+	vec2 uv = clamp(rect.xy + (ndc.xy * 0.5 + 0.5) * rect.z, rect.xy + 0.5 * texelUv, rect.xy + rect.z - 0.5 * texelUv);
+	return texture(pointShadowMap, vec3(uv, clamp(ndc.z, 0., 1.)));
+}
+
+//diffuse light of the baked lights, interpolated between the eight probes around the point. The point is pushed along
+//the normal by half a probe so that the probes behind the surface weigh less. Each probe holds an L1 spherical
+//harmonic per channel, the cosine lobe already convolved, in the (1, y, z, x) order
+vec3 shadeBaked(vec3 worldPosition, vec3 n, vec3 albedo, float metallic)
+{
+	if (probeBuffer.size.w == 0u)
+		return vec3(0.);
+
+	float spacing = probeBuffer.origin.w;
+	vec3 lastProbe = vec3(probeBuffer.size.xyz - 1u);
+	vec3 g = clamp((worldPosition + n * 0.5 * spacing - probeBuffer.origin.xyz) / spacing, vec3(0.), lastProbe);
+	uvec3 base = uvec3(min(floor(g), max(lastProbe - 1., vec3(0.))));
+	vec3 f = g - vec3(base);
+
+	vec4 basis = vec4(0.282095, 0.488603 * n.y, 0.488603 * n.z, 0.488603 * n.x);
+	vec3 irradiance = vec3(0.);
+	for (uint corner = 0u; corner < 8u; corner++)
+	{
+		uvec3 offset = uvec3(corner & 1u, (corner >> 1) & 1u, corner >> 2);
+		uvec3 probe = min(base + offset, probeBuffer.size.xyz - 1u);
+		vec3 w = mix(1. - f, f, vec3(offset));
+		uint index = probe.x + probeBuffer.size.x * (probe.y + probeBuffer.size.y * probe.z);
+		vec3 e = vec3(dot(probeBuffer.probes[index].irradiance[0], basis), dot(probeBuffer.probes[index].irradiance[1], basis),
+			dot(probeBuffer.probes[index].irradiance[2], basis));
+		irradiance += w.x * w.y * w.z * max(e, vec3(0.));
+	}
+	return (1. - metallic) * albedo / PI * irradiance;
+}
+
+//light of the environment with the split sum: the irradiance cube holds the diffuse part, the level of the prefiltered
+//cube matching the roughness the specular one, the lookup table scales and biases f0 for the integral of the lobe
+vec3 shadeEnvironment(vec3 n, vec3 v, vec3 albedo, float metallic, float roughness)
+{
+	if (sceneData.environment.x == 0.)
+		return vec3(0.);
+
+	float nDotv = max(dot(n, v), 0.);
+	vec3 f0 = mix(vec3(0.04), albedo, metallic);
+	//the rough surfaces reflect less at grazing angles
+	vec3 f = f0 + (max(vec3(1. - roughness), f0) - f0) * pow(clamp(1. - nDotv, 0., 1.), 5.);
+	vec3 kD = (1. - f) * (1. - metallic);
+
+	vec3 diffuse = kD * albedo * texture(irradianceMap, n).rgb;
+	vec3 prefiltered = textureLod(specularMap, reflect(-v, n), roughness * sceneData.environment.y).rgb;
+	vec2 brdf = texture(brdfLut, vec2(nDotv, roughness)).rg;
+	return (diffuse + prefiltered * (f * brdf.x + brdf.y)) * sceneData.environment.x;
+}
@@ -0,0 +1,20 @@
+#version 460
+
+//position only, the same vertex input as the depth prepass
+layout (location = 0) in vec3 vPosition;
+
+//the casters of every cascade, grouped by mesh and drawn instanced
+layout(std430, set = 0, binding = 0) readonly buffer CasterBuffer
+{
+	mat4 models[];
+} casterBuffer;
+
+layout(push_constant) uniform ShadowConstants
+{
+	mat4 viewproj;
+} constants;
+
+void main()
+{
+	gl_Position = constants.viewproj * casterBuffer.models[gl_InstanceIndex] * vec4(vPosition, 1.0f);
+}
@@ -1,4 +1,5 @@
 #version 460
+#extension GL_GOOGLE_include_directive : require
 
 
 layout (location = 0) in vec3 inPosition;
@@ -23,31 +24,34 @@ layout(set = 0, binding = 1) uniform  SceneData{
 	float metallic; 
 	vec3 albedo;
 	float roughness;
+	//x the intensity of the environment, 0 without any, y the mip of the roughest specular level
+	vec4 environment;
 } sceneData;
 
-struct Light{
-	vec3 color;
-	float intensity;
-	vec3 position;
-};
+#include "include/lighting.glsl"
 
 layout(std430, set = 1, binding = 1) readonly buffer LightBuffer
 {
 	Light lights[];
 } lightBuffer;
 
+//the view is divided in size.x * size.y screen tiles and size.z depth slices, each cluster has the range of its lights in lightIndexBuffer
+layout(std430, set = 1, binding = 2) readonly buffer ClusterBuffer
+{
+	uvec4 size;
+	vec4 screen;
+	uvec2 ranges[];
+} clusterBuffer;
 
-layout (location = 0) out vec4 outFragColor;
+layout(std430, set = 1, binding = 3) readonly buffer LightIndexBuffer
+{
+	uint ids[];
+} lightIndexBuffer;
 
-/* ****************************************************** */
 
-#define PI 3.1415926538
-#define EPSILON 0.0001
+layout (location = 0) out vec4 outFragColor;
 
-vec3 fresnelSchlick(float cosTheta, vec3 F0);
-float distributionGGX(vec3 n, vec3 h, float roughness);
-float geometrySchlickGGX(float nDotv, float roughness);
-float geometrySmith(vec3 n, vec3 v, vec3 l, float roughness);
+/* ****************************************************** */
 
 void main()
 {
@@ -56,69 +60,24 @@ void main()
 
 	vec3 l0 = vec3(0.);
 
-	for(int i = 0; i < sceneData.lightNb; ++i) 
-	{	
-		Light light = lightBuffer.lights[i];
-
-		vec3 l = normalize(light.position - inPosition);
-		vec3 h = normalize(v + l);
-
-		float distance = length(light.position[i] - worldPosition);
-		float attenuation = 1. / (distance * distance);
-		vec3 radiance = light.color * attenuation * light.intensity;
-
-		vec3 f0 = mix(vec3(0.04), sceneData.albedo, sceneData.metallic); 
-
-		// Cook-Terrance BRDF
-		float ndf = distributionGGX(n, h, sceneData.roughness);
-		float g = geometrySmith(n, v, l, sceneData.roughness);
-		vec3 f = fresnelSchlick(max(dot(h, v), 0.), f0);
+	//inPosition is in view space, the slices are spaced exponentially in depth
+	uvec3 size = clusterBuffer.size.xyz;
+	uvec2 tile = uvec2(min(gl_FragCoord.xy / clusterBuffer.screen.xy * vec2(size.xy), vec2(size.xy) - 1.));
+	uint slice = uint(clamp(log(-inPosition.z) * clusterBuffer.screen.z + clusterBuffer.screen.w, 0., float(size.z - 1)));
+	uvec2 range = clusterBuffer.ranges[(slice * size.y + tile.y) * size.x + tile.x];
 
-		vec3 num = ndf * g * f;
-		float nDotl =  max(dot(n, l), 0.);
-		float denom = 4. * max(dot(n, v), 0.) * nDotl + EPSILON;
-		vec3 specular = num / denom;
-
-		vec3 kS = f;
-		vec3 kD = vec3(1.) - kS;
-		kD *= 1. - sceneData.metallic;
-
-		l0 += (kD * sceneData.albedo / PI + specular) * radiance * nDotl;
+	for(uint i = 0; i < range.y; ++i) 
+	{	
+		uint lightIndex = lightIndexBuffer.ids[range.x + i];
+		Light light = lightBuffer.lights[lightIndex];
+		l0 += shadePointLight(light, worldPosition, n, v, sceneData.albedo, sceneData.metallic, sceneData.roughness)
+			* pointShadow(lightIndex, light.position, worldPosition, n);
 	}
+	l0 += shadeSun(worldPosition, n, v, sceneData.albedo, sceneData.metallic, sceneData.roughness);
+	l0 += shadeBaked(worldPosition, n, sceneData.albedo, sceneData.metallic);
+	l0 += shadeEnvironment(n, v, sceneData.albedo, sceneData.metallic, sceneData.roughness);
 	l0 = l0 / (l0 + vec3(1.));
 	l0 = pow(l0, vec3(1./2.2));
 
 	outFragColor = vec4(l0, 1.); // * vec4(sceneData.albedo, 1.);
 }
-
-vec3 fresnelSchlick(float cosTheta, vec3 f0)
-{
-	return f0 + (1. - f0) * pow(clamp(1.0 - cosTheta, 0., 1.), 5.);
-}
-
-float distributionGGX(vec3 n, vec3 h, float roughness)
-{
-	float a = roughness * roughness;
-	float a2 = a * a;
-	float nDoth = max(dot(n, h), 0.);
-	float nDoth2 = nDoth * nDoth;
-
-	float f = (nDoth2 * (a2 - 1.) + 1.);
-	return a2 / (PI * f * f);
-}
-
-float geometrySchlickGGX(float nDotv, float roughness)
-{
-	float r = roughness + 1.;
-	float k = r * r / 8.;
-	
-	return nDotv / (nDotv * (1. - k) + k);
-}
-
-float geometrySmith(vec3 n, vec3 v, vec3 l, float roughness)
-{
-	float nDotv = max(dot(n, v), 0.);
-	float nDotl = max(dot(n, l), 0.);
-	
-	return geometrySchlickGGX(nDotl, roughness) * geometrySchlickGGX(nDotv, roughness);
-}
@@ -11,6 +11,9 @@ layout (location = 2) out vec4 outColor;
 layout (location = 3) out vec2 outTexCoord;
 layout (location = 4) out vec3 outWorldPosition;
 
+//the depth prepass computes the same position, the equal depth test needs them bit for bit identical
+invariant gl_Position;
+
 
 
 layout(set = 0, binding = 0) uniform  CameraBuffer
@@ -30,17 +33,11 @@ layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer
 	ObjectData objects[];
 } objectBuffer;
 
-//push constants block
-layout( push_constant ) uniform constants
-{
-	vec4 data;
-	mat4 renderMatrix;
-} PushConstants;
-
 
 void main()
 {
-	mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+	//objects drawn together are contiguous in the buffer, gl_InstanceIndex already includes the first instance of the draw
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
 	mat4 mvMatrix = cameraData.view * modelMatrix;
 	mat4 transformMatrix = cameraData.proj * mvMatrix;
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
@@ -48,5 +45,5 @@ void main()
 	outColor = vColor;
 	outNormal = vNormal;
 	outTexCoord = vTexCoord;
-	outWorldPosition = vPosition;
+	outWorldPosition = (modelMatrix * vec4(vPosition, 1.0f)).xyz;
 }
\ No newline at end of file
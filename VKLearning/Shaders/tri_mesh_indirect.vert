@@ -0,0 +1,60 @@
+#version 460
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec3 vNormal;
+layout (location = 2) in vec4 vColor;
+layout (location = 3) in vec2 vTexCoord;
+
+layout (location = 0) out vec3 outPosition;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec4 outColor;
+layout (location = 3) out vec2 outTexCoord;
+layout (location = 4) out vec3 outWorldPosition;
+
+//the depth prepass computes the same position, the equal depth test needs them bit for bit identical
+invariant gl_Position;
+
+
+
+layout(set = 0, binding = 0) uniform  CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+} cameraData;
+
+struct InstanceData
+{
+	mat4 model;
+	vec4 sphere;
+	uint group;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer InstanceBuffer
+{
+	InstanceData instances[];
+} instanceBuffer;
+
+layout(std430, set = 2, binding = 3) readonly buffer VisibleBuffer
+{
+	uint ids[];
+} visibleBuffer;
+
+
+void main()
+{
+	//the culling shader wrote the ids of the visible instances of the draw from its first instance on
+	mat4 modelMatrix = instanceBuffer.instances[visibleBuffer.ids[gl_InstanceIndex]].model;
+	mat4 mvMatrix = cameraData.view * modelMatrix;
+	mat4 transformMatrix = cameraData.proj * mvMatrix;
+	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+	outPosition = (mvMatrix * vec4(vPosition, 1.0f)).xyz;
+	outColor = vColor;
+	outNormal = vNormal;
+	outTexCoord = vTexCoord;
+	outWorldPosition = (modelMatrix * vec4(vPosition, 1.0f)).xyz;
+}
\ No newline at end of file
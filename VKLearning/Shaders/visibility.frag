@@ -0,0 +1,13 @@
+#version 460
+
+layout (location = 0) flat in uint inObjectSlot;
+
+//must match VisibilityRenderer::TRIANGLE_BITS, 0 is the background
+#define TRIANGLE_BITS 17
+
+layout (location = 0) out uint outId;
+
+void main()
+{
+	outId = ((inObjectSlot + 1) << TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
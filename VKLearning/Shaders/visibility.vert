@@ -0,0 +1,31 @@
+#version 460
+
+//position only, the resolve fetches the other attributes itself
+layout (location = 0) in vec3 vPosition;
+
+layout (location = 0) flat out uint outObjectSlot;
+
+layout(set = 0, binding = 0) uniform  CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+} cameraData;
+
+struct ObjectData{
+	mat4 model;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+
+void main()
+{
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+	gl_Position = cameraData.viewproj * modelMatrix * vec4(vPosition, 1.0f);
+	outObjectSlot = gl_InstanceIndex;
+}
@@ -0,0 +1,164 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+layout (location = 0) in vec2 inUV;
+
+layout(set = 0, binding = 0) uniform CameraBuffer
+{
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 cameraPosition;
+	mat4 inverseViewproj;
+} cameraData;
+
+layout(set = 0, binding = 1) uniform  SceneData{
+    vec3 lightDirection; 
+	int lightNb;
+	vec3 lightColor;
+	float metallic; 
+	vec3 albedo;
+	float roughness;
+	//x the intensity of the environment, 0 without any, y the mip of the roughest specular level
+	vec4 environment;
+} sceneData;
+
+#include "include/lighting.glsl"
+
+struct ObjectData{
+	mat4 model;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+layout(std430, set = 1, binding = 1) readonly buffer LightBuffer
+{
+	Light lights[];
+} lightBuffer;
+
+//same clusters as the forward pass
+layout(std430, set = 1, binding = 2) readonly buffer ClusterBuffer
+{
+	uvec4 size;
+	vec4 screen;
+	uvec2 ranges[];
+} clusterBuffer;
+
+layout(std430, set = 1, binding = 3) readonly buffer LightIndexBuffer
+{
+	uint ids[];
+} lightIndexBuffer;
+
+//written by the geometry subpass, read at the same pixel without leaving tile memory
+layout(input_attachment_index = 0, set = 2, binding = 0) uniform usubpassInput idInput;
+
+//the full level of detail of the merged meshes, the indices are relative to the first vertex of their mesh
+struct Vertex{
+	vec4 position;
+	vec4 normal;
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer VertexBuffer
+{
+	Vertex vertices[];
+} vertexBuffer;
+
+layout(std430, set = 2, binding = 2) readonly buffer IndexBuffer
+{
+	uint indices[];
+} indexBuffer;
+
+//first vertex and first index of each mesh
+layout(std430, set = 2, binding = 3) readonly buffer MeshBuffer
+{
+	uvec2 meshes[];
+} meshBuffer;
+
+//the mesh drawn by each slot of the object buffer this frame
+layout(std430, set = 2, binding = 4) readonly buffer ObjectMeshBuffer
+{
+	uint meshIds[];
+} objectMeshBuffer;
+
+layout (location = 0) out vec4 outFragColor;
+
+//must match VisibilityRenderer::TRIANGLE_BITS
+#define TRIANGLE_BITS 17
+
+/* ****************************************************** */
+
+void main()
+{
+	//nothing was drawn there, the clear color of the forward pass
+	uint id = subpassLoad(idInput).r;
+	if (id == 0)
+	{
+		outFragColor = vec4(0.01, 0.01, 0.01, 1.);
+		return;
+	}
+
+	uint slot = (id >> TRIANGLE_BITS) - 1;
+	uint triangle = id & ((1u << TRIANGLE_BITS) - 1);
+	mat4 modelMatrix = objectBuffer.objects[slot].model;
+	uvec2 mesh = meshBuffer.meshes[objectMeshBuffer.meshIds[slot]];
+
+	vec3 positions[3];
+	vec3 normals[3];
+	vec4 clip[3];
+	for (uint i = 0; i < 3; ++i)
+	{
+		Vertex vertex = vertexBuffer.vertices[mesh.x + indexBuffer.indices[mesh.y + triangle * 3 + i]];
+		positions[i] = (modelMatrix * vertex.position).xyz;
+		normals[i] = vertex.normal.xyz;
+		clip[i] = cameraData.viewproj * vec4(positions[i], 1.);
+	}
+
+	//screen space barycentrics of the pixel in the projected triangle, made perspective correct with the clip w
+	vec2 pixel = inUV * 2. - 1.;
+	vec2 p0 = clip[0].xy / clip[0].w;
+	vec2 e1 = clip[1].xy / clip[1].w - p0;
+	vec2 e2 = clip[2].xy / clip[2].w - p0;
+	vec2 q = pixel - p0;
+	float area = e1.x * e2.y - e1.y * e2.x;
+	float b1 = (q.x * e2.y - q.y * e2.x) / area;
+	float b2 = (e1.x * q.y - e1.y * q.x) / area;
+	vec3 barycentrics = vec3(1. - b1 - b2, b1, b2) / vec3(clip[0].w, clip[1].w, clip[2].w);
+	barycentrics /= barycentrics.x + barycentrics.y + barycentrics.z;
+
+	vec3 worldPosition = barycentrics.x * positions[0] + barycentrics.y * positions[1] + barycentrics.z * positions[2];
+	//the same normal as tri_mesh.frag, which shades with the object space one
+	vec3 n = normalize(barycentrics.x * normals[0] + barycentrics.y * normals[1] + barycentrics.z * normals[2]);
+
+	vec3 albedo = sceneData.albedo;
+	float metallic = sceneData.metallic;
+	float roughness = sceneData.roughness;
+
+	vec3 v = normalize(cameraData.cameraPosition.xyz - worldPosition);
+
+	vec3 l0 = vec3(0.);
+
+	uvec3 size = clusterBuffer.size.xyz;
+	float viewDepth = -(cameraData.view * vec4(worldPosition, 1.)).z;
+	uvec2 tile = uvec2(min(gl_FragCoord.xy / clusterBuffer.screen.xy * vec2(size.xy), vec2(size.xy) - 1.));
+	uint slice = uint(clamp(log(viewDepth) * clusterBuffer.screen.z + clusterBuffer.screen.w, 0., float(size.z - 1)));
+	uvec2 range = clusterBuffer.ranges[(slice * size.y + tile.y) * size.x + tile.x];
+
+	//the lights of the cluster
+	for(uint i = 0; i < range.y; ++i) 
+	{	
+		uint lightIndex = lightIndexBuffer.ids[range.x + i];
+		Light light = lightBuffer.lights[lightIndex];
+		l0 += shadePointLight(light, worldPosition, n, v, albedo, metallic, roughness)
+			* pointShadow(lightIndex, light.position, worldPosition, n);
+	}
+	l0 += shadeSun(worldPosition, n, v, albedo, metallic, roughness);
+	l0 += shadeBaked(worldPosition, n, albedo, metallic);
+	l0 += shadeEnvironment(n, v, albedo, metallic, roughness);
+	l0 = l0 / (l0 + vec3(1.));
+	l0 = pow(l0, vec3(1./2.2));
+
+	outFragColor = vec4(l0, 1.);
+}
@@ -0,0 +1,152 @@
+#include "vk_asset.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+#include "vk_hash.h"
+
+namespace
+{
+	struct CookedTextureHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipCount;
+		uint64_t sourceHash;
+		uint64_t dataSize;
+	};
+
+	// the outcome of a comparison, valid while neither file changed
+	struct CookedCheck
+	{
+		uintmax_t sourceSize;
+		std::filesystem::file_time_type sourceTime;
+		std::filesystem::file_time_type cookedTime;
+		bool upToDate;
+	};
+
+	// by cooked path, the load path lookups and the loads themselves check the same files
+	std::mutex cookedChecksMutex;
+	std::unordered_map<std::string, CookedCheck> cookedChecks;
+
+	bool readCookedSourceHash(const std::string& cookedPath, uint64_t& outHash)
+	{
+		std::ifstream file(cookedPath, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		//the headers only share their magic, the source hash sits at a different place in each
+		outHash = 0;
+		uint32_t magic = 0;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		file.seekg(0);
+		if (magic == vkutil::COOKED_MESH_MAGIC)
+		{
+			vkutil::CookedMeshHeader header{};
+			file.read(reinterpret_cast<char*>(&header), sizeof(header));
+			outHash = header.sourceHash;
+		}
+		else if (magic == vkutil::COOKED_TEXTURE_MAGIC)
+		{
+			CookedTextureHeader header{};
+			file.read(reinterpret_cast<char*>(&header), sizeof(header));
+			outHash = header.sourceHash;
+		}
+		return static_cast<bool>(file);
+	}
+}
+
+bool vkutil::saveCookedTexture(const char* filePath, const CookedTexture& texture)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	CookedTextureHeader header{};
+	header.magic = COOKED_TEXTURE_MAGIC;
+	header.version = COOKED_VERSION;
+	header.format = static_cast<uint32_t>(texture.format);
+	header.width = texture.width;
+	header.height = texture.height;
+	header.mipCount = static_cast<uint32_t>(texture.mips.size());
+	header.sourceHash = texture.sourceHash;
+	header.dataSize = texture.data.size();
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(texture.mips.data()), static_cast<std::streamsize>(texture.mips.size() * sizeof(CookedMipLevel)));
+	file.write(reinterpret_cast<const char*>(texture.data.data()), static_cast<std::streamsize>(texture.data.size()));
+	return file.good();
+}
+
+bool vkutil::parseCookedTexture(const uint8_t* bytes, const size_t size, CookedTextureView& outTexture)
+{
+	if (size < sizeof(CookedTextureHeader))
+		return false;
+
+	CookedTextureHeader header{};
+	memcpy(&header, bytes, sizeof(header));
+	if (header.magic != COOKED_TEXTURE_MAGIC || header.version != COOKED_VERSION)
+		return false;
+
+	const uint64_t mipsSize = static_cast<uint64_t>(header.mipCount) * sizeof(CookedMipLevel);
+	if (mipsSize + header.dataSize > size - sizeof(header))
+		return false;
+
+	outTexture.format = static_cast<VkFormat>(header.format);
+	outTexture.width = header.width;
+	outTexture.height = header.height;
+	outTexture.sourceHash = header.sourceHash;
+	outTexture.mips.resize(header.mipCount);
+	memcpy(outTexture.mips.data(), bytes + sizeof(header), static_cast<size_t>(mipsSize));
+	outTexture.data = bytes + sizeof(header) + mipsSize;
+	outTexture.dataSize = header.dataSize;
+	return true;
+}
+
+bool vkutil::isCookedUpToDate(const std::string& sourcePath, const std::string& cookedPath)
+{
+	std::error_code error;
+	const uintmax_t sourceSize = std::filesystem::file_size(sourcePath, error);
+	if (error)
+		return true;
+	const std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(sourcePath, error);
+	const std::filesystem::file_time_type cookedTime = error ? sourceTime : std::filesystem::last_write_time(cookedPath, error);
+	if (error)
+		return true;
+
+	{
+		std::lock_guard lock(cookedChecksMutex);
+		const auto found = cookedChecks.find(cookedPath);
+		if (found != cookedChecks.end() && found->second.sourceSize == sourceSize && found->second.sourceTime == sourceTime
+			&& found->second.cookedTime == cookedTime)
+			return found->second.upToDate;
+	}
+
+	//the cooker writes its output after reading the source, the source is only hashed once it was touched since
+	bool upToDate = cookedTime >= sourceTime;
+	if (!upToDate)
+	{
+		uint64_t cookedHash;
+		uint64_t sourceHash;
+		upToDate = readCookedSourceHash(cookedPath, cookedHash) && hashFile(sourcePath.c_str(), sourceHash) && sourceHash == cookedHash;
+		if (!upToDate)
+			std::cout << "Cooked file " << cookedPath << " is older than " << sourcePath << ", loading the source" << std::endl;
+	}
+
+	std::lock_guard lock(cookedChecksMutex);
+	cookedChecks[cookedPath] = { sourceSize, sourceTime, cookedTime, upToDate };
+	return upToDate;
+}
+
+std::string vkutil::getCookedPath(const std::string& sourcePath, const char* cookedExtension)
+{
+	const std::filesystem::path path(sourcePath);
+	return (path.parent_path() / "cooked" / path.filename()).string() + cookedExtension;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vk_types.h"
+#include <string>
+#include <vector>
+
+// Runtime-ready formats written by the AssetCooker and read back by the engine
+// without any parsing or encoding.
+namespace vkutil
+{
+	constexpr uint32_t COOKED_MESH_MAGIC = 0x534D4B56;    // "VKMS"
+	constexpr uint32_t COOKED_TEXTURE_MAGIC = 0x58544B56; // "VKTX"
+	constexpr uint32_t COOKED_VERSION = 1;
+
+	constexpr const char* COOKED_MESH_EXTENSION = ".vkmesh";
+	constexpr const char* COOKED_TEXTURE_EXTENSION = ".vktex";
+
+	struct CookedMeshHeader
+	{
+		uint32_t magic{ COOKED_MESH_MAGIC };
+		uint32_t version{ COOKED_VERSION };
+		uint32_t vertexCount{ 0 };
+		uint32_t indexCount{ 0 };
+		uint64_t sourceHash{ 0 };
+	};
+
+	struct CookedMipLevel
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	struct CookedTexture
+	{
+		VkFormat format{ VK_FORMAT_UNDEFINED };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint64_t sourceHash{ 0 };
+		std::vector<CookedMipLevel> mips;
+		std::vector<uint8_t> data;
+	};
+
+	// cooked texture parsed in place, the payload points into the bytes it was read from
+	struct CookedTextureView
+	{
+		VkFormat format{ VK_FORMAT_UNDEFINED };
+		uint32_t width{ 0 };
+		uint32_t height{ 0 };
+		uint64_t sourceHash{ 0 };
+		std::vector<CookedMipLevel> mips;
+		const uint8_t* data{ nullptr };
+		uint64_t dataSize{ 0 };
+	};
+
+	bool saveCookedTexture(const char* filePath, const CookedTexture& texture);
+	bool parseCookedTexture(const uint8_t* bytes, size_t size, CookedTextureView& outTexture);
+
+	// "dir/file.ext" -> "dir/cooked/file.ext<cookedExtension>"
+	std::string getCookedPath(const std::string& sourcePath, const char* cookedExtension);
+
+	// false when the source next to a cooked mesh or texture hashes differently from the one it was cooked from.
+	// The source is only hashed when it was written after the cooked file, the outcome is kept until either file changes.
+	// A build shipping the cooked files alone, or a cooked file only found in a pack, is taken as it is
+	bool isCookedUpToDate(const std::string& sourcePath, const std::string& cookedPath);
+}
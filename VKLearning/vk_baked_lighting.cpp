@@ -0,0 +1,237 @@
+#include "vk_baked_lighting.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "vk_asset.h"
+#include "vk_engine.h"
+#include "vk_hash.h"
+#include "vk_jobs.h"
+#include "vk_light_animation.h"
+
+namespace
+{
+	static_assert(sizeof(vkutil::GPUProbe) == 48, "must match the std430 Probe of the lighting shaders");
+	static_assert(sizeof(vkutil::GPUProbeGrid) == 32, "the probes follow the grid in the probe buffer");
+}
+
+void BakedLighting::init(VulkanEngine& engine, const std::string& bakeScenePath)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_bakeScenePath = bakeScenePath;
+	m_probesPath = vkutil::getCookedPath(bakeScenePath, vkutil::COOKED_PROBES_EXTENSION);
+
+	const VkDeviceSize bufferSize = sizeof(vkutil::GPUProbeGrid) + MAX_PROBE_COUNT * sizeof(vkutil::GPUProbe);
+	m_probeBuffer = engine.createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	//an empty grid until probes matching the scene are found
+	void* data;
+	vmaMapMemory(m_allocator, m_probeBuffer.allocation, &data);
+	memset(data, 0, sizeof(vkutil::GPUProbeGrid));
+	vmaUnmapMemory(m_allocator, m_probeBuffer.allocation);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vmaDestroyBuffer(m_allocator, m_probeBuffer.buffer, m_probeBuffer.allocation);
+		});
+}
+
+void BakedLighting::update(const RenderObject* objects, const uint32_t count, const LightAnimator& lights, const uint32_t lightCount, const uint64_t sceneVersion)
+{
+	//walking the static triangles is only done once they changed
+	bool changed = false;
+	if (m_sceneVersion != sceneVersion || m_sceneSpacing != m_probeSpacing)
+	{
+		m_sceneVersion = sceneVersion;
+		m_sceneSpacing = m_probeSpacing;
+		m_scene.probeSpacing = m_probeSpacing;
+		m_scene.maxProbeCount = MAX_PROBE_COUNT;
+		buildGeometry(objects, count, m_scene);
+		changed = true;
+	}
+
+	//the bounds change with every edit and every animated light, the probes only depend on the lights never animated
+	if (m_boundsVersion != lights.getBoundsVersion() || m_lightCount != lightCount)
+	{
+		m_boundsVersion = lights.getBoundsVersion();
+		m_lightCount = lightCount;
+		buildLights(lights, lightCount, m_scene);
+		const uint64_t indicesHash = vkutil::hash64(m_scene.lightIndices.data(), m_scene.lightIndices.size() * sizeof(uint32_t));
+		const uint64_t lightsHash = vkutil::hash64(m_scene.lights.data(), m_scene.lights.size() * sizeof(GPULightData), indicesHash);
+		changed |= lightsHash != m_lightsHash;
+		m_lightsHash = lightsHash;
+	}
+
+	if (changed)
+	{
+		std::vector<uint8_t> bytes;
+		vkutil::serializeBakeScene(m_scene, bytes);
+		m_sceneHash = vkutil::hash64(bytes.data(), bytes.size());
+
+		//the farm may have baked the scene meanwhile
+		vkutil::BakedProbeGrid grid;
+		if (m_probesHash != m_sceneHash && vkutil::assetExists(m_probesPath) && vkutil::loadProbeGrid(m_probesPath.c_str(), grid)
+			&& grid.sourceHash == m_sceneHash && grid.probes.size() <= MAX_PROBE_COUNT)
+		{
+			upload(grid, m_scene);
+			m_stats.fromCache = true;
+		}
+	}
+
+	setActive(m_enabled && m_probesHash != 0 && m_probesHash == m_sceneHash);
+}
+
+bool BakedLighting::bake(JobSystem& jobSystem, const RenderObject* objects, const uint32_t count, const LightAnimator& lights, const uint32_t lightCount)
+{
+	const vkutil::BakeScene scene = buildScene(objects, count, lights, lightCount);
+	std::vector<uint8_t> bytes;
+	vkutil::serializeBakeScene(scene, bytes);
+	const uint64_t sceneHash = vkutil::hash64(bytes.data(), bytes.size());
+	writeScene(bytes);
+
+	LightBaker baker;
+	vkutil::BakedProbeGrid grid;
+	baker.bake(jobSystem, scene, grid);
+	grid.sourceHash = sceneHash;
+	if (grid.probes.size() > MAX_PROBE_COUNT)
+		return false;
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(m_probesPath).parent_path(), error);
+	if (!vkutil::saveProbeGrid(m_probesPath.c_str(), grid))
+		std::cout << "Could not write " << m_probesPath << std::endl;
+
+	upload(grid, scene);
+	m_stats.fromCache = false;
+	m_stats.rayCount = baker.getStats().rayCount;
+	m_stats.bakeMilliseconds = baker.getStats().buildMilliseconds + baker.getStats().bakeMilliseconds;
+	return true;
+}
+
+bool BakedLighting::exportScene(const RenderObject* objects, const uint32_t count, const LightAnimator& lights, const uint32_t lightCount) const
+{
+	std::vector<uint8_t> bytes;
+	vkutil::serializeBakeScene(buildScene(objects, count, lights, lightCount), bytes);
+	return writeScene(bytes);
+}
+
+void BakedLighting::removeBakedLights(std::vector<uint32_t>& lights) const
+{
+	if (!m_active)
+		return;
+
+	lights.erase(std::remove_if(lights.begin(), lights.end(), [this](const uint32_t light)
+		{
+			return light < m_bakedLights.size() && m_bakedLights[light];
+		}), lights.end());
+}
+
+VkDescriptorBufferInfo BakedLighting::getBufferInfo() const
+{
+	return { m_probeBuffer.buffer, 0, VK_WHOLE_SIZE };
+}
+
+vkutil::BakeScene BakedLighting::buildScene(const RenderObject* objects, const uint32_t count, const LightAnimator& lights, const uint32_t lightCount) const
+{
+	vkutil::BakeScene scene;
+	scene.probeSpacing = m_probeSpacing;
+	scene.maxProbeCount = MAX_PROBE_COUNT;
+	buildGeometry(objects, count, scene);
+	buildLights(lights, lightCount, scene);
+	return scene;
+}
+
+void BakedLighting::buildGeometry(const RenderObject* objects, const uint32_t count, vkutil::BakeScene& scene) const
+{
+	scene.positions.clear();
+
+	//only what never moves blocks the baked lights, the dynamic objects are lit by the probes without shadowing them
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const RenderObject& object = objects[i];
+		if (!object.isStatic || object.pass != DrawPass::Opaque || !object.mesh || object.mesh->m_lods.empty())
+			continue;
+
+		const Mesh& mesh = *object.mesh;
+		const MeshLod& lod = mesh.m_lods[0];
+		for (uint32_t index = lod.firstIndex; index < lod.firstIndex + lod.indexCount; index++)
+			scene.positions.push_back(glm::vec3(object.transformMatrix * glm::vec4(mesh.m_vertices[mesh.m_indices[index]].position, 1.f)));
+	}
+}
+
+void BakedLighting::buildLights(const LightAnimator& lights, const uint32_t lightCount, vkutil::BakeScene& scene) const
+{
+	scene.lights.clear();
+	scene.lightIndices.clear();
+
+	//a flickering light keeps its position but not its intensity, it stays per pixel
+	const GPULightData* bounds = lights.getBounds();
+	for (uint32_t i = 0; i < lightCount; i++)
+	{
+		if (lights.isAnimated(i))
+			continue;
+		scene.lights.push_back(bounds[i]);
+		scene.lightIndices.push_back(i);
+	}
+}
+
+bool BakedLighting::writeScene(const std::vector<uint8_t>& bytes) const
+{
+	//the input next to the assets lets the AssetCooker bake the same scene headless, before the engine ever does
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(m_bakeScenePath).parent_path(), error);
+	std::ofstream file(m_bakeScenePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write " << m_bakeScenePath << std::endl;
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	return true;
+}
+
+void BakedLighting::upload(const vkutil::BakedProbeGrid& grid, const vkutil::BakeScene& scene)
+{
+	vkDeviceWaitIdle(m_device);
+
+	char* data;
+	vmaMapMemory(m_allocator, m_probeBuffer.allocation, reinterpret_cast<void**>(&data));
+	vkutil::GPUProbeGrid header = grid.grid;
+	header.size.w = m_active ? 1 : 0;
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + sizeof(header), grid.probes.data(), grid.probes.size() * sizeof(vkutil::GPUProbe));
+	vmaUnmapMemory(m_allocator, m_probeBuffer.allocation);
+
+	m_probesHash = grid.sourceHash;
+	m_bakedLights.clear();
+	for (const uint32_t light : scene.lightIndices)
+	{
+		if (light >= m_bakedLights.size())
+			m_bakedLights.resize(light + 1, 0);
+		m_bakedLights[light] = 1;
+	}
+
+	m_stats.probeCount = static_cast<uint32_t>(grid.probes.size());
+	m_stats.bakedLightCount = static_cast<uint32_t>(scene.lightIndices.size());
+	m_stats.triangleCount = static_cast<uint32_t>(scene.positions.size() / 3);
+}
+
+void BakedLighting::setActive(const bool active)
+{
+	m_stats.active = active;
+	if (m_active == active)
+		return;
+
+	//the shading reads the flag, no frame in flight may see the lights both baked and evaluated
+	vkDeviceWaitIdle(m_device);
+	m_active = active;
+
+	char* data;
+	vmaMapMemory(m_allocator, m_probeBuffer.allocation, reinterpret_cast<void**>(&data));
+	reinterpret_cast<vkutil::GPUProbeGrid*>(data)->size.w = active ? 1 : 0;
+	vmaUnmapMemory(m_allocator, m_probeBuffer.allocation);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include "vk_light_bake.h"
+
+#include <string>
+#include <vector>
+
+class VulkanEngine;
+class JobSystem;
+class LightAnimator;
+
+struct BakedLightingStats
+{
+	// the probes match the scene and the shading uses them
+	bool active = false;
+	// found in the cooked file instead of baked by the engine
+	bool fromCache = false;
+	uint32_t probeCount = 0;
+	uint32_t bakedLightCount = 0;
+	uint32_t triangleCount = 0;
+	// of the last bake done by the engine
+	uint64_t rayCount = 0;
+	float bakeMilliseconds = 0.f;
+};
+
+// Static lighting from the LightBaker. The lights that are never animated are baked with their shadows into a grid of
+// irradiance probes over the static opaque objects, the shading adds the probes and the light loops skip those lights.
+// The probes are keyed by the hash of the bake input, exported next to the assets on demand or with every bake: the
+// AssetCooker bakes it headless, the engine loads the result as soon as its scene hashes the same, or bakes it itself.
+// Once the static geometry or the non-animated lights change the probes no longer match, the lights are evaluated per
+// pixel again until the next bake. Only the diffuse part of the baked lights remains, their highlights are gone.
+class BakedLighting
+{
+public:
+	static constexpr uint32_t MAX_PROBE_COUNT = 32768;
+
+	// creates the probe buffer, read by every frame
+	void init(VulkanEngine& engine, const std::string& bakeScenePath);
+
+	// looks for the probes of the scene once it changed, from the cooked file when the uploaded ones do not match.
+	// The first lightCount lights of the animator are part of the scene, sceneVersion is the version of the static objects
+	void update(const RenderObject* objects, uint32_t count, const LightAnimator& lights, uint32_t lightCount, uint64_t sceneVersion);
+	// writes the bake input of the scene for the AssetCooker
+	bool exportScene(const RenderObject* objects, uint32_t count, const LightAnimator& lights, uint32_t lightCount) const;
+	// bakes the scene on the job system, writes the bake input and the cooked probes. Blocks until done
+	bool bake(JobSystem& jobSystem, const RenderObject* objects, uint32_t count, const LightAnimator& lights, uint32_t lightCount);
+	// removes the lights the probes hold while they are used
+	void removeBakedLights(std::vector<uint32_t>& lights) const;
+
+	VkDescriptorBufferInfo getBufferInfo() const;
+	const BakedLightingStats& getStats() const { return m_stats; }
+
+	bool  m_enabled{ true };
+	// wanted distance between two probes, in meters
+	float m_probeSpacing{ 1.f };
+
+private:
+	vkutil::BakeScene buildScene(const RenderObject* objects, uint32_t count, const LightAnimator& lights, uint32_t lightCount) const;
+	// the static opaque triangles, in world space
+	void buildGeometry(const RenderObject* objects, uint32_t count, vkutil::BakeScene& scene) const;
+	// the lights never animated among the first lightCount
+	void buildLights(const LightAnimator& lights, uint32_t lightCount, vkutil::BakeScene& scene) const;
+	bool writeScene(const std::vector<uint8_t>& bytes) const;
+	// waits for the device, the frames in flight read the buffer
+	void upload(const vkutil::BakedProbeGrid& grid, const vkutil::BakeScene& scene);
+	void setActive(bool active);
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	AllocatedBuffer m_probeBuffer{};
+	std::string m_bakeScenePath;
+	std::string m_probesPath;
+
+	// the scene as of the last update, its geometry only rebuilt with the static objects
+	vkutil::BakeScene m_scene;
+	uint64_t m_sceneVersion{ ~0ull };
+	float m_sceneSpacing{ 0.f };
+	// the lights are only hashed again once one of them or their count changed
+	uint64_t m_boundsVersion{ ~0ull };
+	uint32_t m_lightCount{ ~0u };
+	uint64_t m_lightsHash{ 0 };
+	uint64_t m_sceneHash{ 0 };
+	// hash of the scene the uploaded probes were baked from, 0 without any
+	uint64_t m_probesHash{ 0 };
+	// 1 for every light of the scene the uploaded probes hold
+	std::vector<uint8_t> m_bakedLights;
+	bool m_active{ false };
+	BakedLightingStats m_stats;
+};
@@ -0,0 +1,303 @@
+#include "vk_culling.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "vk_jobs.h"
+#include "vk_light_clusters.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VK_CULL_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_CULL_SSE2 1
+#endif
+
+namespace
+{
+	// the arrays are padded to this many spheres so that the SIMD loops have no remainder
+	constexpr uint32_t CULL_LANES = 8;
+	// small enough to balance the workers, big enough to amortize the job
+	constexpr uint32_t CULL_GROUP_SIZE = 16384;
+	constexpr uint32_t BOUNDS_GROUP_SIZE = 4096;
+
+	glm::vec4 normalizePlane(const glm::vec4& plane)
+	{
+		return plane / glm::length(glm::vec3(plane));
+	}
+
+	// tests the spheres [begin, end), begin and end being multiples of CULL_LANES, and writes the visible indices to outVisible
+	uint32_t cullRange(const Frustum& frustum, const float* centerX, const float* centerY, const float* centerZ, const float* radius,
+		const uint32_t begin, const uint32_t end, uint32_t* outVisible)
+	{
+		uint32_t visibleCount = 0;
+
+#if defined(VK_CULL_AVX2)
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+
+		for (uint32_t i = begin; i < end; i += 8)
+		{
+			const __m256 x = _mm256_loadu_ps(centerX + i);
+			const __m256 y = _mm256_loadu_ps(centerY + i);
+			const __m256 z = _mm256_loadu_ps(centerZ + i);
+			const __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+
+			//a sphere is outside when it is entirely behind one of the planes
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; p++)
+			{
+				const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)), _mm256_add_ps(_mm256_mul_ps(planeZ[p], z), planeW[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+			while (mask)
+			{
+				outVisible[visibleCount++] = i + static_cast<uint32_t>(std::countr_zero(mask));
+				mask &= mask - 1;
+			}
+		}
+#elif defined(VK_CULL_SSE2)
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		for (uint32_t i = begin; i < end; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(centerX + i);
+			const __m128 y = _mm_loadu_ps(centerY + i);
+			const __m128 z = _mm_loadu_ps(centerZ + i);
+			const __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+			//a sphere is outside when it is entirely behind one of the planes
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; p++)
+			{
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)), _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			//4 lanes only, a small table beats a bit scan
+			static constexpr uint8_t laneCounts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+			const int mask = _mm_movemask_ps(inside);
+			uint32_t* out = outVisible + visibleCount;
+			out[0] = i;
+			uint32_t written = mask & 1;
+			out[written] = i + 1;
+			written += (mask >> 1) & 1;
+			out[written] = i + 2;
+			written += (mask >> 2) & 1;
+			out[written] = i + 3;
+			visibleCount += laneCounts[mask];
+		}
+#else
+		for (uint32_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (uint32_t p = 0; p < 6 && inside; p++)
+			{
+				const glm::vec4& plane = frustum.planes[p];
+				inside = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w >= -radius[i];
+			}
+			if (inside)
+				outVisible[visibleCount++] = i;
+		}
+#endif
+		return visibleCount;
+	}
+}
+
+Frustum vkutil::extractFrustum(const glm::mat4& viewProj)
+{
+	//rows of the matrix, glm is column major
+	const glm::vec4 row0 = { viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0] };
+	const glm::vec4 row1 = { viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1] };
+	const glm::vec4 row2 = { viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2] };
+	const glm::vec4 row3 = { viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3] };
+
+	Frustum frustum;
+	frustum.planes[0] = normalizePlane(row3 + row0); //left
+	frustum.planes[1] = normalizePlane(row3 - row0); //right
+	frustum.planes[2] = normalizePlane(row3 + row1); //bottom
+	frustum.planes[3] = normalizePlane(row3 - row1); //top
+	frustum.planes[4] = normalizePlane(row3 + row2); //near, -w <= z as the projection is not zero to one
+	frustum.planes[5] = normalizePlane(row3 - row2); //far
+	return frustum;
+}
+
+glm::vec4 vkutil::computeWorldSphere(const glm::mat4& transform, const Mesh& mesh)
+{
+	const glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.m_boundsCenter, 1.f));
+
+	//non uniform scales grow the sphere by their largest axis
+	const float scaleSquared = std::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+		std::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))));
+	return glm::vec4(center, mesh.m_boundsRadius * std::sqrt(scaleSquared));
+}
+
+void FrustumCuller::updateBounds(JobSystem& jobSystem, const RenderObject* objects, const uint32_t count, const uint64_t staticVersion)
+{
+	float* centerX = m_centerX.data();
+	float* centerY = m_centerY.data();
+	float* centerZ = m_centerZ.data();
+	float* radius = m_radius.data();
+
+	//the static spheres stay as they are, only the objects that move are transformed again
+	if (m_objects == objects && m_count == count && m_staticVersion == staticVersion)
+	{
+		const uint32_t* dynamicObjects = m_dynamicObjects.data();
+		jobSystem.parallelFor(static_cast<uint32_t>(m_dynamicObjects.size()), BOUNDS_GROUP_SIZE, [=](const uint32_t begin, const uint32_t end, uint32_t)
+			{
+				for (uint32_t d = begin; d < end; d++)
+				{
+					const uint32_t i = dynamicObjects[d];
+					const glm::vec4 sphere = vkutil::computeWorldSphere(objects[i].transformMatrix, *objects[i].mesh);
+					centerX[i] = sphere.x;
+					centerY[i] = sphere.y;
+					centerZ[i] = sphere.z;
+					radius[i] = sphere.w;
+				}
+			});
+		return;
+	}
+
+	m_objects = objects;
+	m_count = count;
+	m_staticVersion = staticVersion;
+	const uint32_t paddedCount = (count + CULL_LANES - 1) / CULL_LANES * CULL_LANES;
+	m_centerX.resize(paddedCount);
+	m_centerY.resize(paddedCount);
+	m_centerZ.resize(paddedCount);
+	m_radius.resize(paddedCount);
+
+	centerX = m_centerX.data();
+	centerY = m_centerY.data();
+	centerZ = m_centerZ.data();
+	radius = m_radius.data();
+	jobSystem.parallelFor(paddedCount, BOUNDS_GROUP_SIZE, [=](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				//the padding and the objects that are not drawn fail every plane
+				if (i >= count || !objects[i].mesh || !objects[i].material)
+				{
+					centerX[i] = centerY[i] = centerZ[i] = 0.f;
+					radius[i] = -FLT_MAX;
+					continue;
+				}
+
+				const glm::vec4 sphere = vkutil::computeWorldSphere(objects[i].transformMatrix, *objects[i].mesh);
+				centerX[i] = sphere.x;
+				centerY[i] = sphere.y;
+				centerZ[i] = sphere.z;
+				radius[i] = sphere.w;
+			}
+		});
+
+	m_dynamicObjects.clear();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!objects[i].isStatic && objects[i].mesh && objects[i].material)
+			m_dynamicObjects.push_back(i);
+	}
+}
+
+void FrustumCuller::updateBounds(JobSystem& jobSystem, const GPULightData* lights, const uint32_t count)
+{
+	m_objects = nullptr;
+	m_count = count;
+	const uint32_t paddedCount = (count + CULL_LANES - 1) / CULL_LANES * CULL_LANES;
+	m_centerX.resize(paddedCount);
+	m_centerY.resize(paddedCount);
+	m_centerZ.resize(paddedCount);
+	m_radius.resize(paddedCount);
+
+	float* centerX = m_centerX.data();
+	float* centerY = m_centerY.data();
+	float* centerZ = m_centerZ.data();
+	float* radius = m_radius.data();
+	jobSystem.parallelFor(paddedCount, BOUNDS_GROUP_SIZE, [=](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				if (i >= count)
+				{
+					centerX[i] = centerY[i] = centerZ[i] = 0.f;
+					radius[i] = -FLT_MAX;
+					continue;
+				}
+
+				centerX[i] = lights[i].position.x;
+				centerY[i] = lights[i].position.y;
+				centerZ[i] = lights[i].position.z;
+				radius[i] = vkutil::computeLightRadius(lights[i]);
+			}
+		});
+}
+
+void FrustumCuller::cull(JobSystem& jobSystem, const Frustum& frustum, std::vector<uint32_t>& outVisible)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	//every group writes at its own offset of m_groupVisible, the results are packed afterwards
+	const uint32_t paddedCount = static_cast<uint32_t>(m_radius.size());
+	const uint32_t groupCount = (paddedCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+	if (m_groupVisible.size() < paddedCount)
+		m_groupVisible.resize(paddedCount);
+	m_groupVisibleCounts.assign(groupCount, 0);
+
+	const float* centerX = m_centerX.data();
+	const float* centerY = m_centerY.data();
+	const float* centerZ = m_centerZ.data();
+	const float* radius = m_radius.data();
+	uint32_t* groupVisible = m_groupVisible.data();
+	uint32_t* groupVisibleCounts = m_groupVisibleCounts.data();
+	jobSystem.parallelFor(paddedCount, CULL_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			groupVisibleCounts[begin / CULL_GROUP_SIZE] = cullRange(frustum, centerX, centerY, centerZ, radius, begin, end, groupVisible + begin);
+		});
+
+	uint32_t visibleCount = 0;
+	for (uint32_t group = 0; group < groupCount; group++)
+		visibleCount += groupVisibleCounts[group];
+
+	outVisible.resize(visibleCount);
+	uint32_t* out = outVisible.data();
+	for (uint32_t group = 0; group < groupCount; group++)
+	{
+		memcpy(out, groupVisible + group * CULL_GROUP_SIZE, groupVisibleCounts[group] * sizeof(uint32_t));
+		out += groupVisibleCounts[group];
+	}
+
+	m_stats.testedCount = m_count;
+	m_stats.visibleCount = visibleCount;
+	m_stats.cullMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+const char* FrustumCuller::getInstructionSet()
+{
+#if defined(VK_CULL_AVX2)
+	return "AVX2";
+#elif defined(VK_CULL_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
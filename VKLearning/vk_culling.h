@@ -0,0 +1,61 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+
+#include <vector>
+
+class JobSystem;
+
+// planes point inside, dot(plane, vec4(p, 1)) is the signed distance of p
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+struct CullingStats
+{
+	uint32_t testedCount = 0;
+	uint32_t visibleCount = 0;
+	float cullMilliseconds = 0.f;
+};
+
+namespace vkutil
+{
+	// the six planes of a view projection matrix, normalized so that distances are in world units
+	Frustum extractFrustum(const glm::mat4& viewProj);
+	// bounding sphere of the mesh once transformed, xyz is the center and w the radius
+	glm::vec4 computeWorldSphere(const glm::mat4& transform, const Mesh& mesh);
+}
+
+// Keeps the world space bounding spheres of the renderables as separate x, y, z and radius arrays, so that the
+// frustum test runs on 8 spheres per instruction with AVX2, 4 with SSE2. Large scenes are split across the JobSystem.
+class FrustumCuller
+{
+public:
+	// recomputes the spheres from the mesh bounds and the transforms, objects without a mesh or a material are never visible.
+	// The static objects keep their sphere while staticVersion stays the same, it has to change with any of them
+	void updateBounds(JobSystem& jobSystem, const RenderObject* objects, uint32_t count, uint64_t staticVersion);
+	// same for lights, their sphere is the one of their radius
+	void updateBounds(JobSystem& jobSystem, const GPULightData* lights, uint32_t count);
+	// outVisible receives the indices of the objects intersecting the frustum, in increasing order
+	void cull(JobSystem& jobSystem, const Frustum& frustum, std::vector<uint32_t>& outVisible);
+
+	const CullingStats& getStats() const { return m_stats; }
+	static const char* getInstructionSet();
+
+private:
+	std::vector<float> m_centerX;
+	std::vector<float> m_centerY;
+	std::vector<float> m_centerZ;
+	std::vector<float> m_radius;
+	uint32_t m_count{ 0 };
+	// what the static spheres were computed from, and the objects updated every frame since
+	const RenderObject* m_objects{ nullptr };
+	uint64_t m_staticVersion{ 0 };
+	std::vector<uint32_t> m_dynamicObjects;
+
+	std::vector<uint32_t> m_groupVisible;
+	std::vector<uint32_t> m_groupVisibleCounts;
+	CullingStats m_stats;
+};
@@ -0,0 +1,243 @@
+#include "vk_deferred.h"
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_pipeline.h"
+
+void DeferredRenderer::createAttachment(VulkanEngine& engine, const VkFormat format, AllocatedImage& image, VkImageView& view) const
+{
+	const VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(format,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+		{ engine.m_windowExtent.width, engine.m_windowExtent.height, 1 });
+
+	//lazily allocated memory is only backed when a tile spills, not every device has it
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+	if (vmaCreateImage(engine.m_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr) != VK_SUCCESS)
+	{
+		allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		VK_CHECK(vmaCreateImage(engine.m_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr));
+	}
+
+	const VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(format, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &view));
+}
+
+void DeferredRenderer::init(VulkanEngine& engine)
+{
+	m_device = engine.m_device;
+	createAttachment(engine, ALBEDO_METALLIC_FORMAT, m_albedoMetallic, m_albedoMetallicView);
+	createAttachment(engine, NORMAL_ROUGHNESS_FORMAT, m_normalRoughness, m_normalRoughnessView);
+
+	//the lighting writes every pixel, the background included
+	VkAttachmentDescription attachments[ATTACHMENT_COUNT] = {};
+	attachments[0].format = engine.m_swapchainImageFormat;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	//stored for the passes loading it afterwards
+	attachments[1].format = engine.m_depthFormat;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	//the lighting skips the pixels at the far plane, the G-buffer needs no clear and is never stored
+	for (uint32_t i = 2; i < ATTACHMENT_COUNT; i++)
+	{
+		attachments[i].format = i == 2 ? ALBEDO_METALLIC_FORMAT : NORMAL_ROUGHNESS_FORMAT;
+		attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	const VkAttachmentReference gbufferRefs[GBUFFER_COLOR_COUNT] = {
+		{ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+		{ 3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }
+	};
+	const VkAttachmentReference depthRef = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	const VkAttachmentReference inputRefs[3] = {
+		{ 2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ 3, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+	};
+	const VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpasses[2] = {};
+	subpasses[GEOMETRY_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[GEOMETRY_SUBPASS].colorAttachmentCount = GBUFFER_COLOR_COUNT;
+	subpasses[GEOMETRY_SUBPASS].pColorAttachments = gbufferRefs;
+	subpasses[GEOMETRY_SUBPASS].pDepthStencilAttachment = &depthRef;
+
+	subpasses[LIGHTING_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[LIGHTING_SUBPASS].inputAttachmentCount = 3;
+	subpasses[LIGHTING_SUBPASS].pInputAttachments = inputRefs;
+	subpasses[LIGHTING_SUBPASS].colorAttachmentCount = 1;
+	subpasses[LIGHTING_SUBPASS].pColorAttachments = &colorRef;
+
+	VkSubpassDependency dependencies[3] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = GEOMETRY_SUBPASS;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	//per region, a pixel of the lighting only reads the G-buffer at the same pixel
+	dependencies[1].srcSubpass = GEOMETRY_SUBPASS;
+	dependencies[1].dstSubpass = LIGHTING_SUBPASS;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	dependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[2].dstSubpass = LIGHTING_SUBPASS;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].srcAccessMask = 0;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = ATTACHMENT_COUNT;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = 2;
+	renderPassInfo.pSubpasses = subpasses;
+	renderPassInfo.dependencyCount = 3;
+	renderPassInfo.pDependencies = dependencies;
+	VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass));
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_renderPass;
+	framebufferInfo.attachmentCount = ATTACHMENT_COUNT;
+	framebufferInfo.width = engine.m_windowExtent.width;
+	framebufferInfo.height = engine.m_windowExtent.height;
+	framebufferInfo.layers = 1;
+
+	m_framebuffers.resize(engine.m_swapchainImageViews.size());
+	for (size_t i = 0; i < m_framebuffers.size(); i++)
+	{
+		const VkImageView views[ATTACHMENT_COUNT] = { engine.m_swapchainImageViews[i], engine.m_depthImageView, m_albedoMetallicView, m_normalRoughnessView };
+		framebufferInfo.pAttachments = views;
+		VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_framebuffers[i]));
+	}
+
+	const VkDescriptorSetLayoutBinding bindings[3] = {
+		vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+		vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+		vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 2)
+	};
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = 3;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = engine.m_descriptorPool;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &m_setLayout;
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &setAllocInfo, &m_set));
+
+	VkDescriptorImageInfo imageInfos[3] = {};
+	imageInfos[0] = { VK_NULL_HANDLE, m_albedoMetallicView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	imageInfos[1] = { VK_NULL_HANDLE, m_normalRoughnessView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	imageInfos[2] = { VK_NULL_HANDLE, engine.m_depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+	VkWriteDescriptorSet writes[3];
+	for (uint32_t i = 0; i < 3; i++)
+		writes[i] = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, m_set, &imageInfos[i], i);
+	vkUpdateDescriptorSets(m_device, 3, writes, 0, nullptr);
+
+	VmaAllocator allocator = engine.m_allocator;
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+			for (const VkFramebuffer framebuffer : m_framebuffers)
+				vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			vkDestroyImageView(m_device, m_albedoMetallicView, nullptr);
+			vkDestroyImageView(m_device, m_normalRoughnessView, nullptr);
+			vmaDestroyImage(allocator, m_albedoMetallic.image, m_albedoMetallic.allocation);
+			vmaDestroyImage(allocator, m_normalRoughness.image, m_normalRoughness.allocation);
+		});
+}
+
+void DeferredRenderer::initPipelines(VulkanEngine& engine, const VkShaderModule fullscreenVertShader, const VkShaderModule lightingFragShader,
+	const VkShaderModule sampledLightingFragShader, const LightSampler& lightSampler)
+{
+	const VkDescriptorSetLayout setLayouts[] = { engine.m_globalSetLayout, engine.m_objectSetLayout, m_setLayout, lightSampler.getSetLayout() };
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 3;
+	layoutInfo.pSetLayouts = setLayouts;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	//a single triangle covering the screen, generated from the vertex index
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.m_vertexInputInfo = vkinit::vertexInputStateCreateInfo();
+	pipelineBuilder.m_inputAssembly = vkinit::inputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+	pipelineBuilder.m_viewport = { 0.f, 0.f, static_cast<float>(engine.m_windowExtent.width), static_cast<float>(engine.m_windowExtent.height), 0.f, 1.f };
+	pipelineBuilder.m_scissor = { { 0, 0 }, engine.m_windowExtent };
+	pipelineBuilder.m_rasterizer = vkinit::rasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.m_rasterizer.cullMode = VK_CULL_MODE_NONE;
+	pipelineBuilder.m_multisampling = vkinit::multisamplingStateCreateInfo();
+	pipelineBuilder.m_colorBlendAttachment = vkinit::colorBlendAttachementState();
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(false, false, VK_COMPARE_OP_ALWAYS);
+	pipelineBuilder.m_pipelineLayout = m_pipelineLayout;
+	pipelineBuilder.m_subpass = LIGHTING_SUBPASS;
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, fullscreenVertShader));
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, lightingFragShader));
+	m_pipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+
+	//the reservoirs are written from the fragment shader
+	if (lightSampler.isSupported())
+	{
+		layoutInfo.setLayoutCount = 4;
+		VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_sampledPipelineLayout));
+		pipelineBuilder.m_pipelineLayout = m_sampledPipelineLayout;
+		pipelineBuilder.m_shaderStages[1] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, sampledLightingFragShader);
+		m_sampledPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+			if (m_sampledPipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(m_device, m_sampledPipeline, nullptr);
+				vkDestroyPipelineLayout(m_device, m_sampledPipelineLayout, nullptr);
+			}
+		});
+}
+
+void DeferredRenderer::recordLighting(const VkCommandBuffer cmd, const VkDescriptorSet globalSet, const uint32_t globalOffset, const VkDescriptorSet objectSet,
+	const VkDescriptorSet samplingSet) const
+{
+	const bool sampled = samplingSet != VK_NULL_HANDLE && m_sampledPipeline != VK_NULL_HANDLE;
+	const VkPipelineLayout layout = sampled ? m_sampledPipelineLayout : m_pipelineLayout;
+
+	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, sampled ? m_sampledPipeline : m_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &globalSet, 1, &globalOffset);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &objectSet, 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &m_set, 0, nullptr);
+	if (sampled)
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 3, 1, &samplingSet, 0, nullptr);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_light_sampling.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+// Deferred shading in a single render pass of two subpasses. The geometry subpass writes the G-buffer, the lighting
+// subpass reads it back as input attachments and evaluates the GGX BRDF of tri_mesh.frag once per pixel, with the
+// clustered lights. Tiled GPUs keep the G-buffer in tile memory: it is never stored, its images are transient.
+// The pass leaves the swapchain image and the depth in the layouts the load render pass starts from.
+class DeferredRenderer
+{
+public:
+	static constexpr uint32_t GEOMETRY_SUBPASS = 0;
+	static constexpr uint32_t LIGHTING_SUBPASS = 1;
+	// the geometry subpass writes both, rgb the albedo and a the metallic, xyz the normal and w the roughness
+	static constexpr VkFormat ALBEDO_METALLIC_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+	static constexpr VkFormat NORMAL_ROUGHNESS_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+	static constexpr uint32_t GBUFFER_COLOR_COUNT = 2;
+	// the swapchain image, the depth and the G-buffer
+	static constexpr uint32_t ATTACHMENT_COUNT = 4;
+
+	// creates the G-buffer, the render pass and one framebuffer per swapchain image. The depth image must have the
+	// input attachment usage
+	void init(VulkanEngine& engine);
+	// the full screen lighting pipelines, their first two sets are the global and object sets of the engine. The sampled
+	// variant adds the set of the light sampler, it is only built when the sampler is supported
+	void initPipelines(VulkanEngine& engine, VkShaderModule fullscreenVertShader, VkShaderModule lightingFragShader,
+		VkShaderModule sampledLightingFragShader, const LightSampler& lightSampler);
+
+	// moves to the lighting subpass and draws it, recorded inline in the primary command buffer. With a sampling set
+	// the lights are sampled instead of all being shaded
+	void recordLighting(VkCommandBuffer cmd, VkDescriptorSet globalSet, uint32_t globalOffset, VkDescriptorSet objectSet,
+		VkDescriptorSet samplingSet = VK_NULL_HANDLE) const;
+
+	VkRenderPass getRenderPass() const { return m_renderPass; }
+	VkFramebuffer getFramebuffer(uint32_t swapchainImageIndex) const { return m_framebuffers[swapchainImageIndex]; }
+
+private:
+	void createAttachment(VulkanEngine& engine, VkFormat format, AllocatedImage& image, VkImageView& view) const;
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+
+	AllocatedImage m_albedoMetallic{};
+	AllocatedImage m_normalRoughness{};
+	VkImageView m_albedoMetallicView{ VK_NULL_HANDLE };
+	VkImageView m_normalRoughnessView{ VK_NULL_HANDLE };
+
+	VkRenderPass m_renderPass{ VK_NULL_HANDLE };
+	std::vector<VkFramebuffer> m_framebuffers;
+
+	// the G-buffer and the depth as input attachments of the lighting subpass
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	VkDescriptorSet m_set{ VK_NULL_HANDLE };
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_pipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout m_sampledPipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_sampledPipeline{ VK_NULL_HANDLE };
+};
@@ -0,0 +1,197 @@
+#include "vk_depth_pyramid.h"
+
+#include <algorithm>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+
+namespace
+{
+	constexpr uint32_t REDUCE_GROUP_SIZE = 16;
+
+	struct ReduceConstants
+	{
+		glm::ivec2 inputSize;
+		glm::ivec2 outputSize;
+	};
+}
+
+void DepthPyramid::init(VulkanEngine& engine)
+{
+	m_device = engine.m_device;
+	m_depthImage = engine.m_depthImage.image;
+	m_depthExtent = engine.m_windowExtent;
+
+	//each level halves the previous one, rounding up so that the last row and column are always covered
+	m_levelExtents.clear();
+	VkExtent2D extent = { std::max(1u, (m_depthExtent.width + 1) / 2), std::max(1u, (m_depthExtent.height + 1) / 2) };
+	m_levelExtents.push_back(extent);
+	while (extent.width > 1 || extent.height > 1)
+	{
+		extent = { (extent.width + 1) / 2, (extent.height + 1) / 2 };
+		m_levelExtents.push_back(extent);
+	}
+	m_levelCount = static_cast<uint32_t>(m_levelExtents.size());
+
+	VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, { m_levelExtents[0].width, m_levelExtents[0].height, 1 });
+	imageInfo.mipLevels = m_levelCount;
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(engine.m_allocator, &imageInfo, &allocInfo, &m_image.image, &m_image.allocation, nullptr));
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(VK_FORMAT_R32_SFLOAT, m_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = m_levelCount;
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &m_view));
+
+	m_levelViews.resize(m_levelCount);
+	for (uint32_t level = 0; level < m_levelCount; level++)
+	{
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+		VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &m_levelViews[level]));
+	}
+
+	VkSamplerCreateInfo samplerInfo = vkinit::samplerCreateInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler));
+
+	//the pyramid stays in the general layout, written as storage and read through the sampler. The late culling
+	//only reads it after the build of its frame, its content before the first build does not matter
+	engine.immediateSubmit([&](const VkCommandBuffer cmd)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.image = m_image.image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_levelCount, 0, 1 };
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		});
+
+	const VkDescriptorSetLayoutBinding bindings[] = {
+		vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)
+	};
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = 2;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(m_levelCount);
+	const std::vector<VkDescriptorSetLayout> layouts(m_levelCount, m_setLayout);
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = engine.m_descriptorPool;
+	setAllocInfo.descriptorSetCount = m_levelCount;
+	setAllocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &setAllocInfo, m_sets.data()));
+
+	for (uint32_t level = 0; level < m_levelCount; level++)
+	{
+		VkDescriptorImageInfo inputInfo;
+		inputInfo.sampler = m_sampler;
+		inputInfo.imageView = level == 0 ? engine.m_depthImageView : m_levelViews[level - 1];
+		inputInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo outputInfo;
+		outputInfo.sampler = VK_NULL_HANDLE;
+		outputInfo.imageView = m_levelViews[level];
+		outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		const VkWriteDescriptorSet writes[] = {
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_sets[level], &inputInfo, 0),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_sets[level], &outputInfo, 1)
+		};
+		vkUpdateDescriptorSets(m_device, 2, writes, 0, nullptr);
+	}
+
+	VmaAllocator allocator = engine.m_allocator;
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+			vkDestroySampler(m_device, m_sampler, nullptr);
+			for (const VkImageView view : m_levelViews)
+				vkDestroyImageView(m_device, view, nullptr);
+			vkDestroyImageView(m_device, m_view, nullptr);
+			vmaDestroyImage(allocator, m_image.image, m_image.allocation);
+		});
+}
+
+void DepthPyramid::initPipelines(VulkanEngine& engine, const VkShaderModule reduceShader)
+{
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(ReduceConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_setLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, reduceShader);
+	pipelineInfo.layout = m_pipelineLayout;
+	VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_pipeline));
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		});
+}
+
+void DepthPyramid::build(const VkCommandBuffer cmd) const
+{
+	VkImageMemoryBarrier depthBarrier = {};
+	depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	depthBarrier.image = m_depthImage;
+	depthBarrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+	depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	//the previous readers of the pyramid, the late culling of the last frame, are done before it is overwritten
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+
+	VkMemoryBarrier levelBarrier{};
+	levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkExtent2D inputExtent = m_depthExtent;
+	for (uint32_t level = 0; level < m_levelCount; level++)
+	{
+		const VkExtent2D outputExtent = m_levelExtents[level];
+		const ReduceConstants constants = {
+			{ static_cast<int>(inputExtent.width), static_cast<int>(inputExtent.height) },
+			{ static_cast<int>(outputExtent.width), static_cast<int>(outputExtent.height) }
+		};
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_sets[level], 0, nullptr);
+		vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReduceConstants), &constants);
+		vkCmdDispatch(cmd, (outputExtent.width + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, (outputExtent.height + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+
+		//the next level, or the culling after the last one, reads what was just written
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+		inputExtent = outputExtent;
+	}
+
+	//back to the attachment layout for the late draws, which load the depth of the early ones
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+}
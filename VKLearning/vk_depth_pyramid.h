@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+// Max reduction of the depth buffer: level 0 is half its resolution and every texel keeps the farthest depth of the
+// texels it covers, down to 1x1. A sphere whose nearest depth is behind the pyramid texels covering its
+// screen bounds is hidden, a few fetches at the right level are enough to know it.
+class DepthPyramid
+{
+public:
+	// creates the pyramid for the engine depth image, which must have the sampled usage
+	void init(VulkanEngine& engine);
+	void initPipelines(VulkanEngine& engine, VkShaderModule reduceShader);
+
+	// reduces the depth image, recorded outside of a render pass. The depth image is in the depth attachment
+	// layout before and after, the pyramid is ready for the compute shaders once it returns
+	void build(VkCommandBuffer cmd) const;
+
+	// view over every level, in the general layout
+	VkImageView getView() const { return m_view; }
+	// nearest, clamped sampler for texelFetch
+	VkSampler getSampler() const { return m_sampler; }
+	uint32_t getLevelCount() const { return m_levelCount; }
+
+private:
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VkImage m_depthImage{ VK_NULL_HANDLE };
+	VkExtent2D m_depthExtent{};
+
+	AllocatedImage m_image{};
+	VkImageView m_view{ VK_NULL_HANDLE };
+	VkSampler m_sampler{ VK_NULL_HANDLE };
+	uint32_t m_levelCount{ 0 };
+	std::vector<VkExtent2D> m_levelExtents;
+	// one view and one set per level, each set reads the previous level (the depth image for level 0)
+	std::vector<VkImageView> m_levelViews;
+	std::vector<VkDescriptorSet> m_sets;
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_pipeline{ VK_NULL_HANDLE };
+};
@@ -19,20 +19,31 @@
 
 #include "vk_pipeline.h"
 #include "glm/gtx/transform.hpp"
+#include "glm/gtc/constants.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <random>
 
 #include "vk_textures.h"
+#include "vk_pack.h"
 
 #include <imgui.h>
 #include <imgui_impl_vulkan.h>
 #include <imgui_impl_sdl.h>
 
 #include "vk_ui.h"
+#include "vk_hash.h"
 
 constexpr unsigned int TIMEOUT = 1000000000;
 constexpr unsigned int MAX_OBJECTS = 20000;
+static_assert(MAX_OBJECTS <= VisibilityRenderer::MAX_OBJECT_SLOTS, "every object slot must fit in a visibility id");
 constexpr unsigned int MAX_LIGHTS = 20000;
+//control points of every light path together
+constexpr unsigned int MAX_LIGHT_KEYFRAMES = 1 << 16;
+constexpr VkDeviceSize CLUSTER_BUFFER_SIZE = sizeof(GPUClusterGrid) + sizeof(glm::uvec2) * LightClusterer::CLUSTER_COUNT;
+//below this many batches a chunk is not worth its own secondary command buffer
+constexpr uint32_t MIN_BATCHES_PER_CHUNK = 128;
 
 typedef std::chrono::high_resolution_clock Clock;
 
@@ -52,6 +63,12 @@ void VulkanEngine::init()
 		window_flags
 	);
 
+	//packed assets take precedence over the loose files of the same directory
+	vkutil::mountPack(std::string("../assets") + vkutil::PACK_EXTENSION, "../assets");
+	vkutil::mountPack(std::string("../CompiledShaders") + vkutil::PACK_EXTENSION, "../CompiledShaders");
+	m_fileReader.init();
+	m_jobSystem.init();
+
 	initVulkan();
 	initSwapchain();
 	initDefaultRenderpass();
@@ -80,6 +97,13 @@ void VulkanEngine::cleanup()
 	{
 		vkDeviceWaitIdle(m_device);
 
+		//loads still in flight own fences and staging buffers, let them finish first
+		while (m_scheduler.getActiveTaskCount() > 0)
+		{
+			m_fileReader.poll();
+			m_scheduler.tick();
+		}
+
 		m_mainDeletionQueue.flush();
 		vmaDestroyAllocator(m_allocator);
 
@@ -92,6 +116,9 @@ void VulkanEngine::cleanup()
 
 		SDL_DestroyWindow(m_window);
 	}
+	m_jobSystem.cleanup();
+	m_fileReader.cleanup();
+	vkutil::unmountPacks();
 }
 
 void VulkanEngine::run()
@@ -116,6 +143,10 @@ void VulkanEngine::run()
 			alive = processInput(&e);
 		}
 
+		//resumes the loads whose read, parse or upload completed
+		m_fileReader.poll();
+		m_scheduler.tick();
+
 		VulkanUI::updateImGui(this);
 
 		draw();
@@ -198,9 +229,33 @@ void VulkanEngine::draw()
 	ImGui::Render();
 	VK_CHECK(vkWaitForFences(m_device, 1, &getCurrentFrame().renderFence, true, TIMEOUT));
 	VK_CHECK(vkResetFences(m_device, 1, &getCurrentFrame().renderFence));
+	readFrameTimestamps();
+
+	//the secondary command buffers of this frame are done executing as well
+	for (SecondaryCommands& secondary : getCurrentFrame().secondaryCommands)
+	{
+		VK_CHECK(vkResetCommandPool(m_device, secondary.pool, 0));
+		secondary.usedCount = 0;
+	}
 
 	uint32_t swapchainImageIndex;
 	VK_CHECK(vkAcquireNextImageKHR(m_device, m_swapchain, TIMEOUT, getCurrentFrame().presentSemaphore, VK_NULL_HANDLE, &swapchainImageIndex));
+	//the deferred and visibility buffer paths draw the geometry in their own pass, the UI always ends in the main one
+	const ShadingPath shadingPath = m_shadingPath;
+	const bool deferred = shadingPath == ShadingPath::Deferred;
+	const bool visibility = shadingPath == ShadingPath::VisibilityBuffer;
+	m_currentRenderPass = m_renderPass;
+	m_currentFramebuffer = m_framebuffers[swapchainImageIndex];
+	if (deferred)
+	{
+		m_currentRenderPass = m_deferredRenderer.getRenderPass();
+		m_currentFramebuffer = m_deferredRenderer.getFramebuffer(swapchainImageIndex);
+	}
+	else if (visibility)
+	{
+		m_currentRenderPass = m_visibilityRenderer.getRenderPass();
+		m_currentFramebuffer = m_visibilityRenderer.getFramebuffer(swapchainImageIndex);
+	}
 
 	VK_CHECK(vkResetCommandBuffer(getCurrentFrame().mainCommandBuffer, 0));
 
@@ -216,27 +271,206 @@ void VulkanEngine::draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	const uint32_t firstTimestamp = static_cast<uint32_t>(m_frameNumber % FRAME_OVERLAP) * 2;
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(cmd, m_timestampQueryPool, firstTimestamp, 2);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampQueryPool, firstTimestamp);
+	}
+
 	VkClearValue clearValue{};
 	clearValue.color = { { 0.01f, 0.01f, 0.01f, 1.0f } };
 
 	VkClearValue depthClear;
 	depthClear.depthStencil.depth = 1.f;
 
+	//the id of the background, the other passes have no third attachment to clear
+	VkClearValue idClear{};
+
 	//start the main renderpass.
-	VkRenderPassBeginInfo rpInfo = vkinit::renderpassBeginInfo(m_renderPass, m_windowExtent, m_framebuffers[swapchainImageIndex]);
+	VkRenderPassBeginInfo rpInfo = vkinit::renderpassBeginInfo(m_currentRenderPass, m_windowExtent, m_currentFramebuffer);
 
 	//connect clear values
-	rpInfo.clearValueCount = 2;
-	const VkClearValue clearValues[] = { clearValue, depthClear };
+	rpInfo.clearValueCount = 3;
+	const VkClearValue clearValues[] = { clearValue, depthClear, idClear };
 	rpInfo.pClearValues = &clearValues[0];
 
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+	uploadFrameData();
+	const glm::mat4 view = m_camera.getViewMatrix();
+	const glm::mat4 projection = m_camera.getProjectionMatrix(ASPECT_RATIO);
+	const auto frameIndex = static_cast<uint32_t>(m_frameNumber % FRAME_OVERLAP);
+
+	//the visible lights are evaluated at the time of the frame before anything shades with them
+	m_lightAnimator.recordAnimation(cmd, frameIndex, deltaTime / 1000.f, m_visibleLights);
+
+	//the static casters are cached per cascade, only the dynamic ones are drawn every frame
+	m_shadows.update(m_jobSystem, frameIndex, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), view, projection,
+		m_sceneParameters.lightDirection, m_staticSceneVersion);
+	m_shadows.record(cmd, frameIndex);
+
+	//a few stale faces of the point light cubes are rendered per frame, the others keep their content
+	m_pointShadows.update(m_jobSystem, frameIndex, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_lightAnimator,
+		m_visibleLights, view, projection, m_windowExtent, m_staticSceneVersion);
+	m_pointShadows.record(cmd, frameIndex);
+
+	//the compute culling runs before the render pass, its draws only cost a few calls per mesh and material
+	//the ids of the visibility buffer are only written from the render queue, where every object draws its full mesh
+	const bool gpuDriven = m_gpuDriven && m_gpuCuller.isSupported() && !visibility;
+	if (gpuDriven)
+	{
+		//the instances hold the transforms and the groups the meshes, a static object or mesh changing makes them stale
+		if (m_gpuCuller.getSceneObjectCount() != m_renderables.size() || m_gpuCuller.getSceneVersion() != m_staticSceneVersion)
+		{
+			m_gpuCuller.buildScene(*this, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_staticSceneVersion);
+			invalidateRecordedCommands();
+		}
+		//the occlusion phases need to end the pass in between to build the pyramid, the subpasses of the deferred
+		//path can not be split, its early phase draws everything in the frustum
+		m_gpuCuller.recordEarlyCulling(cmd, frameIndex, view, projection, m_camera.getPosition(), !deferred);
+	}
+
+	//the sampled lighting reads the reservoirs the previous frame wrote
+	const bool sampledLights = deferred && m_lightSampler.m_enabled && m_lightSampler.isSupported();
+	if (sampledLights)
+		m_lightSampler.recordBarrier(cmd);
+
+	//everything inside the pass is recorded in secondary command buffers, the draws on several threads
+	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	m_passCommands.clear();
+	m_forwardCommands.clear();
+
+	if (gpuDriven)
+	{
+		//the indirect draws read the camera from its buffer and their counts from the culling, the same commands
+		//are replayed every frame until the scene changes. The frame fence guarantees they are not executing anymore
+		FrameData& frame = getCurrentFrame();
+		if (frame.cachedCommandsVersion != m_sceneVersion)
+		{
+			VK_CHECK(vkResetCommandPool(m_device, frame.cachedCommandPool, 0));
+
+			//no framebuffer, they are executed with whichever swapchain image was acquired. The load pass is
+			//compatible with the main one, the late draws inherit it as well
+			const VkCommandBufferInheritanceInfo inheritanceInfo = vkinit::commandBufferInheritanceInfo(m_currentRenderPass, 0);
+			const VkCommandBufferInheritanceInfo forwardInheritanceInfo = vkinit::commandBufferInheritanceInfo(m_renderPass, 0);
+			VkCommandBufferBeginInfo beginInfo = vkinit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
 
-	drawObjects(cmd, m_renderables.data(), m_renderables.size());
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+			const auto uniformOffset = static_cast<uint32_t>(padUniformBufferSize(sizeof(GPUSceneData)) * frameIndex);
+			for (uint32_t phase = 0; phase < GPUCuller::PHASE_COUNT; phase++)
+			{
+				//the deferred path has no late phase, that command buffer continues the load pass after the lighting
+				//with the early draws the G-buffer variants can not draw
+				const bool forward = deferred && phase == GPUCuller::PHASE_LATE;
+				beginInfo.pInheritanceInfo = forward ? &forwardInheritanceInfo : &inheritanceInfo;
+				VK_CHECK(vkBeginCommandBuffer(frame.cachedCommands[phase], &beginInfo));
+				if (forward)
+				{
+					m_gpuCuller.recordDraws(frame.cachedCommands[phase], GPUCuller::PHASE_EARLY, frameIndex, frame.globalDescriptor, uniformOffset, frame.objectDescriptor, IndirectDrawPipeline::Forward);
+				}
+				else if (deferred)
+				{
+					m_gpuCuller.recordDraws(frame.cachedCommands[phase], phase, frameIndex, frame.globalDescriptor, uniformOffset, frame.objectDescriptor, IndirectDrawPipeline::GBuffer);
+				}
+				else if (m_depthPrepass)
+				{
+					m_gpuCuller.recordDraws(frame.cachedCommands[phase], phase, frameIndex, frame.globalDescriptor, uniformOffset, frame.objectDescriptor, IndirectDrawPipeline::DepthPrepass);
+					m_gpuCuller.recordDraws(frame.cachedCommands[phase], phase, frameIndex, frame.globalDescriptor, uniformOffset, frame.objectDescriptor, IndirectDrawPipeline::DepthEqual);
+				}
+				else
+				{
+					m_gpuCuller.recordDraws(frame.cachedCommands[phase], phase, frameIndex, frame.globalDescriptor, uniformOffset, frame.objectDescriptor);
+				}
+				VK_CHECK(vkEndCommandBuffer(frame.cachedCommands[phase]));
+			}
+
+			frame.cachedCommandsVersion = m_sceneVersion;
+			m_cachedCommandsRecordCount++;
+		}
+
+		if (deferred)
+		{
+			m_passCommands.push_back(frame.cachedCommands[GPUCuller::PHASE_EARLY]);
+			m_forwardCommands.push_back(frame.cachedCommands[GPUCuller::PHASE_LATE]);
+		}
+		else
+		{
+			//the early draws write the depth the pyramid is reduced from, the late culling tests against it and
+			//what it finds visible is drawn in a second pass loading the attachments
+			vkCmdExecuteCommands(cmd, 1, &frame.cachedCommands[GPUCuller::PHASE_EARLY]);
+			vkCmdEndRenderPass(cmd);
+
+			m_depthPyramid.build(cmd);
+			m_gpuCuller.recordLateCulling(cmd, frameIndex);
+
+			rpInfo.renderPass = m_loadRenderPass;
+			vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			m_passCommands.push_back(frame.cachedCommands[GPUCuller::PHASE_LATE]);
+		}
+
+		//the materials without an indirect pipeline go through the render queue, only frustum culled
+		const std::vector<uint32_t>& skippedObjects = m_gpuCuller.getSkippedObjects();
+		if (!skippedObjects.empty())
+		{
+			m_frustumCuller.updateBounds(m_jobSystem, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_staticSceneVersion);
+			m_frustumCuller.cull(m_jobSystem, vkutil::extractFrustum(projection * view), m_visibleObjects);
+			m_visibleObjects.erase(std::remove_if(m_visibleObjects.begin(), m_visibleObjects.end(), [&](const uint32_t index)
+				{
+					return !std::binary_search(skippedObjects.begin(), skippedObjects.end(), index);
+				}), m_visibleObjects.end());
+			drawObjects(m_renderables.data(), m_visibleObjects.data(), m_visibleObjects.size(), m_passCommands);
+		}
+	}
+	else
+	{
+		//only what intersects the camera frustum reaches the render queue
+		const Frustum frustum = vkutil::extractFrustum(projection * view);
+		m_frustumCuller.updateBounds(m_jobSystem, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_staticSceneVersion);
+		m_frustumCuller.cull(m_jobSystem, frustum, m_visibleObjects);
+		//and of that, only what the occluders do not hide
+		m_occlusionCuller.cull(m_jobSystem, m_renderables.data(), projection * view, m_visibleObjects);
+		//the merged geometry is keyed by mesh, a mesh released or swapped at the same object count makes it stale
+		if (visibility && (m_visibilityRenderer.getSceneObjectCount() != m_renderables.size() || m_visibilityRenderer.getSceneVersion() != m_staticSceneVersion))
+			m_visibilityRenderer.buildScene(*this, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_staticSceneVersion);
+		drawObjects(m_renderables.data(), m_visibleObjects.data(), m_visibleObjects.size(), m_passCommands);
+	}
+
+	if (deferred || visibility)
+	{
+		//the geometry fills the G-buffer or the ids, the second subpass reads them back
+		vkCmdExecuteCommands(cmd, static_cast<uint32_t>(m_passCommands.size()), m_passCommands.data());
+		const auto uniformOffset = static_cast<uint32_t>(padUniformBufferSize(sizeof(GPUSceneData)) * frameIndex);
+		if (deferred)
+			m_deferredRenderer.recordLighting(cmd, getCurrentFrame().globalDescriptor, uniformOffset, getCurrentFrame().objectDescriptor,
+				sampledLights ? m_lightSampler.getSet(frameIndex) : VK_NULL_HANDLE);
+		else
+			m_visibilityRenderer.recordResolve(cmd, frameIndex, getCurrentFrame().globalDescriptor, uniformOffset, getCurrentFrame().objectDescriptor);
+		vkCmdEndRenderPass(cmd);
+
+		//the forward pipelines and the UI one are built for the main pass, they draw over the lit image in the
+		//compatible load pass, which loads the depth of the geometry subpass
+		m_passCommands.assign(m_forwardCommands.begin(), m_forwardCommands.end());
+		m_currentRenderPass = m_renderPass;
+		m_currentFramebuffer = m_framebuffers[swapchainImageIndex];
+		rpInfo.renderPass = m_loadRenderPass;
+		rpInfo.framebuffer = m_currentFramebuffer;
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	}
+
+	VkCommandBuffer uiCmd = beginSecondaryCommandBuffer();
+	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), uiCmd);
+	VK_CHECK(vkEndCommandBuffer(uiCmd));
+	m_passCommands.push_back(uiCmd);
+
+	vkCmdExecuteCommands(cmd, static_cast<uint32_t>(m_passCommands.size()), m_passCommands.data());
 	vkCmdEndRenderPass(cmd);
 	const auto end = std::chrono::high_resolution_clock::now();
 
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, firstTimestamp + 1);
+		getCurrentFrame().timestampsWritten = true;
+		getCurrentFrame().timestampsDepthPrepass = m_depthPrepass && shadingPath == ShadingPath::Forward;
+	}
+
 	//finalize the command buffer (we can no longer add commands, but it can now be executed)
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
@@ -327,8 +561,29 @@ void VulkanEngine::initVulkan()
 	featuresInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
 	featuresInfo.shaderDrawParameters = VK_TRUE;
 
-	vkb::Device vkbDevice = deviceBuilder.add_pNext(&featuresInfo).build().value();
+	//the GPU culling needs the instance counts of indirect draws, the draw count and multi draws are used when available
+	VkPhysicalDeviceVulkan12Features supported12Features = {};
+	supported12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supported12Features;
+	vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
+
+	VkPhysicalDeviceFeatures2 enabledFeatures = {};
+	enabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	enabledFeatures.features.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+	enabledFeatures.features.drawIndirectFirstInstance = supportedFeatures.features.drawIndirectFirstInstance;
+	//the sampled lighting writes its reservoirs from the fragment shader
+	enabledFeatures.features.fragmentStoresAndAtomics = supportedFeatures.features.fragmentStoresAndAtomics;
+
+	VkPhysicalDeviceVulkan12Features enabled12Features = {};
+	enabled12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	enabled12Features.drawIndirectCount = supported12Features.drawIndirectCount;
+
+	vkb::Device vkbDevice = deviceBuilder.add_pNext(&featuresInfo).add_pNext(&enabledFeatures).add_pNext(&enabled12Features).build().value();
 	m_gpuProperties = vkbDevice.physical_device.properties;
+	m_enabledFeatures = enabledFeatures.features;
+	m_drawIndirectCount = enabled12Features.drawIndirectCount;
 
 	// Get the VkDevice handle used in the rest of a Vulkan application
 	m_device = vkbDevice.device;
@@ -379,8 +634,9 @@ void VulkanEngine::initSwapchain()
 	//hardcoding the depth format to 32 bit float
 	m_depthFormat = VK_FORMAT_D32_SFLOAT;
 
-	//the depth image will be an image with the format we selected and Depth Attachment usage flag
-	VkImageCreateInfo dimgInfo = vkinit::imageCreateInfo(m_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
+	//the depth image will be an image with the format we selected and Depth Attachment usage flag,
+	//sampled as well by the reduction building the depth pyramid
+	VkImageCreateInfo dimgInfo = vkinit::imageCreateInfo(m_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, depthImageExtent);
 
 	//for the depth image, we want to allocate it from GPU local memory
 	VmaAllocationCreateInfo dimgAllocinfo = {};
@@ -426,14 +682,48 @@ void VulkanEngine::initCommands()
 
 	VK_CHECK(vkAllocateCommandBuffers(m_device, &cmdAllocInfo, &m_uploadContext.commandBuffer));
 
+	//async uploads allocate a short lived command buffer each
+	const VkCommandPoolCreateInfo asyncCommandPoolInfo = vkinit::commandPoolCreateInfo(m_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	VK_CHECK(vkCreateCommandPool(m_device, &asyncCommandPoolInfo, nullptr, &m_uploadContext.asyncCommandPool));
+
+	//each JobSystem thread records its secondary command buffers from its own pool, reset once per frame
+	const VkCommandPoolCreateInfo secondaryCommandPoolInfo = vkinit::commandPoolCreateInfo(m_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	for (auto& m_frame : m_frames)
+	{
+		m_frame.secondaryCommands.resize(m_jobSystem.getThreadCount());
+		for (SecondaryCommands& secondary : m_frame.secondaryCommands)
+			VK_CHECK(vkCreateCommandPool(m_device, &secondaryCommandPoolInfo, nullptr, &secondary.pool));
+
+		VK_CHECK(vkCreateCommandPool(m_device, &commandPoolInfo, nullptr, &m_frame.cachedCommandPool));
+		const VkCommandBufferAllocateInfo cachedAllocInfo = vkinit::commandBufferAllocateInfo(m_frame.cachedCommandPool, GPUCuller::PHASE_COUNT, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		VK_CHECK(vkAllocateCommandBuffers(m_device, &cachedAllocInfo, m_frame.cachedCommands));
+	}
 
 	m_mainDeletionQueue.push_function([=, this]() {
 		for (const auto& m_frame : m_frames)
 		{
 			vkDestroyCommandPool(m_device, m_frame.commandPool, nullptr);
+			for (const SecondaryCommands& secondary : m_frame.secondaryCommands)
+				vkDestroyCommandPool(m_device, secondary.pool, nullptr);
+			vkDestroyCommandPool(m_device, m_frame.cachedCommandPool, nullptr);
 		}
 		vkDestroyCommandPool(m_device, m_uploadContext.commandPool, nullptr);
+		vkDestroyCommandPool(m_device, m_uploadContext.asyncCommandPool, nullptr);
 		});
+
+	//two timestamps per frame, around its whole command buffer
+	if (m_gpuProperties.limits.timestampComputeAndGraphics)
+	{
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = FRAME_OVERLAP * 2;
+		VK_CHECK(vkCreateQueryPool(m_device, &queryPoolInfo, nullptr, &m_timestampQueryPool));
+
+		m_mainDeletionQueue.push_function([=, this]() {
+			vkDestroyQueryPool(m_device, m_timestampQueryPool, nullptr);
+			});
+	}
 }
 
 void VulkanEngine::initDefaultRenderpass()
@@ -505,9 +795,27 @@ void VulkanEngine::initDefaultRenderpass()
 	renderPassInfo.pDependencies = &dependencies[0];
 
 	VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass));
+
+	//same attachments loaded instead of cleared, the late draws of the occlusion culling continue the frame in it
+	VkAttachmentDescription loadAttachments[2] = { colorAttachement, depthAttachement };
+	loadAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	loadAttachments[0].initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	loadAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	loadAttachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	loadAttachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	renderPassInfo.pAttachments = &loadAttachments[0];
+
+	//the color of the first pass is read back by the load
+	dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_loadRenderPass));
 	m_mainDeletionQueue.push_function([=, this]()
 		{
 			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			vkDestroyRenderPass(m_device, m_loadRenderPass, nullptr);
 		});
 }
 
@@ -575,61 +883,87 @@ void VulkanEngine::initSyncStructures()
 
 bool VulkanEngine::loadShaderModule(const char* filePath, VkShaderModule* outShaderModule) const
 {
-	//open the file. With cursor at the end
-	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open())
+	//read the whole file, either from a mounted pack or from disk
+	vkutil::FileData fileData;
+	if (!vkutil::readFile(filePath, fileData))
 		return false;
 
-	//find what the size of the file is by looking up the location of the cursor
-	//because the cursor is at the end, it gives the size directly in bytes
-	const std::streamsize fileSize = file.tellg();
-
-	//spirv expects the buffer to be on uint32, so make sure to reserve an int vector big enough for the entire file
-	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-	file.seekg(0);
-	file.read(reinterpret_cast<char*>(buffer.data()), fileSize);
-	file.close();
+	return createShaderModule(filePath, fileData, outShaderModule);
+}
 
+bool VulkanEngine::createShaderModule(const char* name, const vkutil::FileData& code, VkShaderModule* outShaderModule) const
+{
 	//create a new shader module, using the buffer we loaded
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	createInfo.pNext = nullptr;
 
-	//codeSize has to be in bytes, so multiply the ints in the buffer by size of int to know the real size of the buffer
-	createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-	createInfo.pCode = buffer.data();
+	//spirv expects the buffer to be on uint32, pack entries and owned file data are both aligned enough
+	createInfo.codeSize = code.size() / sizeof(uint32_t) * sizeof(uint32_t);
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
 	//check that the creation goes well.
 	VkShaderModule shaderModule;
 	if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-		std::cout << "Error when building " << filePath << " shader module" << std::endl;
+		std::cout << "Error when building " << name << " shader module" << std::endl;
+		return false;
 	}
 	*outShaderModule = shaderModule;
-	std::cout << filePath << " successfully loaded" << std::endl;
+	std::cout << name << " successfully loaded" << std::endl;
 
 	return true;
 }
 
 void VulkanEngine::initPipelines()
 {
-	//compile mesh vertex shader
-	VkShaderModule meshVertShader, meshFragShader;
-	loadShaderModule("../CompiledShaders/tri_mesh.vert.spv", &meshVertShader);
-	loadShaderModule("../CompiledShaders/tri_mesh.frag.spv", &meshFragShader);
-
+	//every stage is read in a single batch
+	VkShaderModule meshVertShader{ VK_NULL_HANDLE }, meshFragShader{ VK_NULL_HANDLE }, indirectVertShader{ VK_NULL_HANDLE };
+	VkShaderModule cullShader{ VK_NULL_HANDLE }, compactShader{ VK_NULL_HANDLE }, reduceShader{ VK_NULL_HANDLE };
+	VkShaderModule depthVertShader{ VK_NULL_HANDLE }, depthIndirectVertShader{ VK_NULL_HANDLE };
+	VkShaderModule gbufferFragShader{ VK_NULL_HANDLE }, fullscreenVertShader{ VK_NULL_HANDLE }, lightingFragShader{ VK_NULL_HANDLE };
+	VkShaderModule visibilityVertShader{ VK_NULL_HANDLE }, visibilityFragShader{ VK_NULL_HANDLE }, resolveFragShader{ VK_NULL_HANDLE };
+	VkShaderModule sampledLightingFragShader{ VK_NULL_HANDLE }, animateLightsShader{ VK_NULL_HANDLE }, shadowDepthVertShader{ VK_NULL_HANDLE };
+	m_fileReader.submit({
+		{ "../CompiledShaders/tri_mesh.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("tri_mesh.vert", code, &meshVertShader); } },
+		{ "../CompiledShaders/tri_mesh.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("tri_mesh.frag", code, &meshFragShader); } },
+		{ "../CompiledShaders/tri_mesh_indirect.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("tri_mesh_indirect.vert", code, &indirectVertShader); } },
+		{ "../CompiledShaders/cull_instances.comp.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("cull_instances.comp", code, &cullShader); } },
+		{ "../CompiledShaders/compact_draws.comp.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("compact_draws.comp", code, &compactShader); } },
+		{ "../CompiledShaders/depth_reduce.comp.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("depth_reduce.comp", code, &reduceShader); } },
+		{ "../CompiledShaders/depth_only.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("depth_only.vert", code, &depthVertShader); } },
+		{ "../CompiledShaders/depth_only_indirect.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("depth_only_indirect.vert", code, &depthIndirectVertShader); } },
+		{ "../CompiledShaders/gbuffer.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("gbuffer.frag", code, &gbufferFragShader); } },
+		{ "../CompiledShaders/fullscreen.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("fullscreen.vert", code, &fullscreenVertShader); } },
+		{ "../CompiledShaders/deferred_lighting.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("deferred_lighting.frag", code, &lightingFragShader); } },
+		{ "../CompiledShaders/visibility.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("visibility.vert", code, &visibilityVertShader); } },
+		{ "../CompiledShaders/visibility.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("visibility.frag", code, &visibilityFragShader); } },
+		{ "../CompiledShaders/visibility_resolve.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("visibility_resolve.frag", code, &resolveFragShader); } },
+		{ "../CompiledShaders/deferred_lighting_sampled.frag.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("deferred_lighting_sampled.frag", code, &sampledLightingFragShader); } },
+		{ "../CompiledShaders/animate_lights.comp.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("animate_lights.comp", code, &animateLightsShader); } },
+		{ "../CompiledShaders/shadow_depth.vert.spv", false, [&](bool success, vkutil::FileData& code) {
+			if (success) createShaderModule("shadow_depth.vert", code, &shadowDepthVertShader); } },
+	});
+	m_fileReader.waitAll();
+
+	//the model matrices are read from the object buffer with the instance index, no push constants
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipelineLayoutCreateInfo();
 
-	//setup push constants
-	VkPushConstantRange push_constant;
-	push_constant.offset = 0;
-	push_constant.size = sizeof(MeshPushConstants);
-	push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	pipelineLayoutInfo.pPushConstantRanges = &push_constant;
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
-
 	VkDescriptorSetLayout setLayouts[] = { m_globalSetLayout, m_objectSetLayout};
 	pipelineLayoutInfo.setLayoutCount = 2;
 	pipelineLayoutInfo.pSetLayouts = setLayouts;
@@ -677,90 +1011,269 @@ void VulkanEngine::initPipelines()
 		vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader));
 
 	VkPipeline pipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
-	createMaterial(pipeline, pipelineLayout, "default");
+	Material* defaultMaterial = createMaterial(pipeline, pipelineLayout, "default");
+
+	//same material drawn from the GPU culling output, the instances and their visible ids are in the third set
+	VkDescriptorSetLayout indirectSetLayouts[] = { m_globalSetLayout, m_objectSetLayout, m_gpuCuller.getSetLayout() };
+	pipelineLayoutInfo.setLayoutCount = 3;
+	pipelineLayoutInfo.pSetLayouts = indirectSetLayouts;
+
+	VkPipelineLayout indirectPipelineLayout;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &indirectPipelineLayout));
+
+	pipelineBuilder.m_pipelineLayout = indirectPipelineLayout;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, indirectVertShader);
+	defaultMaterial->indirectPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	defaultMaterial->indirectPipelineLayout = indirectPipelineLayout;
+	VkPipeline indirectPipeline = defaultMaterial->indirectPipeline;
+
+	//the geometry subpass of the deferred path writes the surface to the G-buffer instead of shading it
+	pipelineBuilder.m_shaderStages[1] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, gbufferFragShader);
+	pipelineBuilder.m_colorAttachmentCount = DeferredRenderer::GBUFFER_COLOR_COUNT;
+	pipelineBuilder.m_subpass = DeferredRenderer::GEOMETRY_SUBPASS;
+	defaultMaterial->indirectGbufferPipeline = pipelineBuilder.buildPipeline(m_device, m_deferredRenderer.getRenderPass());
+	pipelineBuilder.m_pipelineLayout = pipelineLayout;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader);
+	defaultMaterial->gbufferPipeline = pipelineBuilder.buildPipeline(m_device, m_deferredRenderer.getRenderPass());
+	VkPipeline gbufferPipeline = defaultMaterial->gbufferPipeline;
+	VkPipeline indirectGbufferPipeline = defaultMaterial->indirectGbufferPipeline;
+
+	pipelineBuilder.m_colorAttachmentCount = 1;
+	pipelineBuilder.m_shaderStages[1] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragShader);
+	pipelineBuilder.m_pipelineLayout = indirectPipelineLayout;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, indirectVertShader);
+
+	//after a depth prepass, the shading only runs for the fragments that wrote the final depth
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(true, false, VK_COMPARE_OP_EQUAL);
+	defaultMaterial->indirectDepthEqualPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	pipelineBuilder.m_pipelineLayout = pipelineLayout;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader);
+	defaultMaterial->depthEqualPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	VkPipeline depthEqualPipeline = defaultMaterial->depthEqualPipeline;
+	VkPipeline indirectDepthEqualPipeline = defaultMaterial->indirectDepthEqualPipeline;
+
+	//the prepass reads the positions only and writes no color
+	pipelineBuilder.m_vertexInputInfo.pVertexAttributeDescriptions = &vertexDescription.attributes[0];
+	pipelineBuilder.m_vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	pipelineBuilder.m_colorBlendAttachment.colorWriteMask = 0;
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	pipelineBuilder.m_shaderStages.clear();
+	pipelineBuilder.m_shaderStages.push_back(
+		vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, depthVertShader));
+	m_depthPrepassPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	m_depthPrepassPipelineLayout = pipelineLayout;
+
+	pipelineBuilder.m_pipelineLayout = indirectPipelineLayout;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, depthIndirectVertShader);
+	VkPipeline indirectDepthPrepassPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+	m_gpuCuller.setDepthPrepassPipeline(indirectDepthPrepassPipeline, indirectPipelineLayout);
+
+	m_gpuCuller.initPipelines(*this, cullShader, compactShader);
+	m_depthPyramid.initPipelines(*this, reduceShader);
+	m_deferredRenderer.initPipelines(*this, fullscreenVertShader, lightingFragShader, sampledLightingFragShader, m_lightSampler);
+	m_visibilityRenderer.initPipelines(*this, visibilityVertShader, visibilityFragShader, fullscreenVertShader, resolveFragShader);
+	m_lightAnimator.initPipelines(*this, animateLightsShader);
+	m_shadows.initPipelines(*this, shadowDepthVertShader);
+	m_pointShadows.initPipelines(*this, shadowDepthVertShader);
 
 	//deleting all of the vulkan shaders
 	vkDestroyShaderModule(m_device, meshVertShader, nullptr);
 	vkDestroyShaderModule(m_device, meshFragShader, nullptr);
+	vkDestroyShaderModule(m_device, indirectVertShader, nullptr);
+	vkDestroyShaderModule(m_device, cullShader, nullptr);
+	vkDestroyShaderModule(m_device, compactShader, nullptr);
+	vkDestroyShaderModule(m_device, reduceShader, nullptr);
+	vkDestroyShaderModule(m_device, depthVertShader, nullptr);
+	vkDestroyShaderModule(m_device, depthIndirectVertShader, nullptr);
+	vkDestroyShaderModule(m_device, gbufferFragShader, nullptr);
+	vkDestroyShaderModule(m_device, fullscreenVertShader, nullptr);
+	vkDestroyShaderModule(m_device, lightingFragShader, nullptr);
+	vkDestroyShaderModule(m_device, visibilityVertShader, nullptr);
+	vkDestroyShaderModule(m_device, visibilityFragShader, nullptr);
+	vkDestroyShaderModule(m_device, resolveFragShader, nullptr);
+	vkDestroyShaderModule(m_device, sampledLightingFragShader, nullptr);
+	vkDestroyShaderModule(m_device, animateLightsShader, nullptr);
+	vkDestroyShaderModule(m_device, shadowDepthVertShader, nullptr);
 
 	//adding the pipelines to the deletion queue
 	m_mainDeletionQueue.push_function([=, this]()
 		{
 			vkDestroyPipeline(m_device, pipeline, nullptr);
 			vkDestroyPipelineLayout(m_device, pipelineLayout, nullptr);
+			vkDestroyPipeline(m_device, indirectPipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, indirectPipelineLayout, nullptr);
+			vkDestroyPipeline(m_device, depthEqualPipeline, nullptr);
+			vkDestroyPipeline(m_device, indirectDepthEqualPipeline, nullptr);
+			vkDestroyPipeline(m_device, m_depthPrepassPipeline, nullptr);
+			vkDestroyPipeline(m_device, indirectDepthPrepassPipeline, nullptr);
+			vkDestroyPipeline(m_device, gbufferPipeline, nullptr);
+			vkDestroyPipeline(m_device, indirectGbufferPipeline, nullptr);
 		});
 }
 
 void VulkanEngine::loadMeshes()
 {
-	Mesh sphere{};
-	sphere.loadFromObj("../assets/sphere.obj");
-	m_meshes["sphere"] = sphere;
+	//the cache owns the vertex and index buffers, destroy whatever is still referenced at shutdown
+	m_mainDeletionQueue.push_function([=, this]()
+		{
+			m_meshBufferCache.forEach([&](const MeshBuffers& buffers) {
+				vmaDestroyBuffer(m_allocator, buffers.vertexBuffer.buffer, buffers.vertexBuffer.allocation);
+				vmaDestroyBuffer(m_allocator, buffers.indexBuffer.buffer, buffers.indexBuffer.allocation);
+				});
+			m_meshBufferCache.clear();
+		});
 
-	//Mesh sphereGltf{};
-	//sphereGltf.loadFromGltf("../assets/sphere.glb");
-	//m_meshes["sphereGLTF"] = sphereGltf;
+	const std::pair<std::string, const char*> meshFiles[] = {
+		{ "sphere", "../assets/sphere.obj" },
+		//{ "sphereGLTF", "../assets/sphere.glb" },
+	};
 
-	uploadMesh(m_meshes["sphere"]);
+	//every mesh is read, parsed and uploaded concurrently, the scene needs all of them before it starts
+	std::vector<Task<Mesh*>> loads;
+	for (const auto& meshFile : meshFiles)
+		loads.push_back(loadMeshAsync(meshFile.first, meshFile.second));
+	m_scheduler.runUntilComplete(whenAll(std::move(loads)), [this] { m_fileReader.poll(); });
 }
 
-void VulkanEngine::uploadMesh(Mesh& mesh)
+Task<Mesh*> VulkanEngine::loadMeshAsync(std::string name, std::string file)
 {
-	const size_t bufferSize = mesh.m_vertices.size() * sizeof(Vertex);
+	//the cooked file from ../assets/cooked when the AssetCooker produced it
+	const std::string path = Mesh::getLoadPath(file.c_str());
+	vkutil::ReadResult read = co_await vkutil::readFileAsync(m_fileReader, path);
+
+	co_await vkutil::switchToWorker(m_jobSystem);
+	Mesh mesh{};
+	//an outdated cooked file goes through the synchronous path, which falls back to the source
+	bool loaded = read.success && mesh.loadFromMemory(path.c_str(), read.data);
+	if (!loaded)
+	{
+		mesh = Mesh{};
+		loaded = mesh.load(file.c_str());
+	}
 
-	//allocate vertex buffer
-	VkBufferCreateInfo stagingBufferInfo = {};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.pNext = nullptr;
-	stagingBufferInfo.size = bufferSize;
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	//the caches and the engine maps are only touched from the main thread
+	co_await m_scheduler.nextFrame();
+	if (!loaded)
+		co_return nullptr;
 
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	co_await uploadMeshAsync(mesh);
+	Mesh& uploaded = m_meshes[name] = std::move(mesh);
+	co_return &uploaded;
+}
 
-	AllocatedBuffer stagingBuffer = {};
+namespace
+{
+	void recordMeshCopy(const VkCommandBuffer cmd, const AllocatedBuffer& stagingBuffer, const Mesh& mesh)
+	{
+		const size_t vertexBufferSize = mesh.m_vertices.size() * sizeof(Vertex);
+		const size_t indexBufferSize = mesh.m_indices.size() * sizeof(uint32_t);
 
-	VK_CHECK(vmaCreateBuffer(m_allocator, &stagingBufferInfo, &vmaallocInfo,
-		&stagingBuffer.buffer,
-		&stagingBuffer.allocation,
-		nullptr));
+		VkBufferCopy copy;
+		copy.dstOffset = 0;
+		copy.srcOffset = 0;
+		copy.size = vertexBufferSize;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, mesh.m_vertexBuffer.buffer, 1, &copy);
 
-	void* data;
-	vmaMapMemory(m_allocator, stagingBuffer.allocation, &data);
-	memcpy(data, mesh.m_vertices.data(), mesh.m_vertices.size() * sizeof(Vertex));
-	vmaUnmapMemory(m_allocator, stagingBuffer.allocation);
+		copy.srcOffset = vertexBufferSize;
+		copy.size = indexBufferSize;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, mesh.m_indexBuffer.buffer, 1, &copy);
+	}
+}
 
-	//allocate vertex buffer
-	VkBufferCreateInfo vertexBufferInfo = {};
-	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferInfo.pNext = nullptr;
-	//this is the total size, in bytes, of the buffer we are allocating
-	vertexBufferInfo.size = bufferSize;
-	//this buffer is going to be used as a Vertex Buffer
-	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+void VulkanEngine::uploadMesh(Mesh& mesh)
+{
+	if (acquireMeshBuffers(mesh))
+		return;
 
-	//let the VMA library know that this data should be GPU native
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	AllocatedBuffer stagingBuffer = createMeshBuffers(mesh);
+	immediateSubmit([&](const VkCommandBuffer& cmd) { recordMeshCopy(cmd, stagingBuffer, mesh); });
 
-	//allocate the buffer
-	VK_CHECK(vmaCreateBuffer(m_allocator, &vertexBufferInfo, &vmaallocInfo,
-		&mesh.m_vertexBuffer.buffer,
-		&mesh.m_vertexBuffer.allocation,
-		nullptr));
+	m_meshBufferCache.insert(mesh.m_contentHash, { mesh.m_vertexBuffer, mesh.m_indexBuffer }, mesh.m_vertices.size() * sizeof(Vertex) + mesh.m_indices.size() * sizeof(uint32_t));
+	vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+}
 
-	immediateSubmit([=, this](const VkCommandBuffer& cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = bufferSize;
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, mesh.m_vertexBuffer.buffer, 1, &copy);
-		});
+Task<void> VulkanEngine::uploadMeshAsync(Mesh& mesh)
+{
+	if (acquireMeshBuffers(mesh))
+		co_return;
 
-	m_mainDeletionQueue.push_function([=, this]()
-		{
-			vmaDestroyBuffer(m_allocator, mesh.m_vertexBuffer.buffer, mesh.m_vertexBuffer.allocation);
-		});
+	AllocatedBuffer stagingBuffer = createMeshBuffers(mesh);
+	co_await submitUploadAsync([&](VkCommandBuffer cmd) { recordMeshCopy(cmd, stagingBuffer, mesh); });
 	vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+
+	//the same geometry may have been uploaded by another load meanwhile, keep a single copy
+	if (const MeshBuffers* cached = m_meshBufferCache.acquire(mesh.m_contentHash))
+	{
+		vmaDestroyBuffer(m_allocator, mesh.m_vertexBuffer.buffer, mesh.m_vertexBuffer.allocation);
+		vmaDestroyBuffer(m_allocator, mesh.m_indexBuffer.buffer, mesh.m_indexBuffer.allocation);
+		mesh.m_vertexBuffer = cached->vertexBuffer;
+		mesh.m_indexBuffer = cached->indexBuffer;
+		co_return;
+	}
+	m_meshBufferCache.insert(mesh.m_contentHash, { mesh.m_vertexBuffer, mesh.m_indexBuffer }, mesh.m_vertices.size() * sizeof(Vertex) + mesh.m_indices.size() * sizeof(uint32_t));
+}
+
+bool VulkanEngine::acquireMeshBuffers(Mesh& mesh)
+{
+	//meshes loaded from source files are not indexed, draw them with an identity index buffer
+	if (mesh.m_indices.empty())
+	{
+		mesh.m_indices.resize(mesh.m_vertices.size());
+		for (uint32_t i = 0; i < mesh.m_indices.size(); i++)
+			mesh.m_indices[i] = i;
+	}
+	mesh.computeBounds();
+	mesh.buildLods();
+
+	const size_t vertexBufferSize = mesh.m_vertices.size() * sizeof(Vertex);
+	const size_t indexBufferSize = mesh.m_indices.size() * sizeof(uint32_t);
+
+	//identical geometry, whatever its name or source file, shares a single pair of GPU buffers
+	mesh.m_contentHash = vkutil::hash64(mesh.m_indices.data(), indexBufferSize, vkutil::hash64(mesh.m_vertices.data(), vertexBufferSize));
+	if (const MeshBuffers* cached = m_meshBufferCache.acquire(mesh.m_contentHash))
+	{
+		mesh.m_vertexBuffer = cached->vertexBuffer;
+		mesh.m_indexBuffer = cached->indexBuffer;
+		return true;
+	}
+	return false;
+}
+
+AllocatedBuffer VulkanEngine::createMeshBuffers(Mesh& mesh)
+{
+	const size_t vertexBufferSize = mesh.m_vertices.size() * sizeof(Vertex);
+	const size_t indexBufferSize = mesh.m_indices.size() * sizeof(uint32_t);
+
+	//one staging buffer holds the vertices followed by the indices
+	AllocatedBuffer stagingBuffer = createBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+	char* data;
+	vmaMapMemory(m_allocator, stagingBuffer.allocation, reinterpret_cast<void**>(&data));
+	memcpy(data, mesh.m_vertices.data(), vertexBufferSize);
+	memcpy(data + vertexBufferSize, mesh.m_indices.data(), indexBufferSize);
+	vmaUnmapMemory(m_allocator, stagingBuffer.allocation);
+
+	//let the VMA library know that this data should be GPU native
+	mesh.m_vertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	mesh.m_indexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	return stagingBuffer;
+}
+
+// the GPU must be done with the mesh, the buffers are destroyed right away when it was the last user
+void VulkanEngine::releaseMesh(const std::string& name)
+{
+	const auto it = m_meshes.find(name);
+	if (it == m_meshes.end())
+		return;
+
+	MeshBuffers buffers;
+	if (m_meshBufferCache.release(it->second.m_contentHash, buffers))
+	{
+		vmaDestroyBuffer(m_allocator, buffers.vertexBuffer.buffer, buffers.vertexBuffer.allocation);
+		vmaDestroyBuffer(m_allocator, buffers.indexBuffer.buffer, buffers.indexBuffer.allocation);
+	}
+	m_meshes.erase(it);
+	invalidateStaticScene();
 }
 
 Material* VulkanEngine::createMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name)
@@ -769,6 +1282,7 @@ Material* VulkanEngine::createMaterial(VkPipeline pipeline, VkPipelineLayout lay
 	mat.pipeline = pipeline;
 	mat.pipelineLayout = layout;
 	m_materials[name] = mat;
+	invalidateRecordedCommands();
 	return &m_materials[name];
 }
 
@@ -790,6 +1304,7 @@ void VulkanEngine::initScene()
 	m_camera.setPosition({ 0.f, 0.f, 4.f });
 
 	m_sceneParameters.lightDirection = glm::vec4(10.f, 20.f, 10.f, 1.f);
+	m_sceneParameters.lightColor = glm::vec3(0.5f, 0.48f, 0.45f);
 	m_sceneParameters.lightNb = 1;
 	RenderObject sphere{};
 	sphere.mesh = getMesh("sphere");
@@ -797,18 +1312,59 @@ void VulkanEngine::initScene()
 	const glm::mat4 translation = glm::translate(glm::mat4{ 1.0 }, glm::vec3(0, 0.f, 0));
 	//const glm::mat4 scale = glm::scale(glm::mat4{ 1.0 }, glm::vec3(0.2, 0.2, 0.2));
 	sphere.transformMatrix = translation;
+	sphere.isStatic = true;
+	sphere.isOccluder = true;
 
 	m_renderables.push_back(sphere);
 
-	for (unsigned i = 0; i < 1000; ++i)
+	//the first light lights the whole scene, the others are small ones scattered around it
+	m_lightData.resize(MAX_LIGHTS);
+	m_lightData[0].position = glm::vec3(8., 8., 8.f);
+	m_lightData[0].color = glm::vec3(1.f, 1.f, 1.f);
+	m_lightData[0].intensity = 1.f;
+
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	for (unsigned i = 1; i < MAX_LIGHTS; ++i)
 	{
 		GPULightData light;
-		light.position = glm::vec3(8., 8., 8.f);
-		light.color = glm::vec3(1.f, 1.f, 1.f);
-		light.intensity = 1.f;
+		light.position = glm::vec3(unit(random) * 80.f - 40.f, unit(random) * 4.f - 1.f, unit(random) * 80.f - 40.f);
+		light.color = glm::vec3(unit(random), unit(random), unit(random));
+		light.intensity = 0.05f;
 		m_lightData[i] = light;
 	}
 
+	//most of the small lights move, the GPU evaluates them every frame from these descriptions
+	for (unsigned i = 0; i < MAX_LIGHTS; ++i)
+		m_lightAnimator.setLight(i, m_lightData[i]);
+	for (unsigned i = 1; i < MAX_LIGHTS; ++i)
+	{
+		const float phase = unit(random) * glm::two_pi<float>();
+		switch (i % 4)
+		{
+		case 1:
+			m_lightAnimator.setOrbit(i, glm::vec3(0.f, 1.f, 0.f), 0.5f + unit(random) * 1.5f, 0.5f + unit(random), phase);
+			break;
+		case 2:
+			m_lightAnimator.setFlicker(i, 0.8f, 4.f + unit(random) * 8.f, phase);
+			break;
+		case 3:
+		{
+			glm::vec3 offsets[4];
+			for (glm::vec3& offset : offsets)
+				offset = glm::vec3(unit(random) * 6.f - 3.f, unit(random) * 2.f - 1.f, unit(random) * 6.f - 3.f);
+			m_lightAnimator.setPath(i, offsets, 4, 0.05f + unit(random) * 0.1f, phase);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+
+	//static props sharing a material are drawn as a few world space chunks
+	m_staticBatcher.build(*this, m_renderables);
+	invalidateStaticScene();
 
 	//RenderObject map;
 	//map.mesh = getMesh("lostEmpire");
@@ -849,20 +1405,21 @@ void VulkanEngine::initScene()
 
 }
 
-void VulkanEngine::drawObjects(VkCommandBuffer cmd, const RenderObject* first, const size_t count)
+void VulkanEngine::uploadFrameData()
 {
-
 	GPUCameraData camData{};
 	camData.proj = m_camera.getProjectionMatrix(ASPECT_RATIO);
 	camData.view = m_camera.getViewMatrix();
 	camData.viewproj = camData.proj * camData.view;
 	camData.cameraPosition = glm::vec4(m_camera.getPosition(), 0.f);
+	camData.inverseViewproj = glm::inverse(camData.viewproj);
 
 	void* data;
 	vmaMapMemory(m_allocator, getCurrentFrame().cameraBuffer.allocation, &data);
 	memcpy(data, &camData, sizeof(GPUCameraData));
 	vmaUnmapMemory(m_allocator, getCurrentFrame().cameraBuffer.allocation);
 
+	m_sceneParameters.environment = m_environmentLighting.getSceneParameters();
 	char* sceneData;
 	vmaMapMemory(m_allocator, m_sceneParameterBuffer.allocation, reinterpret_cast<void**>(&sceneData));
 
@@ -871,62 +1428,276 @@ void VulkanEngine::drawObjects(VkCommandBuffer cmd, const RenderObject* first, c
 	memcpy(sceneData, &m_sceneParameters, sizeof(GPUSceneData));
 	vmaUnmapMemory(m_allocator, m_sceneParameterBuffer.allocation);
 
+	//the lights outside the frustum can not reach a visible fragment now that their range is finite. Their bounds
+	//cover the whole animation, they only change with the descriptions
+	const auto lightCount = static_cast<uint32_t>(std::clamp(m_sceneParameters.lightNb, 0, static_cast<int>(m_lightAnimator.getCapacity())));
+	m_bakedLighting.update(m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_lightAnimator, lightCount, m_staticSceneVersion);
+	if (m_lightBoundsVersion != m_lightAnimator.getBoundsVersion() || m_culledLightCount != lightCount)
+	{
+		m_lightCuller.updateBounds(m_jobSystem, m_lightAnimator.getBounds(), lightCount);
+		m_lightBoundsVersion = m_lightAnimator.getBoundsVersion();
+		m_culledLightCount = lightCount;
+	}
+	m_lightCuller.cull(m_jobSystem, vkutil::extractFrustum(camData.viewproj), m_visibleLights);
+	//the probes hold the baked lights already, with their shadows
+	m_bakedLighting.removeBakedLights(m_visibleLights);
+
+	//the reservoirs of the previous frame refer to its own compacted indices
+	const bool sampledLights = m_shadingPath == ShadingPath::Deferred && m_lightSampler.m_enabled;
+	m_lightSampler.update(static_cast<uint32_t>(frame_index), camData.viewproj, m_visibleLights, sampledLights);
+
+	//the light buffer is written by the animation shader, the clusters are built from the bounds
+	const GPULightData* lightBounds = m_lightAnimator.getBounds();
+	m_visibleLightData.resize(m_visibleLights.size());
+	for (size_t i = 0; i < m_visibleLights.size(); i++)
+		m_visibleLightData[i] = lightBounds[m_visibleLights[i]];
+
+	//the fragments only loop over the lights of their cluster
+	char* clusterData;
+	uint32_t* lightIndices;
+	vmaMapMemory(m_allocator, getCurrentFrame().clusterBuffer.allocation, reinterpret_cast<void**>(&clusterData));
+	vmaMapMemory(m_allocator, getCurrentFrame().lightIndexBuffer.allocation, reinterpret_cast<void**>(&lightIndices));
+	m_lightClusterer.build(m_jobSystem, camData.view, camData.proj, m_windowExtent, m_visibleLightData.data(), static_cast<uint32_t>(m_visibleLightData.size()),
+		reinterpret_cast<GPUClusterGrid*>(clusterData), reinterpret_cast<glm::uvec2*>(clusterData + sizeof(GPUClusterGrid)), lightIndices);
+	vmaUnmapMemory(m_allocator, getCurrentFrame().lightIndexBuffer.allocation);
+	vmaUnmapMemory(m_allocator, getCurrentFrame().clusterBuffer.allocation);
+}
+
+void VulkanEngine::drawObjects(const RenderObject* objects, const uint32_t* visible, const size_t visibleCount, std::vector<VkCommandBuffer>& outCommands)
+{
+	const int frame_index = static_cast<int>(static_cast<uint64_t>(m_frameNumber) % FRAME_OVERLAP);
+
 	void* object_data;
 	vmaMapMemory(m_allocator, getCurrentFrame().objectBuffer.allocation, &object_data);
 
-	const auto objectSSBO = static_cast<GPUObjectData*>(object_data);
-
-	const glm::vec3 forward = { 0.f,0.f, 1.0f };
-	for (unsigned i = 0; i < count; i++)
+	//the culling already dropped the objects without a mesh or a material, the object buffer holds MAX_OBJECTS transforms
+	m_renderQueue.clear();
+	const glm::vec3 cameraPosition = m_camera.getPosition();
+	const glm::vec3 cameraFront = m_camera.getFront();
+	for (size_t i = 0; i < visibleCount && i < MAX_OBJECTS; i++)
 	{
-		objectSSBO[i].modelMatrix = first[i].transformMatrix;
+		const RenderObject& object = objects[visible[i]];
+		m_renderQueue.push(visible[i], object, glm::dot(glm::vec3(object.transformMatrix[3]) - cameraPosition, cameraFront));
 	}
+	m_renderQueue.build(objects, static_cast<GPUObjectData*>(object_data));
 
 	vmaUnmapMemory(m_allocator, getCurrentFrame().objectBuffer.allocation);
 
-	void* lightData;
-	vmaMapMemory(m_allocator, getCurrentFrame().lightBuffer.allocation, &lightData);
-	memcpy(lightData, &m_lightData, sizeof(GPULightData) * m_sceneParameters.lightNb);
-	vmaUnmapMemory(m_allocator, getCurrentFrame().lightBuffer.allocation);
+	//the resolve finds the mesh of a pixel from the object slot in its id
+	const bool visibility = m_shadingPath == ShadingPath::VisibilityBuffer;
+	if (visibility)
+		m_visibilityRenderer.writeObjectMeshes(frame_index, m_renderQueue.getBatches());
+
+	//the sorted batches are split in about two chunks per thread, each recorded into its own secondary command buffer
+	const Clock::time_point recordStart = Clock::now();
+	const std::vector<DrawBatch>& batches = m_renderQueue.getBatches();
+	const auto batchCount = static_cast<uint32_t>(batches.size());
+	const uint32_t chunkTarget = m_jobSystem.getThreadCount() * 2;
+	const uint32_t chunkSize = std::max(MIN_BATCHES_PER_CHUNK, (batchCount + chunkTarget - 1) / chunkTarget);
+	const uint32_t chunkCount = (batchCount + chunkSize - 1) / chunkSize;
+	//with the depth prepass each chunk records its depth only draws as well, all of them run before the shading.
+	//The deferred and visibility buffer paths shade once per pixel already, they need none. Their chunks record
+	//the batches the geometry subpass can not draw instead, textured or transparent, shaded forward after the lighting
+	const bool deferred = m_shadingPath == ShadingPath::Deferred;
+	const bool depthPrepass = m_depthPrepass && m_shadingPath == ShadingPath::Forward;
+	const bool forwardAfterLighting = deferred || visibility;
+	m_drawChunkCommands.resize(depthPrepass || forwardAfterLighting ? chunkCount * 2 : chunkCount);
+
+	const auto uniformOffset = static_cast<uint32_t>(padUniformBufferSize(sizeof(GPUSceneData)) * frame_index);
+	const VkDescriptorSet globalDescriptor = getCurrentFrame().globalDescriptor;
+	const VkDescriptorSet objectDescriptor = getCurrentFrame().objectDescriptor;
+
+	//drawn by the geometry subpass of the deferred or visibility buffer path
+	const auto isDeferred = [&](const DrawBatch& batch)
+		{
+			if (visibility)
+				return m_visibilityRenderer.canDraw(batch);
+			return batch.pass == DrawPass::Opaque && batch.material->gbufferPipeline != VK_NULL_HANDLE;
+		};
 
-	const Mesh* lastMesh = nullptr;
-	const Material* lastMaterial = nullptr;
-	for (unsigned i = 0; i < count; i++)
-	{
-		const RenderObject& object = first[i];
+	//the depth prepass and the ids of the visibility buffer bind a single pipeline, the batches only differ by their mesh
+	const auto recordPositionOnly = [&](const VkPipeline pipeline, const VkPipelineLayout layout, const uint32_t begin, const uint32_t end, const auto& accepts)
+		{
+			VkCommandBuffer cmd = beginSecondaryCommandBuffer();
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &globalDescriptor, 1, &uniformOffset);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &objectDescriptor, 0, nullptr);
 
-		if (!object.material || !object.mesh)
-			break;
+			const Mesh* boundMesh = nullptr;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const DrawBatch& batch = batches[i];
+				if (!accepts(batch))
+					continue;
+
+				if (batch.mesh != boundMesh)
+				{
+					boundMesh = batch.mesh;
+					VkDeviceSize offset = 0;
+					vkCmdBindVertexBuffers(cmd, 0, 1, &batch.mesh->m_vertexBuffer.buffer, &offset);
+					vkCmdBindIndexBuffer(cmd, batch.mesh->m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+				}
+				vkCmdDrawIndexed(cmd, batch.mesh->m_lods[0].indexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+			}
 
-		//only bind the pipeline if it doesn't match with the already bound one
-		if (object.material != lastMaterial)
+			VK_CHECK(vkEndCommandBuffer(cmd));
+			return cmd;
+		};
+
+	//the batches with the pipelines of their material. afterLighting records the ones the geometry subpass skips,
+	//continuing the load pass the UI is drawn in, which the main pass is compatible with
+	const auto recordShaded = [&](const uint32_t begin, const uint32_t end, const bool afterLighting)
 		{
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-			lastMaterial = object.material;
-
-			auto uniformOffset = static_cast<uint32_t>(padUniformBufferSize(sizeof(GPUSceneData)) * frame_index);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 0, 1, &getCurrentFrame().globalDescriptor, 1, &uniformOffset);
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 1, 1, &getCurrentFrame().objectDescriptor, 0, nullptr);
-			if (object.material->textureSet != VK_NULL_HANDLE)
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 2, 1, &object.material->textureSet, 0, nullptr);
-		}
+			VkCommandBuffer cmd = afterLighting ? beginSecondaryCommandBuffer(m_renderPass, VK_NULL_HANDLE) : beginSecondaryCommandBuffer();
+
+			//a chunk starts with nothing bound
+			const DrawBatch* previous = nullptr;
+			VkPipeline boundPipeline = VK_NULL_HANDLE;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const DrawBatch& batch = batches[i];
+				//the opaque batches drawn by the prepass are shaded with its equal variant. In the deferred and visibility
+				//buffer paths a batch is drawn either by the geometry subpass or after the lighting
+				VkPipeline pipeline = batch.material->pipeline;
+				if (forwardAfterLighting)
+				{
+					if (isDeferred(batch) == afterLighting)
+						continue;
+					if (!afterLighting)
+						pipeline = batch.material->gbufferPipeline;
+				}
+				else if (depthPrepass && batch.pass == DrawPass::Opaque && batch.material->depthEqualPipeline != VK_NULL_HANDLE)
+				{
+					pipeline = batch.material->depthEqualPipeline;
+				}
+
+				//only bind what doesn't match with the already bound state
+				const uint32_t changes = RenderQueue::getStateChanges(previous, batch);
+				previous = &batch;
+				if (pipeline != boundPipeline)
+				{
+					boundPipeline = pipeline;
+					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				}
+
+				if (changes & STATE_CHANGE_FRAME_SETS)
+				{
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.material->pipelineLayout, 0, 1, &globalDescriptor, 1, &uniformOffset);
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.material->pipelineLayout, 1, 1, &objectDescriptor, 0, nullptr);
+				}
+				if (changes & STATE_CHANGE_TEXTURE_SET)
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.material->pipelineLayout, 2, 1, &batch.material->textureSet, 0, nullptr);
+
+				if (changes & STATE_CHANGE_MESH) {
+					//bind the mesh vertex buffer with offset 0
+					VkDeviceSize offset = 0;
+					vkCmdBindVertexBuffers(cmd, 0, 1, &batch.mesh->m_vertexBuffer.buffer, &offset);
+					vkCmdBindIndexBuffer(cmd, batch.mesh->m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+				}
+				//the shader reads the transform of each instance at gl_InstanceIndex, which starts at firstInstance
+				vkCmdDrawIndexed(cmd, batch.mesh->m_lods[0].indexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+			}
+
+			VK_CHECK(vkEndCommandBuffer(cmd));
+			return cmd;
+		};
+
+	m_jobSystem.parallelFor(batchCount, chunkSize, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			const uint32_t chunk = begin / chunkSize;
+			//the resolve shades what the ids cover
+			if (visibility)
+			{
+				m_drawChunkCommands[chunk] = recordPositionOnly(m_visibilityRenderer.getIdPipeline(), m_visibilityRenderer.getIdPipelineLayout(), begin, end, isDeferred);
+			}
+			else
+			{
+				if (depthPrepass)
+				{
+					m_drawChunkCommands[chunk] = recordPositionOnly(m_depthPrepassPipeline, m_depthPrepassPipelineLayout, begin, end,
+						[](const DrawBatch& batch) { return batch.pass == DrawPass::Opaque && batch.material->depthEqualPipeline != VK_NULL_HANDLE; });
+				}
+				m_drawChunkCommands[(depthPrepass ? chunkCount : 0) + chunk] = recordShaded(begin, end, false);
+			}
+			if (forwardAfterLighting)
+				m_drawChunkCommands[chunkCount + chunk] = recordShaded(begin, end, true);
+		});
 
+	const auto passChunkCount = forwardAfterLighting ? chunkCount : static_cast<uint32_t>(m_drawChunkCommands.size());
+	outCommands.insert(outCommands.end(), m_drawChunkCommands.begin(), m_drawChunkCommands.begin() + passChunkCount);
+	m_forwardCommands.insert(m_forwardCommands.end(), m_drawChunkCommands.begin() + passChunkCount, m_drawChunkCommands.end());
+	m_recordMilliseconds = std::chrono::duration<float, std::milli>(Clock::now() - recordStart).count();
+}
 
-		MeshPushConstants constants = { object.transformMatrix };
+void VulkanEngine::setDepthPrepass(const bool enabled)
+{
+	if (m_depthPrepass == enabled)
+		return;
+	m_depthPrepass = enabled;
+	invalidateRecordedCommands();
+}
 
-		//upload the mesh to the GPU via push constants
-		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+void VulkanEngine::setShadingPath(const ShadingPath path)
+{
+	if (m_shadingPath == path)
+		return;
+	m_shadingPath = path;
+	invalidateRecordedCommands();
+}
 
-		//only bind the mesh if it's a different one from last bind
-		if (object.mesh != lastMesh) {
-			//bind the mesh vertex buffer with offset 0
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->m_vertexBuffer.buffer, &offset);
-			lastMesh = object.mesh;
-		}
-		//we can now draw
-		vkCmdDraw(cmd, static_cast<uint32_t>(static_cast<uint32_t>(object.mesh->m_vertices.size())), 1, 0, i);
+void VulkanEngine::bakeStaticLighting()
+{
+	const auto lightCount = static_cast<uint32_t>(std::clamp(m_sceneParameters.lightNb, 0, static_cast<int>(m_lightAnimator.getCapacity())));
+	if (!m_bakedLighting.bake(m_jobSystem, m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_lightAnimator, lightCount))
+		std::cout << "The probes of the scene do not fit in the probe buffer, raise their spacing" << std::endl;
+}
+
+void VulkanEngine::exportBakeScene()
+{
+	const auto lightCount = static_cast<uint32_t>(std::clamp(m_sceneParameters.lightNb, 0, static_cast<int>(m_lightAnimator.getCapacity())));
+	m_bakedLighting.exportScene(m_renderables.data(), static_cast<uint32_t>(m_renderables.size()), m_lightAnimator, lightCount);
+}
+
+void VulkanEngine::readFrameTimestamps()
+{
+	FrameData& frame = getCurrentFrame();
+	if (!frame.timestampsWritten)
+		return;
+	frame.timestampsWritten = false;
+
+	uint64_t timestamps[2];
+	const uint32_t firstTimestamp = static_cast<uint32_t>(m_frameNumber % FRAME_OVERLAP) * 2;
+	if (vkGetQueryPoolResults(m_device, m_timestampQueryPool, firstTimestamp, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	//the period is in nanoseconds per tick
+	m_gpuFrameMilliseconds = static_cast<float>(timestamps[1] - timestamps[0]) * m_gpuProperties.limits.timestampPeriod / 1000000.f;
+	float& mean = m_gpuFrameMillisecondsByMode[frame.timestampsDepthPrepass ? 1 : 0];
+	mean = mean == 0.f ? m_gpuFrameMilliseconds : mean * 0.95f + m_gpuFrameMilliseconds * 0.05f;
+}
+
+VkCommandBuffer VulkanEngine::beginSecondaryCommandBuffer()
+{
+	return beginSecondaryCommandBuffer(m_currentRenderPass, m_currentFramebuffer);
+}
+
+VkCommandBuffer VulkanEngine::beginSecondaryCommandBuffer(const VkRenderPass renderPass, const VkFramebuffer framebuffer)
+{
+	//the pools are reset every frame, their command buffers are reused
+	SecondaryCommands& secondary = getCurrentFrame().secondaryCommands[JobSystem::getWorkerIndex()];
+	if (secondary.usedCount == secondary.buffers.size())
+	{
+		const VkCommandBufferAllocateInfo allocInfo = vkinit::commandBufferAllocateInfo(secondary.pool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		VK_CHECK(vkAllocateCommandBuffers(m_device, &allocInfo, &secondary.buffers.emplace_back()));
 	}
+	VkCommandBuffer cmd = secondary.buffers[secondary.usedCount++];
+
+	const VkCommandBufferInheritanceInfo inheritanceInfo = vkinit::commandBufferInheritanceInfo(renderPass, 0, framebuffer);
+
+	VkCommandBufferBeginInfo beginInfo = vkinit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+	return cmd;
 }
 
 FrameData& VulkanEngine::getCurrentFrame()
@@ -963,10 +1734,12 @@ void VulkanEngine::initDescriptors()
 	//create a descriptor pool that will hold 10 uniform buffers
 	std::vector<VkDescriptorPoolSize> sizes =
 	{
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 12 },
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 }
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 64 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 40 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 20 },
+		{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 10 }
 	};
 
 	VkDeviceSize sceneParamBufferSize = FRAME_OVERLAP * padUniformBufferSize(sizeof(GPUSceneData));
@@ -976,7 +1749,7 @@ void VulkanEngine::initDescriptors()
 	VkDescriptorPoolCreateInfo pool_info = {};
 	pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	pool_info.flags = 0;
-	pool_info.maxSets = 10;
+	pool_info.maxSets = 44;
 	pool_info.poolSizeCount = static_cast<uint32_t>(sizes.size());
 	pool_info.pPoolSizes = sizes.data();
 
@@ -984,10 +1757,22 @@ void VulkanEngine::initDescriptors()
 
 	VkDescriptorSetLayoutBinding cameraBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
 	VkDescriptorSetLayoutBinding sceneBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-	VkDescriptorSetLayoutBinding bindings[] = { cameraBind,sceneBind };
+	//the cascades of the sun, written once CascadedShadows created them
+	VkDescriptorSetLayoutBinding shadowDataBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2);
+	VkDescriptorSetLayoutBinding shadowMapBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 3);
+	//the point light cubes, written once PointShadowAtlas created them
+	VkDescriptorSetLayoutBinding pointShadowBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4);
+	VkDescriptorSetLayoutBinding pointShadowMapBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 5);
+	//the probes of the baked lights, written once BakedLighting created them
+	VkDescriptorSetLayoutBinding probeBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 6);
+	//the maps of the environment, written once EnvironmentLighting created them
+	VkDescriptorSetLayoutBinding irradianceBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 7);
+	VkDescriptorSetLayoutBinding specularBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 8);
+	VkDescriptorSetLayoutBinding brdfBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 9);
+	VkDescriptorSetLayoutBinding bindings[] = { cameraBind,sceneBind,shadowDataBind,shadowMapBind,pointShadowBind,pointShadowMapBind,probeBind,irradianceBind,specularBind,brdfBind };
 
 	VkDescriptorSetLayoutCreateInfo set0info = {};
-	set0info.bindingCount = 2;
+	set0info.bindingCount = 10;
 	set0info.flags = 0;
 	set0info.pNext = nullptr;
 	set0info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -995,11 +1780,13 @@ void VulkanEngine::initDescriptors()
 
 	vkCreateDescriptorSetLayout(m_device, &set0info, nullptr, &m_globalSetLayout);
 
-	VkDescriptorSetLayoutBinding objectBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT , 0);
+	VkDescriptorSetLayoutBinding objectBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0);
 	VkDescriptorSetLayoutBinding lightBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
-	VkDescriptorSetLayoutBinding bindings2[] = { objectBind,lightBind };
+	VkDescriptorSetLayoutBinding clusterBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2);
+	VkDescriptorSetLayoutBinding lightIndexBind = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3);
+	VkDescriptorSetLayoutBinding bindings2[] = { objectBind,lightBind,clusterBind,lightIndexBind };
 	VkDescriptorSetLayoutCreateInfo set1info = {};
-	set1info.bindingCount = 2;
+	set1info.bindingCount = 4;
 	set1info.flags = 0;
 	set1info.pNext = nullptr;
 	set1info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1022,7 +1809,9 @@ void VulkanEngine::initDescriptors()
 	{
 		m_frame.cameraBuffer = createBuffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 		m_frame.objectBuffer = createBuffer(sizeof(GPUObjectData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		m_frame.lightBuffer = createBuffer(sizeof(GPULightData) * MAX_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		m_frame.lightBuffer = createBuffer(sizeof(GPULightData) * MAX_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_frame.clusterBuffer = createBuffer(CLUSTER_BUFFER_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		m_frame.lightIndexBuffer = createBuffer(sizeof(uint32_t) * LightClusterer::MAX_LIGHT_INDICES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
 		//allocate one descriptor set for each frame
 		VkDescriptorSetAllocateInfo globalAllocInfo = {};
@@ -1063,14 +1852,27 @@ void VulkanEngine::initDescriptors()
 		lightInfo.offset = 0;
 		lightInfo.range = sizeof(GPULightData) * MAX_LIGHTS;
 
+		VkDescriptorBufferInfo clusterInfo;
+		clusterInfo.buffer = m_frame.clusterBuffer.buffer;
+		clusterInfo.offset = 0;
+		clusterInfo.range = CLUSTER_BUFFER_SIZE;
+
+		VkDescriptorBufferInfo lightIndexInfo;
+		lightIndexInfo.buffer = m_frame.lightIndexBuffer.buffer;
+		lightIndexInfo.offset = 0;
+		lightIndexInfo.range = sizeof(uint32_t) * LightClusterer::MAX_LIGHT_INDICES;
+
 		VkWriteDescriptorSet cameraWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_frame.globalDescriptor, &cameraInfo, 0);
 		VkWriteDescriptorSet sceneWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, m_frame.globalDescriptor, &sceneInfo, 1);
 		VkWriteDescriptorSet objectWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frame.objectDescriptor, &objectBufferInfo, 0);
 		VkWriteDescriptorSet lightWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frame.objectDescriptor, &lightInfo, 1);
 
-		VkWriteDescriptorSet setWrites[] = { cameraWrite,sceneWrite,objectWrite,lightWrite };
+		VkWriteDescriptorSet clusterWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frame.objectDescriptor, &clusterInfo, 2);
+		VkWriteDescriptorSet lightIndexWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frame.objectDescriptor, &lightIndexInfo, 3);
 
-		vkUpdateDescriptorSets(m_device, 4, setWrites, 0, nullptr);
+		VkWriteDescriptorSet setWrites[] = { cameraWrite,sceneWrite,objectWrite,lightWrite,clusterWrite,lightIndexWrite };
+
+		vkUpdateDescriptorSets(m_device, 6, setWrites, 0, nullptr);
 	}
 	// add buffers to deletion queues
 	m_mainDeletionQueue.push_function([=, this]()
@@ -1080,6 +1882,8 @@ void VulkanEngine::initDescriptors()
 				vmaDestroyBuffer(m_allocator, m_frame.cameraBuffer.buffer, m_frame.cameraBuffer.allocation);
 				vmaDestroyBuffer(m_allocator, m_frame.objectBuffer.buffer, m_frame.objectBuffer.allocation);
 				vmaDestroyBuffer(m_allocator, m_frame.lightBuffer.buffer, m_frame.lightBuffer.allocation);
+				vmaDestroyBuffer(m_allocator, m_frame.clusterBuffer.buffer, m_frame.clusterBuffer.allocation);
+				vmaDestroyBuffer(m_allocator, m_frame.lightIndexBuffer.buffer, m_frame.lightIndexBuffer.allocation);
 			}
 
 			vkDestroyDescriptorSetLayout(m_device, m_globalSetLayout, nullptr);
@@ -1092,6 +1896,39 @@ void VulkanEngine::initDescriptors()
 
 		});
 
+	m_depthPyramid.init(*this);
+	m_gpuCuller.init(*this, m_depthPyramid);
+	m_deferredRenderer.init(*this);
+	m_visibilityRenderer.init(*this, MAX_OBJECTS);
+	m_lightSampler.init(*this, MAX_LIGHTS);
+	m_lightAnimator.init(*this, MAX_LIGHTS, MAX_LIGHT_KEYFRAMES);
+	m_shadows.init(*this, MAX_OBJECTS);
+	m_pointShadows.init(*this, MAX_LIGHTS, MAX_OBJECTS);
+	m_bakedLighting.init(*this, "../assets/scene.vkbake");
+	m_environmentLighting.init(*this, "../assets/environment.hdr");
+
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		VkDescriptorBufferInfo shadowDataInfo = m_shadows.getDataInfo(i);
+		VkDescriptorImageInfo shadowMapInfo = m_shadows.getShadowMapInfo();
+		VkDescriptorBufferInfo pointShadowInfo = m_pointShadows.getBufferInfo(i);
+		VkDescriptorImageInfo pointShadowMapInfo = m_pointShadows.getAtlasInfo();
+		VkDescriptorBufferInfo probeInfo = m_bakedLighting.getBufferInfo();
+		VkDescriptorImageInfo irradianceInfo = m_environmentLighting.getIrradianceInfo();
+		VkDescriptorImageInfo specularInfo = m_environmentLighting.getSpecularInfo();
+		VkDescriptorImageInfo brdfInfo = m_environmentLighting.getBrdfInfo();
+		const VkWriteDescriptorSet shadowWrites[] = {
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_frames[i].globalDescriptor, &shadowDataInfo, 2),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frames[i].globalDescriptor, &shadowMapInfo, 3),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frames[i].globalDescriptor, &pointShadowInfo, 4),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frames[i].globalDescriptor, &pointShadowMapInfo, 5),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frames[i].globalDescriptor, &probeInfo, 6),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frames[i].globalDescriptor, &irradianceInfo, 7),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frames[i].globalDescriptor, &specularInfo, 8),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frames[i].globalDescriptor, &brdfInfo, 9)
+		};
+		vkUpdateDescriptorSets(m_device, 8, shadowWrites, 0, nullptr);
+	}
 
 }
 
@@ -1133,19 +1970,94 @@ void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& fu
 	vkResetCommandPool(m_device, m_uploadContext.commandPool, 0);
 }
 
-void VulkanEngine::loadImages()
+Task<void> VulkanEngine::submitUploadAsync(std::function<void(VkCommandBuffer cmd)> function)
 {
-	Texture lostEmpire{};
+	VkCommandBuffer cmd;
+	const VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::commandBufferAllocateInfo(m_uploadContext.asyncCommandPool, 1);
+	VK_CHECK(vkAllocateCommandBuffers(m_device, &cmdAllocInfo, &cmd));
 
-	vkutil::loadImageFromFile(*this, "../assets/lost_empire-RGBA.png", lostEmpire.image);
+	const VkCommandBufferBeginInfo cmdBeginInfo = vkinit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+	function(cmd);
 
-	const VkImageViewCreateInfo imageinfo = vkinit::imageviewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, lostEmpire.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(m_device, &imageinfo, nullptr, &lostEmpire.imageView);
-	m_loadedTextures["empire_diffuse"] = lostEmpire;
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	//every upload gets its own fence so that several of them can be in flight
+	const VkFenceCreateInfo fenceCreateInfo = vkinit::fenceCreateInfo();
+	VkFence fence;
+	VK_CHECK(vkCreateFence(m_device, &fenceCreateInfo, nullptr, &fence));
+
+	const VkSubmitInfo submit = vkinit::submitInfo(&cmd);
+	VK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &submit, fence));
+
+	//polled once per frame instead of waited on
+	co_await m_scheduler.until([this, fence] { return vkGetFenceStatus(m_device, fence) == VK_SUCCESS; });
+
+	vkDestroyFence(m_device, fence, nullptr);
+	vkFreeCommandBuffers(m_device, m_uploadContext.asyncCommandPool, 1, &cmd);
+}
 
+void VulkanEngine::loadImages()
+{
+	//the cache owns the images, each texture only owns its view
 	m_mainDeletionQueue.push_function([=, this]
 		{
-			vkDestroyImageView(m_device, lostEmpire.imageView, nullptr);
+			for (const auto& [name, texture] : m_loadedTextures)
+				vkDestroyImageView(m_device, texture.imageView, nullptr);
+
+			m_imageCache.forEach([&](const AllocatedImage& image) {
+				vmaDestroyImage(m_allocator, image.image, image.allocation);
+				});
+			m_imageCache.clear();
 		});
+
+	const std::pair<std::string, const char*> textureFiles[] = {
+		{ "empire_diffuse", "../assets/lost_empire-RGBA.png" },
+	};
+
+	std::vector<Task<Texture*>> loads;
+	for (const auto& textureFile : textureFiles)
+		loads.push_back(loadTextureAsync(textureFile.first, textureFile.second));
+	m_scheduler.runUntilComplete(whenAll(std::move(loads)), [this] { m_fileReader.poll(); });
+}
+
+Task<Texture*> VulkanEngine::loadTextureAsync(std::string name, std::string file)
+{
+	//prefers the BC3 mip chain from ../assets/cooked when the AssetCooker produced it.
+	//textures are big and uploaded once, they are read without going through the OS cache
+	const std::string path = vkutil::getTextureLoadPath(file.c_str());
+	vkutil::ReadResult read = co_await vkutil::readFileAsync(m_fileReader, path, true);
+
+	co_await vkutil::switchToWorker(m_jobSystem);
+	vkutil::DecodedImage decoded;
+	const bool isDecoded = read.success && vkutil::decodeImage(path.c_str(), read.data, decoded);
+
+	co_await m_scheduler.nextFrame();
+	Texture texture{};
+	if (isDecoded)
+		co_await vkutil::uploadTextureAsync(*this, decoded, texture);
+	//an outdated cooked file goes through the synchronous path, which falls back to the source
+	else if (!vkutil::loadTextureFromFile(*this, file.c_str(), texture))
+		co_return nullptr;
+
+	Texture& loaded = m_loadedTextures[name] = texture;
+	co_return &loaded;
+}
+
+// the GPU must be done with the texture, the image is destroyed right away when it was the last user
+void VulkanEngine::releaseTexture(const std::string& name)
+{
+	const auto it = m_loadedTextures.find(name);
+	if (it == m_loadedTextures.end())
+		return;
+
+	vkDestroyImageView(m_device, it->second.imageView, nullptr);
+
+	AllocatedImage image;
+	if (m_imageCache.release(it->second.contentHash, image))
+		vmaDestroyImage(m_allocator, image.image, image.allocation);
+	m_loadedTextures.erase(it);
+	invalidateRecordedCommands();
 }
 
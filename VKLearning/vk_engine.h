@@ -10,6 +10,25 @@
 #include "camera.h"
 
 #include "vk_mesh.h"
+#include "vk_resource_cache.h"
+#include "vk_io.h"
+#include "vk_jobs.h"
+#include "vk_task.h"
+#include "vk_render_queue.h"
+#include "vk_culling.h"
+#include "vk_occlusion.h"
+#include "vk_gpu_culling.h"
+#include "vk_depth_pyramid.h"
+#include "vk_static_batch.h"
+#include "vk_light_clusters.h"
+#include "vk_light_sampling.h"
+#include "vk_light_animation.h"
+#include "vk_deferred.h"
+#include "vk_visibility.h"
+#include "vk_shadows.h"
+#include "vk_shadow_atlas.h"
+#include "vk_baked_lighting.h"
+#include "vk_environment_lighting.h"
 
 
 constexpr uint32_t WIDTH = 1280;
@@ -18,6 +37,16 @@ constexpr float ASPECT_RATIO = static_cast<float>(WIDTH) / static_cast<float>(HE
 
 constexpr uint64_t FRAME_OVERLAP = 2;
 
+// how the opaque geometry is shaded
+enum class ShadingPath : uint8_t
+{
+	Forward,
+	// G-buffer and lighting subpasses
+	Deferred,
+	// triangle ids and a resolve subpass, always from the render queue
+	VisibilityBuffer,
+};
+
 class VulkanEngine
 {
 public:
@@ -44,23 +73,58 @@ public:
 	void initScene();
 
 	bool loadShaderModule(const char* filePath, VkShaderModule* outShaderModule) const;
+	bool createShaderModule(const char* name, const vkutil::FileData& code, VkShaderModule* outShaderModule) const;
 
 	void loadMeshes();
 	void uploadMesh(Mesh& mesh);
+	// reads, parses on a worker and uploads without blocking, the mesh is added to m_meshes once it is on the GPU
+	Task<Mesh*> loadMeshAsync(std::string name, std::string file);
+	Task<void> uploadMeshAsync(Mesh& mesh);
+	// indexes the mesh, computes its bounds and levels of detail and hashes it, true when its geometry is already on the GPU
+	bool acquireMeshBuffers(Mesh& mesh);
+	// creates the GPU buffers of the mesh and returns the staging buffer holding its data
+	AllocatedBuffer createMeshBuffers(Mesh& mesh);
+	void releaseMesh(const std::string& name);
 
 	FrameData& getCurrentFrame();
 
 	Material* createMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name);
 	Material* getMaterial(const std::string& name);
 	Mesh* getMesh(const std::string& name);
-	void drawObjects(VkCommandBuffer cmd, const RenderObject* first, const size_t count);
+	// writes the camera, scene and light buffers of the current frame
+	void uploadFrameData();
+	// draws the objects whose indices are listed in visible. The sorted batches are split in chunks recorded in
+	// parallel, their secondary command buffers are appended to outCommands in the order they must execute.
+	// In the deferred and visibility buffer paths, the batches their geometry subpass can not draw go to m_forwardCommands
+	void drawObjects(const RenderObject* objects, const uint32_t* visible, const size_t visibleCount, std::vector<VkCommandBuffer>& outCommands);
+	// begins a secondary command buffer continuing the main render pass, from the pool of the calling JobSystem thread
+	VkCommandBuffer beginSecondaryCommandBuffer();
+	// the same, continuing renderPass instead, the framebuffer may be VK_NULL_HANDLE
+	VkCommandBuffer beginSecondaryCommandBuffer(VkRenderPass renderPass, VkFramebuffer framebuffer);
+	// the commands cached by the frames reference the renderables, the materials and the attachments,
+	// whatever changes one of them calls this so that they are recorded again
+	void invalidateRecordedCommands() { m_sceneVersion++; }
+	// the static objects, their meshes or their transforms changed: the cached shadows and the probes are stale too
+	void invalidateStaticScene() { m_staticSceneVersion++; invalidateRecordedCommands(); }
+	void setDepthPrepass(bool enabled);
+	void setShadingPath(ShadingPath path);
+	// bakes the lights that never change into the probes of m_bakedLighting, blocks until done
+	void bakeStaticLighting();
+	// writes the input of that bake next to the assets, for the AssetCooker
+	void exportBakeScene();
+	// reads the timestamps the last submission of the current frame wrote, once its fence is signaled
+	void readFrameTimestamps();
 
 	AllocatedBuffer createBuffer(const size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage) const;
 	VkDeviceSize padUniformBufferSize(size_t originalSize) const;
 
 	void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function) const;
+	// records and submits like immediateSubmit, but the awaiting task resumes once the GPU is done instead of blocking
+	Task<void> submitUploadAsync(std::function<void(VkCommandBuffer cmd)> function);
 
 	void loadImages();
+	Task<Texture*> loadTextureAsync(std::string name, std::string file);
+	void releaseTexture(const std::string& name);
 
 	bool processInput(const SDL_Event* e);
 	bool processKeyboard(const SDL_Event* e);
@@ -84,7 +148,12 @@ public:
 	std::vector<VkImageView> m_swapchainImageViews;
 
 	VkRenderPass			   m_renderPass;
+	// loads the attachments instead of clearing them, for the draws following the occlusion culling of the frame
+	VkRenderPass			   m_loadRenderPass;
 	std::vector<VkFramebuffer> m_framebuffers;
+	// render pass and framebuffer of the frame being recorded, inherited by the secondary command buffers
+	VkRenderPass			   m_currentRenderPass{ VK_NULL_HANDLE };
+	VkFramebuffer			   m_currentFramebuffer{ VK_NULL_HANDLE };
 
 	VkQueue  m_graphicsQueue;
 	uint32_t m_graphicsQueueFamily;
@@ -100,6 +169,45 @@ public:
 	AllocatedImage m_depthImage;
 
 	std::vector<RenderObject> m_renderables;
+	// merges the static objects of the scene per material at load
+	StaticBatcher m_staticBatcher;
+	// the renderables of the frame sorted by state, one instanced batch per mesh and material
+	RenderQueue m_renderQueue;
+	// indices of the renderables inside the camera frustum
+	FrustumCuller         m_frustumCuller;
+	// then removes the ones hidden behind the occluders, rasterized on the CPU
+	OcclusionCuller       m_occlusionCuller;
+	std::vector<uint32_t> m_visibleObjects;
+	// secondary command buffers of the main pass, executed in this order
+	std::vector<VkCommandBuffer> m_passCommands;
+	std::vector<VkCommandBuffer> m_drawChunkCommands;
+	// textured and transparent objects of the deferred and visibility buffer paths, shaded with their forward pipeline
+	// in the load pass once the lighting is done, depth tested against the depth of the geometry subpass
+	std::vector<VkCommandBuffer> m_forwardCommands;
+	float    m_recordMilliseconds{ 0.f };
+	// bumped by invalidateRecordedCommands, the cached commands of a frame are valid while they have the same
+	uint64_t m_sceneVersion{ 1 };
+	// bumped by invalidateStaticScene only, the shadow caches and the baked lighting key on it
+	uint64_t m_staticSceneVersion{ 1 };
+	uint32_t m_cachedCommandsRecordCount{ 0 };
+	// culls, picks the levels of detail and fills indirect draws on the GPU instead, when supported
+	GPUCuller m_gpuCuller;
+	bool      m_gpuDriven{ true };
+	// max reduction of the depth of the early draws, the late culling tests the instances against it
+	DepthPyramid m_depthPyramid;
+	// the opaque draws first write their depth only, then are shaded with an equal depth test
+	VkPipeline       m_depthPrepassPipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout m_depthPrepassPipelineLayout{ VK_NULL_HANDLE };
+	bool             m_depthPrepass{ false };
+	// the deferred and visibility buffer paths have their own render pass, the UI is drawn in the load render pass after it
+	DeferredRenderer   m_deferredRenderer;
+	VisibilityRenderer m_visibilityRenderer;
+	ShadingPath        m_shadingPath{ ShadingPath::Forward };
+	// GPU time of the frames, measured with two timestamps per frame. The mean of each depth prepass mode is
+	// kept so that both can be compared
+	VkQueryPool m_timestampQueryPool{ VK_NULL_HANDLE };
+	float       m_gpuFrameMilliseconds{ 0.f };
+	float       m_gpuFrameMillisecondsByMode[2]{ 0.f, 0.f };
 
 	VkDescriptorPool	  m_descriptorPool;
 	VkDescriptorSetLayout m_globalSetLayout;
@@ -110,6 +218,9 @@ public:
 	std::unordered_map<std::string, Mesh>     m_meshes;
 
 	VkPhysicalDeviceProperties m_gpuProperties;
+	// optional features enabled when the device supports them
+	VkPhysicalDeviceFeatures m_enabledFeatures{};
+	bool                     m_drawIndirectCount{ false };
 
 	GPUSceneData    m_sceneParameters;
 	AllocatedBuffer m_sceneParameterBuffer;
@@ -119,6 +230,16 @@ public:
 	VkDescriptorSetLayout					 m_bindlessTextureSetLayout;
 	std::unordered_map<std::string, Texture> m_loadedTextures;
 
+	// GPU resources shared by every mesh/texture with the same content
+	ResourceCache<MeshBuffers>     m_meshBufferCache;
+	ResourceCache<AllocatedImage>  m_imageCache;
+
+	// asset reads are batched and overlap parsing and uploads
+	vkutil::AsyncFileReader m_fileReader;
+	// loading coroutines parse on the workers and resume on the main thread from m_scheduler
+	JobSystem      m_jobSystem;
+	FrameScheduler m_scheduler;
+
 	bool m_isInitialized{ false };
 	int  m_frameNumber{ 0 };
 
@@ -128,6 +249,28 @@ public:
 
 	std::deque<float> lastDeltaTimes{};
 
-	std::array<GPULightData, 1000> m_lightData;
+	// the lights at rest, the UI edits them and passes them to m_lightAnimator
+	std::vector<GPULightData> m_lightData;
+	// moves the lights on the GPU, the visible ones are evaluated into the light buffer every frame
+	LightAnimator             m_lightAnimator;
+	// only the lights whose animated bounds intersect the frustum are evaluated
+	FrustumCuller             m_lightCuller;
+	uint64_t                  m_lightBoundsVersion{ 0 };
+	uint32_t                  m_culledLightCount{ 0 };
+	std::vector<uint32_t>     m_visibleLights;
+	// the bounds of the visible lights, the clusters are built from them
+	std::vector<GPULightData> m_visibleLightData;
+	// the lights of each cluster of the view, rebuilt every frame
+	LightClusterer m_lightClusterer;
+	// samples a few lights per pixel in the deferred lighting instead of shading the whole cluster
+	LightSampler   m_lightSampler;
+	// shadows of the sun, m_sceneParameters.lightDirection points towards it
+	CascadedShadows m_shadows;
+	// shadows of the brightest stationary point lights on screen
+	PointShadowAtlas m_pointShadows;
+	// the lights that never change, baked into irradiance probes
+	BakedLighting  m_bakedLighting;
+	// the HDR environment around the scene, precomputed into the maps of image based lighting
+	EnvironmentLighting m_environmentLighting;
 };
 
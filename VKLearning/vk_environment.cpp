@@ -0,0 +1,573 @@
+#include "vk_environment.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+#include <stb_image.h>
+
+#include "vk_jobs.h"
+#include "vk_pack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_ENVIRONMENT_SSE2 1
+#endif
+
+namespace
+{
+	// followed by the specular levels, then the data
+	struct CookedEnvironmentHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		vkutil::CookedMipLevel irradiance;
+		vkutil::CookedMipLevel brdf;
+		uint32_t specularMipCount;
+		uint32_t padding;
+		uint64_t dataSize;
+	};
+
+	constexpr uint32_t FACE_COUNT = 6;
+	constexpr uint32_t ROW_GROUP_SIZE = 4;
+	constexpr uint32_t SPECULAR_SAMPLE_COUNT = 256;
+	constexpr uint32_t BRDF_SAMPLE_COUNT = 512;
+	// the source projected on the harmonics, a coarser level is as accurate for nine coefficients
+	constexpr uint32_t HARMONICS_SIZE = 64;
+	constexpr uint32_t HARMONICS_COUNT = 9;
+
+	// the lobe of a specular level, around +z
+	struct LobeSample
+	{
+		glm::vec3 direction;
+		float weight;
+		float lod;
+	};
+
+	// sum + value * weight, the four channels at once
+	inline void addWeighted(glm::vec4& sum, const glm::vec4& value, const float weight)
+	{
+#if defined(VK_ENVIRONMENT_SSE2)
+		_mm_storeu_ps(&sum.x, _mm_add_ps(_mm_loadu_ps(&sum.x), _mm_mul_ps(_mm_loadu_ps(&value.x), _mm_set1_ps(weight))));
+#else
+		sum += value * weight;
+#endif
+	}
+
+	// direction through the coordinates s, t in [-1, 1] of a face, as Vulkan maps the cubes
+	glm::vec3 faceDirection(const uint32_t face, const float s, const float t)
+	{
+		switch (face)
+		{
+		case 0: return { 1.f, -t, -s };
+		case 1: return { -1.f, -t, s };
+		case 2: return { s, 1.f, t };
+		case 3: return { s, -1.f, -t };
+		case 4: return { s, -t, 1.f };
+		default: return { -s, -t, -1.f };
+		}
+	}
+
+	// face a direction points to and its coordinates in [0, 1] on it, the inverse of faceDirection
+	uint32_t directionFace(const glm::vec3& d, float& u, float& v)
+	{
+		const glm::vec3 a = glm::abs(d);
+		uint32_t face;
+		float sc, tc, ma;
+		if (a.x >= a.y && a.x >= a.z)
+		{
+			face = d.x > 0.f ? 0 : 1;
+			ma = a.x;
+			sc = d.x > 0.f ? -d.z : d.z;
+			tc = -d.y;
+		}
+		else if (a.y >= a.z)
+		{
+			face = d.y > 0.f ? 2 : 3;
+			ma = a.y;
+			sc = d.x;
+			tc = d.y > 0.f ? d.z : -d.z;
+		}
+		else
+		{
+			face = d.z > 0.f ? 4 : 5;
+			ma = a.z;
+			sc = d.z > 0.f ? d.x : -d.x;
+			tc = -d.y;
+		}
+		u = 0.5f * (sc / ma + 1.f);
+		v = 0.5f * (tc / ma + 1.f);
+		return face;
+	}
+
+	// normalized direction through the center of a texel
+	glm::vec3 texelDirection(const uint32_t face, const uint32_t x, const uint32_t y, const uint32_t size)
+	{
+		const float s = 2.f * (static_cast<float>(x) + 0.5f) / static_cast<float>(size) - 1.f;
+		const float t = 2.f * (static_cast<float>(y) + 0.5f) / static_cast<float>(size) - 1.f;
+		return glm::normalize(faceDirection(face, s, t));
+	}
+
+	glm::vec4 sampleFace(const std::vector<glm::vec4>& texels, const uint32_t size, const uint32_t face, const float u, const float v)
+	{
+		const float x = std::clamp(u * static_cast<float>(size) - 0.5f, 0.f, static_cast<float>(size - 1));
+		const float y = std::clamp(v * static_cast<float>(size) - 0.5f, 0.f, static_cast<float>(size - 1));
+		const auto x0 = static_cast<uint32_t>(x);
+		const auto y0 = static_cast<uint32_t>(y);
+		const uint32_t x1 = std::min(x0 + 1, size - 1);
+		const uint32_t y1 = std::min(y0 + 1, size - 1);
+		const float fx = x - static_cast<float>(x0);
+		const float fy = y - static_cast<float>(y0);
+
+		const glm::vec4* faceTexels = texels.data() + static_cast<size_t>(face) * size * size;
+		glm::vec4 result(0.f);
+		addWeighted(result, faceTexels[y0 * size + x0], (1.f - fx) * (1.f - fy));
+		addWeighted(result, faceTexels[y0 * size + x1], fx * (1.f - fy));
+		addWeighted(result, faceTexels[y1 * size + x0], (1.f - fx) * fy);
+		addWeighted(result, faceTexels[y1 * size + x1], fx * fy);
+		return result;
+	}
+
+	// bilinear, wrapping around horizontally. +y is the top row
+	glm::vec4 sampleEquirect(const float* pixels, const uint32_t width, const uint32_t height, const glm::vec3& d)
+	{
+		const float u = std::atan2(d.z, d.x) / glm::two_pi<float>() + 0.5f;
+		const float v = std::acos(std::clamp(d.y, -1.f, 1.f)) / glm::pi<float>();
+		const float x = u * static_cast<float>(width) - 0.5f;
+		const float y = std::clamp(v * static_cast<float>(height) - 0.5f, 0.f, static_cast<float>(height - 1));
+		const float floorX = std::floor(x);
+		const auto x0 = static_cast<uint32_t>((static_cast<int64_t>(floorX) % width + width) % width);
+		const uint32_t x1 = (x0 + 1) % width;
+		const auto y0 = static_cast<uint32_t>(y);
+		const uint32_t y1 = std::min(y0 + 1, height - 1);
+		const float fx = x - floorX;
+		const float fy = y - static_cast<float>(y0);
+
+		const auto* texels = reinterpret_cast<const glm::vec4*>(pixels);
+		glm::vec4 result(0.f);
+		addWeighted(result, texels[static_cast<size_t>(y0) * width + x0], (1.f - fx) * (1.f - fy));
+		addWeighted(result, texels[static_cast<size_t>(y0) * width + x1], fx * (1.f - fy));
+		addWeighted(result, texels[static_cast<size_t>(y1) * width + x0], (1.f - fx) * fy);
+		addWeighted(result, texels[static_cast<size_t>(y1) * width + x1], fx * fy);
+		return result;
+	}
+
+	// the real spherical harmonics of the first three bands
+	std::array<float, HARMONICS_COUNT> harmonics(const glm::vec3& n)
+	{
+		return {
+			0.282095f,
+			0.488603f * n.y, 0.488603f * n.z, 0.488603f * n.x,
+			1.092548f * n.x * n.y, 1.092548f * n.y * n.z, 0.315392f * (3.f * n.z * n.z - 1.f), 1.092548f * n.x * n.z, 0.546274f * (n.x * n.x - n.y * n.y)
+		};
+	}
+
+	glm::vec2 hammersley(const uint32_t i, const uint32_t count)
+	{
+		uint32_t bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return { static_cast<float>(i) / static_cast<float>(count), static_cast<float>(bits) * 2.3283064365386963e-10f };
+	}
+
+	// half vector around +z distributed as the GGX lobe of alpha a
+	glm::vec3 importanceSampleGgx(const glm::vec2& xi, const float a)
+	{
+		const float phi = glm::two_pi<float>() * xi.x;
+		const float cosTheta = std::sqrt((1.f - xi.y) / (1.f + (a * a - 1.f) * xi.y));
+		const float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+		return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+	}
+
+	void writeHalf4(uint8_t* destination, const glm::vec4& value)
+	{
+		const uint64_t packed = glm::packHalf4x16(value);
+		memcpy(destination, &packed, sizeof(packed));
+	}
+
+	void writeHalf2(uint8_t* destination, const glm::vec2& value)
+	{
+		const uint32_t packed = glm::packHalf2x16(value);
+		memcpy(destination, &packed, sizeof(packed));
+	}
+
+	float millisecondsSince(const std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+bool vkutil::saveCookedEnvironment(const char* filePath, const CookedEnvironment& environment)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	CookedEnvironmentHeader header{};
+	header.magic = COOKED_ENVIRONMENT_MAGIC;
+	header.version = ENVIRONMENT_VERSION;
+	header.sourceHash = environment.sourceHash;
+	header.irradiance = environment.irradiance;
+	header.brdf = environment.brdf;
+	header.specularMipCount = static_cast<uint32_t>(environment.specular.size());
+	header.dataSize = environment.data.size();
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(environment.specular.data()), static_cast<std::streamsize>(environment.specular.size() * sizeof(CookedMipLevel)));
+	file.write(reinterpret_cast<const char*>(environment.data.data()), static_cast<std::streamsize>(environment.data.size()));
+	return file.good();
+}
+
+bool vkutil::loadCookedEnvironment(const char* filePath, CookedEnvironment& outEnvironment)
+{
+	FileData fileData;
+	if (!readFile(filePath, fileData))
+		return false;
+
+	CookedEnvironmentHeader header{};
+	if (fileData.size() < sizeof(header))
+		return false;
+	memcpy(&header, fileData.data(), sizeof(header));
+
+	const size_t mipsSize = static_cast<size_t>(header.specularMipCount) * sizeof(CookedMipLevel);
+	if (header.magic != COOKED_ENVIRONMENT_MAGIC || header.version != ENVIRONMENT_VERSION || header.specularMipCount == 0
+		|| sizeof(header) + mipsSize + header.dataSize > fileData.size())
+	{
+		return false;
+	}
+
+	outEnvironment.sourceHash = header.sourceHash;
+	outEnvironment.irradiance = header.irradiance;
+	outEnvironment.brdf = header.brdf;
+	outEnvironment.specular.resize(header.specularMipCount);
+	memcpy(outEnvironment.specular.data(), fileData.data() + sizeof(header), mipsSize);
+	outEnvironment.data.assign(fileData.data() + sizeof(header) + mipsSize, fileData.data() + sizeof(header) + mipsSize + header.dataSize);
+
+	//every level has to lie in the data with the size of its texels, the cubes have square faces and the specular
+	//levels halve down to a texel at most, the images are created and copied from these
+	const auto isLevel = [&](const CookedMipLevel& level, const uint32_t width, const uint32_t height, const uint64_t texelSize)
+		{
+			return width > 0 && height > 0 && level.width == width && level.height == height && level.size == static_cast<uint64_t>(width) * height * texelSize
+				&& level.offset <= header.dataSize && level.size <= header.dataSize - level.offset;
+		};
+	const CookedMipLevel& irradiance = outEnvironment.irradiance;
+	const CookedMipLevel& brdf = outEnvironment.brdf;
+	const uint32_t specularWidth = outEnvironment.specular[0].width;
+	if (!isLevel(irradiance, irradiance.width, irradiance.width, FACE_COUNT * 8) || !isLevel(brdf, brdf.width, brdf.height, 4)
+		|| header.specularMipCount > 32 || (specularWidth >> (header.specularMipCount - 1)) == 0)
+	{
+		return false;
+	}
+	for (uint32_t level = 0; level < header.specularMipCount; level++)
+	{
+		if (!isLevel(outEnvironment.specular[level], specularWidth >> level, specularWidth >> level, FACE_COUNT * 8))
+			return false;
+	}
+	return true;
+}
+
+bool EnvironmentFilter::decode(const uint8_t* bytes, const size_t size, std::vector<float>& outPixels, uint32_t& outWidth, uint32_t& outHeight)
+{
+	int width, height, channels;
+	float* pixels = stbi_loadf_from_memory(bytes, static_cast<int>(size), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+		return false;
+
+	outWidth = static_cast<uint32_t>(width);
+	outHeight = static_cast<uint32_t>(height);
+	outPixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+	stbi_image_free(pixels);
+	return true;
+}
+
+void EnvironmentFilter::filter(JobSystem& jobSystem, const float* pixels, const uint32_t width, const uint32_t height, vkutil::CookedEnvironment& outEnvironment)
+{
+	m_stats = {};
+	m_stats.sourceWidth = width;
+	m_stats.sourceHeight = height;
+
+	//the cubes in RGBA16F, the table in RG16F
+	uint64_t offset = 0;
+	outEnvironment.irradiance = { IRRADIANCE_SIZE, IRRADIANCE_SIZE, offset, FACE_COUNT * IRRADIANCE_SIZE * IRRADIANCE_SIZE * 8ull };
+	offset += outEnvironment.irradiance.size;
+	outEnvironment.specular.resize(SPECULAR_MIP_COUNT);
+	for (uint32_t level = 0; level < SPECULAR_MIP_COUNT; level++)
+	{
+		const uint32_t size = SPECULAR_SIZE >> level;
+		outEnvironment.specular[level] = { size, size, offset, FACE_COUNT * size * size * 8ull };
+		offset += outEnvironment.specular[level].size;
+	}
+	outEnvironment.brdf = { BRDF_SIZE, BRDF_SIZE, offset, BRDF_SIZE * BRDF_SIZE * 4ull };
+	offset += outEnvironment.brdf.size;
+	outEnvironment.data.assign(offset, 0);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	buildSource(jobSystem, pixels, width, height);
+	filterIrradiance(jobSystem, outEnvironment);
+	m_stats.irradianceMilliseconds = millisecondsSince(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	filterSpecular(jobSystem, outEnvironment);
+	m_stats.specularMilliseconds = millisecondsSince(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	integrateBrdf(jobSystem, outEnvironment);
+	m_stats.brdfMilliseconds = millisecondsSince(start);
+
+	m_source.clear();
+}
+
+void EnvironmentFilter::buildSource(JobSystem& jobSystem, const float* pixels, const uint32_t width, const uint32_t height)
+{
+	uint32_t levelCount = 1;
+	while ((SOURCE_SIZE >> levelCount) > 0)
+		levelCount++;
+	m_source.resize(levelCount);
+	m_source[0].assign(static_cast<size_t>(FACE_COUNT) * SOURCE_SIZE * SOURCE_SIZE, glm::vec4(0.f));
+
+	//a face covers a quarter of the width, a large environment is averaged over several samples per texel
+	const uint32_t samples = std::clamp(width / (4 * SOURCE_SIZE), 1u, 4u);
+	const float sampleWeight = 1.f / static_cast<float>(samples * samples);
+	jobSystem.parallelFor(FACE_COUNT * SOURCE_SIZE, ROW_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t row = begin; row < end; row++)
+			{
+				const uint32_t face = row / SOURCE_SIZE;
+				const uint32_t y = row % SOURCE_SIZE;
+				for (uint32_t x = 0; x < SOURCE_SIZE; x++)
+				{
+					glm::vec4 texel(0.f);
+					for (uint32_t sy = 0; sy < samples; sy++)
+					{
+						for (uint32_t sx = 0; sx < samples; sx++)
+						{
+							const float s = 2.f * (static_cast<float>(x) + (static_cast<float>(sx) + 0.5f) / static_cast<float>(samples)) / SOURCE_SIZE - 1.f;
+							const float t = 2.f * (static_cast<float>(y) + (static_cast<float>(sy) + 0.5f) / static_cast<float>(samples)) / SOURCE_SIZE - 1.f;
+							addWeighted(texel, sampleEquirect(pixels, width, height, glm::normalize(faceDirection(face, s, t))), sampleWeight);
+						}
+					}
+					m_source[0][row * SOURCE_SIZE + x] = texel;
+				}
+			}
+		});
+
+	//2x2 box filter, each face on its own
+	for (uint32_t level = 1; level < levelCount; level++)
+	{
+		const uint32_t size = SOURCE_SIZE >> level;
+		const uint32_t parentSize = size * 2;
+		const std::vector<glm::vec4>& parent = m_source[level - 1];
+		std::vector<glm::vec4>& texels = m_source[level];
+		texels.resize(static_cast<size_t>(FACE_COUNT) * size * size);
+		for (uint32_t face = 0; face < FACE_COUNT; face++)
+		{
+			const glm::vec4* parentFace = parent.data() + static_cast<size_t>(face) * parentSize * parentSize;
+			for (uint32_t y = 0; y < size; y++)
+			{
+				for (uint32_t x = 0; x < size; x++)
+				{
+					glm::vec4 texel(0.f);
+					addWeighted(texel, parentFace[(y * 2) * parentSize + x * 2], 0.25f);
+					addWeighted(texel, parentFace[(y * 2) * parentSize + x * 2 + 1], 0.25f);
+					addWeighted(texel, parentFace[(y * 2 + 1) * parentSize + x * 2], 0.25f);
+					addWeighted(texel, parentFace[(y * 2 + 1) * parentSize + x * 2 + 1], 0.25f);
+					texels[(static_cast<size_t>(face) * size + y) * size + x] = texel;
+				}
+			}
+		}
+	}
+}
+
+void EnvironmentFilter::filterIrradiance(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment)
+{
+	uint32_t harmonicsLevel = 0;
+	while ((SOURCE_SIZE >> harmonicsLevel) > HARMONICS_SIZE)
+		harmonicsLevel++;
+	const uint32_t size = SOURCE_SIZE >> harmonicsLevel;
+	const std::vector<glm::vec4>& texels = m_source[harmonicsLevel];
+
+	//each worker sums its own rows, weighted by the solid angle of their texels
+	std::vector<std::array<glm::vec4, HARMONICS_COUNT>> partialSums(jobSystem.getThreadCount());
+	for (auto& sums : partialSums)
+		sums.fill(glm::vec4(0.f));
+	jobSystem.parallelFor(FACE_COUNT * size, ROW_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, const uint32_t worker)
+		{
+			std::array<glm::vec4, HARMONICS_COUNT>& sums = partialSums[worker];
+			for (uint32_t row = begin; row < end; row++)
+			{
+				const uint32_t face = row / size;
+				const uint32_t y = row % size;
+				for (uint32_t x = 0; x < size; x++)
+				{
+					const float s = 2.f * (static_cast<float>(x) + 0.5f) / static_cast<float>(size) - 1.f;
+					const float t = 2.f * (static_cast<float>(y) + 0.5f) / static_cast<float>(size) - 1.f;
+					const float distanceSquared = 1.f + s * s + t * t;
+					const float solidAngle = 4.f / (static_cast<float>(size * size) * distanceSquared * std::sqrt(distanceSquared));
+					const std::array<float, HARMONICS_COUNT> basis = harmonics(glm::normalize(faceDirection(face, s, t)));
+					const glm::vec4& texel = texels[row * size + x];
+					for (uint32_t i = 0; i < HARMONICS_COUNT; i++)
+						addWeighted(sums[i], texel, basis[i] * solidAngle);
+				}
+			}
+		});
+
+	//convolved with the cosine lobe, and over pi
+	const float bands[HARMONICS_COUNT] = { 1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+	std::array<glm::vec4, HARMONICS_COUNT> coefficients;
+	coefficients.fill(glm::vec4(0.f));
+	for (const auto& sums : partialSums)
+		for (uint32_t i = 0; i < HARMONICS_COUNT; i++)
+			addWeighted(coefficients[i], sums[i], bands[i]);
+
+	uint8_t* destination = outEnvironment.data.data() + outEnvironment.irradiance.offset;
+	for (uint32_t face = 0; face < FACE_COUNT; face++)
+	{
+		for (uint32_t y = 0; y < IRRADIANCE_SIZE; y++)
+		{
+			for (uint32_t x = 0; x < IRRADIANCE_SIZE; x++)
+			{
+				const std::array<float, HARMONICS_COUNT> basis = harmonics(texelDirection(face, x, y, IRRADIANCE_SIZE));
+				glm::vec4 irradiance(0.f);
+				for (uint32_t i = 0; i < HARMONICS_COUNT; i++)
+					addWeighted(irradiance, coefficients[i], basis[i]);
+				writeHalf4(destination + ((face * IRRADIANCE_SIZE + y) * IRRADIANCE_SIZE + x) * 8, glm::max(irradiance, glm::vec4(0.f)));
+			}
+		}
+	}
+}
+
+void EnvironmentFilter::filterSpecular(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment)
+{
+	const float maxLod = static_cast<float>(m_source.size() - 1);
+	const float texelSolidAngle = 4.f * glm::pi<float>() / (FACE_COUNT * SOURCE_SIZE * SOURCE_SIZE);
+
+	for (uint32_t level = 0; level < SPECULAR_MIP_COUNT; level++)
+	{
+		const uint32_t size = SPECULAR_SIZE >> level;
+		const float roughness = static_cast<float>(level) / static_cast<float>(SPECULAR_MIP_COUNT - 1);
+		const float a = roughness * roughness;
+
+		//the lobe only depends on the roughness with n = v = r, it is rotated around each texel.
+		//Each sample reads the source mip whose texels cover about its own solid angle, one more level to blur it
+		std::vector<LobeSample> lobe;
+		if (level == 0)
+			lobe.push_back({ glm::vec3(0.f, 0.f, 1.f), 1.f, std::log2(static_cast<float>(SOURCE_SIZE / SPECULAR_SIZE)) });
+		else
+		{
+			for (uint32_t i = 0; i < SPECULAR_SAMPLE_COUNT; i++)
+			{
+				const glm::vec3 h = importanceSampleGgx(hammersley(i, SPECULAR_SAMPLE_COUNT), a);
+				const glm::vec3 l = 2.f * h.z * h - glm::vec3(0.f, 0.f, 1.f);
+				if (l.z <= 0.f)
+					continue;
+
+				const float d = (h.z * h.z) * (a * a - 1.f) + 1.f;
+				const float distribution = a * a / (glm::pi<float>() * d * d);
+				const float pdf = distribution * 0.25f;
+				const float sampleSolidAngle = 1.f / (static_cast<float>(SPECULAR_SAMPLE_COUNT) * pdf + 1e-4f);
+				const float lod = std::clamp(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.f, 0.f, maxLod);
+				lobe.push_back({ l, l.z, lod });
+			}
+		}
+
+		float weightSum = 0.f;
+		for (const LobeSample& sample : lobe)
+			weightSum += sample.weight;
+		const float normalization = 1.f / weightSum;
+
+		uint8_t* destination = outEnvironment.data.data() + outEnvironment.specular[level].offset;
+		jobSystem.parallelFor(FACE_COUNT * size, ROW_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+			{
+				for (uint32_t row = begin; row < end; row++)
+				{
+					const uint32_t face = row / size;
+					const uint32_t y = row % size;
+					for (uint32_t x = 0; x < size; x++)
+					{
+						const glm::vec3 n = texelDirection(face, x, y, size);
+						const glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(1.f, 0.f, 0.f);
+						const glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+						const glm::vec3 bitangent = glm::cross(n, tangent);
+
+						glm::vec4 texel(0.f);
+						for (const LobeSample& sample : lobe)
+						{
+							const glm::vec3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+							addWeighted(texel, sampleSource(l, sample.lod), sample.weight * normalization);
+						}
+						writeHalf4(destination + (static_cast<size_t>(row) * size + x) * 8, texel);
+					}
+				}
+			});
+	}
+}
+
+void EnvironmentFilter::integrateBrdf(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment)
+{
+	uint8_t* destination = outEnvironment.data.data() + outEnvironment.brdf.offset;
+	jobSystem.parallelFor(BRDF_SIZE, ROW_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const float roughness = (static_cast<float>(y) + 0.5f) / BRDF_SIZE;
+				const float a = roughness * roughness;
+				//the k of the Schlick-GGX visibility for image based lighting
+				const float k = a * 0.5f;
+				for (uint32_t x = 0; x < BRDF_SIZE; x++)
+				{
+					const float nDotv = (static_cast<float>(x) + 0.5f) / BRDF_SIZE;
+					const glm::vec3 v(std::sqrt(1.f - nDotv * nDotv), 0.f, nDotv);
+
+					glm::vec2 scaleBias(0.f);
+					for (uint32_t i = 0; i < BRDF_SAMPLE_COUNT; i++)
+					{
+						const glm::vec3 h = importanceSampleGgx(hammersley(i, BRDF_SAMPLE_COUNT), a);
+						const float vDoth = glm::dot(v, h);
+						const glm::vec3 l = 2.f * vDoth * h - v;
+						if (l.z <= 0.f)
+							continue;
+
+						const float g = nDotv / (nDotv * (1.f - k) + k) * l.z / (l.z * (1.f - k) + k);
+						const float visibility = g * std::max(vDoth, 0.f) / (h.z * nDotv);
+						const float fresnel = std::pow(1.f - std::max(vDoth, 0.f), 5.f);
+						scaleBias += glm::vec2(1.f - fresnel, fresnel) * visibility;
+					}
+					writeHalf2(destination + (static_cast<size_t>(y) * BRDF_SIZE + x) * 4, scaleBias / static_cast<float>(BRDF_SAMPLE_COUNT));
+				}
+			}
+		});
+}
+
+glm::vec4 EnvironmentFilter::sampleSource(const glm::vec3& direction, const float lod) const
+{
+	float u, v;
+	const uint32_t face = directionFace(direction, u, v);
+
+	const auto level = static_cast<uint32_t>(lod);
+	const float blend = lod - static_cast<float>(level);
+	glm::vec4 result = sampleFace(m_source[level], SOURCE_SIZE >> level, face, u, v);
+	if (blend > 0.f && level + 1 < m_source.size())
+	{
+		result *= 1.f - blend;
+		addWeighted(result, sampleFace(m_source[level + 1], SOURCE_SIZE >> (level + 1), face, u, v), blend);
+	}
+	return result;
+}
+
+const char* EnvironmentFilter::getInstructionSet()
+{
+#if defined(VK_ENVIRONMENT_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_asset.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Image based lighting of an HDR environment, shared by the engine and the AssetCooker
+namespace vkutil
+{
+	constexpr uint32_t COOKED_ENVIRONMENT_MAGIC = 0x56454B56; // "VKEV"
+	constexpr uint32_t ENVIRONMENT_VERSION = 1;
+
+	constexpr const char* COOKED_ENVIRONMENT_EXTENSION = ".vkenv";
+
+	// everything the shading samples, in RGBA16F for the cubes and RG16F for the lookup table.
+	// A cube level holds its six faces one after the other, in the +x, -x, +y, -y, +z, -z order
+	struct CookedEnvironment
+	{
+		// hash of the HDR file the maps were filtered from
+		uint64_t sourceHash{ 0 };
+		// irradiance over pi, the light a white diffuse surface of that normal reflects
+		CookedMipLevel irradiance{};
+		// the environment convolved with GGX lobes, the roughness goes from 0 at the first level to 1 at the last
+		std::vector<CookedMipLevel> specular;
+		// scale and bias of f0 in the split sum, indexed by dot(n, v) along u and the roughness along v
+		CookedMipLevel brdf{};
+		std::vector<uint8_t> data;
+	};
+
+	bool saveCookedEnvironment(const char* filePath, const CookedEnvironment& environment);
+	bool loadCookedEnvironment(const char* filePath, CookedEnvironment& outEnvironment);
+}
+
+struct EnvironmentFilterStats
+{
+	uint32_t sourceWidth = 0;
+	uint32_t sourceHeight = 0;
+	float irradianceMilliseconds = 0.f;
+	float specularMilliseconds = 0.f;
+	float brdfMilliseconds = 0.f;
+};
+
+// Precomputes the image based lighting of an equirectangular HDR environment on the CPU, without any device so that
+// it runs headless. The environment is first resampled into a cube with its mip chain.
+// The irradiance comes from its projection on nine spherical harmonics. The specular levels importance sample the GGX
+// lobe of their roughness and read the mip whose texels cover the solid angle of each sample, which keeps the sample
+// count low without the noise. The BRDF lookup table integrates the same lobe against the Smith visibility.
+// Texels are RGBA floats, blended and accumulated as a single SSE register. Faces and rows are spread over the JobSystem
+class EnvironmentFilter
+{
+public:
+	static constexpr uint32_t SOURCE_SIZE = 256;
+	static constexpr uint32_t IRRADIANCE_SIZE = 32;
+	static constexpr uint32_t SPECULAR_SIZE = 128;
+	static constexpr uint32_t SPECULAR_MIP_COUNT = 6;
+	static constexpr uint32_t BRDF_SIZE = 128;
+
+	// decodes a Radiance .hdr file into linear RGBA floats
+	static bool decode(const uint8_t* bytes, size_t size, std::vector<float>& outPixels, uint32_t& outWidth, uint32_t& outHeight);
+
+	// pixels are linear RGBA, width twice the height. outEnvironment gets everything but its source hash
+	void filter(JobSystem& jobSystem, const float* pixels, uint32_t width, uint32_t height, vkutil::CookedEnvironment& outEnvironment);
+
+	const EnvironmentFilterStats& getStats() const { return m_stats; }
+	static const char* getInstructionSet();
+
+private:
+	void buildSource(JobSystem& jobSystem, const float* pixels, uint32_t width, uint32_t height);
+	void filterIrradiance(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment);
+	void filterSpecular(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment);
+	void integrateBrdf(JobSystem& jobSystem, vkutil::CookedEnvironment& outEnvironment);
+	// trilinear, the faces are clamped at their edges
+	glm::vec4 sampleSource(const glm::vec3& direction, float lod) const;
+
+	// every mip of the source cube, level l has faces of SOURCE_SIZE >> l texels per side
+	std::vector<std::vector<glm::vec4>> m_source;
+	EnvironmentFilterStats m_stats;
+};
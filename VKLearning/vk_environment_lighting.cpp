@@ -0,0 +1,216 @@
+#include "vk_environment_lighting.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "vk_asset.h"
+#include "vk_engine.h"
+#include "vk_hash.h"
+#include "vk_initializers.h"
+#include "vk_pack.h"
+
+namespace
+{
+	constexpr VkFormat CUBE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+	constexpr VkFormat BRDF_FORMAT = VK_FORMAT_R16G16_SFLOAT;
+	constexpr uint32_t FACE_COUNT = 6;
+
+	// single black texels, bound while there is no environment
+	vkutil::CookedEnvironment makeEmptyEnvironment()
+	{
+		vkutil::CookedEnvironment environment;
+		environment.irradiance = { 1, 1, 0, FACE_COUNT * 8 };
+		environment.specular = { { 1, 1, FACE_COUNT * 8, FACE_COUNT * 8 } };
+		environment.brdf = { 1, 1, 2 * FACE_COUNT * 8, 4 };
+		environment.data.assign(2 * FACE_COUNT * 8 + 4, 0);
+		return environment;
+	}
+
+	VkBufferImageCopy copyRegion(const vkutil::CookedMipLevel& level, const uint32_t mipLevel, const uint32_t layerCount)
+	{
+		VkBufferImageCopy region = {};
+		region.bufferOffset = level.offset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = mipLevel;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = layerCount;
+		region.imageExtent = { level.width, level.height, 1 };
+		return region;
+	}
+}
+
+void EnvironmentLighting::init(VulkanEngine& engine, const std::string& environmentPath)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	vkutil::CookedEnvironment environment;
+	m_stats.loaded = load(engine, environmentPath, environment);
+	if (!m_stats.loaded)
+		environment = makeEmptyEnvironment();
+	m_specularMipCount = static_cast<uint32_t>(environment.specular.size());
+
+	createMap(CUBE_FORMAT, environment.irradiance.width, 1, true, m_irradiance);
+	createMap(CUBE_FORMAT, environment.specular[0].width, m_specularMipCount, true, m_specular);
+	createMap(BRDF_FORMAT, environment.brdf.width, 1, false, m_brdf);
+	upload(engine, environment);
+	m_stats.loadMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	//the roughest level is blurred enough for linear filtering between the levels
+	VkSamplerCreateInfo samplerInfo = vkinit::samplerCreateInfo(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler));
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroySampler(m_device, m_sampler, nullptr);
+			for (const EnvironmentMap* map : { &m_irradiance, &m_specular, &m_brdf })
+			{
+				vkDestroyImageView(m_device, map->view, nullptr);
+				vmaDestroyImage(m_allocator, map->image.image, map->image.allocation);
+			}
+		});
+}
+
+glm::vec4 EnvironmentLighting::getSceneParameters() const
+{
+	const float intensity = m_enabled && m_stats.loaded ? m_intensity : 0.f;
+	return glm::vec4(intensity, static_cast<float>(m_specularMipCount - 1), 0.f, 0.f);
+}
+
+VkDescriptorImageInfo EnvironmentLighting::getIrradianceInfo() const
+{
+	return { m_sampler, m_irradiance.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+}
+
+VkDescriptorImageInfo EnvironmentLighting::getSpecularInfo() const
+{
+	return { m_sampler, m_specular.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+}
+
+VkDescriptorImageInfo EnvironmentLighting::getBrdfInfo() const
+{
+	return { m_sampler, m_brdf.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+}
+
+bool EnvironmentLighting::load(VulkanEngine& engine, const std::string& environmentPath, vkutil::CookedEnvironment& outEnvironment)
+{
+	const std::string cookedPath = vkutil::getCookedPath(environmentPath, vkutil::COOKED_ENVIRONMENT_EXTENSION);
+	const bool cooked = vkutil::assetExists(cookedPath);
+
+	//a pack only holds the cooked maps, they are taken as they are like the cooked meshes
+	vkutil::FileData source;
+	if (!vkutil::assetExists(environmentPath) || !vkutil::readFile(environmentPath, source))
+	{
+		m_stats.fromCache = cooked && vkutil::loadCookedEnvironment(cookedPath.c_str(), outEnvironment);
+		return m_stats.fromCache;
+	}
+
+	const uint64_t sourceHash = vkutil::hash64(source.data(), source.size());
+	if (cooked && vkutil::loadCookedEnvironment(cookedPath.c_str(), outEnvironment) && outEnvironment.sourceHash == sourceHash)
+	{
+		m_stats.fromCache = true;
+		return true;
+	}
+
+	std::vector<float> pixels;
+	if (!EnvironmentFilter::decode(source.data(), source.size(), pixels, m_stats.sourceWidth, m_stats.sourceHeight))
+	{
+		std::cout << "Could not decode the environment " << environmentPath << std::endl;
+		return false;
+	}
+
+	EnvironmentFilter filter;
+	outEnvironment = {};
+	filter.filter(engine.m_jobSystem, pixels.data(), m_stats.sourceWidth, m_stats.sourceHeight, outEnvironment);
+	outEnvironment.sourceHash = sourceHash;
+	m_filterStats = filter.getStats();
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(cookedPath).parent_path(), error);
+	if (!vkutil::saveCookedEnvironment(cookedPath.c_str(), outEnvironment))
+		std::cout << "Could not write " << cookedPath << std::endl;
+	return true;
+}
+
+void EnvironmentLighting::createMap(const VkFormat format, const uint32_t size, const uint32_t mipCount, const bool cube, EnvironmentMap& outMap)
+{
+	VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, { size, size, 1 });
+	imageInfo.mipLevels = mipCount;
+	if (cube)
+	{
+		imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+		imageInfo.arrayLayers = FACE_COUNT;
+	}
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &outMap.image.image, &outMap.image.allocation, nullptr));
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(format, outMap.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = mipCount;
+	if (cube)
+	{
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+		viewInfo.subresourceRange.layerCount = FACE_COUNT;
+	}
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &outMap.view));
+}
+
+void EnvironmentLighting::upload(VulkanEngine& engine, const vkutil::CookedEnvironment& environment)
+{
+	const AllocatedBuffer stagingBuffer = engine.createBuffer(environment.data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	void* data;
+	vmaMapMemory(m_allocator, stagingBuffer.allocation, &data);
+	memcpy(data, environment.data.data(), environment.data.size());
+	vmaUnmapMemory(m_allocator, stagingBuffer.allocation);
+
+	engine.immediateSubmit([&](VkCommandBuffer cmd)
+		{
+			const struct { VkImage image; uint32_t mipCount; uint32_t layerCount; } maps[] = {
+				{ m_irradiance.image.image, 1, FACE_COUNT },
+				{ m_specular.image.image, m_specularMipCount, FACE_COUNT },
+				{ m_brdf.image.image, 1, 1 }
+			};
+
+			VkImageMemoryBarrier barriers[3] = {};
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barriers[i].image = maps[i].image;
+				barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, maps[i].mipCount, 0, maps[i].layerCount };
+				barriers[i].srcAccessMask = 0;
+				barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			}
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 3, barriers);
+
+			//the six faces of a level are contiguous, one copy per level
+			const VkBufferImageCopy irradianceRegion = copyRegion(environment.irradiance, 0, FACE_COUNT);
+			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, m_irradiance.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &irradianceRegion);
+			std::vector<VkBufferImageCopy> specularRegions;
+			for (uint32_t level = 0; level < m_specularMipCount; level++)
+				specularRegions.push_back(copyRegion(environment.specular[level], level, FACE_COUNT));
+			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, m_specular.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(specularRegions.size()), specularRegions.data());
+			const VkBufferImageCopy brdfRegion = copyRegion(environment.brdf, 0, 1);
+			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, m_brdf.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &brdfRegion);
+
+			for (VkImageMemoryBarrier& barrier : barriers)
+			{
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			}
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 3, barriers);
+		});
+
+	vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+}
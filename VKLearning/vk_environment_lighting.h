@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_environment.h"
+
+#include <string>
+
+class VulkanEngine;
+
+struct EnvironmentLightingStats
+{
+	bool loaded = false;
+	// read from the cooked file instead of filtered at startup
+	bool fromCache = false;
+	uint32_t sourceWidth = 0;
+	uint32_t sourceHeight = 0;
+	float loadMilliseconds = 0.f;
+};
+
+// Lighting of an HDR environment surrounding the scene, with two lookups per pixel instead of an integral: the
+// irradiance cube for the diffuse part, the level of the prefiltered cube matching the roughness for the specular one,
+// scaled by the BRDF lookup table. The EnvironmentFilter precomputes them once, the result is cached next to the
+// environment and keyed by its hash so that the following runs only read it, the AssetCooker cooks it as well.
+// Without any environment the maps are black and the shading skips them.
+class EnvironmentLighting
+{
+public:
+	// loads or filters the environment, blocks until its maps are uploaded
+	void init(VulkanEngine& engine, const std::string& environmentPath);
+
+	// x the intensity, 0 while disabled, y the mip of the roughest specular level. For GPUSceneData::environment
+	glm::vec4 getSceneParameters() const;
+	VkDescriptorImageInfo getIrradianceInfo() const;
+	VkDescriptorImageInfo getSpecularInfo() const;
+	VkDescriptorImageInfo getBrdfInfo() const;
+	const EnvironmentLightingStats& getStats() const { return m_stats; }
+	const EnvironmentFilterStats& getFilterStats() const { return m_filterStats; }
+
+	bool  m_enabled{ true };
+	float m_intensity{ 1.f };
+
+private:
+	struct EnvironmentMap
+	{
+		AllocatedImage image{};
+		VkImageView view{ VK_NULL_HANDLE };
+	};
+
+	// the cooked maps when they match the source, filtered from it and cached otherwise
+	bool load(VulkanEngine& engine, const std::string& environmentPath, vkutil::CookedEnvironment& outEnvironment);
+	void createMap(VkFormat format, uint32_t size, uint32_t mipCount, bool cube, EnvironmentMap& outMap);
+	void upload(VulkanEngine& engine, const vkutil::CookedEnvironment& environment);
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	EnvironmentMap m_irradiance;
+	EnvironmentMap m_specular;
+	EnvironmentMap m_brdf;
+	VkSampler m_sampler{ VK_NULL_HANDLE };
+	uint32_t m_specularMipCount{ 0 };
+
+	EnvironmentLightingStats m_stats;
+	EnvironmentFilterStats m_filterStats;
+};
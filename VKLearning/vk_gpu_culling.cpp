@@ -0,0 +1,467 @@
+#include "vk_gpu_culling.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_utils.h"
+
+namespace
+{
+	constexpr uint32_t CULL_GROUP_SIZE = 256;
+	constexpr uint32_t COMPACT_GROUP_SIZE = 64;
+
+	// push constants of both compute shaders, the rest is in GPUCullData
+	struct CullConstants
+	{
+		uint32_t phase;
+	};
+	static_assert(sizeof(GPUInstanceData) == 96, "must match InstanceData in the shaders");
+	static_assert(sizeof(GPUCullData) == 224, "must match the std140 CullData in the shaders");
+
+	enum CullBinding : uint32_t
+	{
+		BINDING_INSTANCES = 0,
+		BINDING_GROUPS,
+		BINDING_DRAWS,
+		BINDING_VISIBLE,
+		BINDING_COMPACTED_DRAWS,
+		BINDING_DRAW_COUNTS,
+		BINDING_VISIBILITY,
+		BINDING_CULL_DATA,
+		BINDING_DEPTH_PYRAMID,
+		BINDING_COUNT,
+		STORAGE_BINDING_COUNT = BINDING_CULL_DATA
+	};
+
+	void memoryBarrier(const VkCommandBuffer cmd, const VkPipelineStageFlags srcStage, const VkAccessFlags srcAccess, const VkPipelineStageFlags dstStage, const VkAccessFlags dstAccess)
+	{
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	VkPipeline createComputePipeline(const VkDevice device, const VkPipelineLayout layout, const VkShaderModule shader)
+	{
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+		pipelineInfo.layout = layout;
+
+		VkPipeline pipeline;
+		VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+		return pipeline;
+	}
+}
+
+void GPUCuller::init(VulkanEngine& engine, const DepthPyramid& depthPyramid)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_depthExtent = engine.m_windowExtent;
+
+	//the instance counts written by the shader are only read from firstInstance on with this feature
+	m_supported = engine.m_enabledFeatures.drawIndirectFirstInstance;
+	if (engine.m_drawIndirectCount)
+		m_drawPath = IndirectDrawPath::Count;
+	else if (engine.m_enabledFeatures.multiDrawIndirect)
+		m_drawPath = IndirectDrawPath::MultiDraw;
+	else
+		m_drawPath = IndirectDrawPath::SingleDraw;
+
+	VkDescriptorSetLayoutBinding bindings[BINDING_COUNT];
+	for (uint32_t i = 0; i < STORAGE_BINDING_COUNT; i++)
+		bindings[i] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, i);
+	bindings[BINDING_CULL_DATA] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, BINDING_CULL_DATA);
+	bindings[BINDING_DEPTH_PYRAMID] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, BINDING_DEPTH_PYRAMID);
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = BINDING_COUNT;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = engine.m_descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	allocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, m_sets.data()));
+
+	//the cull data is written every frame, the pyramid never changes of image
+	m_cullDataStride = engine.padUniformBufferSize(sizeof(GPUCullData));
+	m_cullDataBuffer = engine.createBuffer(FRAME_OVERLAP * m_cullDataStride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		VkDescriptorBufferInfo cullDataInfo;
+		cullDataInfo.buffer = m_cullDataBuffer.buffer;
+		cullDataInfo.offset = i * m_cullDataStride;
+		cullDataInfo.range = sizeof(GPUCullData);
+
+		VkDescriptorImageInfo pyramidInfo;
+		pyramidInfo.sampler = depthPyramid.getSampler();
+		pyramidInfo.imageView = depthPyramid.getView();
+		pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		const VkWriteDescriptorSet writes[] = {
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_sets[i], &cullDataInfo, BINDING_CULL_DATA),
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_sets[i], &pyramidInfo, BINDING_DEPTH_PYRAMID)
+		};
+		vkUpdateDescriptorSets(m_device, 2, writes, 0, nullptr);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			destroyBuffers();
+			vmaDestroyBuffer(m_allocator, m_cullDataBuffer.buffer, m_cullDataBuffer.allocation);
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+		});
+}
+
+void GPUCuller::initPipelines(VulkanEngine& engine, const VkShaderModule cullShader, const VkShaderModule compactShader)
+{
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(CullConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_setLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	m_cullPipeline = createComputePipeline(m_device, m_pipelineLayout, cullShader);
+	m_compactPipeline = createComputePipeline(m_device, m_pipelineLayout, compactShader);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_cullPipeline, nullptr);
+			vkDestroyPipeline(m_device, m_compactPipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		});
+}
+
+void GPUCuller::destroyBuffers()
+{
+	for (AllocatedBuffer* buffer : { &m_instanceBuffer, &m_groupBuffer, &m_drawTemplateBuffer, &m_drawBuffer, &m_visibleBuffer, &m_compactedDrawBuffer, &m_drawCountBuffer, &m_visibilityBuffer })
+	{
+		if (buffer->buffer != VK_NULL_HANDLE)
+			vmaDestroyBuffer(m_allocator, buffer->buffer, buffer->allocation);
+		*buffer = {};
+	}
+}
+
+void GPUCuller::buildScene(VulkanEngine& engine, const RenderObject* objects, const uint32_t count, const uint64_t sceneVersion)
+{
+	//the previous frames may still read the buffers
+	vkDeviceWaitIdle(m_device);
+	destroyBuffers();
+	m_groups.clear();
+	m_skippedObjects.clear();
+	m_sceneObjectCount = count;
+	m_sceneVersion = sceneVersion;
+
+	//one group per mesh and material, the instances keep the order of the objects
+	std::map<std::pair<const Material*, const Mesh*>, uint32_t> groupIds;
+	std::vector<uint32_t> groupSizes;
+	std::vector<GPUInstanceData> instances;
+	instances.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const RenderObject& object = objects[i];
+		if (!object.mesh || !object.material || object.mesh->m_lods.empty())
+			continue;
+		if (object.material->indirectPipeline == VK_NULL_HANDLE)
+		{
+			m_skippedObjects.push_back(i);
+			continue;
+		}
+
+		const auto [it, inserted] = groupIds.try_emplace({ object.material, object.mesh }, static_cast<uint32_t>(m_groups.size()));
+		if (inserted)
+		{
+			const uint32_t lodCount = static_cast<uint32_t>(object.mesh->m_lods.size());
+			m_groups.push_back({ object.mesh, object.material, 0, lodCount });
+			groupSizes.push_back(0);
+		}
+		groupSizes[it->second]++;
+
+		GPUInstanceData& instance = instances.emplace_back();
+		instance.modelMatrix = object.transformMatrix;
+		instance.sphere = vkutil::computeWorldSphere(object.transformMatrix, *object.mesh);
+		instance.group = it->second;
+	}
+
+	//every lod of a group reserves room for all of its instances in the visible buffer, for each phase
+	std::vector<GPUDrawGroup> gpuGroups;
+	std::vector<VkDrawIndexedIndirectCommand> drawTemplates;
+	uint32_t visibleCount = 0;
+	for (uint32_t g = 0; g < m_groups.size(); g++)
+	{
+		DrawGroup& group = m_groups[g];
+		group.firstDraw = static_cast<uint32_t>(drawTemplates.size());
+		gpuGroups.push_back({ group.firstDraw, group.lodCount, {} });
+
+		for (const MeshLod& lod : group.mesh->m_lods)
+		{
+			VkDrawIndexedIndirectCommand& draw = drawTemplates.emplace_back();
+			draw.indexCount = lod.indexCount;
+			draw.instanceCount = 0;
+			draw.firstIndex = lod.firstIndex;
+			draw.vertexOffset = 0;
+			draw.firstInstance = visibleCount;
+			visibleCount += groupSizes[g];
+		}
+	}
+
+	//the late phase commands follow the early ones, their instances are after the early ids
+	m_instanceCount = static_cast<uint32_t>(instances.size());
+	m_drawCommandCount = static_cast<uint32_t>(drawTemplates.size());
+	for (uint32_t i = 0; i < m_drawCommandCount; i++)
+	{
+		VkDrawIndexedIndirectCommand draw = drawTemplates[i];
+		draw.firstInstance += visibleCount;
+		drawTemplates.push_back(draw);
+	}
+	m_stats = {};
+	m_stats.instanceCount = m_instanceCount;
+	m_stats.groupCount = static_cast<uint32_t>(m_groups.size());
+	m_stats.drawCommandCount = m_drawCommandCount;
+
+	//empty buffers cannot be bound, an empty scene keeps one unused element
+	const size_t instanceSize = std::max<size_t>(instances.size(), 1) * sizeof(GPUInstanceData);
+	const size_t groupSize = std::max<size_t>(gpuGroups.size(), 1) * sizeof(GPUDrawGroup);
+	const size_t drawSize = std::max<size_t>(drawTemplates.size(), 1) * sizeof(VkDrawIndexedIndirectCommand);
+	const size_t visibleSize = std::max<size_t>(PHASE_COUNT * visibleCount, 1) * sizeof(uint32_t);
+	const size_t drawCountSize = std::max<size_t>(PHASE_COUNT * gpuGroups.size(), 1) * sizeof(uint32_t);
+	const size_t visibilitySize = std::max<size_t>(instances.size(), 1) * sizeof(uint32_t);
+
+	m_instanceBuffer = engine.createBuffer(instanceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_groupBuffer = engine.createBuffer(groupSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_drawTemplateBuffer = engine.createBuffer(drawSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_drawBuffer = engine.createBuffer(drawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_visibleBuffer = engine.createBuffer(visibleSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_compactedDrawBuffer = engine.createBuffer(drawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_drawCountBuffer = engine.createBuffer(drawCountSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_visibilityBuffer = engine.createBuffer(visibilitySize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	//one staging buffer holds the instances, the groups and the draw templates
+	const size_t instanceBytes = instances.size() * sizeof(GPUInstanceData);
+	const size_t groupBytes = gpuGroups.size() * sizeof(GPUDrawGroup);
+	const size_t drawBytes = drawTemplates.size() * sizeof(VkDrawIndexedIndirectCommand);
+	if (instanceBytes > 0)
+	{
+		AllocatedBuffer stagingBuffer = engine.createBuffer(instanceBytes + groupBytes + drawBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+		char* data;
+		vmaMapMemory(m_allocator, stagingBuffer.allocation, reinterpret_cast<void**>(&data));
+		memcpy(data, instances.data(), instanceBytes);
+		memcpy(data + instanceBytes, gpuGroups.data(), groupBytes);
+		memcpy(data + instanceBytes + groupBytes, drawTemplates.data(), drawBytes);
+		vmaUnmapMemory(m_allocator, stagingBuffer.allocation);
+
+		engine.immediateSubmit([&](const VkCommandBuffer cmd)
+			{
+				VkBufferCopy copy{ 0, 0, instanceBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_instanceBuffer.buffer, 1, &copy);
+				copy = { instanceBytes, 0, groupBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_groupBuffer.buffer, 1, &copy);
+				copy = { instanceBytes + groupBytes, 0, drawBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_drawTemplateBuffer.buffer, 1, &copy);
+				//nothing is known to be occluded yet, the first early phase draws everything in the frustum
+				vkCmdFillBuffer(cmd, m_visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 1);
+			});
+		vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	}
+
+	const AllocatedBuffer* buffers[STORAGE_BINDING_COUNT] = { &m_instanceBuffer, &m_groupBuffer, &m_drawBuffer, &m_visibleBuffer, &m_compactedDrawBuffer, &m_drawCountBuffer, &m_visibilityBuffer };
+	const size_t sizes[STORAGE_BINDING_COUNT] = { instanceSize, groupSize, drawSize, visibleSize, drawSize, drawCountSize, visibilitySize };
+	VkDescriptorBufferInfo bufferInfos[STORAGE_BINDING_COUNT];
+	for (uint32_t i = 0; i < STORAGE_BINDING_COUNT; i++)
+	{
+		bufferInfos[i].buffer = buffers[i]->buffer;
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = sizes[i];
+	}
+	for (const VkDescriptorSet set : m_sets)
+	{
+		VkWriteDescriptorSet writes[STORAGE_BINDING_COUNT];
+		for (uint32_t i = 0; i < STORAGE_BINDING_COUNT; i++)
+			writes[i] = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &bufferInfos[i], i);
+		vkUpdateDescriptorSets(m_device, STORAGE_BINDING_COUNT, writes, 0, nullptr);
+	}
+}
+
+void GPUCuller::recordEarlyCulling(const VkCommandBuffer cmd, const uint32_t frameIndex, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition,
+	const bool allowOcclusion)
+{
+	if (m_instanceCount == 0)
+		return;
+
+	//the depth of the nearest point of a sphere is rebuilt from the projection, the near plane as well
+	GPUCullData cullData{};
+	const Frustum frustum = vkutil::extractFrustum(projection * view);
+	cullData.view = view;
+	cullData.projection = glm::vec4(projection[0][0], projection[1][1], projection[2][2], projection[3][2]);
+	std::copy(std::begin(frustum.planes), std::end(frustum.planes), cullData.planes);
+	cullData.cameraPosition = glm::vec4(cameraPosition, m_lodDistanceScale);
+	cullData.depthSize = glm::vec2(static_cast<float>(m_depthExtent.width), static_cast<float>(m_depthExtent.height));
+	cullData.znear = projection[3][2] / (projection[2][2] - 1.f);
+	cullData.occlusionEnabled = m_occlusionCulling && allowOcclusion ? 1 : 0;
+	cullData.instanceCount = m_instanceCount;
+	cullData.groupCount = static_cast<uint32_t>(m_groups.size());
+	cullData.drawCommandCount = m_drawCommandCount;
+
+	char* data;
+	vmaMapMemory(m_allocator, m_cullDataBuffer.allocation, reinterpret_cast<void**>(&data));
+	memcpy(data + frameIndex * m_cullDataStride, &cullData, sizeof(GPUCullData));
+	vmaUnmapMemory(m_allocator, m_cullDataBuffer.allocation);
+
+	//the draws and the late culling of the previous frame are done with the buffers before the counts go back to zero
+	memoryBarrier(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	const VkBufferCopy copy{ 0, 0, PHASE_COUNT * m_drawCommandCount * sizeof(VkDrawIndexedIndirectCommand) };
+	vkCmdCopyBuffer(cmd, m_drawTemplateBuffer.buffer, m_drawBuffer.buffer, 1, &copy);
+	memoryBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	dispatchPhase(cmd, PHASE_EARLY, frameIndex);
+}
+
+void GPUCuller::recordLateCulling(const VkCommandBuffer cmd, const uint32_t frameIndex)
+{
+	if (m_instanceCount == 0)
+		return;
+
+	//the visibility read by the early phase is overwritten by this one
+	memoryBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	dispatchPhase(cmd, PHASE_LATE, frameIndex);
+}
+
+void GPUCuller::dispatchPhase(const VkCommandBuffer cmd, const uint32_t phase, const uint32_t frameIndex) const
+{
+	const CullConstants constants{ phase };
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_sets[frameIndex], 0, nullptr);
+	vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+	vkCmdDispatch(cmd, (m_instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	//the count path only draws the non empty commands, moved to the start of their group
+	if (m_drawPath == IndirectDrawPath::Count)
+	{
+		const auto groupCount = static_cast<uint32_t>(m_groups.size());
+		memoryBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_compactPipeline);
+		vkCmdDispatch(cmd, (groupCount + COMPACT_GROUP_SIZE - 1) / COMPACT_GROUP_SIZE, 1, 1);
+	}
+
+	memoryBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
+
+void GPUCuller::recordDraws(const VkCommandBuffer cmd, const uint32_t phase, const uint32_t frameIndex, const VkDescriptorSet globalSet, const uint32_t globalOffset, const VkDescriptorSet objectSet,
+	const IndirectDrawPipeline drawPipeline)
+{
+	//the stats add up the draws of both phases, the depth equal draws always follow a prepass
+	if (phase == PHASE_EARLY && drawPipeline != IndirectDrawPipeline::DepthEqual && drawPipeline != IndirectDrawPipeline::Forward)
+		m_stats.recordedDraws = 0;
+	if (m_instanceCount == 0)
+		return;
+
+	constexpr uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+	const Mesh* boundMesh = nullptr;
+	for (uint32_t g = 0; g < m_groups.size(); g++)
+	{
+		const DrawGroup& group = m_groups[g];
+		const Material& material = *group.material;
+		VkPipeline pipeline = material.indirectPipeline;
+		VkPipelineLayout layout = material.indirectPipelineLayout;
+		if (drawPipeline == IndirectDrawPipeline::DepthPrepass)
+		{
+			//the materials without an equal variant are shaded with their regular pipeline, which writes their depth
+			if (material.indirectDepthEqualPipeline == VK_NULL_HANDLE)
+				continue;
+			pipeline = m_depthPrepassPipeline;
+			layout = m_depthPrepassPipelineLayout;
+		}
+		else if (drawPipeline == IndirectDrawPipeline::DepthEqual && material.indirectDepthEqualPipeline != VK_NULL_HANDLE)
+		{
+			pipeline = material.indirectDepthEqualPipeline;
+		}
+		else if (drawPipeline == IndirectDrawPipeline::GBuffer)
+		{
+			//the geometry subpass has no color attachment the other pipelines could write
+			if (material.indirectGbufferPipeline == VK_NULL_HANDLE)
+				continue;
+			pipeline = material.indirectGbufferPipeline;
+		}
+		else if (drawPipeline == IndirectDrawPipeline::Forward && material.indirectGbufferPipeline != VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		if (pipeline != boundPipeline)
+		{
+			boundPipeline = pipeline;
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		}
+		if (layout != boundLayout)
+		{
+			boundLayout = layout;
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &globalSet, 1, &globalOffset);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &objectSet, 0, nullptr);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &m_sets[frameIndex], 0, nullptr);
+		}
+		if (group.mesh != boundMesh)
+		{
+			boundMesh = group.mesh;
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &group.mesh->m_vertexBuffer.buffer, &offset);
+			vkCmdBindIndexBuffer(cmd, group.mesh->m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		}
+
+		const VkDeviceSize drawOffset = static_cast<VkDeviceSize>(phase * m_drawCommandCount + group.firstDraw) * stride;
+		switch (m_drawPath)
+		{
+		case IndirectDrawPath::Count:
+			vkCmdDrawIndexedIndirectCount(cmd, m_compactedDrawBuffer.buffer, drawOffset, m_drawCountBuffer.buffer, (phase * m_groups.size() + g) * sizeof(uint32_t), group.lodCount, stride);
+			m_stats.recordedDraws++;
+			break;
+		case IndirectDrawPath::MultiDraw:
+			vkCmdDrawIndexedIndirect(cmd, m_drawBuffer.buffer, drawOffset, group.lodCount, stride);
+			m_stats.recordedDraws++;
+			break;
+		case IndirectDrawPath::SingleDraw:
+			for (uint32_t lod = 0; lod < group.lodCount; lod++)
+				vkCmdDrawIndexedIndirect(cmd, m_drawBuffer.buffer, drawOffset + lod * stride, 1, stride);
+			m_stats.recordedDraws += group.lodCount;
+			break;
+		}
+	}
+}
+
+const char* GPUCuller::getDrawPathName() const
+{
+	switch (m_drawPath)
+	{
+	case IndirectDrawPath::Count:
+		return "indirect count";
+	case IndirectDrawPath::MultiDraw:
+		return "multi draw indirect";
+	default:
+		return "single draw indirect";
+	}
+}
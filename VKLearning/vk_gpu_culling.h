@@ -0,0 +1,180 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include "vk_culling.h"
+#include "vk_depth_pyramid.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+// instance as the culling shader reads it, the sphere is in world space
+GPU_DATA struct GPUInstanceData
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 sphere;
+	uint32_t group;
+	uint32_t padding[3];
+};
+
+// parameters of both culling phases, one copy per frame in flight
+GPU_DATA struct GPUCullData
+{
+	glm::mat4 view;
+	// P00, P11, P22 and P32 of the projection, enough to project the spheres and their depth
+	glm::vec4 projection;
+	glm::vec4 planes[6];
+	// w scales the distances at which the levels of detail switch
+	glm::vec4 cameraPosition;
+	glm::vec2 depthSize;
+	float znear;
+	uint32_t occlusionEnabled;
+	uint32_t instanceCount;
+	uint32_t groupCount;
+	uint32_t drawCommandCount;
+	uint32_t padding;
+};
+
+// the draw commands of a mesh and material pair, one per level of detail from firstDraw on
+struct GPUDrawGroup
+{
+	uint32_t firstDraw;
+	uint32_t lodCount;
+	uint32_t padding[2];
+};
+
+// how the draw commands written by the culling shader are consumed, from the cheapest to record to the most expensive
+enum class IndirectDrawPath : uint8_t
+{
+	// vkCmdDrawIndexedIndirectCount over the non empty commands of each group
+	Count,
+	// one vkCmdDrawIndexedIndirect over all the commands of each group, empty ones included
+	MultiDraw,
+	// one vkCmdDrawIndexedIndirect per command
+	SingleDraw,
+};
+
+// pipelines the indirect draws are recorded with
+enum class IndirectDrawPipeline : uint8_t
+{
+	// the indirect pipeline of the materials
+	Material,
+	// depth only, for the groups whose material has a depth equal variant
+	DepthPrepass,
+	// the depth equal variant of the materials, after the prepass
+	DepthEqual,
+	// the G-buffer variant of the materials, for the geometry subpass of the deferred path
+	GBuffer,
+	// the indirect pipeline of the groups without a G-buffer variant, after the lighting of the deferred path
+	Forward,
+};
+
+struct GPUCullingStats
+{
+	uint32_t instanceCount = 0;
+	uint32_t groupCount = 0;
+	uint32_t drawCommandCount = 0;
+	uint32_t recordedDraws = 0;
+};
+
+// Culls the instances against the frustum and picks their level of detail in a compute shader, which appends
+// the visible ones to the VkDrawIndexedIndirectCommand of their mesh, material and lod. Recording a frame then
+// costs a few calls per mesh and material, whatever the number of objects.
+// Occlusion is culled in two phases: the early phase draws what was visible last frame, the depth pyramid is built
+// from these draws, and the late phase tests every instance against it, drawing the ones that just became visible
+// and keeping the result for the next early phase.
+// The instances are uploaded once by buildScene, the scene is static until it is built again. The objects whose
+// material has no indirect pipeline are left to the render queue.
+class GPUCuller
+{
+public:
+	static constexpr uint32_t PHASE_EARLY = 0;
+	static constexpr uint32_t PHASE_LATE = 1;
+	static constexpr uint32_t PHASE_COUNT = 2;
+
+	// creates the descriptor set layout shared by the compute and the indirect graphics pipelines, and picks the
+	// draw path from the features enabled on the device. The late phase reads the pyramid
+	void init(VulkanEngine& engine, const DepthPyramid& depthPyramid);
+	void initPipelines(VulkanEngine& engine, VkShaderModule cullShader, VkShaderModule compactShader);
+	// the depth only pipeline of the prepass, its layout is the one of the indirect material pipelines
+	void setDepthPrepassPipeline(VkPipeline pipeline, VkPipelineLayout layout) { m_depthPrepassPipeline = pipeline; m_depthPrepassPipelineLayout = layout; }
+
+	// waits for the GPU to be idle and uploads the instances, objects without a mesh or an indirect pipeline are skipped.
+	// sceneVersion is the version of the static objects the scene is built from
+	void buildScene(VulkanEngine& engine, const RenderObject* objects, uint32_t count, uint64_t sceneVersion);
+	// resets the draw commands of both phases and culls the early one, recorded outside of the render pass.
+	// Without allowOcclusion the early phase draws everything in the frustum, whatever m_occlusionCulling is
+	void recordEarlyCulling(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition,
+		bool allowOcclusion = true);
+	// culls the late phase against the depth pyramid of the early draws, recorded outside of the render pass
+	void recordLateCulling(VkCommandBuffer cmd, uint32_t frameIndex);
+	// draws what the culling of the phase kept, the global and object sets are the ones of the regular pipelines
+	void recordDraws(VkCommandBuffer cmd, uint32_t phase, uint32_t frameIndex, VkDescriptorSet globalSet, uint32_t globalOffset, VkDescriptorSet objectSet,
+		IndirectDrawPipeline drawPipeline = IndirectDrawPipeline::Material);
+
+	// instance counts of the GPU culling need drawIndirectFirstInstance
+	bool isSupported() const { return m_supported; }
+	// number of render objects the current scene was built from
+	uint32_t getSceneObjectCount() const { return m_sceneObjectCount; }
+	uint64_t getSceneVersion() const { return m_sceneVersion; }
+	// indices of the objects with a mesh and a material that has no indirect pipeline, in increasing order
+	const std::vector<uint32_t>& getSkippedObjects() const { return m_skippedObjects; }
+	VkDescriptorSetLayout getSetLayout() const { return m_setLayout; }
+	const GPUCullingStats& getStats() const { return m_stats; }
+	const char* getDrawPathName() const;
+
+	// the level of detail changes every time the distance doubles past radius * scale
+	float m_lodDistanceScale{ 8.f };
+	// without it the early phase draws everything inside the frustum and the late phase nothing
+	bool m_occlusionCulling{ true };
+
+private:
+	struct DrawGroup
+	{
+		Mesh* mesh;
+		Material* material;
+		uint32_t firstDraw;
+		uint32_t lodCount;
+	};
+
+	void destroyBuffers();
+	void dispatchPhase(VkCommandBuffer cmd, uint32_t phase, uint32_t frameIndex) const;
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	bool m_supported{ false };
+	IndirectDrawPath m_drawPath{ IndirectDrawPath::SingleDraw };
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	// one per frame in flight, they only differ by their cull data
+	std::vector<VkDescriptorSet> m_sets;
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_cullPipeline{ VK_NULL_HANDLE };
+	VkPipeline m_compactPipeline{ VK_NULL_HANDLE };
+	VkPipeline m_depthPrepassPipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout m_depthPrepassPipelineLayout{ VK_NULL_HANDLE };
+
+	AllocatedBuffer m_instanceBuffer{};
+	AllocatedBuffer m_groupBuffer{};
+	// the commands with no instances, copied over m_drawBuffer before every culling
+	AllocatedBuffer m_drawTemplateBuffer{};
+	// the commands, ids and counts of the phases follow each other in these buffers
+	AllocatedBuffer m_drawBuffer{};
+	AllocatedBuffer m_visibleBuffer{};
+	AllocatedBuffer m_compactedDrawBuffer{};
+	AllocatedBuffer m_drawCountBuffer{};
+	// per instance, whether the last late phase found it visible
+	AllocatedBuffer m_visibilityBuffer{};
+	AllocatedBuffer m_cullDataBuffer{};
+	VkDeviceSize m_cullDataStride{ 0 };
+	VkExtent2D m_depthExtent{};
+
+	std::vector<DrawGroup> m_groups;
+	uint32_t m_instanceCount{ 0 };
+	uint32_t m_drawCommandCount{ 0 };
+	uint32_t m_sceneObjectCount{ 0 };
+	uint64_t m_sceneVersion{ 0 };
+	std::vector<uint32_t> m_skippedObjects;
+	GPUCullingStats m_stats;
+};
@@ -0,0 +1,127 @@
+#include "vk_hash.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+	constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+	constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+	inline uint64_t rotl(const uint64_t x, const int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t read64(const uint8_t* p)
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint32_t read32(const uint8_t* p)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint64_t round(uint64_t acc, const uint64_t input)
+	{
+		acc += input * PRIME2;
+		acc = rotl(acc, 31);
+		return acc * PRIME1;
+	}
+
+	inline uint64_t mergeRound(uint64_t acc, const uint64_t val)
+	{
+		acc ^= round(0, val);
+		return acc * PRIME1 + PRIME4;
+	}
+}
+
+uint64_t vkutil::hash64(const void* data, const size_t size, const uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* const end = p + size;
+	uint64_t h;
+
+	if (size >= 32)
+	{
+		//4 parallel lanes over 32 bytes stripes
+		const uint8_t* const limit = end - 32;
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+
+		do
+		{
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	}
+	else
+	{
+		h = seed + PRIME5;
+	}
+
+	h += static_cast<uint64_t>(size);
+
+	//consume the remaining tail
+	while (p + 8 <= end)
+	{
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+		p += 8;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	while (p < end)
+	{
+		h ^= (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+		++p;
+	}
+
+	//final avalanche
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool vkutil::hashFile(const char* filePath, uint64_t& outHash)
+{
+	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	const std::streamsize fileSize = file.tellg();
+	std::vector<char> buffer(static_cast<size_t>(fileSize));
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+
+	outHash = hash64(buffer.data(), buffer.size());
+	return true;
+}
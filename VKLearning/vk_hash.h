@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace vkutil
+{
+	// 64 bit xxHash (XXH64) of a memory block, used to key assets by their content
+	uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+	// hashes the whole content of a file, returns false if the file can't be read
+	bool hashFile(const char* filePath, uint64_t& outHash);
+}
@@ -253,6 +253,18 @@ VkCommandBufferBeginInfo vkinit::commandBufferBeginInfo(VkCommandBufferUsageFlag
 	return info;
 }
 
+VkCommandBufferInheritanceInfo vkinit::commandBufferInheritanceInfo(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+{
+	VkCommandBufferInheritanceInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	info.pNext = nullptr;
+
+	info.renderPass = renderPass;
+	info.subpass = subpass;
+	info.framebuffer = framebuffer;
+	return info;
+}
+
 VkSubmitInfo vkinit::submitInfo(VkCommandBuffer* cmd)
 {
 	VkSubmitInfo info = {};
@@ -0,0 +1,609 @@
+#include "vk_io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef VK_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace
+{
+	//unbuffered reads need sector aligned offsets, sizes and memory, a page covers every device
+	constexpr size_t DIRECT_ALIGNMENT = 4096;
+	constexpr size_t BUFFERED_ALIGNMENT = 16;
+
+#ifdef _WIN32
+	using NativeFile = HANDLE;
+	const NativeFile INVALID_FILE = INVALID_HANDLE_VALUE;
+#else
+	using NativeFile = int;
+	constexpr NativeFile INVALID_FILE = -1;
+#endif
+
+	size_t alignUp(const size_t value, const size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// direct is cleared when the file system does not support unbuffered reads
+	NativeFile openFile(const std::string& filePath, bool& direct, uint64_t& outSize)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			direct ? FILE_FLAG_NO_BUFFERING : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE && direct)
+		{
+			direct = false;
+			file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		}
+		if (file == INVALID_HANDLE_VALUE)
+			return INVALID_FILE;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			CloseHandle(file);
+			return INVALID_FILE;
+		}
+		outSize = static_cast<uint64_t>(fileSize.QuadPart);
+		return file;
+#else
+		int file = open(filePath.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+		if (file < 0 && direct)
+		{
+			direct = false;
+			file = open(filePath.c_str(), O_RDONLY);
+		}
+		if (file < 0)
+			return INVALID_FILE;
+
+		struct stat fileStat {};
+		if (fstat(file, &fileStat) != 0)
+		{
+			close(file);
+			return INVALID_FILE;
+		}
+		outSize = static_cast<uint64_t>(fileStat.st_size);
+		return file;
+#endif
+	}
+
+	void closeFile(const NativeFile file)
+	{
+#ifdef _WIN32
+		CloseHandle(file);
+#else
+		close(file);
+#endif
+	}
+
+	// blocking read from the start of the file, returns the number of bytes read or -1
+	int64_t readWhole(const NativeFile file, uint8_t* buffer, const uint64_t capacity)
+	{
+		uint64_t done = 0;
+		while (done < capacity)
+		{
+#ifdef _WIN32
+			//ReadFile sizes are 32 bits, 1 GB keeps unbuffered reads aligned
+			const DWORD size = static_cast<DWORD>(std::min<uint64_t>(capacity - done, 1ull << 30));
+			OVERLAPPED overlapped{};
+			overlapped.Offset = static_cast<DWORD>(done);
+			overlapped.OffsetHigh = static_cast<DWORD>(done >> 32);
+			DWORD bytesRead = 0;
+			if (!ReadFile(file, buffer + done, size, &bytesRead, &overlapped))
+				return GetLastError() == ERROR_HANDLE_EOF ? static_cast<int64_t>(done) : -1;
+#else
+			const ssize_t bytesRead = pread(file, buffer + done, static_cast<size_t>(capacity - done), static_cast<off_t>(done));
+			if (bytesRead < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+#endif
+			if (bytesRead == 0)
+				break;
+			done += static_cast<uint64_t>(bytesRead);
+		}
+		return static_cast<int64_t>(done);
+	}
+}
+
+#ifdef VK_IO_URING
+//the read buffers are split in chunks so a big file is read with several requests in flight
+constexpr uint64_t RING_CHUNK_SIZE = 1 << 20;
+
+// Minimal io_uring : the submission and completion rings are mapped once, submission entries
+// are used in ring order so the index array stays the identity.
+struct vkutil::AsyncFileReader::Ring
+{
+	int fd{ -1 };
+	uint8_t* sqRing{ nullptr };
+	uint8_t* cqRing{ nullptr };
+	size_t sqRingSize{ 0 };
+	size_t cqRingSize{ 0 };
+	io_uring_sqe* sqes{ nullptr };
+	size_t sqesSize{ 0 };
+
+	unsigned* sqHead{ nullptr };
+	unsigned* sqTail{ nullptr };
+	unsigned sqMask{ 0 };
+	unsigned sqEntries{ 0 };
+	unsigned* cqHead{ nullptr };
+	unsigned* cqTail{ nullptr };
+	unsigned cqMask{ 0 };
+	io_uring_cqe* cqes{ nullptr };
+
+	unsigned localTail{ 0 };
+
+	~Ring() { destroy(); }
+
+	bool init(const uint32_t entries)
+	{
+		io_uring_params params{};
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0)
+			return false;
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMapping)
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+		void* sq = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq == MAP_FAILED)
+		{
+			destroy();
+			return false;
+		}
+		sqRing = static_cast<uint8_t*>(sq);
+
+		void* cq = singleMapping ? sq : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+		{
+			destroy();
+			return false;
+		}
+		cqRing = static_cast<uint8_t*>(cq);
+
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* entriesMapping = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (entriesMapping == MAP_FAILED)
+		{
+			destroy();
+			return false;
+		}
+		sqes = static_cast<io_uring_sqe*>(entriesMapping);
+
+		sqHead = reinterpret_cast<unsigned*>(sqRing + params.sq_off.head);
+		sqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+		sqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+		sqEntries = params.sq_entries;
+		cqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+		cqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+		cqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+
+		unsigned* indices = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+		for (unsigned i = 0; i < sqEntries; i++)
+			indices[i] = i;
+		localTail = *sqTail;
+		return true;
+	}
+
+	void destroy()
+	{
+		if (sqes)
+			munmap(sqes, sqesSize);
+		if (cqRing && cqRing != sqRing)
+			munmap(cqRing, cqRingSize);
+		if (sqRing)
+			munmap(sqRing, sqRingSize);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		sqRing = cqRing = nullptr;
+		sqes = nullptr;
+	}
+
+	// nullptr when the submission ring is full
+	io_uring_sqe* getSqe()
+	{
+		const unsigned head = std::atomic_ref<unsigned>(*sqHead).load(std::memory_order_acquire);
+		if (localTail - head >= sqEntries)
+			return nullptr;
+
+		io_uring_sqe* sqe = &sqes[localTail & sqMask];
+		localTail++;
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		return sqe;
+	}
+
+	// publishes the new entries, plus any the kernel did not consume last time, in one system call
+	void submit()
+	{
+		std::atomic_ref<unsigned>(*sqTail).store(localTail, std::memory_order_release);
+		const unsigned toSubmit = localTail - std::atomic_ref<unsigned>(*sqHead).load(std::memory_order_acquire);
+		if (toSubmit > 0)
+			syscall(__NR_io_uring_enter, fd, toSubmit, 0, 0, nullptr, 0);
+	}
+
+	bool peek(io_uring_cqe& outCqe)
+	{
+		const unsigned head = *cqHead;
+		if (head == std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire))
+			return false;
+
+		outCqe = cqes[head & cqMask];
+		std::atomic_ref<unsigned>(*cqHead).store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	void wait()
+	{
+		syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+	}
+};
+
+struct vkutil::AsyncFileReader::Chunk
+{
+	PendingRead* read;
+	uint64_t offset;
+	uint64_t length;
+	iovec vector;
+};
+#endif
+
+struct vkutil::AsyncFileReader::PendingRead
+{
+	ReadRequest request;
+	FileData data;
+	bool success{ false };
+
+#ifdef VK_IO_URING
+	NativeFile file{ INVALID_FILE };
+	uint64_t fileSize{ 0 };
+	uint8_t* buffer{ nullptr };
+	std::vector<Chunk> chunks;
+	uint32_t chunksLeft{ 0 };
+	size_t ringIndex{ 0 };
+	bool failed{ false };
+#endif
+};
+
+vkutil::AsyncFileReader::AsyncFileReader() = default;
+vkutil::AsyncFileReader::~AsyncFileReader() = default;
+
+void vkutil::AsyncFileReader::init(const uint32_t threadCount, const uint32_t queueDepth)
+{
+	m_running = true;
+
+#ifdef VK_IO_URING
+	auto ring = std::make_unique<Ring>();
+	if (ring->init(queueDepth))
+	{
+		m_ring = std::move(ring);
+		m_queueDepth = queueDepth;
+		return;
+	}
+	std::cout << "io_uring is not available, file reads fall back to I/O threads" << std::endl;
+#endif
+
+	for (uint32_t i = 0; i < std::max(1u, threadCount); i++)
+		m_threads.emplace_back([this] { workerLoop(); });
+}
+
+void vkutil::AsyncFileReader::cleanup()
+{
+	//reads still in flight are finished, their callbacks are dropped
+	{
+		std::lock_guard lock(m_queueMutex);
+		m_running = false;
+		m_queue.clear();
+	}
+	m_queueCondition.notify_all();
+	for (std::thread& thread : m_threads)
+		thread.join();
+	m_threads.clear();
+
+#ifdef VK_IO_URING
+	if (m_ring)
+	{
+		//the kernel may still write into the buffers, wait for every chunk before freeing them
+		m_waitingChunks.clear();
+		io_uring_cqe cqe;
+		while (m_chunksInFlight > 0)
+		{
+			if (m_ring->peek(cqe))
+				m_chunksInFlight--;
+			else
+				m_ring->wait();
+		}
+		for (const std::unique_ptr<PendingRead>& read : m_ringReads)
+			closeFile(read->file);
+		m_ringReads.clear();
+		m_ring.reset();
+	}
+#endif
+
+	std::lock_guard lock(m_completedMutex);
+	m_completed.clear();
+	m_pendingCount = 0;
+}
+
+const char* vkutil::AsyncFileReader::getBackendName() const
+{
+#ifdef VK_IO_URING
+	if (m_ring)
+		return "io_uring";
+#endif
+	return "I/O threads";
+}
+
+void vkutil::AsyncFileReader::submit(std::vector<ReadRequest>&& batch)
+{
+#ifdef VK_IO_URING
+	std::unique_lock ringLock(m_ringMutex, std::defer_lock);
+	if (m_ring)
+		ringLock.lock();
+#endif
+
+	for (ReadRequest& request : batch)
+	{
+		auto read = std::make_unique<PendingRead>();
+		read->request = std::move(request);
+		m_pendingCount++;
+
+		//packed files are already in memory
+		if (isPacked(read->request.filePath))
+		{
+			read->success = readFile(read->request.filePath, read->data);
+			complete(std::move(read));
+			continue;
+		}
+
+#ifdef VK_IO_URING
+		if (m_ring)
+		{
+			bool direct = read->request.direct;
+			read->file = openFile(read->request.filePath, direct, read->fileSize);
+			if (read->file == INVALID_FILE)
+			{
+				complete(std::move(read));
+				continue;
+			}
+
+			const size_t alignment = direct ? DIRECT_ALIGNMENT : BUFFERED_ALIGNMENT;
+			const uint64_t capacity = alignUp(static_cast<size_t>(read->fileSize), alignment);
+			read->buffer = read->data.allocate(static_cast<size_t>(capacity), alignment);
+			read->data.truncate(static_cast<size_t>(read->fileSize));
+
+			if (capacity == 0)
+			{
+				closeFile(read->file);
+				read->success = true;
+				complete(std::move(read));
+				continue;
+			}
+
+			const uint64_t chunkCount = (capacity + RING_CHUNK_SIZE - 1) / RING_CHUNK_SIZE;
+			read->chunks.resize(static_cast<size_t>(chunkCount));
+			read->chunksLeft = static_cast<uint32_t>(chunkCount);
+			for (uint64_t i = 0; i < chunkCount; i++)
+			{
+				Chunk& chunk = read->chunks[static_cast<size_t>(i)];
+				chunk.read = read.get();
+				chunk.offset = i * RING_CHUNK_SIZE;
+				chunk.length = std::min(RING_CHUNK_SIZE, capacity - chunk.offset);
+				m_waitingChunks.push_back(&chunk);
+			}
+
+			read->ringIndex = m_ringReads.size();
+			m_ringReads.push_back(std::move(read));
+			continue;
+		}
+#endif
+
+		{
+			std::lock_guard lock(m_queueMutex);
+			m_queue.push_back(std::move(read));
+		}
+		m_queueCondition.notify_one();
+	}
+
+#ifdef VK_IO_URING
+	if (m_ring)
+		fillRing();
+#endif
+}
+
+uint32_t vkutil::AsyncFileReader::poll()
+{
+#ifdef VK_IO_URING
+	if (m_ring)
+		reapRing();
+#endif
+
+	std::vector<std::unique_ptr<PendingRead>> completed;
+	{
+		std::lock_guard lock(m_completedMutex);
+		completed.swap(m_completed);
+	}
+
+	for (const std::unique_ptr<PendingRead>& read : completed)
+	{
+		if (!read->success)
+		{
+			std::cout << "Failed to read " << read->request.filePath << std::endl;
+			read->data = FileData{};
+		}
+		if (read->request.onComplete)
+			read->request.onComplete(read->success, read->data);
+	}
+
+	m_pendingCount -= static_cast<uint32_t>(completed.size());
+	return static_cast<uint32_t>(completed.size());
+}
+
+void vkutil::AsyncFileReader::waitAll()
+{
+	while (m_pendingCount > 0)
+	{
+		if (poll() > 0)
+			continue;
+
+#ifdef VK_IO_URING
+		if (m_ring && m_chunksInFlight > 0)
+		{
+			m_ring->wait();
+			continue;
+		}
+#endif
+
+		std::unique_lock lock(m_completedMutex);
+		m_completedCondition.wait(lock, [this] { return !m_completed.empty(); });
+	}
+}
+
+void vkutil::AsyncFileReader::complete(std::unique_ptr<PendingRead>&& read)
+{
+	{
+		std::lock_guard lock(m_completedMutex);
+		m_completed.push_back(std::move(read));
+	}
+	m_completedCondition.notify_all();
+}
+
+void vkutil::AsyncFileReader::workerLoop()
+{
+	while (true)
+	{
+		std::unique_ptr<PendingRead> read;
+		{
+			std::unique_lock lock(m_queueMutex);
+			m_queueCondition.wait(lock, [this] { return !m_running || !m_queue.empty(); });
+			if (!m_running)
+				return;
+			read = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		bool direct = read->request.direct;
+		uint64_t fileSize = 0;
+		const NativeFile file = openFile(read->request.filePath, direct, fileSize);
+		if (file != INVALID_FILE)
+		{
+			//unbuffered reads go up to the next aligned size and stop short at the end of the file
+			const size_t alignment = direct ? DIRECT_ALIGNMENT : BUFFERED_ALIGNMENT;
+			const size_t capacity = alignUp(static_cast<size_t>(fileSize), alignment);
+			uint8_t* buffer = read->data.allocate(capacity, alignment);
+			const int64_t bytesRead = readWhole(file, buffer, capacity);
+			closeFile(file);
+
+			read->data.truncate(static_cast<size_t>(fileSize));
+			read->success = bytesRead >= static_cast<int64_t>(fileSize);
+			if (read->success)
+				m_bytesRead += fileSize;
+		}
+
+		complete(std::move(read));
+	}
+}
+
+#ifdef VK_IO_URING
+void vkutil::AsyncFileReader::fillRing()
+{
+	//the completion ring is twice the queue depth, staying under the depth means it never overflows
+	while (!m_waitingChunks.empty() && m_chunksInFlight < m_queueDepth)
+	{
+		io_uring_sqe* sqe = m_ring->getSqe();
+		if (!sqe)
+			break;
+
+		Chunk* chunk = m_waitingChunks.front();
+		m_waitingChunks.pop_front();
+
+		chunk->vector.iov_base = chunk->read->buffer + chunk->offset;
+		chunk->vector.iov_len = static_cast<size_t>(chunk->length);
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = chunk->read->file;
+		sqe->addr = reinterpret_cast<uint64_t>(&chunk->vector);
+		sqe->len = 1;
+		sqe->off = chunk->offset;
+		sqe->user_data = reinterpret_cast<uint64_t>(chunk);
+		m_chunksInFlight++;
+	}
+	m_ring->submit();
+}
+
+void vkutil::AsyncFileReader::reapRing()
+{
+	std::lock_guard lock(m_ringMutex);
+	io_uring_cqe cqe;
+	while (m_ring->peek(cqe))
+	{
+		m_chunksInFlight--;
+		Chunk* chunk = reinterpret_cast<Chunk*>(cqe.user_data);
+		PendingRead* read = chunk->read;
+
+		if (cqe.res < 0)
+			read->failed = true;
+		else
+		{
+			chunk->offset += static_cast<uint64_t>(cqe.res);
+			chunk->length -= static_cast<uint64_t>(cqe.res);
+			//a short read before the end of the file is resumed where it stopped
+			if (chunk->length > 0 && chunk->offset < read->fileSize)
+			{
+				if (cqe.res > 0)
+				{
+					m_waitingChunks.push_back(chunk);
+					continue;
+				}
+				read->failed = true;
+			}
+		}
+
+		if (--read->chunksLeft > 0)
+			continue;
+
+		closeFile(read->file);
+		read->success = !read->failed;
+		if (read->success)
+			m_bytesRead += read->fileSize;
+
+		//swap-remove from the reads owned by the ring
+		const size_t index = read->ringIndex;
+		std::unique_ptr<PendingRead> finished = std::move(m_ringReads[index]);
+		if (index + 1 < m_ringReads.size())
+		{
+			m_ringReads[index] = std::move(m_ringReads.back());
+			m_ringReads[index]->ringIndex = index;
+		}
+		m_ringReads.pop_back();
+		complete(std::move(finished));
+	}
+
+	if (!m_waitingChunks.empty())
+		fillRing();
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vk_pack.h"
+
+// io_uring is driven through its raw syscalls, no liburing dependency
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define VK_IO_URING 1
+#endif
+
+namespace vkutil
+{
+	struct ReadRequest
+	{
+		std::string filePath;
+		// bypasses the OS cache (O_DIRECT / FILE_FLAG_NO_BUFFERING) and reads into page aligned memory,
+		// worth it for big cold reads that are uploaded once
+		bool direct{ false };
+		// runs on the thread calling poll(), data is empty when the read failed
+		std::function<void(bool success, FileData& data)> onComplete;
+	};
+
+	// Reads files in the background so that parsing and GPU uploads overlap the disk.
+	// With io_uring every read of a submit() is queued in one system call and split in chunks
+	// so a single big file still keeps several requests in flight; without it (Windows, old kernels)
+	// a few I/O threads run blocking pread / ReadFile calls.
+	// Files served by a mounted pack complete at once without touching the disk.
+	class AsyncFileReader
+	{
+	public:
+		AsyncFileReader();
+		~AsyncFileReader();
+
+		void init(uint32_t threadCount = 4, uint32_t queueDepth = 256);
+		void cleanup();
+
+		// returns right away, the callbacks run from poll(). Safe from any thread
+		void submit(std::vector<ReadRequest>&& batch);
+		// runs the callbacks of the finished reads, returns how many ran
+		uint32_t poll();
+		// polls until every submitted read completed
+		void waitAll();
+
+		uint32_t getPendingCount() const { return m_pendingCount; }
+		uint64_t getBytesRead() const { return m_bytesRead; }
+		const char* getBackendName() const;
+
+	private:
+		struct PendingRead;
+
+		void complete(std::unique_ptr<PendingRead>&& read);
+		void workerLoop();
+
+		std::atomic<uint32_t> m_pendingCount{ 0 };
+		std::atomic<uint64_t> m_bytesRead{ 0 };
+
+		std::vector<std::unique_ptr<PendingRead>> m_completed;
+		std::mutex m_completedMutex;
+		std::condition_variable m_completedCondition;
+
+		//thread pool backend
+		std::vector<std::thread> m_threads;
+		std::deque<std::unique_ptr<PendingRead>> m_queue;
+		std::mutex m_queueMutex;
+		std::condition_variable m_queueCondition;
+		bool m_running{ false };
+
+#ifdef VK_IO_URING
+		struct Ring;
+		struct Chunk;
+
+		void fillRing();
+		void reapRing();
+
+		std::unique_ptr<Ring> m_ring;
+		std::vector<std::unique_ptr<PendingRead>> m_ringReads;
+		std::deque<Chunk*> m_waitingChunks;
+		std::atomic<uint32_t> m_chunksInFlight{ 0 };
+		std::mutex m_ringMutex;
+		uint32_t m_queueDepth{ 0 };
+#endif
+	};
+}
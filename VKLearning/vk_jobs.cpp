@@ -0,0 +1,125 @@
+#include "vk_jobs.h"
+
+#include <algorithm>
+
+namespace
+{
+	thread_local uint32_t t_workerIndex = 0;
+}
+
+void JobSystem::init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	m_running = true;
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		m_threads.emplace_back([this, i]()
+			{
+				t_workerIndex = i + 1;
+				while (true)
+				{
+					std::function<void()> job;
+					{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_wakeCondition.wait(lock, [this]() { return !m_running || !m_jobs.empty(); });
+						if (!m_running && m_jobs.empty())
+							return;
+
+						job = std::move(m_jobs.front());
+						m_jobs.pop_front();
+					}
+					job();
+					m_pendingJobs.fetch_sub(1, std::memory_order_release);
+				}
+			});
+	}
+}
+
+void JobSystem::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_wakeCondition.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+	m_threads.clear();
+}
+
+void JobSystem::submit(std::function<void()>&& job)
+{
+	m_pendingJobs.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_wakeCondition.notify_one();
+}
+
+bool JobSystem::runOne()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_jobs.empty())
+			return false;
+
+		job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+	}
+	job();
+	m_pendingJobs.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void JobSystem::wait()
+{
+	while (m_pendingJobs.load(std::memory_order_acquire) > 0)
+	{
+		if (!runOne())
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::parallelFor(const uint32_t count, uint32_t groupSize, const std::function<void(uint32_t, uint32_t, uint32_t)>& function)
+{
+	if (count == 0)
+		return;
+	groupSize = std::max(1u, groupSize);
+
+	//not worth waking the workers for a single group
+	if (count <= groupSize || m_threads.empty())
+	{
+		function(0, count, getWorkerIndex());
+		return;
+	}
+
+	const uint32_t groupCount = (count + groupSize - 1) / groupSize;
+	std::atomic<uint32_t> remaining{ groupCount };
+
+	for (uint32_t group = 0; group < groupCount; ++group)
+	{
+		const uint32_t begin = group * groupSize;
+		const uint32_t end = std::min(begin + groupSize, count);
+		submit([&function, &remaining, begin, end]()
+			{
+				function(begin, end, getWorkerIndex());
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+	}
+
+	while (remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (!runOne())
+			std::this_thread::yield();
+	}
+}
+
+uint32_t JobSystem::getWorkerIndex()
+{
+	return t_workerIndex;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Minimal thread pool shared by the engine and the offline tools.
+// The thread calling wait()/parallelFor() helps running the jobs instead of sleeping.
+class JobSystem
+{
+public:
+	// threadCount = 0 uses every hardware thread but the calling one
+	void init(uint32_t threadCount = 0);
+	void cleanup();
+
+	void submit(std::function<void()>&& job);
+	// blocks until every submitted job is done
+	void wait();
+
+	// splits [0, count) in ranges of groupSize elements, function receives (begin, end, workerIndex)
+	void parallelFor(uint32_t count, uint32_t groupSize, const std::function<void(uint32_t, uint32_t, uint32_t)>& function);
+
+	// worker threads + the calling thread
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+	// 0 for the thread that owns the job system, 1..N for the workers
+	static uint32_t getWorkerIndex();
+
+private:
+	bool runOne();
+
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeCondition;
+	std::atomic<uint32_t> m_pendingJobs{ 0 };
+	bool m_running{ false };
+};
@@ -0,0 +1,295 @@
+#include "vk_light_animation.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_light_clusters.h"
+
+namespace
+{
+	constexpr uint32_t ANIMATE_GROUP_SIZE = 256;
+
+	// push constants of the animation shader
+	struct AnimateConstants
+	{
+		float time;
+		uint32_t lightCount;
+	};
+	static_assert(sizeof(GPULightAnimation) == 80, "must match LightAnimation in animate_lights.comp");
+
+	enum AnimateBinding : uint32_t
+	{
+		BINDING_ANIMATIONS = 0,
+		BINDING_KEYFRAMES,
+		BINDING_VISIBLE,
+		BINDING_LIGHTS,
+		BINDING_COUNT
+	};
+
+	void memoryBarrier(const VkCommandBuffer cmd, const VkPipelineStageFlags srcStage, const VkAccessFlags srcAccess, const VkPipelineStageFlags dstStage, const VkAccessFlags dstAccess)
+	{
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(cmd, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+void LightAnimator::init(VulkanEngine& engine, const uint32_t maxLightCount, const uint32_t maxKeyframeCount)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_maxLightCount = maxLightCount;
+	m_maxKeyframeCount = maxKeyframeCount;
+	m_animations.resize(maxLightCount);
+	m_bounds.resize(maxLightCount);
+	m_keyframes.reserve(maxKeyframeCount);
+
+	VkDescriptorSetLayoutBinding bindings[BINDING_COUNT];
+	for (uint32_t i = 0; i < BINDING_COUNT; i++)
+		bindings[i] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, i);
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = BINDING_COUNT;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = engine.m_descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	allocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, m_sets.data()));
+
+	//the descriptions only change through the staging buffers, the visible indices are written every frame
+	const VkDeviceSize animationSize = static_cast<VkDeviceSize>(maxLightCount) * sizeof(GPULightAnimation);
+	const VkDeviceSize keyframeSize = std::max<VkDeviceSize>(maxKeyframeCount, 1) * sizeof(glm::vec4);
+	const VkDeviceSize visibleSize = static_cast<VkDeviceSize>(maxLightCount) * sizeof(uint32_t);
+	const VkDeviceSize lightSize = static_cast<VkDeviceSize>(maxLightCount) * sizeof(GPULightData);
+	m_animationBuffer = engine.createBuffer(animationSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_keyframeBuffer = engine.createBuffer(keyframeSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_stagingBuffers.resize(FRAME_OVERLAP);
+	m_visibleBuffers.resize(FRAME_OVERLAP);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		m_stagingBuffers[i] = engine.createBuffer(animationSize + keyframeSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+		m_visibleBuffers[i] = engine.createBuffer(visibleSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		VkDescriptorBufferInfo animationInfo{ m_animationBuffer.buffer, 0, animationSize };
+		VkDescriptorBufferInfo keyframeInfo{ m_keyframeBuffer.buffer, 0, keyframeSize };
+		VkDescriptorBufferInfo visibleInfo{ m_visibleBuffers[i].buffer, 0, visibleSize };
+		VkDescriptorBufferInfo lightInfo{ engine.m_frames[i].lightBuffer.buffer, 0, lightSize };
+
+		const VkWriteDescriptorSet writes[] = {
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &animationInfo, BINDING_ANIMATIONS),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &keyframeInfo, BINDING_KEYFRAMES),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &visibleInfo, BINDING_VISIBLE),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &lightInfo, BINDING_LIGHTS)
+		};
+		vkUpdateDescriptorSets(m_device, BINDING_COUNT, writes, 0, nullptr);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+			{
+				vmaDestroyBuffer(m_allocator, m_stagingBuffers[i].buffer, m_stagingBuffers[i].allocation);
+				vmaDestroyBuffer(m_allocator, m_visibleBuffers[i].buffer, m_visibleBuffers[i].allocation);
+			}
+			vmaDestroyBuffer(m_allocator, m_animationBuffer.buffer, m_animationBuffer.allocation);
+			vmaDestroyBuffer(m_allocator, m_keyframeBuffer.buffer, m_keyframeBuffer.allocation);
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+		});
+}
+
+void LightAnimator::initPipelines(VulkanEngine& engine, const VkShaderModule animateShader)
+{
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(AnimateConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_setLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, animateShader);
+	pipelineInfo.layout = m_pipelineLayout;
+	VK_CHECK(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_pipeline));
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		});
+}
+
+void LightAnimator::setLight(const uint32_t index, const GPULightData& light)
+{
+	if (index >= m_maxLightCount)
+		return;
+
+	//a flicker only darkens the light, the radius at rest covers it
+	GPULightAnimation& animation = m_animations[index];
+	animation.light = light;
+	animation.light.radius = vkutil::computeLightRadius(light);
+	markChanged(index);
+}
+
+void LightAnimator::setStatic(const uint32_t index)
+{
+	if (index >= m_maxLightCount)
+		return;
+
+	m_animations[index].type = LightAnimationType::None;
+	markChanged(index);
+}
+
+void LightAnimator::setOrbit(const uint32_t index, const glm::vec3& axis, const float radius, const float speed, const float phase)
+{
+	if (index >= m_maxLightCount)
+		return;
+
+	GPULightAnimation& animation = m_animations[index];
+	animation.type = LightAnimationType::Orbit;
+	animation.axis = glm::length(axis) > 0.f ? glm::normalize(axis) : glm::vec3(0.f, 1.f, 0.f);
+	animation.amplitude = std::max(radius, 0.f);
+	animation.speed = speed;
+	animation.phase = phase;
+	markChanged(index);
+}
+
+void LightAnimator::setFlicker(const uint32_t index, const float depth, const float speed, const float phase)
+{
+	if (index >= m_maxLightCount)
+		return;
+
+	GPULightAnimation& animation = m_animations[index];
+	animation.type = LightAnimationType::Flicker;
+	animation.amplitude = std::clamp(depth, 0.f, 1.f);
+	animation.speed = speed;
+	animation.phase = phase;
+	markChanged(index);
+}
+
+bool LightAnimator::setPath(const uint32_t index, const glm::vec3* offsets, const uint32_t count, const float speed, const float phase)
+{
+	if (index >= m_maxLightCount || count == 0)
+		return false;
+
+	//a path of the same length or longer is overwritten in place, otherwise the keyframes are appended
+	GPULightAnimation& animation = m_animations[index];
+	uint32_t first = animation.firstKeyframe;
+	if (animation.type != LightAnimationType::Path || animation.keyframeCount < count)
+	{
+		if (m_keyframes.size() + count > m_maxKeyframeCount)
+			return false;
+		first = static_cast<uint32_t>(m_keyframes.size());
+		m_keyframes.resize(m_keyframes.size() + count);
+	}
+	for (uint32_t i = 0; i < count; i++)
+		m_keyframes[first + i] = glm::vec4(offsets[i], 0.f);
+
+	if (m_dirtyKeyframeBegin == m_dirtyKeyframeEnd)
+		m_dirtyKeyframeBegin = first;
+	m_dirtyKeyframeBegin = std::min(m_dirtyKeyframeBegin, first);
+	m_dirtyKeyframeEnd = std::max(m_dirtyKeyframeEnd, first + count);
+
+	animation.type = LightAnimationType::Path;
+	animation.firstKeyframe = first;
+	animation.keyframeCount = count;
+	animation.speed = speed;
+	animation.phase = phase;
+	markChanged(index);
+	return true;
+}
+
+void LightAnimator::markChanged(const uint32_t index)
+{
+	//the orbit stays at its radius from the rest position, the B-spline inside the hull of its control points
+	const GPULightAnimation& animation = m_animations[index];
+	float reach = 0.f;
+	if (animation.type == LightAnimationType::Orbit)
+	{
+		reach = animation.amplitude;
+	}
+	else if (animation.type == LightAnimationType::Path)
+	{
+		for (uint32_t i = 0; i < animation.keyframeCount; i++)
+			reach = std::max(reach, glm::length(glm::vec3(m_keyframes[animation.firstKeyframe + i])));
+	}
+	m_bounds[index] = animation.light;
+	m_bounds[index].radius = animation.light.radius + reach;
+
+	if (m_dirtyBegin == m_dirtyEnd)
+		m_dirtyBegin = index;
+	m_dirtyBegin = std::min(m_dirtyBegin, index);
+	m_dirtyEnd = std::max(m_dirtyEnd, index + 1);
+	m_boundsVersion++;
+}
+
+void LightAnimator::recordAnimation(const VkCommandBuffer cmd, const uint32_t frameIndex, const float deltaSeconds, const std::vector<uint32_t>& visibleLights)
+{
+	if (m_playing)
+		m_time += deltaSeconds * m_timeScale;
+
+	const auto lightCount = static_cast<uint32_t>(std::min<size_t>(visibleLights.size(), m_maxLightCount));
+	m_stats.evaluatedCount = lightCount;
+	m_stats.keyframeCount = static_cast<uint32_t>(m_keyframes.size());
+	m_stats.uploadedBytes = static_cast<uint32_t>(lightCount * sizeof(uint32_t));
+
+	uint32_t* visible;
+	vmaMapMemory(m_allocator, m_visibleBuffers[frameIndex].allocation, reinterpret_cast<void**>(&visible));
+	memcpy(visible, visibleLights.data(), lightCount * sizeof(uint32_t));
+	vmaUnmapMemory(m_allocator, m_visibleBuffers[frameIndex].allocation);
+
+	//only the ranges changed since the last frame go through the staging buffer of this one
+	if (m_dirtyBegin != m_dirtyEnd || m_dirtyKeyframeBegin != m_dirtyKeyframeEnd)
+	{
+		const VkDeviceSize keyframeOffset = static_cast<VkDeviceSize>(m_maxLightCount) * sizeof(GPULightAnimation);
+		VkBufferCopy animationCopy{ m_dirtyBegin * sizeof(GPULightAnimation), m_dirtyBegin * sizeof(GPULightAnimation), (m_dirtyEnd - m_dirtyBegin) * sizeof(GPULightAnimation) };
+		VkBufferCopy keyframeCopy{ keyframeOffset + m_dirtyKeyframeBegin * sizeof(glm::vec4), m_dirtyKeyframeBegin * sizeof(glm::vec4), (m_dirtyKeyframeEnd - m_dirtyKeyframeBegin) * sizeof(glm::vec4) };
+
+		char* staging;
+		vmaMapMemory(m_allocator, m_stagingBuffers[frameIndex].allocation, reinterpret_cast<void**>(&staging));
+		if (animationCopy.size > 0)
+			memcpy(staging + animationCopy.srcOffset, m_animations.data() + m_dirtyBegin, animationCopy.size);
+		if (keyframeCopy.size > 0)
+			memcpy(staging + keyframeCopy.srcOffset, m_keyframes.data() + m_dirtyKeyframeBegin, keyframeCopy.size);
+		vmaUnmapMemory(m_allocator, m_stagingBuffers[frameIndex].allocation);
+
+		//the previous frame may still be evaluating from the descriptions
+		memoryBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		if (animationCopy.size > 0)
+			vkCmdCopyBuffer(cmd, m_stagingBuffers[frameIndex].buffer, m_animationBuffer.buffer, 1, &animationCopy);
+		if (keyframeCopy.size > 0)
+			vkCmdCopyBuffer(cmd, m_stagingBuffers[frameIndex].buffer, m_keyframeBuffer.buffer, 1, &keyframeCopy);
+		memoryBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		m_stats.uploadedBytes += static_cast<uint32_t>(animationCopy.size + keyframeCopy.size);
+		m_dirtyBegin = m_dirtyEnd = 0;
+		m_dirtyKeyframeBegin = m_dirtyKeyframeEnd = 0;
+	}
+
+	if (lightCount == 0)
+		return;
+
+	const AnimateConstants constants{ m_time, lightCount };
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_sets[frameIndex], 0, nullptr);
+	vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AnimateConstants), &constants);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+	vkCmdDispatch(cmd, (lightCount + ANIMATE_GROUP_SIZE - 1) / ANIMATE_GROUP_SIZE, 1, 1);
+
+	memoryBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+enum class LightAnimationType : uint32_t
+{
+	None,
+	// circles around its rest position, in the plane orthogonal to the axis
+	Orbit,
+	// the intensity is scaled down by a smooth noise, the light never gets brighter than at rest
+	Flicker,
+	// loops along a closed uniform B-spline whose control points are offsets from its rest position
+	Path,
+};
+
+// a light at rest and how it moves, as the animation shader reads it
+GPU_DATA struct GPULightAnimation
+{
+	// the radius is always resolved, the animated light keeps it
+	GPULightData light;
+	glm::vec3 axis;
+	// radius of the orbit, or how much of the intensity the flicker removes at most
+	float amplitude;
+	LightAnimationType type;
+	// radians per second for an orbit, noise periods per second for a flicker, loops per second for a path
+	float speed;
+	float phase;
+	uint32_t firstKeyframe;
+	uint32_t keyframeCount;
+	uint32_t padding[3];
+};
+
+struct LightAnimationStats
+{
+	// visible lights evaluated the last frame
+	uint32_t evaluatedCount = 0;
+	uint32_t keyframeCount = 0;
+	// bytes copied to the GPU the last frame, changed parameters and visible indices
+	uint32_t uploadedBytes = 0;
+};
+
+// Evaluates the lights on the GPU from parametric descriptions: a compute shader writes the visible lights of the
+// frame into the light buffer the shading reads, the CPU uploads the descriptions that changed and the indices of
+// the visible lights only. The descriptions live in a device local buffer.
+// The CPU culls and clusters the lights with the sphere covering every position they can reach, computed once per
+// change: the clusters a light is binned in always contain it, whatever the time.
+class LightAnimator
+{
+public:
+	// creates the buffers and one set per frame in flight, writing to the light buffer of that frame
+	void init(VulkanEngine& engine, uint32_t maxLightCount, uint32_t maxKeyframeCount);
+	void initPipelines(VulkanEngine& engine, VkShaderModule animateShader);
+
+	// the rest state of the light, it keeps its animation
+	void setLight(uint32_t index, const GPULightData& light);
+	void setStatic(uint32_t index);
+	void setOrbit(uint32_t index, const glm::vec3& axis, float radius, float speed, float phase = 0.f);
+	// depth between 0 and 1, the fraction of the intensity the darkest flicker removes
+	void setFlicker(uint32_t index, float depth, float speed, float phase = 0.f);
+	// false when the keyframe buffer is full, the light keeps its previous animation.
+	// Indices past the maximum light count are ignored by every setter
+	bool setPath(uint32_t index, const glm::vec3* offsets, uint32_t count, float speed, float phase = 0.f);
+
+	// advances the clock, uploads what changed since the last frame and evaluates visibleLights into the light buffer
+	// of the frame, recorded outside of any render pass. visibleLights are indices of the lights set before
+	void recordAnimation(VkCommandBuffer cmd, uint32_t frameIndex, float deltaSeconds, const std::vector<uint32_t>& visibleLights);
+
+	// spheres enclosing every position of the lights, with the radius of their influence added
+	const GPULightData* getBounds() const { return m_bounds.data(); }
+	// the maximum light count given to init, the scene only uses the first SceneData::lightNb of them
+	uint32_t getCapacity() const { return static_cast<uint32_t>(m_bounds.size()); }
+	// false while the light stays as set, a flicker animates it as well
+	bool isAnimated(uint32_t index) const { return m_animations[index].type != LightAnimationType::None; }
+	// a flicker only scales the intensity, the light stays at its rest position
+	bool isStationary(uint32_t index) const { return m_animations[index].type == LightAnimationType::None || m_animations[index].type == LightAnimationType::Flicker; }
+	// bumped every time a light or its animation changes
+	uint64_t getBoundsVersion() const { return m_boundsVersion; }
+	const LightAnimationStats& getStats() const { return m_stats; }
+
+	// the clock stops without it, the lights stay where they are
+	bool  m_playing{ true };
+	float m_timeScale{ 1.f };
+
+private:
+	// recomputes the bounds of the light and adds it to the range to upload
+	void markChanged(uint32_t index);
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	uint32_t m_maxLightCount{ 0 };
+	uint32_t m_maxKeyframeCount{ 0 };
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorSet> m_sets;
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_pipeline{ VK_NULL_HANDLE };
+
+	AllocatedBuffer m_animationBuffer{};
+	AllocatedBuffer m_keyframeBuffer{};
+	// the changed descriptions and keyframes of the frame, then copied to the device local buffers
+	std::vector<AllocatedBuffer> m_stagingBuffers;
+	std::vector<AllocatedBuffer> m_visibleBuffers;
+
+	std::vector<GPULightAnimation> m_animations;
+	std::vector<glm::vec4> m_keyframes;
+	std::vector<GPULightData> m_bounds;
+	// [begin, end) ranges not uploaded yet
+	uint32_t m_dirtyBegin{ 0 };
+	uint32_t m_dirtyEnd{ 0 };
+	uint32_t m_dirtyKeyframeBegin{ 0 };
+	uint32_t m_dirtyKeyframeEnd{ 0 };
+	uint64_t m_boundsVersion{ 0 };
+	float m_time{ 0.f };
+	LightAnimationStats m_stats;
+};
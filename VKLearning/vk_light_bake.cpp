@@ -0,0 +1,470 @@
+#include "vk_light_bake.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include <glm/gtc/constants.hpp>
+
+#include "vk_jobs.h"
+#include "vk_pack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_BAKE_SSE2 1
+#endif
+
+namespace
+{
+	struct BakeSceneHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		float probeSpacing;
+		uint32_t maxProbeCount;
+		uint32_t triangleCount;
+		uint32_t lightCount;
+	};
+
+	struct CookedProbesHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		vkutil::GPUProbeGrid grid;
+		uint64_t sourceHash;
+		uint64_t probeCount;
+	};
+
+	constexpr uint32_t LEAF_SIZE = 4;
+	// deep enough for the median splits of any scene that fits in memory
+	constexpr uint32_t MAX_STACK_DEPTH = 64;
+	constexpr uint32_t PROBE_GROUP_SIZE = 16;
+	// ignores the hits right at the probe and right at the light
+	constexpr float RAY_EPSILON = 1e-4f;
+
+	// real spherical harmonics of the bands 0 and 1, and the cosine lobe convolving them into irradiance
+	constexpr float SH_Y0 = 0.282095f;
+	constexpr float SH_Y1 = 0.488603f;
+	const float SH_A0 = glm::pi<float>();
+	const float SH_A1 = glm::two_pi<float>() / 3.f;
+
+	template<typename T>
+	void append(std::vector<uint8_t>& bytes, const T* data, const size_t count)
+	{
+		const size_t offset = bytes.size();
+		bytes.resize(offset + count * sizeof(T));
+		memcpy(bytes.data() + offset, data, count * sizeof(T));
+	}
+
+#if !defined(VK_BAKE_SSE2)
+	bool intersectsBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const float distance, const glm::vec3& min, const glm::vec3& max)
+	{
+		const glm::vec3 t1 = (min - origin) * inverseDirection;
+		const glm::vec3 t2 = (max - origin) * inverseDirection;
+		const glm::vec3 tMin = glm::min(t1, t2);
+		const glm::vec3 tMax = glm::max(t1, t2);
+		const float tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.f));
+		const float tFar = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, distance));
+		return tNear <= tFar;
+	}
+#endif
+}
+
+void vkutil::serializeBakeScene(const BakeScene& scene, std::vector<uint8_t>& outBytes)
+{
+	BakeSceneHeader header{};
+	header.magic = BAKE_SCENE_MAGIC;
+	header.version = BAKE_VERSION;
+	header.probeSpacing = scene.probeSpacing;
+	header.maxProbeCount = scene.maxProbeCount;
+	header.triangleCount = static_cast<uint32_t>(scene.positions.size() / 3);
+	header.lightCount = static_cast<uint32_t>(scene.lights.size());
+
+	outBytes.clear();
+	append(outBytes, &header, 1);
+	append(outBytes, scene.positions.data(), header.triangleCount * 3);
+	append(outBytes, scene.lights.data(), scene.lights.size());
+	append(outBytes, scene.lightIndices.data(), scene.lightIndices.size());
+}
+
+bool vkutil::parseBakeScene(const uint8_t* bytes, const size_t size, BakeScene& outScene)
+{
+	BakeSceneHeader header{};
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, bytes, sizeof(header));
+	if (header.magic != BAKE_SCENE_MAGIC || header.version != BAKE_VERSION)
+		return false;
+
+	const size_t positionsSize = static_cast<size_t>(header.triangleCount) * 3 * sizeof(glm::vec3);
+	const size_t lightsSize = static_cast<size_t>(header.lightCount) * sizeof(GPULightData);
+	const size_t indicesSize = static_cast<size_t>(header.lightCount) * sizeof(uint32_t);
+	if (sizeof(header) + positionsSize + lightsSize + indicesSize > size)
+		return false;
+
+	const uint8_t* data = bytes + sizeof(header);
+	outScene.probeSpacing = header.probeSpacing;
+	outScene.maxProbeCount = header.maxProbeCount;
+	outScene.positions.resize(static_cast<size_t>(header.triangleCount) * 3);
+	outScene.lights.resize(header.lightCount);
+	outScene.lightIndices.resize(header.lightCount);
+	memcpy(outScene.positions.data(), data, positionsSize);
+	memcpy(outScene.lights.data(), data + positionsSize, lightsSize);
+	memcpy(outScene.lightIndices.data(), data + positionsSize + lightsSize, indicesSize);
+	return true;
+}
+
+bool vkutil::saveProbeGrid(const char* filePath, const BakedProbeGrid& grid)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	CookedProbesHeader header{};
+	header.magic = COOKED_PROBES_MAGIC;
+	header.version = BAKE_VERSION;
+	header.grid = grid.grid;
+	header.sourceHash = grid.sourceHash;
+	header.probeCount = grid.probes.size();
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(grid.probes.data()), static_cast<std::streamsize>(grid.probes.size() * sizeof(GPUProbe)));
+	return file.good();
+}
+
+bool vkutil::loadProbeGrid(const char* filePath, BakedProbeGrid& outGrid)
+{
+	FileData fileData;
+	if (!readFile(filePath, fileData))
+		return false;
+
+	CookedProbesHeader header{};
+	if (fileData.size() < sizeof(header))
+		return false;
+	memcpy(&header, fileData.data(), sizeof(header));
+	if (header.magic != COOKED_PROBES_MAGIC || header.version != BAKE_VERSION
+		|| header.probeCount != static_cast<uint64_t>(header.grid.size.x) * header.grid.size.y * header.grid.size.z
+		|| sizeof(header) + header.probeCount * sizeof(GPUProbe) > fileData.size())
+	{
+		return false;
+	}
+
+	outGrid.grid = header.grid;
+	outGrid.sourceHash = header.sourceHash;
+	outGrid.probes.resize(static_cast<size_t>(header.probeCount));
+	memcpy(outGrid.probes.data(), fileData.data() + sizeof(header), outGrid.probes.size() * sizeof(GPUProbe));
+	return true;
+}
+
+void LightBaker::bake(JobSystem& jobSystem, const vkutil::BakeScene& scene, vkutil::BakedProbeGrid& outGrid)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	m_stats = {};
+	buildBvh(scene);
+	m_stats.triangleCount = static_cast<uint32_t>(m_triangles.size());
+	m_stats.nodeCount = static_cast<uint32_t>(m_nodes.size());
+	m_stats.lightCount = static_cast<uint32_t>(scene.lights.size());
+	m_stats.buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	start = std::chrono::high_resolution_clock::now();
+
+	outGrid.grid = {};
+	outGrid.probes.clear();
+	if (m_nodes.empty())
+		return;
+
+	//the grid covers the static geometry with a probe of margin, its spacing grows until it fits
+	const glm::vec3 boundsMin = m_nodes[0].min;
+	const glm::vec3 boundsMax = m_nodes[0].max;
+	const uint32_t maxProbeCount = std::max(scene.maxProbeCount, 8u);
+	float spacing = std::max(scene.probeSpacing, 1e-3f);
+	glm::uvec3 size;
+	for (;;)
+	{
+		size = glm::uvec3(glm::ceil((boundsMax - boundsMin) / spacing)) + 2u;
+		const uint64_t probeCount = static_cast<uint64_t>(size.x) * size.y * size.z;
+		if (probeCount <= maxProbeCount)
+			break;
+		spacing *= std::max(std::cbrt(static_cast<float>(probeCount) / static_cast<float>(maxProbeCount)), 1.01f);
+	}
+	const glm::vec3 origin = (boundsMin + boundsMax) * 0.5f - glm::vec3(size - 1u) * spacing * 0.5f;
+	outGrid.grid.size = glm::uvec4(size, 1u);
+	outGrid.grid.origin = glm::vec4(origin, spacing);
+	outGrid.probes.resize(static_cast<size_t>(size.x) * size.y * size.z);
+	m_stats.probeCount = static_cast<uint32_t>(outGrid.probes.size());
+
+	std::atomic<uint64_t> rayCount{ 0 };
+	jobSystem.parallelFor(m_stats.probeCount, PROBE_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			std::vector<uint32_t> inRange;
+			uint64_t groupRays = 0;
+			for (uint32_t p = begin; p < end; p++)
+			{
+				const glm::uvec3 cell(p % size.x, p / size.x % size.y, p / (size.x * size.y));
+				const glm::vec3 position = origin + glm::vec3(cell) * spacing;
+
+				inRange.clear();
+				for (uint32_t l = 0; l < scene.lights.size(); l++)
+				{
+					const glm::vec3 offset = scene.lights[l].position - position;
+					if (glm::dot(offset, offset) < scene.lights[l].radius * scene.lights[l].radius)
+						inRange.push_back(l);
+				}
+
+				//the light reaching the probe from each direction, projected on the harmonics then convolved
+				glm::vec4 irradiance[3] = {};
+				for (size_t first = 0; first < inRange.size(); first += 4)
+				{
+					const auto rayCountInPacket = static_cast<uint32_t>(std::min<size_t>(4, inRange.size() - first));
+					glm::vec4 rays[4];
+					for (uint32_t i = 0; i < rayCountInPacket; i++)
+					{
+						const glm::vec3 offset = scene.lights[inRange[first + i]].position - position;
+						const float distance = glm::length(offset);
+						rays[i] = glm::vec4(distance > 0.f ? offset / distance : glm::vec3(0.f, 1.f, 0.f), distance * (1.f - RAY_EPSILON));
+					}
+					const uint32_t blocked = traceOcclusion(position, rays, rayCountInPacket);
+					groupRays += rayCountInPacket;
+
+					for (uint32_t i = 0; i < rayCountInPacket; i++)
+					{
+						if (blocked & (1u << i))
+							continue;
+
+						//the falloff of the lighting shaders, windowed inverse square
+						const GPULightData& light = scene.lights[inRange[first + i]];
+						const float distance = rays[i].w / (1.f - RAY_EPSILON);
+						const float window = std::clamp(1.f - std::pow(distance / light.radius, 4.f), 0.f, 1.f);
+						const glm::vec3 radiance = light.color * light.intensity * window * window / std::max(distance * distance, 1e-4f);
+						const glm::vec4 basis(SH_A0 * SH_Y0, SH_A1 * SH_Y1 * rays[i].y, SH_A1 * SH_Y1 * rays[i].z, SH_A1 * SH_Y1 * rays[i].x);
+						for (int c = 0; c < 3; c++)
+							irradiance[c] += radiance[c] * basis;
+					}
+				}
+				for (int c = 0; c < 3; c++)
+					outGrid.probes[p].irradiance[c] = irradiance[c];
+			}
+			rayCount += groupRays;
+		});
+
+	m_stats.rayCount = rayCount;
+	m_stats.bakeMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightBaker::buildBvh(const vkutil::BakeScene& scene)
+{
+	m_nodes.clear();
+	m_triangles.clear();
+	const auto triangleCount = static_cast<uint32_t>(scene.positions.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	std::vector<uint32_t> order(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++)
+	{
+		order[i] = i;
+		centroids[i] = (scene.positions[i * 3] + scene.positions[i * 3 + 1] + scene.positions[i * 3 + 2]) / 3.f;
+	}
+
+	m_nodes.reserve(2 * (triangleCount / LEAF_SIZE + 1));
+	m_nodes.push_back({});
+	buildNode(0, 0, triangleCount, scene, order, centroids);
+
+	//the triangles are stored in the order of the leaves
+	m_triangles.resize(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++)
+	{
+		const glm::vec3* v = &scene.positions[order[i] * 3];
+		m_triangles[i] = { v[0], v[1] - v[0], v[2] - v[0] };
+	}
+}
+
+void LightBaker::buildNode(const uint32_t node, const uint32_t first, const uint32_t count, const vkutil::BakeScene& scene,
+	std::vector<uint32_t>& order, const std::vector<glm::vec3>& centroids)
+{
+	//the box holds the whole triangles, the split only looks at their centroids
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		const uint32_t triangle = order[i];
+		for (uint32_t v = 0; v < 3; v++)
+		{
+			min = glm::min(min, scene.positions[triangle * 3 + v]);
+			max = glm::max(max, scene.positions[triangle * 3 + v]);
+		}
+		centroidMin = glm::min(centroidMin, centroids[triangle]);
+		centroidMax = glm::max(centroidMax, centroids[triangle]);
+	}
+	m_nodes[node].min = min;
+	m_nodes[node].max = max;
+
+	const glm::vec3 extent = centroidMax - centroidMin;
+	if (count <= LEAF_SIZE || std::max(extent.x, std::max(extent.y, extent.z)) <= 0.f)
+	{
+		m_nodes[node].first = first;
+		m_nodes[node].count = count;
+		return;
+	}
+
+	const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+	const uint32_t half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[&centroids, axis](const uint32_t a, const uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	//both children are allocated together, the node only keeps the first
+	const auto left = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.push_back({});
+	m_nodes.push_back({});
+	m_nodes[node].first = left;
+	m_nodes[node].count = 0;
+	buildNode(left, first, half, scene, order, centroids);
+	buildNode(left + 1, first + half, count - half, scene, order, centroids);
+}
+
+uint32_t LightBaker::traceOcclusion(const glm::vec3& origin, const glm::vec4* rays, const uint32_t rayCount) const
+{
+	const uint32_t lanes = (1u << rayCount) - 1u;
+	if (m_nodes.empty() || rayCount == 0)
+		return 0;
+
+	uint32_t stack[MAX_STACK_DEPTH];
+#if defined(VK_BAKE_SSE2)
+	alignas(16) float directionX[4] = { 1.f, 1.f, 1.f, 1.f };
+	alignas(16) float directionY[4] = {};
+	alignas(16) float directionZ[4] = {};
+	alignas(16) float distances[4] = {};
+	for (uint32_t i = 0; i < rayCount; i++)
+	{
+		directionX[i] = rays[i].x;
+		directionY[i] = rays[i].y;
+		directionZ[i] = rays[i].z;
+		distances[i] = rays[i].w;
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 dirX = _mm_load_ps(directionX);
+	const __m128 dirY = _mm_load_ps(directionY);
+	const __m128 dirZ = _mm_load_ps(directionZ);
+	const __m128 invX = _mm_div_ps(one, dirX);
+	const __m128 invY = _mm_div_ps(one, dirY);
+	const __m128 invZ = _mm_div_ps(one, dirZ);
+	const __m128 distance = _mm_load_ps(distances);
+	const __m128 signMask = _mm_set1_ps(-0.f);
+	const __m128 minDet = _mm_set1_ps(1e-10f);
+	const __m128 minT = _mm_set1_ps(RAY_EPSILON);
+
+	//the lanes past rayCount start blocked
+	uint32_t blocked = ~lanes & 0xFu;
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BvhNode& node = m_nodes[stack[--stackSize]];
+
+		//slabs of the box against the four rays, a lane already blocked does not need to go further
+		const __m128 t1x = _mm_mul_ps(_mm_set1_ps(node.min.x - origin.x), invX);
+		const __m128 t2x = _mm_mul_ps(_mm_set1_ps(node.max.x - origin.x), invX);
+		const __m128 t1y = _mm_mul_ps(_mm_set1_ps(node.min.y - origin.y), invY);
+		const __m128 t2y = _mm_mul_ps(_mm_set1_ps(node.max.y - origin.y), invY);
+		const __m128 t1z = _mm_mul_ps(_mm_set1_ps(node.min.z - origin.z), invZ);
+		const __m128 t2z = _mm_mul_ps(_mm_set1_ps(node.max.z - origin.z), invZ);
+		const __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_max_ps(_mm_min_ps(t1z, t2z), zero));
+		const __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_min_ps(_mm_max_ps(t1z, t2z), distance));
+		if ((_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & ~blocked) == 0)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack[stackSize++] = node.first;
+			stack[stackSize++] = node.first + 1;
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			//Moller-Trumbore, what only depends on the shared origin is computed once
+			const BakeTriangle& triangle = m_triangles[i];
+			const glm::vec3 toOrigin = origin - triangle.v0;
+			const glm::vec3 q = glm::cross(toOrigin, triangle.e1);
+
+			const __m128 px = _mm_sub_ps(_mm_mul_ps(dirY, _mm_set1_ps(triangle.e2.z)), _mm_mul_ps(dirZ, _mm_set1_ps(triangle.e2.y)));
+			const __m128 py = _mm_sub_ps(_mm_mul_ps(dirZ, _mm_set1_ps(triangle.e2.x)), _mm_mul_ps(dirX, _mm_set1_ps(triangle.e2.z)));
+			const __m128 pz = _mm_sub_ps(_mm_mul_ps(dirX, _mm_set1_ps(triangle.e2.y)), _mm_mul_ps(dirY, _mm_set1_ps(triangle.e2.x)));
+			const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.e1.x)), _mm_mul_ps(py, _mm_set1_ps(triangle.e1.y))),
+				_mm_mul_ps(pz, _mm_set1_ps(triangle.e1.z)));
+			const __m128 inverseDet = _mm_div_ps(one, det);
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(toOrigin.x)), _mm_mul_ps(py, _mm_set1_ps(toOrigin.y))),
+				_mm_mul_ps(pz, _mm_set1_ps(toOrigin.z))), inverseDet);
+			const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, _mm_set1_ps(q.x)), _mm_mul_ps(dirY, _mm_set1_ps(q.y))),
+				_mm_mul_ps(dirZ, _mm_set1_ps(q.z))), inverseDet);
+			const __m128 t = _mm_mul_ps(_mm_set1_ps(glm::dot(triangle.e2, q)), inverseDet);
+
+			__m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), minDet);
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, minT), _mm_cmplt_ps(t, distance)));
+			blocked |= static_cast<uint32_t>(_mm_movemask_ps(hit));
+			if (blocked == 0xFu)
+				return lanes;
+		}
+	}
+	return blocked & lanes;
+#else
+	uint32_t blocked = 0;
+	for (uint32_t r = 0; r < rayCount; r++)
+	{
+		const glm::vec3 direction(rays[r]);
+		const glm::vec3 inverseDirection = 1.f / direction;
+		uint32_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0 && (blocked & (1u << r)) == 0)
+		{
+			const BvhNode& node = m_nodes[stack[--stackSize]];
+			if (!intersectsBox(origin, inverseDirection, rays[r].w, node.min, node.max))
+				continue;
+
+			if (node.count == 0)
+			{
+				stack[stackSize++] = node.first;
+				stack[stackSize++] = node.first + 1;
+				continue;
+			}
+
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const BakeTriangle& triangle = m_triangles[i];
+				const glm::vec3 p = glm::cross(direction, triangle.e2);
+				const float det = glm::dot(triangle.e1, p);
+				if (std::abs(det) <= 1e-10f)
+					continue;
+
+				const glm::vec3 toOrigin = origin - triangle.v0;
+				const glm::vec3 q = glm::cross(toOrigin, triangle.e1);
+				const float u = glm::dot(toOrigin, p) / det;
+				const float v = glm::dot(direction, q) / det;
+				const float t = glm::dot(triangle.e2, q) / det;
+				if (u >= 0.f && v >= 0.f && u + v <= 1.f && t > RAY_EPSILON && t < rays[r].w)
+				{
+					blocked |= 1u << r;
+					break;
+				}
+			}
+		}
+	}
+	return blocked;
+#endif
+}
+
+const char* LightBaker::getInstructionSet()
+{
+#if defined(VK_BAKE_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
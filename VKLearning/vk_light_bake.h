@@ -0,0 +1,115 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Input and output of the light baker, shared by the engine and the AssetCooker
+namespace vkutil
+{
+	constexpr uint32_t BAKE_SCENE_MAGIC = 0x53424B56;    // "VKBS"
+	constexpr uint32_t COOKED_PROBES_MAGIC = 0x50424B56; // "VKBP"
+	constexpr uint32_t BAKE_VERSION = 1;
+
+	constexpr const char* BAKE_SCENE_EXTENSION = ".vkbake";
+	constexpr const char* COOKED_PROBES_EXTENSION = ".vkprobes";
+
+	// what the baker needs of a scene: the static opaque triangles in world space and the lights that never change
+	struct BakeScene
+	{
+		// wanted distance between two probes, larger when the grid would hold more than maxProbeCount
+		float probeSpacing{ 1.f };
+		uint32_t maxProbeCount{ 0 };
+		// three per triangle
+		std::vector<glm::vec3> positions;
+		std::vector<GPULightData> lights;
+		// index of each baked light in the scene
+		std::vector<uint32_t> lightIndices;
+	};
+
+	// irradiance of a probe as an L1 spherical harmonic per channel, the cosine lobe already convolved.
+	// The coefficients are in the (1, y, z, x) order
+	GPU_DATA struct GPUProbe
+	{
+		glm::vec4 irradiance[3];
+	};
+
+	GPU_DATA struct GPUProbeGrid
+	{
+		// probes along each axis, w is 1 while the shading uses them
+		glm::uvec4 size;
+		// xyz the first probe, w the distance between two probes
+		glm::vec4 origin;
+	};
+
+	struct BakedProbeGrid
+	{
+		GPUProbeGrid grid{};
+		// hash of the serialized BakeScene the probes were baked from
+		uint64_t sourceHash{ 0 };
+		// x first, then y, then z
+		std::vector<GPUProbe> probes;
+	};
+
+	// the hash of these bytes keys the probes, the same scene always gives the same bytes
+	void serializeBakeScene(const BakeScene& scene, std::vector<uint8_t>& outBytes);
+	bool parseBakeScene(const uint8_t* bytes, size_t size, BakeScene& outScene);
+
+	bool saveProbeGrid(const char* filePath, const BakedProbeGrid& grid);
+	bool loadProbeGrid(const char* filePath, BakedProbeGrid& outGrid);
+}
+
+struct LightBakeStats
+{
+	uint32_t triangleCount = 0;
+	uint32_t nodeCount = 0;
+	uint32_t probeCount = 0;
+	uint32_t lightCount = 0;
+	uint64_t rayCount = 0;
+	float buildMilliseconds = 0.f;
+	float bakeMilliseconds = 0.f;
+};
+
+// Bakes the direct light of the static lights into a grid of irradiance probes, on the CPU and without any device so
+// that it runs headless. The triangles go in a bounding volume hierarchy split at the median of the longest axis.
+// Every probe traces a shadow ray towards each light in range, the probes are spread over the JobSystem.
+// The rays of a probe share their origin and are traced four at a time with SSE2: a packet tests each box and each
+// triangle against its four rays at once, and stops as soon as all of them are blocked.
+class LightBaker
+{
+public:
+	void bake(JobSystem& jobSystem, const vkutil::BakeScene& scene, vkutil::BakedProbeGrid& outGrid);
+
+	const LightBakeStats& getStats() const { return m_stats; }
+	static const char* getInstructionSet();
+
+private:
+	// an inner node has its two children at first and first + 1, a leaf has count triangles from first
+	struct BvhNode
+	{
+		glm::vec3 min;
+		uint32_t first;
+		glm::vec3 max;
+		uint32_t count;
+	};
+
+	// one vertex and the two edges leaving it, as the intersection test reads them
+	struct BakeTriangle
+	{
+		glm::vec3 v0;
+		glm::vec3 e1;
+		glm::vec3 e2;
+	};
+
+	void buildBvh(const vkutil::BakeScene& scene);
+	void buildNode(uint32_t node, uint32_t first, uint32_t count, const vkutil::BakeScene& scene, std::vector<uint32_t>& order,
+		const std::vector<glm::vec3>& centroids);
+	// bit i is set when something is between origin and the end of ray i, rays are xyz the direction and w the distance
+	uint32_t traceOcclusion(const glm::vec3& origin, const glm::vec4* rays, uint32_t rayCount) const;
+
+	std::vector<BvhNode> m_nodes;
+	std::vector<BakeTriangle> m_triangles;
+	LightBakeStats m_stats;
+};
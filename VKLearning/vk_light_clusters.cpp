@@ -0,0 +1,209 @@
+#include "vk_light_clusters.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "vk_jobs.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VK_CLUSTER_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_CLUSTER_SSE2 1
+#endif
+
+namespace
+{
+	// the sphere arrays are padded to this many lights so that the SIMD loops have no remainder
+	constexpr uint32_t CLUSTER_LANES = 8;
+	constexpr uint32_t TRANSFORM_GROUP_SIZE = 4096;
+
+	// tiles [first, last] covered by the sphere along one screen axis, between the depths nearest and farthest.
+	// The extent of center / depth over the box around the sphere is reached at one of its corners
+	bool computeTileRange(const float center, const float radius, const float nearest, const float farthest, const float scale,
+		const uint32_t tileCount, uint32_t& first, uint32_t& last)
+	{
+		const float low = center - radius;
+		const float high = center + radius;
+		float ndcLow = low / (low < 0.f ? nearest : farthest) * scale;
+		float ndcHigh = high / (high < 0.f ? farthest : nearest) * scale;
+		//the y axis of the projection is flipped
+		if (scale < 0.f)
+			std::swap(ndcLow, ndcHigh);
+		if (ndcHigh < -1.f || ndcLow > 1.f)
+			return false;
+
+		const float tiles = static_cast<float>(tileCount);
+		first = static_cast<uint32_t>(std::clamp((ndcLow * 0.5f + 0.5f) * tiles, 0.f, tiles - 1.f));
+		last = static_cast<uint32_t>(std::clamp((ndcHigh * 0.5f + 0.5f) * tiles, 0.f, tiles - 1.f));
+		return true;
+	}
+}
+
+float vkutil::computeLightRadius(const GPULightData& light)
+{
+	if (light.radius > 0.f)
+		return light.radius;
+
+	const float power = light.intensity * std::max(light.color.r, std::max(light.color.g, light.color.b));
+	return std::sqrt(std::max(power, 0.f) / LightClusterer::LIGHT_CUTOFF);
+}
+
+void LightClusterer::build(JobSystem& jobSystem, const glm::mat4& view, const glm::mat4& projection, const VkExtent2D extent,
+	const GPULightData* lights, const uint32_t lightCount, GPUClusterGrid* outGrid, glm::uvec2* outRanges, uint32_t* outIndices)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	//the same depth range as the projection, its matrix is not zero to one
+	m_zNear = projection[3][2] / (projection[2][2] - 1.f);
+	m_zFar = projection[3][2] / (projection[2][2] + 1.f);
+	m_projectionScale = glm::vec2(projection[0][0], projection[1][1]);
+
+	const uint32_t paddedCount = (lightCount + CLUSTER_LANES - 1) / CLUSTER_LANES * CLUSTER_LANES;
+	m_viewX.resize(paddedCount);
+	m_viewY.resize(paddedCount);
+	m_depth.resize(paddedCount);
+	m_radius.resize(paddedCount);
+
+	float* viewX = m_viewX.data();
+	float* viewY = m_viewY.data();
+	float* depth = m_depth.data();
+	float* radius = m_radius.data();
+	jobSystem.parallelFor(paddedCount, TRANSFORM_GROUP_SIZE, [=, &view](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				//the padding is behind every slice
+				if (i >= lightCount)
+				{
+					viewX[i] = viewY[i] = radius[i] = 0.f;
+					depth[i] = -FLT_MAX;
+					continue;
+				}
+
+				const glm::vec4 center = view * glm::vec4(lights[i].position, 1.f);
+				viewX[i] = center.x;
+				viewY[i] = center.y;
+				depth[i] = -center.z;
+				radius[i] = vkutil::computeLightRadius(lights[i]);
+			}
+		});
+
+	m_clusterLights.resize(CLUSTER_COUNT);
+	jobSystem.parallelFor(GRID_Z, 1, [this](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t slice = begin; slice < end; slice++)
+				binSlice(slice);
+		});
+
+	//the lists are packed in cluster order, what does not fit in the index buffer is dropped
+	uint32_t indexCount = 0;
+	m_stats.maxClusterLights = 0;
+	m_stats.overflow = false;
+	for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+	{
+		const auto clusterLightCount = static_cast<uint32_t>(m_clusterLights[cluster].size());
+		const uint32_t count = std::min(clusterLightCount, MAX_LIGHT_INDICES - indexCount);
+		memcpy(outIndices + indexCount, m_clusterLights[cluster].data(), count * sizeof(uint32_t));
+		outRanges[cluster] = glm::uvec2(indexCount, count);
+
+		indexCount += count;
+		m_stats.maxClusterLights = std::max(m_stats.maxClusterLights, clusterLightCount);
+		m_stats.overflow |= count < clusterLightCount;
+	}
+
+	const float logDepthRatio = std::log(m_zFar / m_zNear);
+	GPUClusterGrid grid;
+	grid.size = glm::uvec4(GRID_X, GRID_Y, GRID_Z, indexCount);
+	grid.screen = glm::vec4(static_cast<float>(extent.width), static_cast<float>(extent.height),
+		static_cast<float>(GRID_Z) / logDepthRatio, -static_cast<float>(GRID_Z) * std::log(m_zNear) / logDepthRatio);
+	memcpy(outGrid, &grid, sizeof(GPUClusterGrid));
+
+	m_stats.lightCount = lightCount;
+	m_stats.indexCount = indexCount;
+	m_stats.buildMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightClusterer::binSlice(const uint32_t slice)
+{
+	const float sliceNear = m_zNear * std::pow(m_zFar / m_zNear, static_cast<float>(slice) / GRID_Z);
+	const float sliceFar = m_zNear * std::pow(m_zFar / m_zNear, static_cast<float>(slice + 1) / GRID_Z);
+	std::vector<uint32_t>* sliceLights = m_clusterLights.data() + slice * GRID_X * GRID_Y;
+	for (uint32_t tile = 0; tile < GRID_X * GRID_Y; tile++)
+		sliceLights[tile].clear();
+
+	//the light overlaps the slice in depth, bin it in the tiles its box covers at these depths
+	const auto binLight = [&](const uint32_t i)
+		{
+			const float nearest = std::max(m_depth[i] - m_radius[i], sliceNear);
+			const float farthest = std::min(m_depth[i] + m_radius[i], sliceFar);
+			uint32_t firstX, lastX, firstY, lastY;
+			if (!computeTileRange(m_viewX[i], m_radius[i], nearest, farthest, m_projectionScale.x, GRID_X, firstX, lastX)
+				|| !computeTileRange(m_viewY[i], m_radius[i], nearest, farthest, m_projectionScale.y, GRID_Y, firstY, lastY))
+				return;
+
+			for (uint32_t y = firstY; y <= lastY; y++)
+				for (uint32_t x = firstX; x <= lastX; x++)
+					sliceLights[y * GRID_X + x].push_back(i);
+		};
+
+	const float* depth = m_depth.data();
+	const float* radius = m_radius.data();
+	const auto paddedCount = static_cast<uint32_t>(m_depth.size());
+
+#if defined(VK_CLUSTER_AVX2)
+	const __m256 nearPlane = _mm256_set1_ps(sliceNear);
+	const __m256 farPlane = _mm256_set1_ps(sliceFar);
+	for (uint32_t i = 0; i < paddedCount; i += 8)
+	{
+		const __m256 d = _mm256_loadu_ps(depth + i);
+		const __m256 r = _mm256_loadu_ps(radius + i);
+		const __m256 overlap = _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(d, r), farPlane, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_add_ps(d, r), nearPlane, _CMP_GE_OQ));
+
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(overlap));
+		while (mask)
+		{
+			binLight(i + static_cast<uint32_t>(std::countr_zero(mask)));
+			mask &= mask - 1;
+		}
+	}
+#elif defined(VK_CLUSTER_SSE2)
+	const __m128 nearPlane = _mm_set1_ps(sliceNear);
+	const __m128 farPlane = _mm_set1_ps(sliceFar);
+	for (uint32_t i = 0; i < paddedCount; i += 4)
+	{
+		const __m128 d = _mm_loadu_ps(depth + i);
+		const __m128 r = _mm_loadu_ps(radius + i);
+		const __m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_sub_ps(d, r), farPlane), _mm_cmpge_ps(_mm_add_ps(d, r), nearPlane));
+
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(overlap));
+		while (mask)
+		{
+			binLight(i + static_cast<uint32_t>(std::countr_zero(mask)));
+			mask &= mask - 1;
+		}
+	}
+#else
+	for (uint32_t i = 0; i < paddedCount; i++)
+	{
+		if (depth[i] - radius[i] <= sliceFar && depth[i] + radius[i] >= sliceNear)
+			binLight(i);
+	}
+#endif
+}
+
+const char* LightClusterer::getInstructionSet()
+{
+#if defined(VK_CLUSTER_AVX2)
+	return "AVX2";
+#elif defined(VK_CLUSTER_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
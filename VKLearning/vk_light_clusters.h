@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+class JobSystem;
+
+// header of the cluster buffer, followed by one (first index, light count) pair per cluster
+GPU_DATA struct GPUClusterGrid
+{
+	// xyz the cluster counts, w the light indices written
+	glm::uvec4 size{};
+	// xy the framebuffer size, slice = log(view depth) * z + w
+	glm::vec4 screen{};
+};
+
+struct LightClusterStats
+{
+	uint32_t lightCount = 0;
+	uint32_t indexCount = 0;
+	uint32_t maxClusterLights = 0;
+	// the indices did not fit in MAX_LIGHT_INDICES, the last clusters lost lights
+	bool overflow = false;
+	float buildMilliseconds = 0.f;
+};
+
+namespace vkutil
+{
+	// the explicit radius of the light, otherwise the distance past which its inverse square attenuation
+	// contributes less than LIGHT_CUTOFF
+	float computeLightRadius(const GPULightData& light);
+}
+
+// Clustered forward shading: the view frustum is divided in GRID_X x GRID_Y screen tiles and GRID_Z slices spaced
+// exponentially in depth, every cluster receives the list of the lights whose sphere of influence touches it.
+// The fragment shader finds its cluster from its pixel and view depth and only loops over that list.
+// The spheres are moved to view space on the JobSystem, then every slice is a job: it rejects the lights outside its
+// depth range 8 at a time with AVX2, 4 with SSE2, and bins the others in its own tiles, without synchronization.
+class LightClusterer
+{
+public:
+	static constexpr uint32_t GRID_X = 16;
+	static constexpr uint32_t GRID_Y = 9;
+	static constexpr uint32_t GRID_Z = 24;
+	static constexpr uint32_t CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+	// 256 lights per cluster on average
+	static constexpr uint32_t MAX_LIGHT_INDICES = CLUSTER_COUNT * 256;
+	static constexpr float LIGHT_CUTOFF = 1.f / 256.f;
+
+	// assigns the lights to the clusters of the view. outRanges receives CLUSTER_COUNT pairs, outIndices at most
+	// MAX_LIGHT_INDICES light indices. The depth range of the grid is the one of the projection
+	void build(JobSystem& jobSystem, const glm::mat4& view, const glm::mat4& projection, VkExtent2D extent,
+		const GPULightData* lights, uint32_t lightCount, GPUClusterGrid* outGrid, glm::uvec2* outRanges, uint32_t* outIndices);
+
+	const LightClusterStats& getStats() const { return m_stats; }
+	static const char* getInstructionSet();
+
+private:
+	void binSlice(uint32_t slice);
+
+	//view space spheres, depth is positive in front of the camera
+	std::vector<float> m_viewX;
+	std::vector<float> m_viewY;
+	std::vector<float> m_depth;
+	std::vector<float> m_radius;
+
+	glm::vec2 m_projectionScale{ 1.f };
+	float m_zNear{ 0.1f };
+	float m_zFar{ 100.f };
+
+	//the lights of each cluster, slice major, reused between frames
+	std::vector<std::vector<uint32_t>> m_clusterLights;
+	LightClusterStats m_stats;
+};
@@ -0,0 +1,153 @@
+#include "vk_light_sampling.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+
+namespace
+{
+	static_assert(sizeof(GPULightSamplingData) == 96, "must match the std140 SamplingData in deferred_lighting_sampled.frag");
+	static_assert(sizeof(GPULightReservoir) == 16, "must match Reservoir in deferred_lighting_sampled.frag");
+	static_assert(FRAME_OVERLAP % 2 == 0, "the frame index picks the reservoir buffer");
+
+	constexpr uint32_t INVALID_LIGHT = ~0u;
+
+	enum SamplingBinding : uint32_t
+	{
+		BINDING_DATA = 0,
+		BINDING_PREVIOUS_RESERVOIRS,
+		BINDING_CURRENT_RESERVOIRS,
+		BINDING_REMAP,
+		BINDING_COUNT
+	};
+}
+
+void LightSampler::init(VulkanEngine& engine, const uint32_t maxLightCount)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_maxLightCount = maxLightCount;
+	m_supported = engine.m_enabledFeatures.fragmentStoresAndAtomics;
+	if (!m_supported)
+		return;
+
+	VkDescriptorSetLayoutBinding bindings[BINDING_COUNT];
+	bindings[BINDING_DATA] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, BINDING_DATA);
+	for (uint32_t i = BINDING_PREVIOUS_RESERVOIRS; i < BINDING_COUNT; i++)
+		bindings[i] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, i);
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = BINDING_COUNT;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = engine.m_descriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	allocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, m_sets.data()));
+
+	//one reservoir per pixel, nothing is reused before they were written once
+	const VkDeviceSize reservoirSize = static_cast<VkDeviceSize>(engine.m_windowExtent.width) * engine.m_windowExtent.height * sizeof(GPULightReservoir);
+	for (AllocatedBuffer& buffer : m_reservoirBuffers)
+		buffer = engine.createBuffer(reservoirSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	engine.immediateSubmit([&](const VkCommandBuffer cmd)
+		{
+			for (const AllocatedBuffer& buffer : m_reservoirBuffers)
+				vkCmdFillBuffer(cmd, buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+		});
+
+	const VkDeviceSize remapSize = std::max<VkDeviceSize>(maxLightCount, 1) * sizeof(uint32_t);
+	m_dataStride = engine.padUniformBufferSize(sizeof(GPULightSamplingData));
+	m_dataBuffer = engine.createBuffer(FRAME_OVERLAP * m_dataStride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	m_remapBuffers.resize(FRAME_OVERLAP);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		m_remapBuffers[i] = engine.createBuffer(remapSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		VkDescriptorBufferInfo dataInfo{ m_dataBuffer.buffer, i * m_dataStride, sizeof(GPULightSamplingData) };
+		VkDescriptorBufferInfo previousInfo{ m_reservoirBuffers[(i + 1) % 2].buffer, 0, reservoirSize };
+		VkDescriptorBufferInfo currentInfo{ m_reservoirBuffers[i % 2].buffer, 0, reservoirSize };
+		VkDescriptorBufferInfo remapInfo{ m_remapBuffers[i].buffer, 0, remapSize };
+
+		const VkWriteDescriptorSet writes[] = {
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_sets[i], &dataInfo, BINDING_DATA),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &previousInfo, BINDING_PREVIOUS_RESERVOIRS),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &currentInfo, BINDING_CURRENT_RESERVOIRS),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &remapInfo, BINDING_REMAP)
+		};
+		vkUpdateDescriptorSets(m_device, BINDING_COUNT, writes, 0, nullptr);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			for (const AllocatedBuffer& buffer : m_reservoirBuffers)
+				vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+			for (const AllocatedBuffer& buffer : m_remapBuffers)
+				vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+			vmaDestroyBuffer(m_allocator, m_dataBuffer.buffer, m_dataBuffer.allocation);
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+		});
+}
+
+void LightSampler::update(const uint32_t frameIndex, const glm::mat4& viewproj, const std::vector<uint32_t>& visibleLights, const bool active)
+{
+	if (!m_supported)
+		return;
+
+	GPULightSamplingData data{};
+	data.previousViewproj = m_previousViewproj;
+	data.frame = m_frame++;
+	data.historyValid = active && m_previousActive;
+	data.candidateCount = static_cast<uint32_t>(std::max(m_candidateCount, 1));
+	data.exhaustiveLightCount = static_cast<uint32_t>(std::max(m_exhaustiveLightCount, 0));
+	data.spatialSampleCount = static_cast<uint32_t>(std::max(m_spatialSampleCount, 0));
+	data.spatialRadius = m_spatialRadius;
+	data.maxHistory = m_maxHistory;
+
+	char* mapped;
+	vmaMapMemory(m_allocator, m_dataBuffer.allocation, reinterpret_cast<void**>(&mapped));
+	memcpy(mapped + frameIndex * m_dataStride, &data, sizeof(GPULightSamplingData));
+	vmaUnmapMemory(m_allocator, m_dataBuffer.allocation);
+
+	//the light a previous reservoir picked is at remap[index] now, or was culled
+	if (data.historyValid)
+	{
+		for (size_t i = 0; i < visibleLights.size(); i++)
+		{
+			if (visibleLights[i] >= m_currentIndices.size())
+				m_currentIndices.resize(visibleLights[i] + 1, INVALID_LIGHT);
+			m_currentIndices[visibleLights[i]] = static_cast<uint32_t>(i);
+		}
+
+		uint32_t* remap;
+		vmaMapMemory(m_allocator, m_remapBuffers[frameIndex].allocation, reinterpret_cast<void**>(&remap));
+		const size_t previousCount = std::min<size_t>(m_previousLights.size(), m_maxLightCount);
+		for (size_t i = 0; i < previousCount; i++)
+			remap[i] = m_previousLights[i] < m_currentIndices.size() ? m_currentIndices[m_previousLights[i]] : INVALID_LIGHT;
+		vmaUnmapMemory(m_allocator, m_remapBuffers[frameIndex].allocation);
+
+		for (const uint32_t light : visibleLights)
+			m_currentIndices[light] = INVALID_LIGHT;
+	}
+
+	m_previousViewproj = viewproj;
+	m_previousLights = visibleLights;
+	m_previousActive = active;
+}
+
+void LightSampler::recordBarrier(const VkCommandBuffer cmd) const
+{
+	//covers the writes of the previous submission, and its reads of the buffer this frame overwrites
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+// parameters of the sampled lighting, one copy per frame in flight
+GPU_DATA struct GPULightSamplingData
+{
+	// reprojects the pixels in the reservoirs of the previous frame
+	glm::mat4 previousViewproj;
+	uint32_t frame;
+	// the previous reservoirs were written last frame, with the light indices of the remap table
+	uint32_t historyValid;
+	uint32_t candidateCount;
+	// clusters with at most this many lights are shaded exhaustively
+	uint32_t exhaustiveLightCount;
+	uint32_t spatialSampleCount;
+	float spatialRadius;
+	// the reused reservoirs count for at most this many times the candidates
+	float maxHistory;
+	uint32_t padding;
+};
+
+// one light picked for a pixel, as the lighting shader streams it
+GPU_DATA struct GPULightReservoir
+{
+	uint32_t light;
+	// the unbiased contribution weight of the light
+	float weight;
+	float sampleCount;
+	// view depth of the pixel, the reuse rejects the reservoirs of other surfaces
+	float depth;
+};
+
+// Stochastic many-light shading, a variant of the deferred lighting pipeline. Every pixel draws candidateCount lights
+// of its cluster and keeps one in a reservoir by weighted reservoir sampling, with the unshadowed contribution as
+// target function. The reservoir is merged with the one of the previous frame at the reprojected pixel and with a few
+// of its neighbours, then only the picked light is shaded: the cost per pixel no longer depends on the light count.
+// The reservoirs live in two buffers the frames alternate between. The lights are compacted every frame, the previous
+// light indices go through a remap table to the current ones.
+class LightSampler
+{
+public:
+	// writes to storage buffers from the fragment shader need fragmentStoresAndAtomics, nothing is created without it
+	void init(VulkanEngine& engine, uint32_t maxLightCount);
+
+	// fills the parameters and the remap table of the frame. visibleLights are the scene indices of the uploaded lights,
+	// active tells whether the sampled lighting runs this frame
+	void update(uint32_t frameIndex, const glm::mat4& viewproj, const std::vector<uint32_t>& visibleLights, bool active);
+	// the reservoirs written by the previous frame are read by this one
+	void recordBarrier(VkCommandBuffer cmd) const;
+
+	bool isSupported() const { return m_supported; }
+	VkDescriptorSetLayout getSetLayout() const { return m_setLayout; }
+	VkDescriptorSet getSet(uint32_t frameIndex) const { return m_sets[frameIndex]; }
+
+	bool m_enabled{ false };
+	int m_candidateCount{ 4 };
+	int m_spatialSampleCount{ 2 };
+	int m_exhaustiveLightCount{ 8 };
+	float m_spatialRadius{ 16.f };
+	float m_maxHistory{ 20.f };
+
+private:
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	bool m_supported{ false };
+	uint32_t m_maxLightCount{ 0 };
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorSet> m_sets;
+	// the frames alternate between the two, FRAME_OVERLAP being even the frame index picks it
+	AllocatedBuffer m_reservoirBuffers[2]{};
+	std::vector<AllocatedBuffer> m_remapBuffers;
+	AllocatedBuffer m_dataBuffer{};
+	VkDeviceSize m_dataStride{ 0 };
+
+	glm::mat4 m_previousViewproj{ 1.f };
+	std::vector<uint32_t> m_previousLights;
+	// current index of every scene light, only valid while the remap table is built
+	std::vector<uint32_t> m_currentIndices;
+	bool m_previousActive{ false };
+	uint32_t m_frame{ 0 };
+};
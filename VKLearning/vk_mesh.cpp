@@ -3,11 +3,84 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#include "vk_asset.h"
+#include "vk_hash.h"
+#include "vk_pack.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #include "tiny_gltf.h"
 
+namespace
+{
+	// read-only istream over bytes that are already in memory
+	class MemoryStreamBuffer : public std::streambuf
+	{
+	public:
+		explicit MemoryStreamBuffer(const std::string_view bytes)
+		{
+			char* begin = const_cast<char*>(bytes.data());
+			setg(begin, begin, begin + bytes.size());
+		}
+	};
+
+	// material libraries go through vkutil::readFile as well so they can live in a pack
+	class MaterialReader : public tinyobj::MaterialReader
+	{
+	public:
+		explicit MaterialReader(std::string baseDirectory) : m_baseDirectory(std::move(baseDirectory)) {}
+
+		bool operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials,
+			std::map<std::string, int>* matMap, std::string* warn, std::string* err) override
+		{
+			vkutil::FileData fileData;
+			if (!vkutil::readFile(m_baseDirectory + matId, fileData))
+			{
+				if (warn)
+					*warn += "Material file [ " + matId + " ] not found in " + m_baseDirectory + "\n";
+				return false;
+			}
+
+			MemoryStreamBuffer buffer(fileData.view());
+			std::istream stream(&buffer);
+			tinyobj::LoadMtl(matMap, materials, &stream, warn, err);
+			return true;
+		}
+
+	private:
+		std::string m_baseDirectory;
+	};
+
+	bool readWholeFile(std::vector<unsigned char>* out, std::string* err, const std::string& filePath, void*)
+	{
+		vkutil::FileData fileData;
+		if (!vkutil::readFile(filePath, fileData))
+		{
+			if (err)
+				*err += "File read error : " + filePath + "\n";
+			return false;
+		}
+		out->assign(fileData.data(), fileData.data() + fileData.size());
+		return true;
+	}
+
+	bool assetExists(const std::string& filePath, void*)
+	{
+		return vkutil::assetExists(filePath);
+	}
+
+	std::string expandFilePath(const std::string& filePath, void*)
+	{
+		return filePath;
+	}
+}
+
 VertexInputDescription Vertex::getVertexDescription()
 {
 	VertexInputDescription description;
@@ -52,6 +125,17 @@ VertexInputDescription Vertex::getVertexDescription()
 }
 
 bool Mesh::loadFromObj(const char* filename)
+{
+	vkutil::FileData fileData;
+	if (!vkutil::readFile(filename, fileData))
+	{
+		std::cerr << "Failed to read " << filename << std::endl;
+		return false;
+	}
+	return loadObjFromMemory(filename, fileData);
+}
+
+bool Mesh::loadObjFromMemory(const char* filename, const vkutil::FileData& fileData)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -60,7 +144,11 @@ bool Mesh::loadFromObj(const char* filename)
 	std::string warn;
 	std::string err;
 
-	tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, nullptr);
+	//material libraries are looked up next to the obj file
+	MaterialReader materialReader(std::filesystem::path(filename).parent_path().string() + "/");
+	MemoryStreamBuffer buffer(fileData.view());
+	std::istream stream(&buffer);
+	tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream, &materialReader);
 
 	if (!warn.empty()) {
 		std::cout << "WARN: " << warn << std::endl;
@@ -127,13 +215,30 @@ bool Mesh::loadFromObj(const char* filename)
 }
 
 bool Mesh::loadFromGltf(const char* filename)
+{
+	vkutil::FileData fileData;
+	if (!vkutil::readFile(filename, fileData))
+	{
+		std::cout << "Failed to read glTF: " << filename << std::endl;
+		return false;
+	}
+	return loadGltfFromMemory(filename, fileData);
+}
+
+bool Mesh::loadGltfFromMemory(const char* filename, const vkutil::FileData& fileData)
 {
 	tinygltf::TinyGLTF loader;
 	std::string err;
 	std::string warn;
 	tinygltf::Model model;
 
-	const bool res = loader.LoadBinaryFromFile(&model, &err, &warn, filename);
+	//external buffers and images are resolved through vkutil::readFile too
+	loader.SetFsCallbacks({ &assetExists, &expandFilePath, &readWholeFile, &tinygltf::WriteWholeFile, nullptr });
+
+	const std::string baseDirectory = std::filesystem::path(filename).parent_path().string();
+	const bool isBinary = std::filesystem::path(filename).extension() == ".glb";
+	const bool res = isBinary ? loader.LoadBinaryFromMemory(&model, &err, &warn, fileData.data(), static_cast<unsigned int>(fileData.size()), baseDirectory)
+							  : loader.LoadASCIIFromString(&model, &err, &warn, reinterpret_cast<const char*>(fileData.data()), static_cast<unsigned int>(fileData.size()), baseDirectory);
 	if (!warn.empty()) {
 		std::cout << "WARN: " << warn << std::endl;
 	}
@@ -143,9 +248,388 @@ bool Mesh::loadFromGltf(const char* filename)
 	}
 
 	if (!res)
+	{
 		std::cout << "Failed to load glTF: " << filename << std::endl;
+		return false;
+	}
+
+	//reads the i-th element of a float accessor, whatever the stride of its buffer view
+	auto readFloats = [&model](const tinygltf::Accessor& accessor, size_t i, float* out, int count)
+	{
+		const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+		const unsigned char* data = model.buffers[view.buffer].data.data() + view.byteOffset + accessor.byteOffset;
+		memcpy(out, data + i * accessor.ByteStride(view), count * sizeof(float));
+	};
+
+	//node transforms are ignored, every triangle primitive is merged in mesh space
+	for (const tinygltf::Mesh& gltfMesh : model.meshes)
+	{
+		for (const tinygltf::Primitive& primitive : gltfMesh.primitives)
+		{
+			const auto position = primitive.attributes.find("POSITION");
+			if (primitive.mode != TINYGLTF_MODE_TRIANGLES || position == primitive.attributes.end())
+				continue;
+
+			const auto normal = primitive.attributes.find("NORMAL");
+			const auto uv = primitive.attributes.find("TEXCOORD_0");
+
+			const tinygltf::Accessor& positionAccessor = model.accessors[position->second];
+			const uint32_t firstVertex = static_cast<uint32_t>(m_vertices.size());
+
+			for (size_t v = 0; v < positionAccessor.count; v++)
+			{
+				Vertex new_vert{};
+				readFloats(positionAccessor, v, &new_vert.position.x, 3);
+				if (normal != primitive.attributes.end())
+					readFloats(model.accessors[normal->second], v, &new_vert.normal.x, 3);
+				if (uv != primitive.attributes.end())
+					readFloats(model.accessors[uv->second], v, &new_vert.uv.x, 2);
+				new_vert.color = glm::vec4(1.f);
+				m_vertices.push_back(new_vert);
+			}
+
+			if (primitive.indices < 0)
+			{
+				for (uint32_t v = 0; v < positionAccessor.count; v++)
+					m_indices.push_back(firstVertex + v);
+				continue;
+			}
+
+			const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
+			const tinygltf::BufferView& view = model.bufferViews[indexAccessor.bufferView];
+			const unsigned char* data = model.buffers[view.buffer].data.data() + view.byteOffset + indexAccessor.byteOffset;
+			const int stride = indexAccessor.ByteStride(view);
+
+			for (size_t i = 0; i < indexAccessor.count; i++)
+			{
+				const unsigned char* element = data + i * stride;
+				uint32_t index;
+				switch (indexAccessor.componentType)
+				{
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+					index = *element;
+					break;
+				case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+					index = *reinterpret_cast<const uint16_t*>(element);
+					break;
+				default:
+					index = *reinterpret_cast<const uint32_t*>(element);
+					break;
+				}
+				m_indices.push_back(firstVertex + index);
+			}
+		}
+	}
+
+	std::cout << "Loaded glTF: " << filename << std::endl;
+	return true;
+}
+
+bool Mesh::load(const char* filename)
+{
+	const std::string cookedPath = vkutil::getCookedPath(filename, vkutil::COOKED_MESH_EXTENSION);
+	if (vkutil::assetExists(cookedPath) && vkutil::isCookedUpToDate(filename, cookedPath) && loadFromCooked(cookedPath.c_str()))
+		return true;
+
+	const std::filesystem::path extension = std::filesystem::path(filename).extension();
+	if (extension == ".glb" || extension == ".gltf")
+		return loadFromGltf(filename);
+	return loadFromObj(filename);
+}
+
+std::string Mesh::getLoadPath(const char* filename)
+{
+	const std::string cookedPath = vkutil::getCookedPath(filename, vkutil::COOKED_MESH_EXTENSION);
+	return vkutil::assetExists(cookedPath) && vkutil::isCookedUpToDate(filename, cookedPath) ? cookedPath : std::string(filename);
+}
+
+bool Mesh::loadFromMemory(const char* filename, const vkutil::FileData& data)
+{
+	const std::filesystem::path extension = std::filesystem::path(filename).extension();
+	if (extension == vkutil::COOKED_MESH_EXTENSION)
+		return loadCookedFromMemory(filename, data);
+	if (extension == ".glb" || extension == ".gltf")
+		return loadGltfFromMemory(filename, data);
+	return loadObjFromMemory(filename, data);
+}
+
+bool Mesh::loadFromCooked(const char* filename)
+{
+	vkutil::FileData fileData;
+	if (!vkutil::readFile(filename, fileData))
+		return false;
+	return loadCookedFromMemory(filename, fileData);
+}
+
+bool Mesh::loadCookedFromMemory(const char* filename, const vkutil::FileData& fileData)
+{
+	vkutil::CookedMeshHeader header{};
+	if (fileData.size() >= sizeof(header))
+		memcpy(&header, fileData.data(), sizeof(header));
+	if (header.magic != vkutil::COOKED_MESH_MAGIC || header.version != vkutil::COOKED_VERSION)
+	{
+		std::cout << "Outdated cooked mesh " << filename << std::endl;
+		return false;
+	}
+
+	const size_t verticesSize = header.vertexCount * sizeof(Vertex);
+	const size_t indicesSize = header.indexCount * sizeof(uint32_t);
+	if (sizeof(header) + verticesSize + indicesSize > fileData.size())
+		return false;
+
+	//the payload is already in the runtime layout, copy it straight into place
+	m_vertices.resize(header.vertexCount);
+	m_indices.resize(header.indexCount);
+	memcpy(m_vertices.data(), fileData.data() + sizeof(header), verticesSize);
+	memcpy(m_indices.data(), fileData.data() + sizeof(header) + verticesSize, indicesSize);
+	return true;
+}
+
+bool Mesh::saveCooked(const char* filename, const uint64_t sourceHash) const
+{
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	vkutil::CookedMeshHeader header{};
+	header.vertexCount = static_cast<uint32_t>(m_vertices.size());
+	header.indexCount = static_cast<uint32_t>(m_indices.size());
+	header.sourceHash = sourceHash;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_vertices.data()), static_cast<std::streamsize>(m_vertices.size() * sizeof(Vertex)));
+	file.write(reinterpret_cast<const char*>(m_indices.data()), static_cast<std::streamsize>(m_indices.size() * sizeof(uint32_t)));
+	return file.good();
+}
+
+void Mesh::buildIndices()
+{
+	struct VertexHash
+	{
+		size_t operator()(const Vertex& v) const { return static_cast<size_t>(vkutil::hash64(&v, sizeof(Vertex))); }
+	};
+	struct VertexEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const { return memcmp(&a, &b, sizeof(Vertex)) == 0; }
+	};
+
+	//an already indexed mesh is expanded first so identical vertices can be merged
+	std::vector<Vertex> source;
+	if (m_indices.empty())
+		source.swap(m_vertices);
 	else
-		std::cout << "Loaded glTF: " << filename << std::endl;
+	{
+		source.reserve(m_indices.size());
+		for (const uint32_t index : m_indices)
+			source.push_back(m_vertices[index]);
+	}
+
+	std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> uniqueVertices;
+	uniqueVertices.reserve(source.size());
+
+	m_vertices.clear();
+	m_indices.clear();
+	m_indices.reserve(source.size());
+
+	for (const Vertex& vertex : source)
+	{
+		const auto [it, inserted] = uniqueVertices.try_emplace(vertex, static_cast<uint32_t>(m_vertices.size()));
+		if (inserted)
+			m_vertices.push_back(vertex);
+		m_indices.push_back(it->second);
+	}
+}
+
+void Mesh::computeBounds()
+{
+	if (m_vertices.empty())
+	{
+		m_boundsCenter = glm::vec3(0.f);
+		m_boundsRadius = 0.f;
+		return;
+	}
+
+	glm::vec3 minimum = m_vertices[0].position;
+	glm::vec3 maximum = m_vertices[0].position;
+	for (const Vertex& vertex : m_vertices)
+	{
+		minimum = glm::min(minimum, vertex.position);
+		maximum = glm::max(maximum, vertex.position);
+	}
+
+	m_boundsCenter = (minimum + maximum) * 0.5f;
+	float radiusSquared = 0.f;
+	for (const Vertex& vertex : m_vertices)
+	{
+		const glm::vec3 offset = vertex.position - m_boundsCenter;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	m_boundsRadius = std::sqrt(radiusSquared);
+}
+
+void Mesh::buildLods(const uint32_t maxLodCount)
+{
+	//built again from the full mesh when it already has levels
+	const uint32_t baseIndexCount = m_lods.empty() ? static_cast<uint32_t>(m_indices.size()) : m_lods[0].indexCount;
+	m_indices.resize(baseIndexCount);
+	m_lods.clear();
+	m_lods.push_back({ 0, baseIndexCount });
+	if (baseIndexCount < 3 || m_boundsRadius <= 0.f)
+		return;
+
+	const glm::vec3 origin = m_boundsCenter - glm::vec3(m_boundsRadius);
+	std::unordered_map<uint64_t, uint32_t> cellVertices;
+	std::vector<uint32_t> remap(m_vertices.size());
+
+	//the first level clusters on a 32 cells wide grid
+	uint32_t cellsPerAxis = 64;
+	for (uint32_t lod = 1; lod < maxLodCount; lod++)
+	{
+		cellsPerAxis /= 2;
+		const float cellScale = static_cast<float>(cellsPerAxis) / (2.f * m_boundsRadius);
+
+		//every vertex is replaced by the first vertex of its cell
+		cellVertices.clear();
+		for (uint32_t i = 0; i < m_vertices.size(); i++)
+		{
+			const glm::uvec3 cell = glm::min(glm::uvec3(glm::max((m_vertices[i].position - origin) * cellScale, 0.f)), glm::uvec3(cellsPerAxis - 1));
+			const uint64_t cellKey = (static_cast<uint64_t>(cell.x) << 42) | (static_cast<uint64_t>(cell.y) << 21) | cell.z;
+			remap[i] = cellVertices.try_emplace(cellKey, i).first->second;
+		}
+
+		//triangles collapsed by the clustering disappear
+		const uint32_t firstIndex = static_cast<uint32_t>(m_indices.size());
+		for (uint32_t i = 0; i + 2 < baseIndexCount; i += 3)
+		{
+			const uint32_t a = remap[m_indices[i]];
+			const uint32_t b = remap[m_indices[i + 1]];
+			const uint32_t c = remap[m_indices[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				m_indices.push_back(a);
+				m_indices.push_back(b);
+				m_indices.push_back(c);
+			}
+		}
+
+		//stop once a level does not remove a meaningful part of the previous one
+		const uint32_t indexCount = static_cast<uint32_t>(m_indices.size()) - firstIndex;
+		if (indexCount == 0 || indexCount * 10 > m_lods.back().indexCount * 9)
+		{
+			m_indices.resize(firstIndex);
+			break;
+		}
+		m_lods.push_back({ firstIndex, indexCount });
+	}
+}
+
+void Mesh::optimize()
+{
+	if (m_indices.empty())
+		buildIndices();
+
+	//Tipsify (Sander et al. 2007) : fans around the last emitted vertices while they are still in cache
+	constexpr int CACHE_SIZE = 16;
+	const uint32_t vertexCount = static_cast<uint32_t>(m_vertices.size());
+	const uint32_t triangleCount = static_cast<uint32_t>(m_indices.size() / 3);
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (const uint32_t index : m_indices)
+		adjacencyOffsets[index + 1]++;
+	for (uint32_t v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+	std::vector<uint32_t> adjacency(m_indices.size());
+	std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (uint32_t t = 0; t < triangleCount; t++)
+		for (uint32_t k = 0; k < 3; k++)
+			adjacency[fill[m_indices[t * 3 + k]]++] = t;
+
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+		liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+
+	std::vector<int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> optimizedIndices;
+	optimizedIndices.reserve(m_indices.size());
+
+	int time = CACHE_SIZE + 1;
+	uint32_t cursor = 0;
+	int64_t fanning = vertexCount > 0 ? 0 : -1;
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+		const uint32_t f = static_cast<uint32_t>(fanning);
+		for (uint32_t a = adjacencyOffsets[f]; a < adjacencyOffsets[f + 1]; a++)
+		{
+			const uint32_t t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = m_indices[t * 3 + k];
+				optimizedIndices.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > CACHE_SIZE)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		//next fanning vertex : the oldest candidate that will still be in cache after its fan
+		fanning = -1;
+		int bestPriority = -1;
+		for (const uint32_t v : candidates)
+		{
+			if (liveTriangles[v] == 0)
+				continue;
+			const int age = time - cacheTime[v];
+			const int priority = age + 2 * static_cast<int>(liveTriangles[v]) <= CACHE_SIZE ? age : 0;
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanning = v;
+			}
+		}
+
+		//dead end : fall back to recently used vertices, then to the next unfinished one
+		while (fanning < 0 && !deadEnd.empty())
+		{
+			const uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0)
+				fanning = v;
+		}
+		while (fanning < 0 && cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+				fanning = cursor;
+			cursor++;
+		}
+	}
+
+	//vertices in order of first use so the vertex fetch walks memory linearly
+	constexpr uint32_t UNUSED = ~0u;
+	std::vector<uint32_t> remap(vertexCount, UNUSED);
+	std::vector<Vertex> optimizedVertices;
+	optimizedVertices.reserve(vertexCount);
+	for (uint32_t& index : optimizedIndices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(optimizedVertices.size());
+			optimizedVertices.push_back(m_vertices[index]);
+		}
+		index = remap[index];
+	}
 
-	return res;
+	m_vertices.swap(optimizedVertices);
+	m_indices.swap(optimizedIndices);
 }
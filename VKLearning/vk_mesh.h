@@ -1,11 +1,14 @@
 #pragma once
 
 #include "vk_types.h"
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 
 using Color = glm::vec4;
 
+namespace vkutil { class FileData; }
+
 struct VertexInputDescription 
 {
     std::vector<VkVertexInputBindingDescription> bindings;
@@ -24,14 +27,59 @@ struct Vertex
     static VertexInputDescription getVertexDescription();
 };
 
+constexpr uint32_t MAX_MESH_LODS = 4;
+
+// range of the index buffer drawn for a level of detail
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
 class Mesh
 {
 public:
+    // loads the cooked version of the file when the AssetCooker produced one, the source otherwise
+    bool load(const char* filename);
     bool loadFromObj(const char* filename);
     bool loadFromGltf(const char* filename);
+    bool loadFromCooked(const char* filename);
+    // parses a file already read in memory, the format is chosen from the filename extension
+    bool loadFromMemory(const char* filename, const vkutil::FileData& data);
+    // the file load() would read : the cooked one when it exists, the source otherwise
+    static std::string getLoadPath(const char* filename);
+    bool saveCooked(const char* filename, uint64_t sourceHash) const;
+
+    // merges identical vertices and fills m_indices
+    void buildIndices();
+    // reorders triangles for the post-transform cache, then vertices in order of first use
+    void optimize();
+    // bounding sphere around the center of the vertices' box, used for culling
+    void computeBounds();
+    // appends coarser versions of the indexed mesh to m_indices, made by clustering vertices on a grid
+    // that halves its resolution at every level. Needs the bounds
+    void buildLods(uint32_t maxLodCount = MAX_MESH_LODS);
+private:
+    bool loadObjFromMemory(const char* filename, const vkutil::FileData& data);
+    bool loadGltfFromMemory(const char* filename, const vkutil::FileData& data);
+    bool loadCookedFromMemory(const char* filename, const vkutil::FileData& data);
 public:
     std::vector<Vertex> m_vertices;
+    std::vector<uint32_t> m_indices;
     AllocatedBuffer m_vertexBuffer;
+    AllocatedBuffer m_indexBuffer;
+    uint64_t m_contentHash{ 0 };
+    glm::vec3 m_boundsCenter{ 0.f };
+    float m_boundsRadius{ 0.f };
+    // m_lods[0] is the full mesh
+    std::vector<MeshLod> m_lods;
+};
+
+// passes in their draw order
+enum class DrawPass : uint8_t
+{
+	Opaque = 0,
+	Transparent = 1,
 };
 
 struct RenderObject
@@ -39,4 +87,9 @@ struct RenderObject
 	Mesh* mesh = nullptr;
 	Material* material = nullptr;
 	glm::mat4 transformMatrix{};
+	DrawPass pass = DrawPass::Opaque;
+	// never moves once the scene is built, static objects can be merged by the StaticBatcher
+	bool isStatic = false;
+	// rasterized by the OcclusionCuller, hiding what is behind it
+	bool isOccluder = false;
 };
\ No newline at end of file
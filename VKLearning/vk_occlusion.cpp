@@ -0,0 +1,330 @@
+#include "vk_occlusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+#include "vk_culling.h"
+#include "vk_jobs.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VK_OCCLUSION_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VK_OCCLUSION_SSE2 1
+#endif
+
+namespace
+{
+	constexpr uint32_t FULL_COVERAGE = 0xFFFFFFFFu;
+	// the tile rows are few, one per job keeps every core busy
+	constexpr uint32_t RASTER_ROWS_PER_JOB = 1;
+	constexpr uint32_t SETUP_GROUP_SIZE = 4;
+	constexpr uint32_t TEST_GROUP_SIZE = 1024;
+
+	// inside the triangle when a * x + b * y + c >= 0 for the three edges
+	struct EdgeFunctions
+	{
+		float a[3];
+		float b[3];
+		float c[3];
+	};
+
+	// 32 bits coverage of the 8x4 tile at (tileX, tileY), row after row, sampled at the pixel centers
+	uint32_t computeCoverage(const EdgeFunctions& edges, const uint32_t tileX, const uint32_t tileY)
+	{
+		const float x0 = static_cast<float>(tileX * OcclusionCuller::TILE_WIDTH);
+		const float y0 = static_cast<float>(tileY * OcclusionCuller::TILE_HEIGHT) + 0.5f;
+		uint32_t coverage = 0;
+
+#if defined(VK_OCCLUSION_AVX2)
+		const __m256 columns = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f));
+		__m256 edgeX[3];
+		for (uint32_t e = 0; e < 3; e++)
+			edgeX[e] = _mm256_mul_ps(_mm256_set1_ps(edges.a[e]), columns);
+
+		for (uint32_t row = 0; row < OcclusionCuller::TILE_HEIGHT; row++)
+		{
+			const float y = y0 + static_cast<float>(row);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				const __m256 distance = _mm256_add_ps(edgeX[e], _mm256_set1_ps(edges.b[e] * y + edges.c[e]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			coverage |= static_cast<uint32_t>(_mm256_movemask_ps(inside)) << (row * OcclusionCuller::TILE_WIDTH);
+		}
+#elif defined(VK_OCCLUSION_SSE2)
+		const __m128 columnsLow = _mm_add_ps(_mm_set1_ps(x0), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+		const __m128 columnsHigh = _mm_add_ps(_mm_set1_ps(x0), _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f));
+		__m128 edgeXLow[3], edgeXHigh[3];
+		for (uint32_t e = 0; e < 3; e++)
+		{
+			edgeXLow[e] = _mm_mul_ps(_mm_set1_ps(edges.a[e]), columnsLow);
+			edgeXHigh[e] = _mm_mul_ps(_mm_set1_ps(edges.a[e]), columnsHigh);
+		}
+
+		for (uint32_t row = 0; row < OcclusionCuller::TILE_HEIGHT; row++)
+		{
+			const float y = y0 + static_cast<float>(row);
+			__m128 insideLow = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			__m128 insideHigh = insideLow;
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				const __m128 edgeY = _mm_set1_ps(edges.b[e] * y + edges.c[e]);
+				insideLow = _mm_and_ps(insideLow, _mm_cmpge_ps(_mm_add_ps(edgeXLow[e], edgeY), _mm_setzero_ps()));
+				insideHigh = _mm_and_ps(insideHigh, _mm_cmpge_ps(_mm_add_ps(edgeXHigh[e], edgeY), _mm_setzero_ps()));
+			}
+			const auto rowCoverage = static_cast<uint32_t>(_mm_movemask_ps(insideLow) | (_mm_movemask_ps(insideHigh) << 4));
+			coverage |= rowCoverage << (row * OcclusionCuller::TILE_WIDTH);
+		}
+#else
+		for (uint32_t row = 0; row < OcclusionCuller::TILE_HEIGHT; row++)
+		{
+			const float y = y0 + static_cast<float>(row);
+			for (uint32_t column = 0; column < OcclusionCuller::TILE_WIDTH; column++)
+			{
+				const float x = x0 + static_cast<float>(column) + 0.5f;
+				bool inside = true;
+				for (uint32_t e = 0; e < 3; e++)
+					inside = inside && edges.a[e] * x + edges.b[e] * y + edges.c[e] >= 0.f;
+				if (inside)
+					coverage |= 1u << (row * OcclusionCuller::TILE_WIDTH + column);
+			}
+		}
+#endif
+		return coverage;
+	}
+}
+
+void OcclusionCuller::clear()
+{
+	constexpr uint32_t tileCount = TILES_X * TILES_Y;
+	m_farDepth.assign(tileCount, FLT_MAX);
+	m_layerDepth.assign(tileCount, 0.f);
+	m_layerMask.assign(tileCount, 0);
+}
+
+void OcclusionCuller::cull(JobSystem& jobSystem, const RenderObject* objects, const glm::mat4& viewProj, std::vector<uint32_t>& visible)
+{
+	m_stats = {};
+	if (!m_enabled)
+		return;
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	m_viewProj = viewProj;
+	clear();
+
+	//only the visible occluders are drawn, with their full mesh. The clustered levels of detail can reach outside of the
+	//real silhouette and hide objects that are visible
+	m_occluders.clear();
+	m_firstTriangles.assign(1, 0);
+	for (const uint32_t index : visible)
+	{
+		const RenderObject& object = objects[index];
+		if (!object.isOccluder || !object.mesh || object.mesh->m_lods.empty())
+			continue;
+		m_occluders.push_back(index);
+		m_firstTriangles.push_back(m_firstTriangles.back() + object.mesh->m_lods[0].indexCount / 3);
+	}
+	m_triangles.resize(m_firstTriangles.back());
+	m_stats.occluderCount = static_cast<uint32_t>(m_occluders.size());
+	m_stats.triangleCount = m_firstTriangles.back();
+
+	//projects the triangles, the ones that cannot be rasterized get an empty range of rows
+	jobSystem.parallelFor(static_cast<uint32_t>(m_occluders.size()), SETUP_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t o = begin; o < end; o++)
+			{
+				const RenderObject& object = objects[m_occluders[o]];
+				const Mesh& mesh = *object.mesh;
+				const MeshLod& lod = mesh.m_lods[0];
+				const glm::mat4 transform = m_viewProj * object.transformMatrix;
+
+				ScreenTriangle* triangles = m_triangles.data() + m_firstTriangles[o];
+				for (uint32_t t = 0; t < lod.indexCount / 3; t++)
+				{
+					ScreenTriangle& triangle = triangles[t];
+					triangle.minTileY = 1;
+					triangle.maxTileY = 0;
+					triangle.maxDepth = 0.f;
+
+					//triangles crossing the near plane are skipped, they would only ever occlude less
+					bool rasterizable = true;
+					glm::vec2 minPosition{ FLT_MAX }, maxPosition{ -FLT_MAX };
+					for (uint32_t v = 0; v < 3; v++)
+					{
+						const glm::vec4 clip = transform * glm::vec4(mesh.m_vertices[mesh.m_indices[lod.firstIndex + t * 3 + v]].position, 1.f);
+						if (clip.w <= 0.f || clip.z < -clip.w)
+						{
+							rasterizable = false;
+							break;
+						}
+						triangle.vertices[v] = { (clip.x / clip.w * 0.5f + 0.5f) * WIDTH, (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT };
+						triangle.maxDepth = std::max(triangle.maxDepth, clip.w);
+						minPosition = glm::min(minPosition, triangle.vertices[v]);
+						maxPosition = glm::max(maxPosition, triangle.vertices[v]);
+					}
+					if (!rasterizable || maxPosition.x < 0.f || maxPosition.y < 0.f || minPosition.x >= WIDTH || minPosition.y >= HEIGHT)
+						continue;
+
+					triangle.minTileY = static_cast<uint32_t>(std::max(minPosition.y, 0.f)) / TILE_HEIGHT;
+					triangle.maxTileY = static_cast<uint32_t>(std::min(maxPosition.y, static_cast<float>(HEIGHT - 1))) / TILE_HEIGHT;
+				}
+			}
+		});
+
+	//every job owns whole tile rows, the triangles are read by all of them
+	jobSystem.parallelFor(TILES_Y, RASTER_ROWS_PER_JOB, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			rasterizeRows(begin, end - 1);
+		});
+
+	const auto rasterized = std::chrono::high_resolution_clock::now();
+	m_stats.rasterMilliseconds = std::chrono::duration<float, std::milli>(rasterized - start).count();
+
+	//the bounds are the box around the bounding sphere
+	const auto visibleCount = static_cast<uint32_t>(visible.size());
+	m_occluded.resize(visibleCount);
+	jobSystem.parallelFor(visibleCount, TEST_GROUP_SIZE, [&](const uint32_t begin, const uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const RenderObject& object = objects[visible[i]];
+				const glm::vec4 sphere = vkutil::computeWorldSphere(object.transformMatrix, *object.mesh);
+				m_occluded[i] = isOccluded(glm::vec3(sphere) - sphere.w, glm::vec3(sphere) + sphere.w);
+			}
+		});
+
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < visibleCount; i++)
+	{
+		if (!m_occluded[i])
+			visible[kept++] = visible[i];
+	}
+	visible.resize(kept);
+
+	m_stats.testedCount = visibleCount;
+	m_stats.occludedCount = visibleCount - kept;
+	m_stats.testMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - rasterized).count();
+}
+
+void OcclusionCuller::rasterizeRows(const uint32_t firstTileRow, const uint32_t lastTileRow)
+{
+	for (const ScreenTriangle& triangle : m_triangles)
+	{
+		if (triangle.minTileY > triangle.maxTileY || triangle.maxTileY < firstTileRow || triangle.minTileY > lastTileRow)
+			continue;
+		rasterizeTriangle(triangle, std::max(firstTileRow, triangle.minTileY), std::min(lastTileRow, triangle.maxTileY));
+	}
+}
+
+void OcclusionCuller::rasterizeTriangle(const ScreenTriangle& triangle, const uint32_t firstTileRow, const uint32_t lastTileRow)
+{
+	const glm::vec2* v = triangle.vertices;
+	const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+	if (std::abs(area) < 1e-6f)
+		return;
+
+	//both windings are drawn, the edges are flipped so that the inside is always positive
+	const float orientation = area > 0.f ? 1.f : -1.f;
+	EdgeFunctions edges;
+	for (uint32_t e = 0; e < 3; e++)
+	{
+		const glm::vec2& from = v[e];
+		const glm::vec2& to = v[(e + 1) % 3];
+		edges.a[e] = (from.y - to.y) * orientation;
+		edges.b[e] = (to.x - from.x) * orientation;
+		edges.c[e] = (from.x * to.y - to.x * from.y) * orientation;
+	}
+
+	const float minX = std::min(v[0].x, std::min(v[1].x, v[2].x));
+	const float maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+	const uint32_t minTileX = static_cast<uint32_t>(std::max(minX, 0.f)) / TILE_WIDTH;
+	const uint32_t maxTileX = static_cast<uint32_t>(std::min(maxX, static_cast<float>(WIDTH - 1))) / TILE_WIDTH;
+
+	for (uint32_t tileY = firstTileRow; tileY <= lastTileRow; tileY++)
+	{
+		for (uint32_t tileX = minTileX; tileX <= maxTileX; tileX++)
+		{
+			const uint32_t coverage = computeCoverage(edges, tileX, tileY);
+			if (coverage != 0)
+				updateTile(tileY * TILES_X + tileX, coverage, triangle.maxDepth);
+		}
+	}
+}
+
+void OcclusionCuller::updateTile(const uint32_t tile, const uint32_t coverage, const float depth)
+{
+	//already behind what fully covers the tile
+	if (depth >= m_farDepth[tile])
+		return;
+
+	if (coverage == FULL_COVERAGE)
+	{
+		m_farDepth[tile] = depth;
+		return;
+	}
+
+	//the working layer grows until it covers the tile, then replaces the far depth if it is nearer
+	m_layerDepth[tile] = m_layerMask[tile] == 0 ? depth : std::max(m_layerDepth[tile], depth);
+	m_layerMask[tile] |= coverage;
+	if (m_layerMask[tile] == FULL_COVERAGE)
+	{
+		m_farDepth[tile] = std::min(m_farDepth[tile], m_layerDepth[tile]);
+		m_layerDepth[tile] = 0.f;
+		m_layerMask[tile] = 0;
+	}
+}
+
+bool OcclusionCuller::isOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+{
+	//the nearest depth of the box is at one of its corners
+	float minDepth = FLT_MAX;
+	glm::vec2 minPosition{ FLT_MAX }, maxPosition{ -FLT_MAX };
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		const glm::vec3 position = { corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z };
+		const glm::vec4 clip = m_viewProj * glm::vec4(position, 1.f);
+		//boxes crossing the near plane are always visible
+		if (clip.w <= 0.f || clip.z < -clip.w)
+			return false;
+
+		const glm::vec2 screen = { (clip.x / clip.w * 0.5f + 0.5f) * WIDTH, (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT };
+		minPosition = glm::min(minPosition, screen);
+		maxPosition = glm::max(maxPosition, screen);
+		minDepth = std::min(minDepth, clip.w);
+	}
+	if (maxPosition.x < 0.f || maxPosition.y < 0.f || minPosition.x >= WIDTH || minPosition.y >= HEIGHT)
+		return false;
+
+	const uint32_t minTileX = static_cast<uint32_t>(std::max(minPosition.x, 0.f)) / TILE_WIDTH;
+	const uint32_t maxTileX = static_cast<uint32_t>(std::min(maxPosition.x, static_cast<float>(WIDTH - 1))) / TILE_WIDTH;
+	const uint32_t minTileY = static_cast<uint32_t>(std::max(minPosition.y, 0.f)) / TILE_HEIGHT;
+	const uint32_t maxTileY = static_cast<uint32_t>(std::min(maxPosition.y, static_cast<float>(HEIGHT - 1))) / TILE_HEIGHT;
+
+	//hidden only when every tile it overlaps is fully covered by something nearer
+	for (uint32_t tileY = minTileY; tileY <= maxTileY; tileY++)
+	{
+		const float* farDepth = m_farDepth.data() + tileY * TILES_X;
+		for (uint32_t tileX = minTileX; tileX <= maxTileX; tileX++)
+		{
+			if (minDepth <= farDepth[tileX])
+				return false;
+		}
+	}
+	return true;
+}
+
+const char* OcclusionCuller::getInstructionSet()
+{
+#if defined(VK_OCCLUSION_AVX2)
+	return "AVX2";
+#elif defined(VK_OCCLUSION_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
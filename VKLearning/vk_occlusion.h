@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+
+#include <vector>
+
+class JobSystem;
+
+struct OcclusionStats
+{
+	uint32_t occluderCount = 0;
+	uint32_t triangleCount = 0;
+	uint32_t testedCount = 0;
+	uint32_t occludedCount = 0;
+	float rasterMilliseconds = 0.f;
+	float testMilliseconds = 0.f;
+};
+
+// Software occlusion culling in the spirit of Masked Occlusion Culling: the occluders are rasterized on the CPU into
+// a small depth buffer made of 8x4 pixel tiles. A tile keeps no per pixel depth, only a coverage mask of 32 bits and
+// two depths: the farthest depth of the whole tile, and the farthest depth of the triangles in the mask. Once the mask
+// is full, the second one becomes the first. The coverage of a tile row is computed with SIMD edge functions.
+// Depths are clip space w, the distance along the view axis, so the object tests need no perspective divide.
+// The tile rows are split across the JobSystem, each job owns its rows and needs no synchronization.
+class OcclusionCuller
+{
+public:
+	static constexpr uint32_t WIDTH = 256;
+	static constexpr uint32_t HEIGHT = 128;
+	static constexpr uint32_t TILE_WIDTH = 8;
+	static constexpr uint32_t TILE_HEIGHT = 4;
+	static constexpr uint32_t TILES_X = WIDTH / TILE_WIDTH;
+	static constexpr uint32_t TILES_Y = HEIGHT / TILE_HEIGHT;
+
+	// rasterizes the full mesh of the occluders listed in visible, then removes from visible the
+	// objects whose bounds are hidden behind them. The order of visible is kept
+	void cull(JobSystem& jobSystem, const RenderObject* objects, const glm::mat4& viewProj, std::vector<uint32_t>& visible);
+
+	// true when the bounds, from the last cull, are entirely behind the occluders
+	bool isOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+	const OcclusionStats& getStats() const { return m_stats; }
+	static const char* getInstructionSet();
+
+	bool m_enabled{ true };
+
+private:
+	// screen space triangle, in pixels, with its farthest depth
+	struct ScreenTriangle
+	{
+		glm::vec2 vertices[3];
+		float maxDepth;
+		uint32_t minTileY;
+		uint32_t maxTileY;
+	};
+
+	void clear();
+	void rasterizeRows(uint32_t firstTileRow, uint32_t lastTileRow);
+	void rasterizeTriangle(const ScreenTriangle& triangle, uint32_t firstTileRow, uint32_t lastTileRow);
+	void updateTile(uint32_t tile, uint32_t coverage, float depth);
+
+	glm::mat4 m_viewProj{ 1.f };
+
+	//the layers of the tiles, row major
+	std::vector<float> m_farDepth;
+	std::vector<float> m_layerDepth;
+	std::vector<uint32_t> m_layerMask;
+
+	std::vector<uint32_t> m_occluders;
+	std::vector<uint32_t> m_firstTriangles;
+	std::vector<ScreenTriangle> m_triangles;
+	std::vector<uint8_t> m_occluded;
+	OcclusionStats m_stats;
+};
@@ -0,0 +1,339 @@
+#include "vk_pack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "vk_hash.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct MountedPack
+	{
+		std::string mountPoint;
+		std::unique_ptr<vkutil::PackFile> pack;
+	};
+
+	std::vector<MountedPack> mountedPacks;
+
+	// entry of the first mounted pack covering the path, nullptr if the path is not packed
+	const vkutil::PackEntry* findPacked(const std::string& filePath, const vkutil::PackFile** outPack)
+	{
+		if (mountedPacks.empty())
+			return nullptr;
+
+		const std::string normalized = vkutil::normalizePackPath(filePath);
+		for (const MountedPack& mounted : mountedPacks)
+		{
+			const std::string& root = mounted.mountPoint;
+			if (normalized.size() <= root.size() + 1 || normalized.compare(0, root.size(), root) != 0 || normalized[root.size()] != '/')
+				continue;
+
+			if (const vkutil::PackEntry* entry = mounted.pack->find(std::string_view(normalized).substr(root.size() + 1)))
+			{
+				*outPack = mounted.pack.get();
+				return entry;
+			}
+		}
+		return nullptr;
+	}
+}
+
+std::string vkutil::normalizePackPath(const std::string& path)
+{
+	std::string normalized = std::filesystem::path(path).lexically_normal().generic_string();
+	while (!normalized.empty() && normalized.back() == '/')
+		normalized.pop_back();
+	return normalized;
+}
+
+uint64_t vkutil::hashPackPath(const std::string_view normalizedPath)
+{
+	return hash64(normalizedPath.data(), normalizedPath.size());
+}
+
+int64_t vkutil::lz4Decompress(const uint8_t* src, const size_t srcSize, uint8_t* dst, const size_t dstCapacity)
+{
+	const uint8_t* ip = src;
+	const uint8_t* const ipEnd = src + srcSize;
+	uint8_t* op = dst;
+	uint8_t* const opEnd = dst + dstCapacity;
+
+	//lengths of 15 continue with bytes until one is not 255
+	auto readLength = [&](size_t& length)
+	{
+		uint8_t byte;
+		do
+		{
+			if (ip >= ipEnd)
+				return false;
+			byte = *ip++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	};
+
+	while (ip < ipEnd)
+	{
+		const uint8_t token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(literalLength))
+			return -1;
+		if (literalLength > static_cast<size_t>(ipEnd - ip) || literalLength > static_cast<size_t>(opEnd - op))
+			return -1;
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		//the last sequence of a block only carries literals
+		if (ip == ipEnd)
+			break;
+
+		if (ipEnd - ip < 2)
+			return -1;
+		const size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<size_t>(op - dst))
+			return -1;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(matchLength))
+			return -1;
+		matchLength += 4;
+		if (matchLength > static_cast<size_t>(opEnd - op))
+			return -1;
+
+		//an overlapping match repeats its first bytes, it has to be copied forward one byte at a time
+		const uint8_t* match = op - offset;
+		if (offset >= matchLength)
+			memcpy(op, match, matchLength);
+		else
+			for (size_t i = 0; i < matchLength; i++)
+				op[i] = match[i];
+		op += matchLength;
+	}
+
+	return op - dst;
+}
+
+void vkutil::FileData::setView(const uint8_t* data, const size_t size)
+{
+	m_storage.reset();
+	m_data = data;
+	m_size = size;
+}
+
+uint8_t* vkutil::FileData::allocate(const size_t size, const size_t alignment)
+{
+	const std::align_val_t align{ alignment };
+	m_storage = std::unique_ptr<uint8_t[], AlignedDelete>(new (align) uint8_t[size > 0 ? size : 1], AlignedDelete{ align });
+	m_data = m_storage.get();
+	m_size = size;
+	return m_storage.get();
+}
+
+void vkutil::FileData::truncate(const size_t size)
+{
+	if (size < m_size)
+		m_size = size;
+}
+
+vkutil::PackFile::~PackFile()
+{
+	close();
+}
+
+bool vkutil::PackFile::open(const std::string& filePath)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+#else
+	const int file = ::open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat fileStat {};
+	void* mapping = MAP_FAILED;
+	if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+		mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	//the mapping keeps its own reference on the file
+	::close(file);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	m_base = static_cast<const uint8_t*>(mapping);
+	m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	if (!m_base || m_size < sizeof(PackHeader))
+	{
+		close();
+		return false;
+	}
+
+	const PackHeader* header = reinterpret_cast<const PackHeader*>(m_base);
+	const uint64_t tocSize = static_cast<uint64_t>(header->entryCount) * sizeof(PackEntry);
+	if (header->magic != PACK_MAGIC || header->version != PACK_VERSION
+		|| header->tocOffset > m_size || tocSize > m_size - header->tocOffset
+		|| header->namesOffset > m_size || header->namesSize > m_size - header->namesOffset)
+	{
+		std::cout << "Invalid or outdated pack file " << filePath << std::endl;
+		close();
+		return false;
+	}
+
+	m_entries = reinterpret_cast<const PackEntry*>(m_base + header->tocOffset);
+	m_entryCount = header->entryCount;
+	m_names = reinterpret_cast<const char*>(m_base + header->namesOffset);
+
+	for (uint32_t i = 0; i < m_entryCount; i++)
+	{
+		const PackEntry& entry = m_entries[i];
+		if (entry.offset > m_size || entry.storedSize > m_size - entry.offset
+			|| static_cast<uint64_t>(entry.nameOffset) + entry.nameLength > header->namesSize)
+		{
+			std::cout << "Corrupted entry in pack file " << filePath << std::endl;
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void vkutil::PackFile::close()
+{
+#ifdef _WIN32
+	if (m_base)
+		UnmapViewOfFile(m_base);
+	if (m_mappingHandle)
+		CloseHandle(m_mappingHandle);
+	if (m_fileHandle)
+		CloseHandle(m_fileHandle);
+#else
+	if (m_base)
+		munmap(const_cast<uint8_t*>(m_base), m_size);
+#endif
+	m_base = nullptr;
+	m_size = 0;
+	m_entries = nullptr;
+	m_entryCount = 0;
+	m_names = nullptr;
+	m_fileHandle = nullptr;
+	m_mappingHandle = nullptr;
+}
+
+std::string_view vkutil::PackFile::getName(const PackEntry& entry) const
+{
+	return { m_names + entry.nameOffset, entry.nameLength };
+}
+
+const vkutil::PackEntry* vkutil::PackFile::find(const std::string_view normalizedName) const
+{
+	const uint64_t nameHash = hashPackPath(normalizedName);
+	const PackEntry* end = m_entries + m_entryCount;
+	const PackEntry* it = std::lower_bound(m_entries, end, nameHash,
+		[](const PackEntry& entry, const uint64_t hash) { return entry.nameHash < hash; });
+
+	//hash collisions are possible, compare the names of every candidate
+	for (; it != end && it->nameHash == nameHash; ++it)
+		if (getName(*it) == normalizedName)
+			return it;
+	return nullptr;
+}
+
+bool vkutil::PackFile::read(const PackEntry& entry, FileData& outData) const
+{
+	const uint8_t* stored = m_base + entry.offset;
+	if (!(entry.flags & PACK_ENTRY_LZ4))
+	{
+		outData.setView(stored, static_cast<size_t>(entry.size));
+		return true;
+	}
+
+	uint8_t* decoded = outData.allocate(static_cast<size_t>(entry.size));
+	return lz4Decompress(stored, static_cast<size_t>(entry.storedSize), decoded, static_cast<size_t>(entry.size)) == static_cast<int64_t>(entry.size);
+}
+
+bool vkutil::mountPack(const std::string& packPath, const std::string& mountPoint)
+{
+	auto pack = std::make_unique<PackFile>();
+	if (!pack->open(packPath))
+		return false;
+
+	std::cout << "Mounted " << packPath << " (" << pack->getEntryCount() << " entries) on " << mountPoint << std::endl;
+	mountedPacks.push_back({ normalizePackPath(mountPoint), std::move(pack) });
+	return true;
+}
+
+void vkutil::unmountPacks()
+{
+	mountedPacks.clear();
+}
+
+bool vkutil::readFile(const std::string& filePath, FileData& outData)
+{
+	const PackFile* pack = nullptr;
+	if (const PackEntry* entry = findPacked(filePath, &pack))
+		return pack->read(*entry, outData);
+
+	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	const std::streamsize fileSize = file.tellg();
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(outData.allocate(static_cast<size_t>(fileSize))), fileSize);
+	return file.good();
+}
+
+bool vkutil::assetExists(const std::string& filePath)
+{
+	const PackFile* pack = nullptr;
+	if (findPacked(filePath, &pack))
+		return true;
+
+	std::error_code error;
+	return std::filesystem::is_regular_file(filePath, error);
+}
+
+bool vkutil::isPacked(const std::string& filePath)
+{
+	const PackFile* pack = nullptr;
+	return findPacked(filePath, &pack) != nullptr;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Single-file asset archive written by the AssetCooker (--pack).
+// Every entry starts on a 4 KB boundary so an uncompressed payload is used straight from the
+// memory mapping, compressed entries are LZ4 blocks. The table of contents sits at the end of
+// the file, sorted by name hash.
+namespace vkutil
+{
+	constexpr uint32_t PACK_MAGIC = 0x4B504B56; // "VKPK"
+	constexpr uint32_t PACK_VERSION = 1;
+	constexpr uint64_t PACK_ALIGNMENT = 4096;
+	constexpr const char* PACK_EXTENSION = ".vkpak";
+
+	constexpr uint32_t PACK_ENTRY_LZ4 = 1 << 0;
+
+	struct PackHeader
+	{
+		uint32_t magic{ PACK_MAGIC };
+		uint32_t version{ PACK_VERSION };
+		uint32_t entryCount{ 0 };
+		uint32_t reserved{ 0 };
+		uint64_t tocOffset{ 0 };
+		uint64_t namesOffset{ 0 };
+		uint64_t namesSize{ 0 };
+	};
+
+	struct PackEntry
+	{
+		uint64_t nameHash;
+		uint64_t offset;
+		uint64_t storedSize;
+		uint64_t size;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+		uint32_t flags;
+		uint32_t reserved;
+	};
+
+	// entry names are relative to the packed directory, with forward slashes and no "." or ".."
+	std::string normalizePackPath(const std::string& path);
+	uint64_t hashPackPath(std::string_view normalizedPath);
+
+	// decodes a raw LZ4 block, returns the decoded size or -1 when the block is malformed
+	int64_t lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+	// content of an asset : a view into a mapped pack, or owned bytes when it had to be decoded or read from disk
+	class FileData
+	{
+	public:
+		FileData() = default;
+		FileData(const FileData&) = delete;
+		FileData& operator=(const FileData&) = delete;
+		FileData(FileData&&) = default;
+		FileData& operator=(FileData&&) = default;
+
+		// at least 16 bytes aligned in both cases, SPIR-V can be passed as is
+		const uint8_t* data() const { return m_data; }
+		size_t size() const { return m_size; }
+		std::string_view view() const { return { reinterpret_cast<const char*>(m_data), m_size }; }
+
+		void setView(const uint8_t* data, size_t size);
+		// unbuffered reads need page aligned memory, and a capacity rounded up to the page size
+		uint8_t* allocate(size_t size, size_t alignment = 16);
+		// shrinks the visible size once the real file size is known
+		void truncate(size_t size);
+
+	private:
+		struct AlignedDelete
+		{
+			std::align_val_t alignment;
+			void operator()(uint8_t* pointer) const { ::operator delete[](pointer, alignment); }
+		};
+
+		const uint8_t* m_data{ nullptr };
+		size_t m_size{ 0 };
+		std::unique_ptr<uint8_t[], AlignedDelete> m_storage{ nullptr, AlignedDelete{ std::align_val_t{ 16 } } };
+	};
+
+	class PackFile
+	{
+	public:
+		PackFile() = default;
+		PackFile(const PackFile&) = delete;
+		PackFile& operator=(const PackFile&) = delete;
+		~PackFile();
+
+		bool open(const std::string& filePath);
+		void close();
+
+		const PackEntry* find(std::string_view normalizedName) const;
+		bool read(const PackEntry& entry, FileData& outData) const;
+
+		uint32_t getEntryCount() const { return m_entryCount; }
+		std::string_view getName(const PackEntry& entry) const;
+
+	private:
+		const uint8_t* m_base{ nullptr };
+		size_t m_size{ 0 };
+		const PackEntry* m_entries{ nullptr };
+		uint32_t m_entryCount{ 0 };
+		const char* m_names{ nullptr };
+
+		//platform handles kept alive for the lifetime of the mapping
+		void* m_fileHandle{ nullptr };
+		void* m_mappingHandle{ nullptr };
+	};
+
+	// Reads of "<mountPoint>/x" are served by the pack entry "x" before looking on disk.
+	// Mount before loading from several threads, reads are lock free.
+	bool mountPack(const std::string& packPath, const std::string& mountPoint);
+	void unmountPacks();
+
+	bool readFile(const std::string& filePath, FileData& outData);
+	bool assetExists(const std::string& filePath);
+	// true when a mounted pack serves the file, reading it then costs no I/O
+	bool isPacked(const std::string& filePath);
+}
@@ -22,8 +22,14 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device, VkRenderPass pass)
 
 	colorBlending.logicOpEnable = VK_FALSE;
 	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &m_colorBlendAttachment;
+	const std::vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments(m_colorAttachmentCount, m_colorBlendAttachment);
+	colorBlending.attachmentCount = m_colorAttachmentCount;
+	colorBlending.pAttachments = colorBlendAttachments.data();
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(m_dynamicStates.size());
+	dynamicState.pDynamicStates = m_dynamicStates.data();
 
 	//build the actual pipeline
 	//we now use all of the info structs we have been writing into into this one to create the pipeline
@@ -41,9 +47,10 @@ VkPipeline PipelineBuilder::buildPipeline(VkDevice device, VkRenderPass pass)
 	pipelineInfo.pColorBlendState = &colorBlending;
 	pipelineInfo.layout = m_pipelineLayout;
 	pipelineInfo.renderPass = pass;
-	pipelineInfo.subpass = 0;
+	pipelineInfo.subpass = m_subpass;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.pDepthStencilState = &m_depthStencil;
+	pipelineInfo.pDynamicState = m_dynamicStates.empty() ? nullptr : &dynamicState;
 
 	//it's easy to error out on create graphics pipeline, so we handle it a bit better than the common VK_CHECK case
 	VkPipeline newPipeline;
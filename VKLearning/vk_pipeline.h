@@ -21,5 +21,10 @@ public:
 	VkPipelineMultisampleStateCreateInfo		 m_multisampling;
 	VkPipelineLayout							 m_pipelineLayout;
 	VkPipelineDepthStencilStateCreateInfo		 m_depthStencil;
+	// every color attachment of the subpass is blended with m_colorBlendAttachment
+	uint32_t									 m_colorAttachmentCount{ 1 };
+	uint32_t									 m_subpass{ 0 };
+	// empty, the viewport and the scissor above are baked in the pipeline
+	std::vector<VkDynamicState>					 m_dynamicStates;
 
 };
@@ -0,0 +1,163 @@
+#include "vk_render_queue.h"
+
+#include <bit>
+
+namespace
+{
+	constexpr uint32_t PASS_BITS = 2;
+	constexpr uint32_t PIPELINE_BITS = 10;
+	constexpr uint32_t MATERIAL_BITS = 12;
+	constexpr uint32_t MESH_BITS = 16;
+	constexpr uint32_t DEPTH_BITS = 24;
+	static_assert(PASS_BITS + PIPELINE_BITS + MATERIAL_BITS + MESH_BITS + DEPTH_BITS == 64);
+
+	constexpr uint32_t RADIX_BITS = 8;
+	constexpr uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+
+	// the bits of a positive float grow with its value, the top ones keep a constant relative precision
+	uint64_t quantizeDepth(const float viewDepth)
+	{
+		if (!(viewDepth > 0.f))
+			return 0;
+		return std::bit_cast<uint32_t>(viewDepth) >> (32 - DEPTH_BITS);
+	}
+}
+
+void RenderQueue::clear()
+{
+	m_items.clear();
+	m_batches.clear();
+	m_stats = {};
+}
+
+void RenderQueue::push(const uint32_t objectIndex, const RenderObject& object, const float viewDepth)
+{
+	const uint64_t pipeline = getSortId(m_pipelineIds, reinterpret_cast<uint64_t>(object.material->pipeline), PIPELINE_BITS);
+	const uint64_t material = getSortId(m_materialIds, reinterpret_cast<uint64_t>(object.material), MATERIAL_BITS);
+	const uint64_t mesh = getSortId(m_meshIds, reinterpret_cast<uint64_t>(object.mesh), MESH_BITS);
+	const uint64_t depth = quantizeDepth(viewDepth);
+	const uint64_t pass = static_cast<uint64_t>(object.pass);
+
+	const uint64_t state = (pipeline << (MATERIAL_BITS + MESH_BITS)) | (material << MESH_BITS) | mesh;
+	uint64_t key;
+	if (object.pass == DrawPass::Transparent)
+	{
+		//blending needs the far objects first, the state only breaks ties
+		const uint64_t farToNear = ((1ull << DEPTH_BITS) - 1) - depth;
+		key = (pass << (64 - PASS_BITS)) | (farToNear << (PIPELINE_BITS + MATERIAL_BITS + MESH_BITS)) | state;
+	}
+	else
+		key = (pass << (64 - PASS_BITS)) | (state << DEPTH_BITS) | depth;
+
+	m_items.push_back({ key, objectIndex });
+}
+
+void RenderQueue::build(const RenderObject* objects, GPUObjectData* objectSSBO)
+{
+	radixSort(m_items, m_scratch);
+
+	m_batches.clear();
+	for (uint32_t instance = 0; instance < m_items.size(); instance++)
+	{
+		const RenderObject& object = objects[m_items[instance].objectIndex];
+		objectSSBO[instance].modelMatrix = object.transformMatrix;
+
+		if (m_batches.empty() || m_batches.back().material != object.material || m_batches.back().mesh != object.mesh || m_batches.back().pass != object.pass)
+			m_batches.push_back({ object.mesh, object.material, instance, 0, object.pass });
+		m_batches.back().instanceCount++;
+	}
+
+	m_stats = {};
+	m_stats.objectCount = static_cast<uint32_t>(m_items.size());
+	m_stats.drawCount = static_cast<uint32_t>(m_batches.size());
+	const DrawBatch* previous = nullptr;
+	for (const DrawBatch& batch : m_batches)
+	{
+		const uint32_t changes = getStateChanges(previous, batch);
+		m_stats.pipelineBinds += (changes & STATE_CHANGE_PIPELINE) ? 1 : 0;
+		m_stats.descriptorSetBinds += (changes & STATE_CHANGE_FRAME_SETS) ? 2 : 0;
+		m_stats.descriptorSetBinds += (changes & STATE_CHANGE_TEXTURE_SET) ? 1 : 0;
+		m_stats.meshBinds += (changes & STATE_CHANGE_MESH) ? 1 : 0;
+		previous = &batch;
+	}
+}
+
+uint32_t RenderQueue::getStateChanges(const DrawBatch* previous, const DrawBatch& batch)
+{
+	const Material& material = *batch.material;
+	if (!previous)
+		return STATE_CHANGE_PIPELINE | STATE_CHANGE_FRAME_SETS | STATE_CHANGE_MESH | (material.textureSet != VK_NULL_HANDLE ? static_cast<uint32_t>(STATE_CHANGE_TEXTURE_SET) : 0u);
+
+	uint32_t changes = 0;
+	if (material.pipeline != previous->material->pipeline)
+		changes |= STATE_CHANGE_PIPELINE;
+	//binding a set with another layout disturbs the sets after it
+	if (material.pipelineLayout != previous->material->pipelineLayout)
+		changes |= STATE_CHANGE_FRAME_SETS;
+	if (material.textureSet != VK_NULL_HANDLE && ((changes & STATE_CHANGE_FRAME_SETS) || material.textureSet != previous->material->textureSet))
+		changes |= STATE_CHANGE_TEXTURE_SET;
+	if (batch.mesh != previous->mesh)
+		changes |= STATE_CHANGE_MESH;
+	return changes;
+}
+
+uint64_t RenderQueue::getSortId(std::unordered_map<uint64_t, uint32_t>& ids, const uint64_t resource, const uint32_t bits)
+{
+	const auto it = ids.find(resource);
+	if (it != ids.end())
+		return it->second;
+
+	//released resources keep their id, start over once the bits are exhausted.
+	//sharing an id only costs some binds, batches compare the pointers
+	if (ids.size() >= (1ull << bits))
+		ids.clear();
+
+	const uint32_t id = static_cast<uint32_t>(ids.size());
+	ids.emplace(resource, id);
+	return id;
+}
+
+void RenderQueue::radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+{
+	const size_t count = items.size();
+	if (count < 2)
+		return;
+	scratch.resize(count);
+
+	//one histogram per digit, all filled in a single pass over the keys
+	constexpr uint32_t DIGIT_COUNT = 64 / RADIX_BITS;
+	uint32_t histograms[DIGIT_COUNT][RADIX_SIZE] = {};
+	for (const SortItem& item : items)
+		for (uint32_t digit = 0; digit < DIGIT_COUNT; digit++)
+			histograms[digit][(item.key >> (digit * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+
+	SortItem* source = items.data();
+	SortItem* destination = scratch.data();
+	for (uint32_t digit = 0; digit < DIGIT_COUNT; digit++)
+	{
+		uint32_t* histogram = histograms[digit];
+		const uint32_t shift = digit * RADIX_BITS;
+
+		//every key has the same digit (unused ids, a single pass...), this pass would not move anything
+		if (histogram[(source[0].key >> shift) & (RADIX_SIZE - 1)] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < RADIX_SIZE; bucket++)
+		{
+			const uint32_t bucketSize = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketSize;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const SortItem& item = source[i];
+			destination[histogram[(item.key >> shift) & (RADIX_SIZE - 1)]++] = item;
+		}
+		std::swap(source, destination);
+	}
+
+	if (source != items.data())
+		items.swap(scratch);
+}
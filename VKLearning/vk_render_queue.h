@@ -0,0 +1,78 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+
+#include <unordered_map>
+#include <vector>
+
+// render objects sharing a mesh and a material, drawn with a single instanced call
+struct DrawBatch
+{
+	Mesh* mesh = nullptr;
+	Material* material = nullptr;
+	uint32_t firstInstance = 0;
+	uint32_t instanceCount = 0;
+	// the opaque batches come first, only they go through the depth prepass
+	DrawPass pass = DrawPass::Opaque;
+};
+
+struct RenderQueueStats
+{
+	uint32_t objectCount = 0;
+	uint32_t drawCount = 0;
+	uint32_t pipelineBinds = 0;
+	uint32_t descriptorSetBinds = 0;
+	uint32_t meshBinds = 0;
+};
+
+// what has to be bound before drawing a batch
+enum StateChangeFlags : uint32_t
+{
+	STATE_CHANGE_PIPELINE = 1 << 0,
+	// the per frame sets 0 and 1, rebound when the pipeline layout changes
+	STATE_CHANGE_FRAME_SETS = 1 << 1,
+	STATE_CHANGE_TEXTURE_SET = 1 << 2,
+	STATE_CHANGE_MESH = 1 << 3,
+};
+
+// Orders the visible objects of a frame by a 64 bit key
+//   opaque      | pass 2 | pipeline 10 | material 12 | mesh 16 | depth 24 |
+//   transparent | pass 2 | far to near depth 24 | pipeline 10 | material 12 | mesh 16 |
+// and sorts the keys with a LSD radix sort, so that binds are grouped whatever the order the scene was built in.
+// Opaque objects are drawn front to back inside a (material, mesh) group to get the most out of early-Z.
+class RenderQueue
+{
+public:
+	void clear();
+	// viewDepth is the distance to the camera along its front axis
+	void push(uint32_t objectIndex, const RenderObject& object, float viewDepth);
+	// sorts the queue, writes the transforms in draw order and builds the instanced batches
+	void build(const RenderObject* objects, GPUObjectData* objectSSBO);
+
+	const std::vector<DrawBatch>& getBatches() const { return m_batches; }
+	const RenderQueueStats& getStats() const { return m_stats; }
+
+	// StateChangeFlags needed to go from the previous batch (nullptr for the first one) to this one
+	static uint32_t getStateChanges(const DrawBatch* previous, const DrawBatch& batch);
+
+private:
+	struct SortItem
+	{
+		uint64_t key;
+		uint32_t objectIndex;
+	};
+
+	// small ids handed out the first time a resource is seen, so that it fits in its bits of the key
+	static uint64_t getSortId(std::unordered_map<uint64_t, uint32_t>& ids, uint64_t resource, uint32_t bits);
+	static void radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch);
+
+	std::vector<SortItem> m_items;
+	std::vector<SortItem> m_scratch;
+	std::vector<DrawBatch> m_batches;
+	RenderQueueStats m_stats;
+
+	std::unordered_map<uint64_t, uint32_t> m_pipelineIds;
+	std::unordered_map<uint64_t, uint32_t> m_materialIds;
+	std::unordered_map<uint64_t, uint32_t> m_meshIds;
+};
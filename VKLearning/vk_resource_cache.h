@@ -0,0 +1,97 @@
+#pragma once
+
+#include "vk_types.h"
+#include <unordered_map>
+
+struct MeshBuffers
+{
+	AllocatedBuffer vertexBuffer;
+	AllocatedBuffer indexBuffer;
+};
+
+struct DedupStats
+{
+	uint32_t uniqueCount = 0;
+	uint32_t sharedCount = 0;
+	VkDeviceSize uniqueBytes = 0;
+	VkDeviceSize savedBytes = 0;
+};
+
+// Reference counted GPU resources keyed by the hash of their content.
+// Loading identical content twice hands back the resource created the first time.
+template<typename T>
+class ResourceCache
+{
+public:
+	// returns the cached resource and takes a reference on it, nullptr if the content was never seen
+	T* acquire(const uint64_t hash)
+	{
+		const auto it = m_entries.find(hash);
+		if (it == m_entries.end())
+			return nullptr;
+
+		it->second.refCount++;
+		m_stats.sharedCount++;
+		m_stats.savedBytes += it->second.size;
+		return &it->second.resource;
+	}
+
+	T& insert(const uint64_t hash, const T& resource, const VkDeviceSize size)
+	{
+		Entry& entry = m_entries[hash];
+		entry.resource = resource;
+		entry.size = size;
+		entry.refCount = 1;
+
+		m_stats.uniqueCount++;
+		m_stats.uniqueBytes += size;
+		return entry.resource;
+	}
+
+	// drops a reference, returns true and the resource when it was the last one so the caller can destroy it
+	bool release(const uint64_t hash, T& outResource)
+	{
+		const auto it = m_entries.find(hash);
+		if (it == m_entries.end())
+			return false;
+
+		if (--it->second.refCount > 0)
+		{
+			m_stats.sharedCount--;
+			m_stats.savedBytes -= it->second.size;
+			return false;
+		}
+
+		outResource = it->second.resource;
+		m_stats.uniqueCount--;
+		m_stats.uniqueBytes -= it->second.size;
+		m_entries.erase(it);
+		return true;
+	}
+
+	template<typename F>
+	void forEach(F&& function)
+	{
+		for (auto& [hash, entry] : m_entries)
+			function(entry.resource);
+	}
+
+	void clear()
+	{
+		m_entries.clear();
+		m_stats = {};
+	}
+
+	const DedupStats& getStats() const { return m_stats; }
+
+private:
+	struct Entry
+	{
+		T resource{};
+		VkDeviceSize size{ 0 };
+		uint32_t refCount{ 0 };
+	};
+
+	std::unordered_map<uint64_t, Entry> m_entries;
+	DedupStats m_stats;
+};
@@ -0,0 +1,664 @@
+#include "vk_shadow_atlas.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_light_animation.h"
+#include "vk_pipeline.h"
+
+namespace
+{
+	static_assert(sizeof(GPUPointShadow) == 480, "must match the std430 PointShadow of the lighting shaders");
+
+	const glm::vec3 FACE_AXES[6] = { { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f } };
+	const glm::vec3 FACE_UPS[6] = { { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f }, { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f } };
+
+	// nodes per side of the atlas at a level of the quadtree
+	uint32_t gridSize(const uint32_t level)
+	{
+		return PointShadowAtlas::ATLAS_SIZE / PointShadowAtlas::MAX_FACE_SIZE << level;
+	}
+
+	// index of the first node of a level, the levels are stored one after the other
+	uint32_t levelOffset(const uint32_t level)
+	{
+		uint32_t offset = 0;
+		for (uint32_t l = 0; l < level; l++)
+			offset += gridSize(l) * gridSize(l);
+		return offset;
+	}
+
+	uint32_t nodeLevel(const uint32_t node)
+	{
+		uint32_t level = 0;
+		while (node >= levelOffset(level + 1))
+			level++;
+		return level;
+	}
+
+	uint32_t nodeTexels(const uint32_t node)
+	{
+		const uint32_t size = PointShadowAtlas::MAX_FACE_SIZE >> nodeLevel(node);
+		return size * size;
+	}
+
+	bool intersects(const Frustum& frustum, const glm::vec4& sphere)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			if (glm::dot(plane, glm::vec4(glm::vec3(sphere), 1.f)) < -sphere.w)
+				return false;
+		}
+		return true;
+	}
+}
+
+void PointShadowAtlas::init(VulkanEngine& engine, const uint32_t maxLightCount, const uint32_t maxCasterCount)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_maxLightCount = maxLightCount;
+	m_maxCasterCount = maxCasterCount;
+
+	m_nodes.assign(levelOffset(LEVEL_COUNT), NodeState::Absent);
+	std::fill(m_nodes.begin(), m_nodes.begin() + levelOffset(1), NodeState::Free);
+	m_lightSlots.assign(maxLightCount, NO_SHADOW);
+	m_lightSelected.assign(maxLightCount, 0);
+
+	const VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		{ ATLAS_SIZE, ATLAS_SIZE, 1 });
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &m_atlasImage.image, &m_atlasImage.allocation, nullptr));
+
+	const VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(FORMAT, m_atlasImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &m_atlasView));
+
+	//a single tap, the hardware compares and filters the four nearest texels
+	VkSamplerCreateInfo samplerInfo = vkinit::samplerCreateInfo(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	samplerInfo.compareEnable = VK_TRUE;
+	samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler));
+
+	//the atlas stays sampled between the frames, only the rendered faces are cleared
+	VkAttachmentDescription attachment = {};
+	attachment.format = FORMAT;
+	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	const VkAttachmentReference depthRef = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.pDepthStencilAttachment = &depthRef;
+
+	//the shading of the previous frame is done sampling before the faces are overwritten
+	VkSubpassDependency dependencies[2] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &attachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.pDependencies = dependencies;
+	VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass));
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &m_atlasView;
+	framebufferInfo.width = ATLAS_SIZE;
+	framebufferInfo.height = ATLAS_SIZE;
+	framebufferInfo.layers = 1;
+	VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_framebuffer));
+
+	//the render pass loads the atlas in the shader read only layout, it starts lit everywhere
+	engine.immediateSubmit([&](const VkCommandBuffer cmd)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.image = m_atlasImage.image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			const VkClearDepthStencilValue clear{ 1.f, 0 };
+			vkCmdClearDepthStencilImage(cmd, m_atlasImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear, 1, &barrier.subresourceRange);
+
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		});
+
+	const VkDescriptorSetLayoutBinding binding = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = 1;
+	setInfo.pBindings = &binding;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = engine.m_descriptorPool;
+	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	setAllocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &setAllocInfo, m_sets.data()));
+
+	const VkDeviceSize casterSize = std::max<VkDeviceSize>(maxCasterCount, 1) * sizeof(glm::mat4);
+	const VkDeviceSize shadowSize = MAX_SHADOW_LIGHTS * sizeof(GPUPointShadow) + std::max<VkDeviceSize>(maxLightCount, 1) * sizeof(uint32_t);
+	m_casterBuffers.resize(FRAME_OVERLAP);
+	m_shadowBuffers.resize(FRAME_OVERLAP);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		m_casterBuffers[i] = engine.createBuffer(casterSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		m_shadowBuffers[i] = engine.createBuffer(shadowSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		VkDescriptorBufferInfo casterInfo{ m_casterBuffers[i].buffer, 0, casterSize };
+		const VkWriteDescriptorSet write = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &casterInfo, 0);
+		vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+			{
+				vmaDestroyBuffer(m_allocator, m_casterBuffers[i].buffer, m_casterBuffers[i].allocation);
+				vmaDestroyBuffer(m_allocator, m_shadowBuffers[i].buffer, m_shadowBuffers[i].allocation);
+			}
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+			vkDestroyFramebuffer(m_device, m_framebuffer, nullptr);
+			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			vkDestroySampler(m_device, m_sampler, nullptr);
+			vkDestroyImageView(m_device, m_atlasView, nullptr);
+			vmaDestroyImage(m_allocator, m_atlasImage.image, m_atlasImage.allocation);
+		});
+}
+
+void PointShadowAtlas::initPipelines(VulkanEngine& engine, const VkShaderModule vertShader)
+{
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(ShadowCasterDraws::Constants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_setLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	//the pipeline of the cascades, the viewport and the scissor are set per face
+	const VertexInputDescription vertexDescription = Vertex::getVertexDescription();
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.m_vertexInputInfo = vkinit::vertexInputStateCreateInfo();
+	pipelineBuilder.m_vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
+	pipelineBuilder.m_vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexDescription.bindings.size());
+	pipelineBuilder.m_vertexInputInfo.pVertexAttributeDescriptions = &vertexDescription.attributes[0];
+	pipelineBuilder.m_vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	pipelineBuilder.m_inputAssembly = vkinit::inputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+	pipelineBuilder.m_viewport = { 0.f, 0.f, static_cast<float>(MAX_FACE_SIZE), static_cast<float>(MAX_FACE_SIZE), 0.f, 1.f };
+	pipelineBuilder.m_scissor = { { 0, 0 }, { MAX_FACE_SIZE, MAX_FACE_SIZE } };
+	pipelineBuilder.m_dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	pipelineBuilder.m_rasterizer = vkinit::rasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.m_rasterizer.cullMode = VK_CULL_MODE_NONE;
+	pipelineBuilder.m_rasterizer.depthBiasEnable = VK_TRUE;
+	pipelineBuilder.m_rasterizer.depthBiasConstantFactor = 2.f;
+	pipelineBuilder.m_rasterizer.depthBiasSlopeFactor = 2.5f;
+	pipelineBuilder.m_multisampling = vkinit::multisamplingStateCreateInfo();
+	pipelineBuilder.m_colorBlendAttachment = vkinit::colorBlendAttachementState();
+	pipelineBuilder.m_colorAttachmentCount = 0;
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	pipelineBuilder.m_pipelineLayout = m_pipelineLayout;
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vertShader));
+	m_pipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		});
+}
+
+void PointShadowAtlas::update(JobSystem& jobSystem, const uint32_t frameIndex, const RenderObject* objects, const uint32_t count, const LightAnimator& lights,
+	const std::vector<uint32_t>& visibleLights, const glm::mat4& view, const glm::mat4& projection, const VkExtent2D extent, const uint64_t sceneVersion)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	m_frame++;
+	m_stats = {};
+	m_draws.clear();
+	m_faceDraws.clear();
+
+	const GPULightData* bounds = lights.getBounds();
+	const uint32_t lightCount = std::min(lights.getCapacity(), m_maxLightCount);
+	if (m_enabled)
+	{
+		//the radius of the range of the light on screen, in pixels, times how bright it is
+		m_candidates.clear();
+		float maxImportance = 0.f;
+		for (const uint32_t index : visibleLights)
+		{
+			if (index >= lightCount || !lights.isStationary(index))
+				continue;
+
+			const GPULightData& light = bounds[index];
+			const float distance = glm::length(glm::vec3(view * glm::vec4(light.position, 1.f)));
+			const float screenRadius = distance <= light.radius ? static_cast<float>(extent.height)
+				: light.radius / std::sqrt(distance * distance - light.radius * light.radius) * std::abs(projection[1][1]) * static_cast<float>(extent.height) * 0.5f;
+			const float importance = light.intensity * std::max(light.color.r, std::max(light.color.g, light.color.b));
+			if (importance <= 0.f)
+				continue;
+
+			maxImportance = std::max(maxImportance, importance);
+			m_candidates.push_back({ screenRadius * importance, index, 0 });
+		}
+		const auto candidateCount = std::min<size_t>(m_candidates.size(), MAX_SHADOW_LIGHTS);
+		std::partial_sort(m_candidates.begin(), m_candidates.begin() + candidateCount, m_candidates.end(),
+			[](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+		m_candidates.resize(candidateCount);
+
+		//a face texel per pixel of the screen radius, fewer for the dimmer lights
+		for (Candidate& candidate : m_candidates)
+		{
+			const GPULightData& light = bounds[candidate.light];
+			const float importance = light.intensity * std::max(light.color.r, std::max(light.color.g, light.color.b));
+			const float screenRadius = candidate.score / importance;
+			const float texels = screenRadius * m_resolutionScale * std::clamp(std::sqrt(importance / maxImportance), 0.25f, 1.f);
+			const float size = std::exp2(std::ceil(std::log2(std::max(texels, 1.f))));
+			candidate.level = static_cast<uint32_t>(std::log2(MAX_FACE_SIZE / std::clamp(size, static_cast<float>(MIN_FACE_SIZE), static_cast<float>(MAX_FACE_SIZE))));
+			m_lightSelected[candidate.light] = m_frame;
+		}
+
+		//the lights left out give their space back first. A face grows as soon as it needs to, it only shrinks once it
+		//has four times the texels it needs, a light at the threshold does not resize every frame. A light keeps its
+		//faces when the atlas has no room for the new size, and shades with them until the new ones are rendered
+		for (ShadowSlot& slot : m_slots)
+		{
+			if (slot.light != NO_SHADOW && m_lightSelected[slot.light] != m_frame)
+				releaseSlot(slot);
+		}
+		for (const Candidate& candidate : m_candidates)
+		{
+			const uint32_t slotIndex = m_lightSlots[candidate.light];
+			if (slotIndex == NO_SHADOW)
+				continue;
+
+			ShadowSlot& slot = m_slots[slotIndex];
+			slot.score = candidate.score;
+			if (candidate.level < slot.level || candidate.level >= slot.level + 2)
+				resizeSlot(slot, candidate.level);
+		}
+
+		//the brightest lights are placed first, the others fall back to smaller faces and go without once the atlas is full
+		for (const Candidate& candidate : m_candidates)
+		{
+			if (m_lightSlots[candidate.light] != NO_SHADOW)
+				continue;
+
+			ShadowSlot* slot = std::find_if(std::begin(m_slots), std::end(m_slots), [](const ShadowSlot& s) { return s.light == NO_SHADOW; });
+			for (uint32_t level = candidate.level; level < LEVEL_COUNT; level++)
+			{
+				if (!allocateSlot(*slot, level))
+					continue;
+
+				slot->light = candidate.light;
+				slot->score = candidate.score;
+				m_lightSlots[candidate.light] = static_cast<uint32_t>(slot - m_slots);
+				updateFaces(*slot, bounds[candidate.light], sceneVersion);
+				break;
+			}
+		}
+
+		//a face holding dynamic casters, now or when it was rendered, is stale
+		m_dynamicSpheres.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (!objects[i].isStatic && objects[i].mesh != nullptr && objects[i].pass == DrawPass::Opaque)
+				m_dynamicSpheres.push_back(vkutil::computeWorldSphere(objects[i].transformMatrix, *objects[i].mesh));
+		}
+
+		m_staleFaces.clear();
+		for (ShadowSlot& slot : m_slots)
+		{
+			if (slot.light == NO_SHADOW)
+				continue;
+
+			const GPULightData& light = bounds[slot.light];
+			if (slot.position != light.position || slot.radius != light.radius || slot.sceneVersion != sceneVersion)
+				updateFaces(slot, light, sceneVersion);
+
+			m_stats.shadowLightCount++;
+			for (AtlasFace& face : slot.faces)
+			{
+				bool hasDynamic = face.hasDynamic;
+				for (size_t i = 0; i < m_dynamicSpheres.size() && !hasDynamic; i++)
+				{
+					const glm::vec4& sphere = m_dynamicSpheres[i];
+					hasDynamic = glm::length(glm::vec3(sphere) - slot.position) < sphere.w + slot.radius && intersects(face.frustum, sphere);
+				}
+				if (hasDynamic && face.dirtySince == 0)
+					face.dirtySince = m_frame;
+
+				if (face.dirtySince == 0)
+				{
+					m_stats.cachedFaces++;
+					continue;
+				}
+
+				//the brightest lights first, the longer a face waits the higher it goes. An empty face waits the least
+				const float age = static_cast<float>(m_frame - face.dirtySince + 1);
+				m_staleFaces.push_back({ slot.score * age * (face.rendered ? 1.f : 8.f), &face });
+			}
+		}
+
+		const auto budget = std::min<size_t>(m_staleFaces.size(), static_cast<size_t>(std::max(m_faceBudget, 0)));
+		std::partial_sort(m_staleFaces.begin(), m_staleFaces.begin() + budget, m_staleFaces.end(),
+			[](const std::pair<float, AtlasFace*>& a, const std::pair<float, AtlasFace*>& b) { return a.first > b.first; });
+		m_stats.renderedFaces = static_cast<uint32_t>(budget);
+		m_stats.pendingFaces = static_cast<uint32_t>(m_staleFaces.size() - budget);
+
+		if (budget > 0)
+		{
+			m_culler.updateBounds(jobSystem, objects, count, sceneVersion);
+
+			glm::mat4* mapped;
+			uint32_t transformCount = 0;
+			vmaMapMemory(m_allocator, m_casterBuffers[frameIndex].allocation, reinterpret_cast<void**>(&mapped));
+			for (size_t i = 0; i < budget; i++)
+			{
+				AtlasFace& face = *m_staleFaces[i].second;
+				m_culler.cull(jobSystem, face.frustum, m_casters);
+				m_casters.erase(std::remove_if(m_casters.begin(), m_casters.end(), [&](const uint32_t index)
+					{
+						return objects[index].pass != DrawPass::Opaque;
+					}), m_casters.end());
+
+				face.hasDynamic = std::any_of(m_casters.begin(), m_casters.end(), [&](const uint32_t index) { return !objects[index].isStatic; });
+				face.renderedViewproj = face.viewproj;
+				face.rendered = true;
+				face.dirtySince = 0;
+				if (face.pendingNode != NO_SHADOW)
+				{
+					m_usedTexels -= nodeTexels(face.node);
+					freeNode(face.node);
+					face.node = face.pendingNode;
+					face.pendingNode = NO_SHADOW;
+				}
+
+				const uint32_t firstDraw = m_draws.getDrawCount();
+				const uint32_t drawCount = m_draws.append(objects, m_casters, mapped, transformCount, m_maxCasterCount);
+				m_faceDraws.push_back({ face.viewproj, getNodeRect(face.node), firstDraw, drawCount });
+			}
+			vmaUnmapMemory(m_allocator, m_casterBuffers[frameIndex].allocation);
+		}
+	}
+
+	//the cubes as they were rendered, a face moved since keeps shading with its previous content
+	char* mapped;
+	vmaMapMemory(m_allocator, m_shadowBuffers[frameIndex].allocation, reinterpret_cast<void**>(&mapped));
+	auto* shadows = reinterpret_cast<GPUPointShadow*>(mapped);
+	for (uint32_t s = 0; s < MAX_SHADOW_LIGHTS; s++)
+	{
+		const ShadowSlot& slot = m_slots[s];
+		shadows[s] = {};
+		if (slot.light == NO_SHADOW)
+			continue;
+
+		for (uint32_t f = 0; f < FACE_COUNT; f++)
+		{
+			const AtlasFace& face = slot.faces[f];
+			const VkRect2D rect = getNodeRect(face.node);
+			shadows[s].faceViewproj[f] = face.renderedViewproj;
+			shadows[s].faceRects[f] = glm::vec4(static_cast<float>(rect.offset.x), static_cast<float>(rect.offset.y), static_cast<float>(rect.extent.width), 0.f) / static_cast<float>(ATLAS_SIZE);
+			shadows[s].faceRects[f].w = face.rendered ? 1.f / static_cast<float>(rect.extent.width) : 0.f;
+		}
+	}
+	auto* lightShadows = reinterpret_cast<uint32_t*>(mapped + MAX_SHADOW_LIGHTS * sizeof(GPUPointShadow));
+	const auto visibleCount = static_cast<uint32_t>(std::min<size_t>(visibleLights.size(), m_maxLightCount));
+	for (uint32_t i = 0; i < visibleCount; i++)
+		lightShadows[i] = m_enabled && visibleLights[i] < lightCount ? m_lightSlots[visibleLights[i]] : NO_SHADOW;
+	vmaUnmapMemory(m_allocator, m_shadowBuffers[frameIndex].allocation);
+
+	m_stats.atlasUsage = static_cast<float>(m_usedTexels) / (static_cast<float>(ATLAS_SIZE) * ATLAS_SIZE);
+	m_stats.scheduleMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+uint32_t PointShadowAtlas::allocateNode(const uint32_t level)
+{
+	const uint32_t first = levelOffset(level);
+	const uint32_t last = levelOffset(level + 1);
+	for (uint32_t node = first; node < last; node++)
+	{
+		if (m_nodes[node] == NodeState::Free)
+		{
+			m_nodes[node] = NodeState::Used;
+			return node;
+		}
+	}
+	if (level == 0)
+		return NO_SHADOW;
+
+	//no free node of that size, a larger one is split in four
+	const uint32_t parent = allocateNode(level - 1);
+	if (parent == NO_SHADOW)
+		return NO_SHADOW;
+
+	const uint32_t parentGrid = gridSize(level - 1);
+	const uint32_t x = (parent - levelOffset(level - 1)) % parentGrid * 2;
+	const uint32_t y = (parent - levelOffset(level - 1)) / parentGrid * 2;
+	m_nodes[parent] = NodeState::Split;
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t i = 0; i < 2; i++)
+			m_nodes[first + (y + j) * gridSize(level) + x + i] = NodeState::Free;
+
+	const uint32_t node = first + y * gridSize(level) + x;
+	m_nodes[node] = NodeState::Used;
+	return node;
+}
+
+void PointShadowAtlas::freeNode(const uint32_t node)
+{
+	m_nodes[node] = NodeState::Free;
+	const uint32_t level = nodeLevel(node);
+	if (level == 0)
+		return;
+
+	const uint32_t first = levelOffset(level);
+	const uint32_t x = (node - first) % gridSize(level) & ~1u;
+	const uint32_t y = (node - first) / gridSize(level) & ~1u;
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			if (m_nodes[first + (y + j) * gridSize(level) + x + i] != NodeState::Free)
+				return;
+		}
+
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t i = 0; i < 2; i++)
+			m_nodes[first + (y + j) * gridSize(level) + x + i] = NodeState::Absent;
+	freeNode(levelOffset(level - 1) + y / 2 * gridSize(level - 1) + x / 2);
+}
+
+bool PointShadowAtlas::allocateSlot(ShadowSlot& slot, const uint32_t level)
+{
+	for (uint32_t f = 0; f < FACE_COUNT; f++)
+	{
+		slot.faces[f].node = allocateNode(level);
+		if (slot.faces[f].node != NO_SHADOW)
+			continue;
+
+		//all six faces or none
+		for (uint32_t i = 0; i < f; i++)
+			freeNode(slot.faces[i].node);
+		return false;
+	}
+
+	const uint32_t size = MAX_FACE_SIZE >> level;
+	m_usedTexels += FACE_COUNT * size * size;
+	slot.level = level;
+	for (AtlasFace& face : slot.faces)
+	{
+		face.pendingNode = NO_SHADOW;
+		face.rendered = false;
+		face.hasDynamic = false;
+		face.dirtySince = m_frame;
+	}
+	return true;
+}
+
+bool PointShadowAtlas::resizeSlot(ShadowSlot& slot, const uint32_t level)
+{
+	//the new nodes are taken while the current ones are still used, nothing is given up when they do not fit
+	uint32_t nodes[FACE_COUNT];
+	for (uint32_t f = 0; f < FACE_COUNT; f++)
+	{
+		nodes[f] = allocateNode(level);
+		if (nodes[f] != NO_SHADOW)
+			continue;
+
+		for (uint32_t i = 0; i < f; i++)
+			freeNode(nodes[i]);
+		return false;
+	}
+
+	slot.level = level;
+	for (uint32_t f = 0; f < FACE_COUNT; f++)
+	{
+		AtlasFace& face = slot.faces[f];
+		m_usedTexels += nodeTexels(nodes[f]);
+		if (face.pendingNode != NO_SHADOW)
+		{
+			m_usedTexels -= nodeTexels(face.pendingNode);
+			freeNode(face.pendingNode);
+		}
+		face.pendingNode = nodes[f];
+
+		//without any content to keep the face moves right away
+		if (!face.rendered)
+		{
+			m_usedTexels -= nodeTexels(face.node);
+			freeNode(face.node);
+			face.node = face.pendingNode;
+			face.pendingNode = NO_SHADOW;
+		}
+		if (face.dirtySince == 0)
+			face.dirtySince = m_frame;
+	}
+	return true;
+}
+
+void PointShadowAtlas::releaseSlot(ShadowSlot& slot)
+{
+	for (AtlasFace& face : slot.faces)
+	{
+		m_usedTexels -= nodeTexels(face.node);
+		freeNode(face.node);
+		if (face.pendingNode != NO_SHADOW)
+		{
+			m_usedTexels -= nodeTexels(face.pendingNode);
+			freeNode(face.pendingNode);
+			face.pendingNode = NO_SHADOW;
+		}
+	}
+
+	m_lightSlots[slot.light] = NO_SHADOW;
+	slot.light = NO_SHADOW;
+}
+
+VkRect2D PointShadowAtlas::getNodeRect(const uint32_t node) const
+{
+	const uint32_t level = nodeLevel(node);
+	const uint32_t local = node - levelOffset(level);
+	const uint32_t size = MAX_FACE_SIZE >> level;
+	return { { static_cast<int32_t>(local % gridSize(level) * size), static_cast<int32_t>(local / gridSize(level) * size) }, { size, size } };
+}
+
+void PointShadowAtlas::updateFaces(ShadowSlot& slot, const GPULightData& light, const uint64_t sceneVersion)
+{
+	slot.position = light.position;
+	slot.radius = light.radius;
+	slot.sceneVersion = sceneVersion;
+
+	//nothing beyond the radius is lit, it bounds the depth of every face
+	const glm::mat4 projection = glm::perspectiveRH_ZO(glm::half_pi<float>(), 1.f, 0.05f, std::max(light.radius, 0.1f));
+	for (uint32_t f = 0; f < FACE_COUNT; f++)
+	{
+		AtlasFace& face = slot.faces[f];
+		face.viewproj = projection * glm::lookAt(light.position, light.position + FACE_AXES[f], FACE_UPS[f]);
+		face.frustum = vkutil::extractFrustum(face.viewproj);
+		if (face.dirtySince == 0)
+			face.dirtySince = m_frame;
+	}
+}
+
+void PointShadowAtlas::record(const VkCommandBuffer cmd, const uint32_t frameIndex) const
+{
+	if (m_faceDraws.empty())
+		return;
+
+	const VkRenderPassBeginInfo rpInfo = vkinit::renderpassBeginInfo(m_renderPass, { ATLAS_SIZE, ATLAS_SIZE }, m_framebuffer);
+	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_sets[frameIndex], 0, nullptr);
+
+	for (const FaceDraw& faceDraw : m_faceDraws)
+	{
+		const VkViewport viewport{ static_cast<float>(faceDraw.rect.offset.x), static_cast<float>(faceDraw.rect.offset.y),
+			static_cast<float>(faceDraw.rect.extent.width), static_cast<float>(faceDraw.rect.extent.height), 0.f, 1.f };
+		vkCmdSetViewport(cmd, 0, 1, &viewport);
+		vkCmdSetScissor(cmd, 0, 1, &faceDraw.rect);
+
+		VkClearAttachment clear = {};
+		clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clear.clearValue.depthStencil.depth = 1.f;
+		const VkClearRect clearRect{ faceDraw.rect, 0, 1 };
+		vkCmdClearAttachments(cmd, 1, &clear, 1, &clearRect);
+
+		m_draws.record(cmd, m_pipelineLayout, faceDraw.viewproj, faceDraw.firstDraw, faceDraw.drawCount);
+	}
+	vkCmdEndRenderPass(cmd);
+}
+
+VkDescriptorBufferInfo PointShadowAtlas::getBufferInfo(const uint32_t frameIndex) const
+{
+	return { m_shadowBuffers[frameIndex].buffer, 0, VK_WHOLE_SIZE };
+}
+
+VkDescriptorImageInfo PointShadowAtlas::getAtlasInfo() const
+{
+	return { m_sampler, m_atlasView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include "vk_culling.h"
+#include "vk_shadows.h"
+
+#include <vector>
+
+class VulkanEngine;
+class JobSystem;
+class LightAnimator;
+
+// the cube of a light as the shading reads it, faces in the +x, -x, +y, -y, +z, -z order
+GPU_DATA struct GPUPointShadow
+{
+	glm::mat4 faceViewproj[6];
+	// xy the corner of the face in the atlas and z its size, in uv. w is one over its resolution, 0 until it was rendered
+	glm::vec4 faceRects[6];
+};
+
+struct ShadowAtlasStats
+{
+	uint32_t shadowLightCount = 0;
+	// faces rendered this frame, and the stale ones waiting for the budget
+	uint32_t renderedFaces = 0;
+	uint32_t pendingFaces = 0;
+	// faces whose content was still valid, nothing was rendered for them
+	uint32_t cachedFaces = 0;
+	// fraction of the atlas allocated to faces
+	float atlasUsage = 0.f;
+	float scheduleMilliseconds = 0.f;
+};
+
+// Shadows of the point lights, the six faces of each light packed in a single depth atlas. The visible stationary
+// lights are ranked by the screen radius of their range times their intensity, the first MAX_SHADOW_LIGHTS get a cube,
+// its face size follows the screen radius and the relative intensity. Faces are allocated in a quadtree over the atlas.
+// A face keeps its content until the light moves, the scene changes or a dynamic caster is inside it. The stale faces
+// are rendered by priority, at most m_faceBudget per frame, a stale face keeps shading with what it holds meanwhile.
+// A resized face holds its previous node the same way until the new one is rendered.
+// Orbiting lights and lights on a path move on the GPU, they cast no shadow.
+class PointShadowAtlas
+{
+public:
+	static constexpr uint32_t ATLAS_SIZE = 4096;
+	static constexpr uint32_t MAX_FACE_SIZE = 512;
+	static constexpr uint32_t MIN_FACE_SIZE = 64;
+	static constexpr uint32_t MAX_SHADOW_LIGHTS = 64;
+	static constexpr uint32_t FACE_COUNT = 6;
+	static constexpr uint32_t NO_SHADOW = ~0u;
+	static constexpr VkFormat FORMAT = VK_FORMAT_D32_SFLOAT;
+
+	// the shadows of up to maxLightCount lights of the light buffer, maxCasterCount transforms are uploaded per frame at most
+	void init(VulkanEngine& engine, uint32_t maxLightCount, uint32_t maxCasterCount);
+	// the vertex shader of the cascades, the casters are read the same way
+	void initPipelines(VulkanEngine& engine, VkShaderModule vertShader);
+
+	// picks the lights, sizes and allocates their faces, then schedules the faces to render.
+	// visibleLights are the scene indices of the light buffer of the frame, sceneVersion the version of the static objects
+	void update(JobSystem& jobSystem, uint32_t frameIndex, const RenderObject* objects, uint32_t count, const LightAnimator& lights,
+		const std::vector<uint32_t>& visibleLights, const glm::mat4& view, const glm::mat4& projection, VkExtent2D extent, uint64_t sceneVersion);
+	// renders the scheduled faces, recorded outside of any render pass
+	void record(VkCommandBuffer cmd, uint32_t frameIndex) const;
+
+	// the cubes, then the cube of every light of the light buffer
+	VkDescriptorBufferInfo getBufferInfo(uint32_t frameIndex) const;
+	VkDescriptorImageInfo getAtlasInfo() const;
+	const ShadowAtlasStats& getStats() const { return m_stats; }
+
+	bool  m_enabled{ true };
+	int   m_faceBudget{ 8 };
+	// face texels per pixel of the screen radius of the light
+	float m_resolutionScale{ 1.f };
+
+private:
+	static constexpr uint32_t LEVEL_COUNT = 4;
+	static constexpr uint32_t ROOT_COUNT = ATLAS_SIZE / MAX_FACE_SIZE;
+
+	enum class NodeState : uint8_t
+	{
+		// covered by a free or used ancestor
+		Absent,
+		Free,
+		Split,
+		Used,
+	};
+
+	struct AtlasFace
+	{
+		// of the light as it is now, and as the atlas holds it
+		glm::mat4 viewproj;
+		glm::mat4 renderedViewproj;
+		Frustum frustum;
+		uint32_t node;
+		// node of the new size while the face is resized, node keeps the content shading until it is rendered
+		uint32_t pendingNode{ NO_SHADOW };
+		// frame the face became stale, 0 while its content is current
+		uint64_t dirtySince;
+		bool rendered;
+		bool hasDynamic;
+	};
+
+	struct ShadowSlot
+	{
+		uint32_t light{ NO_SHADOW };
+		uint32_t level{ 0 };
+		glm::vec3 position{ 0.f };
+		float radius{ 0.f };
+		uint64_t sceneVersion{ 0 };
+		float score{ 0.f };
+		AtlasFace faces[FACE_COUNT];
+	};
+
+	struct Candidate
+	{
+		float score;
+		uint32_t light;
+		uint32_t level;
+	};
+
+	struct FaceDraw
+	{
+		glm::mat4 viewproj;
+		VkRect2D rect;
+		uint32_t firstDraw;
+		uint32_t drawCount;
+	};
+
+
+	// a free node of the level, splitting a larger one when needed. NO_SHADOW when the atlas is full
+	uint32_t allocateNode(uint32_t level);
+	// merges the node with its siblings when they are all free
+	void freeNode(uint32_t node);
+	bool allocateSlot(ShadowSlot& slot, uint32_t level);
+	// the faces move to nodes of the level as they are rendered. False when the atlas is full, the slot stays as it is
+	bool resizeSlot(ShadowSlot& slot, uint32_t level);
+	void releaseSlot(ShadowSlot& slot);
+	// texel rectangle of the node in the atlas
+	VkRect2D getNodeRect(uint32_t node) const;
+	void updateFaces(ShadowSlot& slot, const GPULightData& light, uint64_t sceneVersion);
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	uint32_t m_maxLightCount{ 0 };
+	uint32_t m_maxCasterCount{ 0 };
+
+	AllocatedImage m_atlasImage{};
+	VkImageView m_atlasView{ VK_NULL_HANDLE };
+	VkSampler m_sampler{ VK_NULL_HANDLE };
+	// loads the atlas, only the scheduled faces are cleared and rendered
+	VkRenderPass m_renderPass{ VK_NULL_HANDLE };
+	VkFramebuffer m_framebuffer{ VK_NULL_HANDLE };
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorSet> m_sets;
+	std::vector<AllocatedBuffer> m_casterBuffers;
+	std::vector<AllocatedBuffer> m_shadowBuffers;
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_pipeline{ VK_NULL_HANDLE };
+
+	// every level of the quadtree, the largest faces first
+	std::vector<NodeState> m_nodes;
+	uint32_t m_usedTexels{ 0 };
+	ShadowSlot m_slots[MAX_SHADOW_LIGHTS];
+	// slot of every scene light, NO_SHADOW without any
+	std::vector<uint32_t> m_lightSlots;
+	// frame each scene light was last picked
+	std::vector<uint64_t> m_lightSelected;
+	std::vector<Candidate> m_candidates;
+	std::vector<glm::vec4> m_dynamicSpheres;
+	std::vector<std::pair<float, AtlasFace*>> m_staleFaces;
+
+	FrustumCuller m_culler;
+	std::vector<uint32_t> m_casters;
+	ShadowCasterDraws m_draws;
+	std::vector<FaceDraw> m_faceDraws;
+	uint64_t m_frame{ 0 };
+	ShadowAtlasStats m_stats;
+};
@@ -0,0 +1,554 @@
+#include "vk_shadows.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_pipeline.h"
+
+namespace
+{
+	static_assert(sizeof(GPUShadowData) == 288, "must match the std140 ShadowData of the lighting shaders");
+
+	// looks along the rays of the sun, sunDirection points towards it
+	glm::mat4 computeLightView(const glm::vec3& sunDirection)
+	{
+		const glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+		return glm::lookAt(glm::vec3(0.f), -sunDirection, up);
+	}
+
+	glm::vec4 row(const glm::mat4& m, const int i)
+	{
+		return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	}
+
+	VkRenderPass createDepthPass(const VkDevice device, const VkAttachmentLoadOp loadOp, const VkImageLayout initialLayout, const VkImageLayout finalLayout,
+		const VkPipelineStageFlags dstStage, const VkAccessFlags dstAccess)
+	{
+		VkAttachmentDescription attachment = {};
+		attachment.format = CascadedShadows::FORMAT;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = loadOp;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = initialLayout;
+		attachment.finalLayout = finalLayout;
+
+		const VkAttachmentReference depthRef = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.pDepthStencilAttachment = &depthRef;
+
+		//the copy of the previous frame is done reading the layer before it is cleared, the next reader waits for the depth
+		VkSubpassDependency dependencies[2] = {};
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].srcAccessMask = 0;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstStageMask = dstStage;
+		dependencies[1].dstAccessMask = dstAccess;
+
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &attachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = 2;
+		renderPassInfo.pDependencies = dependencies;
+
+		VkRenderPass renderPass;
+		VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
+		return renderPass;
+	}
+}
+
+uint32_t ShadowCasterDraws::append(const RenderObject* objects, std::vector<uint32_t>& casters, glm::mat4* mapped, uint32_t& transformCount,
+	const uint32_t maxTransformCount)
+{
+	std::sort(casters.begin(), casters.end(), [objects](const uint32_t a, const uint32_t b)
+		{
+			return objects[a].mesh != objects[b].mesh ? objects[a].mesh < objects[b].mesh : a < b;
+		});
+
+	//what does not fit in the caster buffer casts no shadow this frame
+	const auto firstDraw = static_cast<uint32_t>(m_draws.size());
+	for (const uint32_t index : casters)
+	{
+		if (transformCount == maxTransformCount)
+			break;
+
+		const Mesh* mesh = objects[index].mesh;
+		if (m_draws.size() == firstDraw || m_draws.back().mesh != mesh)
+			m_draws.push_back({ mesh, transformCount, 0 });
+		m_draws.back().instanceCount++;
+		mapped[transformCount++] = objects[index].transformMatrix;
+	}
+	return static_cast<uint32_t>(m_draws.size()) - firstDraw;
+}
+
+void ShadowCasterDraws::record(const VkCommandBuffer cmd, const VkPipelineLayout pipelineLayout, const glm::mat4& viewproj, const uint32_t firstDraw,
+	const uint32_t drawCount) const
+{
+	const Constants constants{ viewproj };
+	vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Constants), &constants);
+	for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++)
+	{
+		const CasterDraw& draw = m_draws[i];
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(cmd, 0, 1, &draw.mesh->m_vertexBuffer.buffer, &offset);
+		vkCmdBindIndexBuffer(cmd, draw.mesh->m_indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexed(cmd, draw.mesh->m_lods[0].indexCount, draw.instanceCount, draw.mesh->m_lods[0].firstIndex, 0, draw.firstInstance);
+	}
+}
+
+void CascadedShadows::init(VulkanEngine& engine, const uint32_t maxCasterCount)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_maxCasterCount = maxCasterCount;
+
+	//one layer per cascade, the cache is only ever copied from
+	VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		{ RESOLUTION, RESOLUTION, 1 });
+	imageInfo.arrayLayers = CASCADE_COUNT;
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &m_cacheImage.image, &m_cacheImage.allocation, nullptr));
+	imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VK_CHECK(vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &m_shadowImage.image, &m_shadowImage.allocation, nullptr));
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(FORMAT, m_shadowImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.subresourceRange.layerCount = CASCADE_COUNT;
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &m_shadowView));
+	for (uint32_t i = 0; i < CASCADE_COUNT; i++)
+	{
+		VkImageViewCreateInfo layerInfo = vkinit::imageviewCreateInfo(FORMAT, m_cacheImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+		layerInfo.subresourceRange.baseArrayLayer = i;
+		VK_CHECK(vkCreateImageView(m_device, &layerInfo, nullptr, &m_cacheViews[i]));
+		layerInfo.image = m_shadowImage.image;
+		VK_CHECK(vkCreateImageView(m_device, &layerInfo, nullptr, &m_shadowLayerViews[i]));
+	}
+
+	//the hardware compares and filters the four nearest texels, the shader filters a few of those
+	VkSamplerCreateInfo samplerInfo = vkinit::samplerCreateInfo(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	samplerInfo.compareEnable = VK_TRUE;
+	samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler));
+
+	//the cache is cleared and left for the copies, the sampled layer keeps the copy and is left for the shading
+	m_cachePass = createDepthPass(m_device, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	m_compositePass = createDepthPass(m_device, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.width = RESOLUTION;
+	framebufferInfo.height = RESOLUTION;
+	framebufferInfo.layers = 1;
+	for (uint32_t i = 0; i < CASCADE_COUNT; i++)
+	{
+		framebufferInfo.renderPass = m_cachePass;
+		framebufferInfo.pAttachments = &m_cacheViews[i];
+		VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_cacheFramebuffers[i]));
+		framebufferInfo.renderPass = m_compositePass;
+		framebufferInfo.pAttachments = &m_shadowLayerViews[i];
+		VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_compositeFramebuffers[i]));
+	}
+
+	//the shading samples the layers before any cascade was rendered, they are lit everywhere
+	engine.immediateSubmit([&](const VkCommandBuffer cmd)
+		{
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.image = m_shadowImage.image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, CASCADE_COUNT };
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			const VkClearDepthStencilValue clear{ 1.f, 0 };
+			vkCmdClearDepthStencilImage(cmd, m_shadowImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear, 1, &barrier.subresourceRange);
+
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		});
+
+	const VkDescriptorSetLayoutBinding binding = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = 1;
+	setInfo.pBindings = &binding;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = engine.m_descriptorPool;
+	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	setAllocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &setAllocInfo, m_sets.data()));
+
+	//the transforms of the casters drawn by every cascade, static and dynamic ones
+	const VkDeviceSize casterSize = std::max<VkDeviceSize>(maxCasterCount, 1) * sizeof(glm::mat4);
+	m_dataStride = engine.padUniformBufferSize(sizeof(GPUShadowData));
+	m_dataBuffer = engine.createBuffer(FRAME_OVERLAP * m_dataStride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	m_casterBuffers.resize(FRAME_OVERLAP);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		m_casterBuffers[i] = engine.createBuffer(casterSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		VkDescriptorBufferInfo casterInfo{ m_casterBuffers[i].buffer, 0, casterSize };
+		const VkWriteDescriptorSet write = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &casterInfo, 0);
+		vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+	}
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			for (const AllocatedBuffer& buffer : m_casterBuffers)
+				vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+			vmaDestroyBuffer(m_allocator, m_dataBuffer.buffer, m_dataBuffer.allocation);
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+			for (uint32_t i = 0; i < CASCADE_COUNT; i++)
+			{
+				vkDestroyFramebuffer(m_device, m_cacheFramebuffers[i], nullptr);
+				vkDestroyFramebuffer(m_device, m_compositeFramebuffers[i], nullptr);
+				vkDestroyImageView(m_device, m_cacheViews[i], nullptr);
+				vkDestroyImageView(m_device, m_shadowLayerViews[i], nullptr);
+			}
+			vkDestroyRenderPass(m_device, m_cachePass, nullptr);
+			vkDestroyRenderPass(m_device, m_compositePass, nullptr);
+			vkDestroySampler(m_device, m_sampler, nullptr);
+			vkDestroyImageView(m_device, m_shadowView, nullptr);
+			vmaDestroyImage(m_allocator, m_cacheImage.image, m_cacheImage.allocation);
+			vmaDestroyImage(m_allocator, m_shadowImage.image, m_shadowImage.allocation);
+		});
+}
+
+void CascadedShadows::initPipelines(VulkanEngine& engine, const VkShaderModule vertShader)
+{
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(ShadowCasterDraws::Constants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_setLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstant;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+
+	//the vertex input of the depth prepass, positions only and no color attachment. Both sides of the triangles cast,
+	//the bias keeps the lit surfaces from shadowing themselves
+	const VertexInputDescription vertexDescription = Vertex::getVertexDescription();
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.m_vertexInputInfo = vkinit::vertexInputStateCreateInfo();
+	pipelineBuilder.m_vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
+	pipelineBuilder.m_vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexDescription.bindings.size());
+	pipelineBuilder.m_vertexInputInfo.pVertexAttributeDescriptions = &vertexDescription.attributes[0];
+	pipelineBuilder.m_vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	pipelineBuilder.m_inputAssembly = vkinit::inputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+	pipelineBuilder.m_viewport = { 0.f, 0.f, static_cast<float>(RESOLUTION), static_cast<float>(RESOLUTION), 0.f, 1.f };
+	pipelineBuilder.m_scissor = { { 0, 0 }, { RESOLUTION, RESOLUTION } };
+	pipelineBuilder.m_rasterizer = vkinit::rasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.m_rasterizer.cullMode = VK_CULL_MODE_NONE;
+	pipelineBuilder.m_rasterizer.depthBiasEnable = VK_TRUE;
+	pipelineBuilder.m_rasterizer.depthBiasConstantFactor = 2.f;
+	pipelineBuilder.m_rasterizer.depthBiasSlopeFactor = 2.5f;
+	pipelineBuilder.m_multisampling = vkinit::multisamplingStateCreateInfo();
+	pipelineBuilder.m_colorBlendAttachment = vkinit::colorBlendAttachementState();
+	pipelineBuilder.m_colorAttachmentCount = 0;
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	pipelineBuilder.m_pipelineLayout = m_pipelineLayout;
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vertShader));
+	//the composite pass is compatible, only its load operation and layouts differ
+	m_pipeline = pipelineBuilder.buildPipeline(m_device, m_cachePass);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_pipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+		});
+}
+
+void CascadedShadows::update(JobSystem& jobSystem, const uint32_t frameIndex, const RenderObject* objects, const uint32_t count,
+	const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection, const uint64_t sceneVersion)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	m_frame++;
+	m_stats = {};
+	for (CascadeWork& work : m_work)
+		work = {};
+	m_draws.clear();
+
+	const bool enabled = m_enabled && glm::length(sunDirection) > 0.f;
+	if (enabled)
+	{
+		const glm::vec3 lightDirection = glm::normalize(sunDirection);
+		const glm::mat4 lightView = computeLightView(lightDirection);
+		const int threshold = std::clamp(m_snapThreshold, 0, static_cast<int>(RESOLUTION / 4));
+
+		//the splits stop at the farthest visible object instead of the far plane, nothing beyond receives a shadow
+		m_culler.updateBounds(jobSystem, objects, count, sceneVersion);
+		m_culler.cull(jobSystem, vkutil::extractFrustum(projection * view), m_visible);
+		const float zNear = projection[3][2] / (projection[2][2] - 1.f);
+		float farthest = zNear;
+		for (const uint32_t i : m_visible)
+		{
+			const glm::vec4 sphere = vkutil::computeWorldSphere(objects[i].transformMatrix, *objects[i].mesh);
+			farthest = std::max(farthest, -(view * glm::vec4(glm::vec3(sphere), 1.f)).z + sphere.w);
+		}
+		const float zFar = std::max(std::min(farthest, m_maxDistance), zNear + 1.f);
+		bool hasDynamic = false;
+		for (uint32_t i = 0; i < count && !hasDynamic; i++)
+			hasDynamic = !objects[i].isStatic;
+
+		const glm::mat4 inverseView = glm::inverse(view);
+		const float tanX = 1.f / projection[0][0];
+		const float tanY = 1.f / std::abs(projection[1][1]);
+		uint32_t needing[CASCADE_COUNT];
+		uint32_t needingCount = 0;
+		glm::vec3 lightCenters[CASCADE_COUNT];
+		float extents[CASCADE_COUNT];
+		float sliceNear = zNear;
+		for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+		{
+			//practical split scheme, between the uniform and the logarithmic distribution
+			const float p = static_cast<float>(c + 1) / CASCADE_COUNT;
+			const float sliceFar = glm::mix(zNear + (zFar - zNear) * p, zNear * std::pow(zFar / zNear, p), m_splitLambda);
+
+			//the sphere around the slice does not change when the camera turns, its radius is quantized so that
+			//moving the splits a little does not change it either
+			glm::vec3 corners[8];
+			glm::vec3 center(0.f);
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				const float d = i < 4 ? sliceNear : sliceFar;
+				const glm::vec4 corner((i & 1 ? 1.f : -1.f) * d * tanX, (i & 2 ? 1.f : -1.f) * d * tanY, -d, 1.f);
+				corners[i] = glm::vec3(inverseView * corner);
+				center += corners[i] / 8.f;
+			}
+			float radius = 0.f;
+			for (const glm::vec3& corner : corners)
+				radius = std::max(radius, glm::length(corner - center));
+			radius = std::exp2(std::ceil(std::log2(std::max(radius, 1e-3f)) * 8.f) / 8.f);
+			sliceNear = sliceFar;
+
+			//the cached square is larger than the sphere by the threshold, the sphere stays inside while it moves less
+			extents[c] = radius / (1.f - 2.f * static_cast<float>(threshold) / RESOLUTION);
+			const float texel = 2.f * extents[c] / RESOLUTION;
+			lightCenters[c] = glm::vec3(lightView * glm::vec4(center, 1.f));
+
+			const Cascade& cascade = m_cascades[c];
+			const glm::vec2 offset = glm::abs(glm::vec2(lightCenters[c]) - cascade.center);
+			if (!cascade.valid || cascade.extent != extents[c] || cascade.sunDirection != lightDirection || cascade.sceneVersion != sceneVersion
+				|| cascade.depthExceeded || std::max(offset.x, offset.y) > static_cast<float>(threshold) * texel)
+			{
+				needing[needingCount++] = c;
+			}
+		}
+
+		//the cascades waiting the longest go first, the others keep the area they cached
+		std::stable_sort(needing, needing + needingCount, [this](const uint32_t a, const uint32_t b) { return m_cascades[a].updateFrame < m_cascades[b].updateFrame; });
+		const uint32_t budget = std::min(static_cast<uint32_t>(std::clamp(m_updateBudget, 1, static_cast<int>(CASCADE_COUNT))), needingCount);
+		m_stats.cascadeUpdates = budget;
+		m_stats.pendingCascades = needingCount - budget;
+
+		glm::mat4* mapped;
+		uint32_t transformCount = 0;
+		vmaMapMemory(m_allocator, m_casterBuffers[frameIndex].allocation, reinterpret_cast<void**>(&mapped));
+		for (uint32_t i = 0; i < budget; i++)
+		{
+			const uint32_t c = needing[i];
+			Cascade& cascade = m_cascades[c];
+			const float texel = 2.f * extents[c] / RESOLUTION;
+			cascade.center = glm::floor(glm::vec2(lightCenters[c]) / texel + 0.5f) * texel;
+			cascade.extent = extents[c];
+			cascade.sunDirection = lightDirection;
+			cascade.sceneVersion = sceneVersion;
+			cascade.updateFrame = m_frame;
+			cascade.depthExceeded = false;
+			cascade.valid = true;
+
+			//the receivers are within the extent of the center along the rays, the casters anywhere towards the sun.
+			//The dynamic ones get one more extent of room before the cache needs a new range
+			cullCasters(jobSystem, objects, lightView, cascade.center, cascade.extent, true);
+			const float centerDepth = -lightCenters[c].z;
+			float depthNear = centerDepth - cascade.extent;
+			for (const uint32_t index : m_casters)
+			{
+				const glm::vec4 sphere = vkutil::computeWorldSphere(objects[index].transformMatrix, *objects[index].mesh);
+				depthNear = std::min(depthNear, -(lightView * glm::vec4(glm::vec3(sphere), 1.f)).z - sphere.w);
+			}
+			cascade.zNear = depthNear - cascade.extent;
+			cascade.zFar = centerDepth + cascade.extent;
+			cascade.viewproj = glm::orthoRH_ZO(cascade.center.x - cascade.extent, cascade.center.x + cascade.extent,
+				cascade.center.y - cascade.extent, cascade.center.y + cascade.extent, cascade.zNear, cascade.zFar) * lightView;
+
+			CascadeWork& work = m_work[c];
+			work.renderCache = true;
+			work.firstStaticDraw = m_draws.getDrawCount();
+			work.staticDrawCount = m_draws.append(objects, m_casters, mapped, transformCount, m_maxCasterCount);
+			m_stats.staticCasterCount += static_cast<uint32_t>(m_casters.size());
+		}
+
+		//the dynamic casters are drawn every frame over a copy of the cache, with the light of the cached cascade
+		for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+		{
+			Cascade& cascade = m_cascades[c];
+			CascadeWork& work = m_work[c];
+			if (!cascade.valid)
+				continue;
+
+			if (hasDynamic)
+			{
+				const glm::mat4 cascadeView = computeLightView(cascade.sunDirection);
+				cullCasters(jobSystem, objects, cascadeView, cascade.center, cascade.extent, false);
+				for (const uint32_t index : m_casters)
+				{
+					const glm::vec4 sphere = vkutil::computeWorldSphere(objects[index].transformMatrix, *objects[index].mesh);
+					cascade.depthExceeded |= -(cascadeView * glm::vec4(glm::vec3(sphere), 1.f)).z - sphere.w < cascade.zNear;
+				}
+				work.firstDynamicDraw = m_draws.getDrawCount();
+				work.dynamicDrawCount = m_draws.append(objects, m_casters, mapped, transformCount, m_maxCasterCount);
+				m_stats.dynamicCasterCount += static_cast<uint32_t>(m_casters.size());
+			}
+
+			//once the dynamic casters are gone the layer still holds them, it is copied from the cache one more time
+			work.composite = work.renderCache || work.dynamicDrawCount > 0 || m_hasDynamic[c];
+			m_hasDynamic[c] = work.dynamicDrawCount > 0;
+		}
+		vmaUnmapMemory(m_allocator, m_casterBuffers[frameIndex].allocation);
+	}
+
+	GPUShadowData data{};
+	for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+	{
+		data.cascadeViewproj[c] = m_cascades[c].viewproj;
+		data.texelSizes[c] = m_cascades[c].valid ? 2.f * m_cascades[c].extent / RESOLUTION : 0.f;
+	}
+	data.params = glm::vec4(enabled ? static_cast<float>(CASCADE_COUNT) : 0.f, m_normalOffset, 1.f / RESOLUTION, 0.f);
+
+	char* dataMapped;
+	vmaMapMemory(m_allocator, m_dataBuffer.allocation, reinterpret_cast<void**>(&dataMapped));
+	memcpy(dataMapped + frameIndex * m_dataStride, &data, sizeof(GPUShadowData));
+	vmaUnmapMemory(m_allocator, m_dataBuffer.allocation);
+
+	m_stats.fitMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void CascadedShadows::cullCasters(JobSystem& jobSystem, const RenderObject* objects, const glm::mat4& lightView, const glm::vec2 center,
+	const float extent, const bool isStatic)
+{
+	//the four sides of the square, nothing limits the casters along the rays
+	const glm::vec4 rowX = row(lightView, 0);
+	const glm::vec4 rowY = row(lightView, 1);
+	Frustum frustum;
+	frustum.planes[0] = rowX - glm::vec4(0.f, 0.f, 0.f, center.x - extent);
+	frustum.planes[1] = glm::vec4(0.f, 0.f, 0.f, center.x + extent) - rowX;
+	frustum.planes[2] = rowY - glm::vec4(0.f, 0.f, 0.f, center.y - extent);
+	frustum.planes[3] = glm::vec4(0.f, 0.f, 0.f, center.y + extent) - rowY;
+	frustum.planes[4] = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	frustum.planes[5] = glm::vec4(0.f, 0.f, 0.f, 1.f);
+	m_culler.cull(jobSystem, frustum, m_casters);
+
+	//only the opaque objects cast, the culler already skipped those without a mesh
+	m_casters.erase(std::remove_if(m_casters.begin(), m_casters.end(), [&](const uint32_t i)
+		{
+			return objects[i].isStatic != isStatic || objects[i].pass != DrawPass::Opaque;
+		}), m_casters.end());
+}
+
+void CascadedShadows::recordDraws(const VkCommandBuffer cmd, const uint32_t frameIndex, const glm::mat4& viewproj, const uint32_t firstDraw, const uint32_t drawCount) const
+{
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_sets[frameIndex], 0, nullptr);
+	m_draws.record(cmd, m_pipelineLayout, viewproj, firstDraw, drawCount);
+}
+
+void CascadedShadows::record(const VkCommandBuffer cmd, const uint32_t frameIndex) const
+{
+	VkClearValue depthClear;
+	depthClear.depthStencil.depth = 1.f;
+
+	for (uint32_t c = 0; c < CASCADE_COUNT; c++)
+	{
+		const CascadeWork& work = m_work[c];
+		if (!work.composite)
+			continue;
+
+		const VkExtent2D extent{ RESOLUTION, RESOLUTION };
+		if (work.renderCache)
+		{
+			VkRenderPassBeginInfo rpInfo = vkinit::renderpassBeginInfo(m_cachePass, extent, m_cacheFramebuffers[c]);
+			rpInfo.clearValueCount = 1;
+			rpInfo.pClearValues = &depthClear;
+			vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+			recordDraws(cmd, frameIndex, m_cascades[c].viewproj, work.firstStaticDraw, work.staticDrawCount);
+			vkCmdEndRenderPass(cmd);
+		}
+
+		//the shading of the previous frame is done sampling the layer before the cache overwrites it
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.image = m_shadowImage.image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, c, 1 };
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageCopy region = {};
+		region.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, c, 1 };
+		region.dstSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, c, 1 };
+		region.extent = { RESOLUTION, RESOLUTION, 1 };
+		vkCmdCopyImage(cmd, m_cacheImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_shadowImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		//the pass leaves the layer for the shading, even without any dynamic caster
+		const VkRenderPassBeginInfo rpInfo = vkinit::renderpassBeginInfo(m_compositePass, extent, m_compositeFramebuffers[c]);
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		recordDraws(cmd, frameIndex, m_cascades[c].viewproj, work.firstDynamicDraw, work.dynamicDrawCount);
+		vkCmdEndRenderPass(cmd);
+	}
+}
+
+VkDescriptorBufferInfo CascadedShadows::getDataInfo(const uint32_t frameIndex) const
+{
+	return { m_dataBuffer.buffer, frameIndex * m_dataStride, sizeof(GPUShadowData) };
+}
+
+VkDescriptorImageInfo CascadedShadows::getShadowMapInfo() const
+{
+	return { m_sampler, m_shadowView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+}
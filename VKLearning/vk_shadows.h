@@ -0,0 +1,174 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include "vk_culling.h"
+
+#include <vector>
+
+class VulkanEngine;
+class JobSystem;
+
+// cascades of the sun as the shading reads them, one copy per frame in flight
+GPU_DATA struct GPUShadowData
+{
+	// world to the clip space of each cascade, depth from zero to one
+	glm::mat4 cascadeViewproj[4];
+	// world size of a texel of each cascade, 0 when the cascade was never rendered
+	glm::vec4 texelSizes;
+	// x the cascade count, 0 without shadows, y the normal offset in texels, z the size of a texel in uv
+	glm::vec4 params;
+};
+
+// The casters of the shadow passes grouped by mesh, drawn instanced by shadow_depth.vert with the transforms the
+// frame uploaded. Shared by the cascades and the point shadow atlas, cleared every frame
+class ShadowCasterDraws
+{
+public:
+	// push constants of shadow_depth.vert
+	struct Constants
+	{
+		glm::mat4 viewproj;
+	};
+
+	void clear() { m_draws.clear(); }
+	// appends the draws of casters grouped by mesh, their transforms go to mapped until transformCount reaches
+	// maxTransformCount. Returns how many were appended
+	uint32_t append(const RenderObject* objects, std::vector<uint32_t>& casters, glm::mat4* mapped, uint32_t& transformCount, uint32_t maxTransformCount);
+	// pushes the constants and draws, inside a render pass with the pipeline and its descriptor set bound
+	void record(VkCommandBuffer cmd, VkPipelineLayout pipelineLayout, const glm::mat4& viewproj, uint32_t firstDraw, uint32_t drawCount) const;
+	uint32_t getDrawCount() const { return static_cast<uint32_t>(m_draws.size()); }
+
+private:
+	// a run of casters sharing their mesh, drawn instanced
+	struct CasterDraw
+	{
+		const Mesh* mesh;
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+	};
+
+	std::vector<CasterDraw> m_draws;
+};
+
+struct ShadowStats
+{
+	// cascades whose static geometry was rendered again this frame
+	uint32_t cascadeUpdates = 0;
+	// cascades that moved past their threshold but wait for the budget
+	uint32_t pendingCascades = 0;
+	uint32_t staticCasterCount = 0;
+	uint32_t dynamicCasterCount = 0;
+	float fitMilliseconds = 0.f;
+};
+
+// Cascaded shadow maps for the sun. The view is split between the near plane and the farthest visible object,
+// each slice is covered by an orthographic cascade fitted to its bounding sphere, snapped to its texels.
+// The static casters of a cascade are rendered once into a cached layer, with some margin around the fitted square,
+// and again only when the cascade moved past the margin, the sun turned or the scene changed, at most
+// m_updateBudget cascades per frame. Every frame the cached layers are copied to the sampled ones and the dynamic
+// casters drawn on top, with the position only vertex input of the depth prepass.
+// The shading uses the first cascade containing the point, a cascade waiting for the budget keeps the area it covers.
+class CascadedShadows
+{
+public:
+	static constexpr uint32_t CASCADE_COUNT = 4;
+	static constexpr uint32_t RESOLUTION = 2048;
+	static constexpr VkFormat FORMAT = VK_FORMAT_D32_SFLOAT;
+
+	// creates the cached and sampled layers, their render passes and the per frame buffers. maxCasterCount
+	// transforms are uploaded per frame at most
+	void init(VulkanEngine& engine, uint32_t maxCasterCount);
+	void initPipelines(VulkanEngine& engine, VkShaderModule vertShader);
+
+	// fits the cascades to the view, decides which caches are rendered again and culls the casters of the frame.
+	// The objects move freely, only the static ones are cached: every cache is rendered again once sceneVersion changed,
+	// the version of the static objects
+	void update(JobSystem& jobSystem, uint32_t frameIndex, const RenderObject* objects, uint32_t count,
+		const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection, uint64_t sceneVersion);
+	// renders the caches and the dynamic casters, recorded outside of any render pass
+	void record(VkCommandBuffer cmd, uint32_t frameIndex) const;
+
+	VkDescriptorBufferInfo getDataInfo(uint32_t frameIndex) const;
+	// comparison sampler over every cascade, in the shader read only layout
+	VkDescriptorImageInfo getShadowMapInfo() const;
+	const ShadowStats& getStats() const { return m_stats; }
+
+	bool  m_enabled{ true };
+	// cascades whose cache can be rendered again per frame
+	int   m_updateBudget{ 1 };
+	float m_maxDistance{ 80.f };
+	// between the uniform (0) and the logarithmic (1) splits
+	float m_splitLambda{ 0.75f };
+	// texels a cascade moves before its cache is rendered again, the cached square is that much larger
+	int   m_snapThreshold{ 64 };
+	float m_normalOffset{ 1.5f };
+
+private:
+	struct Cascade
+	{
+		// light space center of the cached square, and its half size
+		glm::vec2 center{ 0.f };
+		float extent{ 0.f };
+		float zNear{ 0.f };
+		float zFar{ 0.f };
+		glm::mat4 viewproj{ 1.f };
+		glm::vec3 sunDirection{ 0.f };
+		uint64_t sceneVersion{ 0 };
+		uint64_t updateFrame{ 0 };
+		bool valid{ false };
+		// a dynamic caster went past the depth range, the cache is rendered again with a new one
+		bool depthExceeded{ false };
+	};
+
+	// what record draws for a cascade this frame
+	struct CascadeWork
+	{
+		bool renderCache{ false };
+		bool composite{ false };
+		uint32_t firstStaticDraw{ 0 };
+		uint32_t staticDrawCount{ 0 };
+		uint32_t firstDynamicDraw{ 0 };
+		uint32_t dynamicDrawCount{ 0 };
+	};
+
+	// the casters of the objects inside the light space square, static or dynamic ones
+	void cullCasters(JobSystem& jobSystem, const RenderObject* objects, const glm::mat4& lightView, glm::vec2 center, float extent, bool isStatic);
+	void recordDraws(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4& viewproj, uint32_t firstDraw, uint32_t drawCount) const;
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	uint32_t m_maxCasterCount{ 0 };
+
+	// the static casters of each cascade, copied to the sampled layers every frame the composite changes
+	AllocatedImage m_cacheImage{};
+	AllocatedImage m_shadowImage{};
+	VkImageView m_cacheViews[CASCADE_COUNT]{};
+	VkImageView m_shadowLayerViews[CASCADE_COUNT]{};
+	VkImageView m_shadowView{ VK_NULL_HANDLE };
+	VkSampler m_sampler{ VK_NULL_HANDLE };
+	// clears and renders a cache, then loads a sampled layer to draw the dynamic casters
+	VkRenderPass m_cachePass{ VK_NULL_HANDLE };
+	VkRenderPass m_compositePass{ VK_NULL_HANDLE };
+	VkFramebuffer m_cacheFramebuffers[CASCADE_COUNT]{};
+	VkFramebuffer m_compositeFramebuffers[CASCADE_COUNT]{};
+
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorSet> m_sets;
+	std::vector<AllocatedBuffer> m_casterBuffers;
+	AllocatedBuffer m_dataBuffer{};
+	VkDeviceSize m_dataStride{ 0 };
+	VkPipelineLayout m_pipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_pipeline{ VK_NULL_HANDLE };
+
+	FrustumCuller m_culler;
+	std::vector<uint32_t> m_visible;
+	std::vector<uint32_t> m_casters;
+	ShadowCasterDraws m_draws;
+	Cascade m_cascades[CASCADE_COUNT];
+	CascadeWork m_work[CASCADE_COUNT];
+	// whether the sampled layer holds dynamic casters, it is copied from the cache again once they are gone
+	bool m_hasDynamic[CASCADE_COUNT]{};
+	uint64_t m_frame{ 0 };
+	ShadowStats m_stats;
+};
@@ -0,0 +1,78 @@
+#include "vk_static_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <tuple>
+
+#include "vk_engine.h"
+#include "vk_culling.h"
+
+void StaticBatcher::build(VulkanEngine& engine, std::vector<RenderObject>& renderables)
+{
+	//the objects of a batch share their material and the grid cell holding their center
+	std::map<std::tuple<Material*, int, int, int>, std::vector<uint32_t>> chunks;
+	std::vector<RenderObject> kept;
+	for (uint32_t i = 0; i < renderables.size(); i++)
+	{
+		const RenderObject& object = renderables[i];
+		if (!object.isStatic || object.pass != DrawPass::Opaque || !object.mesh || !object.material || object.mesh->m_indices.empty())
+		{
+			kept.push_back(object);
+			continue;
+		}
+
+		const glm::vec3 center = glm::vec3(vkutil::computeWorldSphere(object.transformMatrix, *object.mesh));
+		const glm::ivec3 cell = glm::ivec3(glm::floor(center / m_chunkSize));
+		chunks[{ object.material, cell.x, cell.y, cell.z }].push_back(i);
+	}
+
+	for (const auto& [key, objectIndices] : chunks)
+	{
+		if (objectIndices.size() == 1)
+		{
+			kept.push_back(renderables[objectIndices[0]]);
+			continue;
+		}
+
+		Mesh batch{};
+		for (const uint32_t i : objectIndices)
+		{
+			const RenderObject& object = renderables[i];
+			const Mesh& mesh = *object.mesh;
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(object.transformMatrix)));
+			const auto baseVertex = static_cast<uint32_t>(batch.m_vertices.size());
+
+			for (const Vertex& vertex : mesh.m_vertices)
+			{
+				Vertex& world = batch.m_vertices.emplace_back(vertex);
+				world.position = glm::vec3(object.transformMatrix * glm::vec4(vertex.position, 1.f));
+				world.normal = glm::normalize(normalMatrix * vertex.normal);
+			}
+
+			//only the full detail level, the batch builds its own
+			const uint32_t indexCount = mesh.m_lods.empty() ? static_cast<uint32_t>(mesh.m_indices.size()) : mesh.m_lods[0].indexCount;
+			for (uint32_t index = 0; index < indexCount; index++)
+				batch.m_indices.push_back(baseVertex + mesh.m_indices[index]);
+		}
+
+		//goes through the regular upload, identical batches share their buffers
+		engine.uploadMesh(batch);
+		m_stats.sourceObjectCount += static_cast<uint32_t>(objectIndices.size());
+		m_stats.batchCount++;
+		m_stats.vertexCount += static_cast<uint32_t>(batch.m_vertices.size());
+
+		Mesh& uploaded = engine.m_meshes["staticBatch" + std::to_string(m_nextBatchId++)] = std::move(batch);
+
+		RenderObject merged{};
+		merged.mesh = &uploaded;
+		merged.material = std::get<0>(key);
+		merged.transformMatrix = glm::mat4{ 1.f };
+		merged.isStatic = true;
+		merged.isOccluder = std::any_of(objectIndices.begin(), objectIndices.end(), [&](const uint32_t i) { return renderables[i].isOccluder; });
+		kept.push_back(merged);
+	}
+
+	renderables = std::move(kept);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+struct StaticBatchStats
+{
+	uint32_t sourceObjectCount = 0;
+	uint32_t batchCount = 0;
+	uint32_t vertexCount = 0;
+};
+
+// Merges the static opaque objects sharing a material into combined meshes, with their vertices pre-transformed
+// to world space, so that different meshes no longer cost a vertex buffer bind and a draw each.
+// Objects are split in the cells of a world grid first, every batch keeps tight bounds and stays cullable.
+class StaticBatcher
+{
+public:
+	// replaces the static objects of renderables by one object per material and chunk, uploaded as a new mesh.
+	// An object alone in its chunk is kept as it is
+	void build(VulkanEngine& engine, std::vector<RenderObject>& renderables);
+
+	const StaticBatchStats& getStats() const { return m_stats; }
+
+	// width of the grid cells, in world units
+	float m_chunkSize{ 32.f };
+
+private:
+	StaticBatchStats m_stats;
+	uint32_t m_nextBatchId{ 0 };
+};
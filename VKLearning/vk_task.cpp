@@ -0,0 +1,75 @@
+#include "vk_task.h"
+
+#include <thread>
+
+detail::DetachedTask FrameScheduler::runDetached(Task<void> task, FrameScheduler& scheduler, std::atomic<bool>* done)
+{
+	co_await task;
+	scheduler.m_activeTasks--;
+	if (done)
+		done->store(true);
+}
+
+void FrameScheduler::spawn(Task<void>&& task)
+{
+	m_activeTasks++;
+	runDetached(std::move(task), *this, nullptr);
+}
+
+void FrameScheduler::runUntilComplete(Task<void>&& task, const std::function<void()>& pump)
+{
+	std::atomic<bool> done{ false };
+	m_activeTasks++;
+	runDetached(std::move(task), *this, &done);
+
+	while (!done)
+	{
+		pump();
+		tick();
+		//the task may be waiting on a worker or on the disk, leave them the core
+		if (!done)
+			std::this_thread::yield();
+	}
+}
+
+void FrameScheduler::tick()
+{
+	std::vector<std::coroutine_handle<>> ready;
+	std::vector<Waiting> waiting;
+	{
+		std::lock_guard lock(m_mutex);
+		ready.swap(m_ready);
+		waiting.swap(m_waiting);
+	}
+
+	//continuations queued while resuming these wait for the next tick
+	for (const std::coroutine_handle<> handle : ready)
+		handle.resume();
+
+	std::vector<Waiting> stillWaiting;
+	for (Waiting& entry : waiting)
+	{
+		if (entry.condition())
+			entry.handle.resume();
+		else
+			stillWaiting.push_back(std::move(entry));
+	}
+
+	if (!stillWaiting.empty())
+	{
+		std::lock_guard lock(m_mutex);
+		m_waiting.insert(m_waiting.end(), std::make_move_iterator(stillWaiting.begin()), std::make_move_iterator(stillWaiting.end()));
+	}
+}
+
+void FrameScheduler::enqueue(const std::coroutine_handle<> handle)
+{
+	std::lock_guard lock(m_mutex);
+	m_ready.push_back(handle);
+}
+
+void FrameScheduler::enqueueWaiting(std::function<bool()>&& condition, const std::coroutine_handle<> handle)
+{
+	std::lock_guard lock(m_mutex);
+	m_waiting.push_back({ std::move(condition), handle });
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "vk_io.h"
+#include "vk_jobs.h"
+
+// C++20 coroutines for asset loading.
+// A Task starts when it is co_awaited and resumes its awaiter when it co_returns, on whatever
+// thread it finished. Top level tasks are started by FrameScheduler::spawn. The awaitables below
+// move a coroutine between the main thread (FrameScheduler), the JobSystem workers and the
+// AsyncFileReader, so a load reads like sequential code without ever blocking the render loop.
+template<typename T = void>
+class Task;
+
+namespace detail
+{
+	template<typename T>
+	struct TaskPromiseBase
+	{
+		std::coroutine_handle<> continuation;
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		// symmetric transfer to the awaiter, nothing to resume for a detached task
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			template<typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+			{
+				const std::coroutine_handle<> continuation = handle.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+
+		//loading code reports failures through its results, an exception escaping a task is a bug
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	template<typename T>
+	struct TaskPromise : TaskPromiseBase<T>
+	{
+		std::optional<T> value;
+
+		Task<T> get_return_object();
+		template<typename U>
+		void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+	};
+
+	template<>
+	struct TaskPromise<void> : TaskPromiseBase<void>
+	{
+		Task<void> get_return_object();
+		void return_void() {}
+	};
+
+	// coroutine that starts right away and frees itself when done, used to run tasks nobody awaits
+	struct DetachedTask
+	{
+		struct promise_type
+		{
+			DetachedTask get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+}
+
+template<typename T>
+class Task
+{
+public:
+	using promise_type = detail::TaskPromise<T>;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(Handle handle) : m_handle(handle) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, {});
+		}
+		return *this;
+	}
+	~Task()
+	{
+		if (m_handle)
+			m_handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+	std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiter) noexcept
+	{
+		m_handle.promise().continuation = awaiter;
+		return m_handle;
+	}
+	T await_resume()
+	{
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*m_handle.promise().value);
+	}
+
+private:
+	Handle m_handle;
+};
+
+template<typename T>
+Task<T> detail::TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// runs every task concurrently and resumes once the last one is done, results are dropped
+template<typename T>
+Task<void> whenAll(std::vector<Task<T>> tasks)
+{
+	struct State
+	{
+		std::atomic<size_t> remaining;
+		std::coroutine_handle<> continuation;
+	};
+
+	struct Awaiter
+	{
+		State& state;
+		std::vector<Task<T>>& tasks;
+
+		static detail::DetachedTask runChild(Task<T> task, State& state)
+		{
+			co_await task;
+			if (state.remaining.fetch_sub(1) == 1)
+				state.continuation.resume();
+		}
+
+		bool await_ready() const noexcept { return tasks.empty(); }
+		bool await_suspend(const std::coroutine_handle<> handle)
+		{
+			state.continuation = handle;
+			for (Task<T>& task : tasks)
+				runChild(std::move(task), state);
+			//the extra count held while starting the children, suspend unless they all finished already
+			return state.remaining.fetch_sub(1) != 1;
+		}
+		void await_resume() const noexcept {}
+	};
+
+	State state{ tasks.size() + 1, {} };
+	co_await Awaiter{ state, tasks };
+}
+
+// Owns the main thread side of the coroutines : continuations queued with nextFrame() and
+// conditions registered with until() are resumed from tick(), called once per frame.
+class FrameScheduler
+{
+public:
+	// starts a task nobody awaits, it carries on by itself through its awaits
+	void spawn(Task<void>&& task);
+	// spawns the task and calls pump + tick until it is done, for loads the caller cannot go on without
+	void runUntilComplete(Task<void>&& task, const std::function<void()>& pump);
+
+	// resumes what was queued for this frame and the conditions that became true
+	void tick();
+
+	uint32_t getActiveTaskCount() const { return m_activeTasks; }
+
+	// resumes on the main thread at the next tick
+	auto nextFrame()
+	{
+		struct Awaiter
+		{
+			FrameScheduler& scheduler;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(const std::coroutine_handle<> handle) { scheduler.enqueue(handle); }
+			void await_resume() const noexcept {}
+		};
+		return Awaiter{ *this };
+	}
+
+	// resumes on the main thread at the first tick where condition() is true, checked once per tick
+	auto until(std::function<bool()> condition)
+	{
+		struct Awaiter
+		{
+			FrameScheduler& scheduler;
+			std::function<bool()> condition;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(const std::coroutine_handle<> handle) { scheduler.enqueueWaiting(std::move(condition), handle); }
+			void await_resume() const noexcept {}
+		};
+		return Awaiter{ *this, std::move(condition) };
+	}
+
+private:
+	struct Waiting
+	{
+		std::function<bool()> condition;
+		std::coroutine_handle<> handle;
+	};
+
+	static detail::DetachedTask runDetached(Task<void> task, FrameScheduler& scheduler, std::atomic<bool>* done);
+
+	void enqueue(std::coroutine_handle<> handle);
+	void enqueueWaiting(std::function<bool()>&& condition, std::coroutine_handle<> handle);
+
+	std::mutex m_mutex;
+	std::vector<std::coroutine_handle<>> m_ready;
+	std::vector<Waiting> m_waiting;
+	std::atomic<uint32_t> m_activeTasks{ 0 };
+};
+
+namespace vkutil
+{
+	// continues on a JobSystem worker, for parsing and decoding
+	inline auto switchToWorker(JobSystem& jobSystem)
+	{
+		struct Awaiter
+		{
+			JobSystem& jobSystem;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(const std::coroutine_handle<> handle) { jobSystem.submit([handle] { handle.resume(); }); }
+			void await_resume() const noexcept {}
+		};
+		return Awaiter{ jobSystem };
+	}
+
+	struct ReadResult
+	{
+		bool success{ false };
+		FileData data;
+	};
+
+	// queues the read and continues from AsyncFileReader::poll once it completed
+	inline auto readFileAsync(AsyncFileReader& reader, std::string filePath, bool direct = false)
+	{
+		struct Awaiter
+		{
+			AsyncFileReader& reader;
+			std::string filePath;
+			bool direct;
+			ReadResult result;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(const std::coroutine_handle<> handle)
+			{
+				std::vector<ReadRequest> batch;
+				batch.push_back({ filePath, direct, [this, handle](bool success, FileData& data)
+					{
+						result.success = success;
+						result.data = std::move(data);
+						handle.resume();
+					} });
+				reader.submit(std::move(batch));
+			}
+			ReadResult await_resume() { return std::move(result); }
+		};
+		return Awaiter{ reader, std::move(filePath), direct, {} };
+	}
+}
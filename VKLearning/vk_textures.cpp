@@ -1,63 +1,55 @@
 #include "vk_textures.h"
+#include <filesystem>
 #include <iostream>
 
 #include "vk_initializers.h"
+#include "vk_utils.h"
+#include "vk_hash.h"
+#include "vk_asset.h"
+#include "vk_pack.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-
-
-bool vkutil::loadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage)
+namespace
 {
-	int texWidth, texHeight, texChannels;
-
-	stbi_uc* pixels = stbi_load(file, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-	if (!pixels)
+	// GPU image of the decoded extent, format and mip count, plus a staging buffer holding its pixels
+	AllocatedImage createStagedImage(const VulkanEngine& engine, const vkutil::DecodedImage& decoded, AllocatedBuffer& outStagingBuffer)
 	{
-		std::cout << "Failed to load texture file " << file << std::endl;
-		return false;
-	}
-
-	void* pixel_ptr = pixels;
-	VkDeviceSize imageSize = static_cast<size_t>(texWidth) * static_cast<size_t>(texHeight) * 4;
+		//allocate temporary buffer for holding texture data to upload
+		outStagingBuffer = engine.createBuffer(static_cast<size_t>(decoded.size), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
 
-	//the format R8G8B8A8 matches exactly with the pixels loaded from stb_image lib
-	VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
-
-	//allocate temporary buffer for holding texture data to upload
-	AllocatedBuffer stagingBuffer = engine.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-	//copy data to buffer
-	void* data;
-	vmaMapMemory(engine.m_allocator, stagingBuffer.allocation, &data);
-	memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
-	vmaUnmapMemory(engine.m_allocator, stagingBuffer.allocation);
+		//copy data to buffer
+		void* data;
+		vmaMapMemory(engine.m_allocator, outStagingBuffer.allocation, &data);
+		memcpy(data, decoded.pixels, static_cast<size_t>(decoded.size));
+		vmaUnmapMemory(engine.m_allocator, outStagingBuffer.allocation);
 
-	stbi_image_free(pixels);
-	
-	VkExtent3D imageExtent;
-	imageExtent.width = static_cast<uint32_t>(texWidth);
-	imageExtent.height = static_cast<uint32_t>(texHeight);
-	imageExtent.depth = 1;
+		VkExtent3D imageExtent;
+		imageExtent.width = decoded.mips[0].width;
+		imageExtent.height = decoded.mips[0].height;
+		imageExtent.depth = 1;
 
-	VkImageCreateInfo dimgInfo = vkinit::imageCreateInfo(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+		VkImageCreateInfo dimgInfo = vkinit::imageCreateInfo(decoded.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+		dimgInfo.mipLevels = static_cast<uint32_t>(decoded.mips.size());
 
-	AllocatedImage newImage;
+		AllocatedImage newImage;
 
-	VmaAllocationCreateInfo dimgAllocinfo = { };
-	dimgAllocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		VmaAllocationCreateInfo dimgAllocinfo = { };
+		dimgAllocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-	//allocate and create the image
-	vmaCreateImage(engine.m_allocator, &dimgInfo, &dimgAllocinfo, &newImage.image, &newImage.allocation, nullptr);
+		//allocate and create the image
+		vmaCreateImage(engine.m_allocator, &dimgInfo, &dimgAllocinfo, &newImage.image, &newImage.allocation, nullptr);
+		return newImage;
+	}
 
-	engine.immediateSubmit([&](VkCommandBuffer cmd) 
+	// copies every mip level of the staging buffer into the image and leaves it shader readable
+	void recordImageUpload(VkCommandBuffer cmd, const AllocatedBuffer& stagingBuffer, const AllocatedImage& image, const std::vector<vkutil::CookedMipLevel>& mips)
 	{
 		VkImageSubresourceRange range;
 		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		range.baseMipLevel = 0;
-		range.levelCount = 1;
+		range.levelCount = static_cast<uint32_t>(mips.size());
 		range.baseArrayLayer = 0;
 		range.layerCount = 1;
 
@@ -66,7 +58,7 @@ bool vkutil::loadImageFromFile(VulkanEngine& engine, const char* file, Allocated
 
 		imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrierToTransfer.image = newImage.image;
+		imageBarrierToTransfer.image = image.image;
 		imageBarrierToTransfer.subresourceRange = range;
 
 		imageBarrierToTransfer.srcAccessMask = 0;
@@ -75,19 +67,25 @@ bool vkutil::loadImageFromFile(VulkanEngine& engine, const char* file, Allocated
 		//barrier the image into the transfer-receive layout
 		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
 
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
-
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageExtent = imageExtent;
+		//one copy region per mip level
+		std::vector<VkBufferImageCopy> copyRegions(mips.size());
+		for (uint32_t level = 0; level < mips.size(); level++)
+		{
+			VkBufferImageCopy& copyRegion = copyRegions[level];
+			copyRegion = {};
+			copyRegion.bufferOffset = mips[level].offset;
+			copyRegion.bufferRowLength = 0;
+			copyRegion.bufferImageHeight = 0;
+
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = level;
+			copyRegion.imageSubresource.baseArrayLayer = 0;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageExtent = { mips[level].width, mips[level].height, 1 };
+		}
 
 		//copy the buffer into the image
-		vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
 
 		VkImageMemoryBarrier imageBarrierToReadable = imageBarrierToTransfer;
 
@@ -99,20 +97,188 @@ bool vkutil::loadImageFromFile(VulkanEngine& engine, const char* file, Allocated
 
 		//barrier the image into the shader readable layout
 		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
-	});
+	}
+
+	// blocking upload through immediateSubmit, images with the same content are only uploaded once
+	void uploadDecodedImage(VulkanEngine& engine, const char* file, const vkutil::DecodedImage& decoded, AllocatedImage& outImage)
+	{
+		if (const AllocatedImage* cached = engine.m_imageCache.acquire(decoded.contentHash))
+		{
+			std::cout << "Texture file " << file << " shares an already loaded image" << std::endl;
+			outImage = *cached;
+			return;
+		}
+
+		AllocatedBuffer stagingBuffer;
+		outImage = createStagedImage(engine, decoded, stagingBuffer);
+		engine.immediateSubmit([&](VkCommandBuffer cmd) { recordImageUpload(cmd, stagingBuffer, outImage, decoded.mips); });
+		vmaDestroyBuffer(engine.m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+
+		engine.m_imageCache.insert(decoded.contentHash, outImage, decoded.size);
+		std::cout << "Texture file " << file << " successfully loaded" << std::endl;
+	}
+
+	void createTextureView(const VulkanEngine& engine, VkFormat format, uint32_t mipLevels, Texture& texture)
+	{
+		VkImageViewCreateInfo imageinfo = vkinit::imageviewCreateInfo(format, texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		imageinfo.subresourceRange.levelCount = mipLevels;
+		VK_CHECK(vkCreateImageView(engine.m_device, &imageinfo, nullptr, &texture.imageView));
+	}
+}
+
+bool vkutil::decodeImage(const char* file, const FileData& fileData, DecodedImage& outImage)
+{
+	if (std::filesystem::path(file).extension() == COOKED_TEXTURE_EXTENSION)
+	{
+		//cooked textures are already in their GPU format, the pixels stay where they were read
+		CookedTextureView cooked;
+		if (!parseCookedTexture(fileData.data(), fileData.size(), cooked) || cooked.mips.empty())
+		{
+			std::cout << "Failed to load cooked texture file " << file << std::endl;
+			return false;
+		}
+
+		outImage.format = cooked.format;
+		outImage.mips = std::move(cooked.mips);
+		outImage.pixels = cooked.data;
+		outImage.size = cooked.dataSize;
+
+		const uint64_t extentSeed = (static_cast<uint64_t>(cooked.width) << 32) | static_cast<uint64_t>(cooked.height);
+		outImage.contentHash = hash64(cooked.data, static_cast<size_t>(cooked.dataSize), extentSeed ^ cooked.format);
+		return true;
+	}
+
+	int texWidth, texHeight, texChannels;
+
+	//decoded from memory so that packed files are read straight from the mapping
+	stbi_uc* pixels = stbi_load_from_memory(fileData.data(), static_cast<int>(fileData.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture file " << file << std::endl;
+		return false;
+	}
+
+	const VkDeviceSize imageSize = static_cast<size_t>(texWidth) * static_cast<size_t>(texHeight) * 4;
+
+	//the format R8G8B8A8 matches exactly with the pixels loaded from stb_image lib
+	outImage.format = VK_FORMAT_R8G8B8A8_SRGB;
+	outImage.mips = { { static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 0, imageSize } };
+	outImage.decodedPixels = std::shared_ptr<void>(pixels, stbi_image_free);
+	outImage.pixels = pixels;
+	outImage.size = imageSize;
+
+	//the extent seeds the hash so that the same bytes with another layout are not merged
+	const uint64_t extentSeed = (static_cast<uint64_t>(texWidth) << 32) | static_cast<uint64_t>(texHeight);
+	outImage.contentHash = hash64(pixels, static_cast<size_t>(imageSize), extentSeed);
+	return true;
+}
+
+bool vkutil::loadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage, uint64_t* outHash)
+{
+	FileData fileData;
+	if (!readFile(file, fileData))
+	{
+		std::cout << "Failed to load texture file " << file << std::endl;
+		return false;
+	}
+	return loadImageFromMemory(engine, file, fileData, outImage, outHash);
+}
+
+bool vkutil::loadImageFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, AllocatedImage& outImage, uint64_t* outHash)
+{
+	DecodedImage decoded;
+	if (!decodeImage(file, fileData, decoded))
+		return false;
 
+	if (outHash)
+		*outHash = decoded.contentHash;
+	uploadDecodedImage(engine, file, decoded, outImage);
+	return true;
+}
 
-	engine.m_mainDeletionQueue.push_function([=]() 
+bool vkutil::loadCookedImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage, VkFormat& outFormat, uint32_t& outMipLevels, uint64_t* outHash)
+{
+	FileData fileData;
+	if (!readFile(file, fileData))
 	{
-		vmaDestroyImage(engine.m_allocator, newImage.image, newImage.allocation);
-	});
+		std::cout << "Failed to load cooked texture file " << file << std::endl;
+		return false;
+	}
+	return loadCookedImageFromMemory(engine, file, fileData, outImage, outFormat, outMipLevels, outHash);
+}
 
-	vmaDestroyBuffer(engine.m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+bool vkutil::loadCookedImageFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, AllocatedImage& outImage, VkFormat& outFormat, uint32_t& outMipLevels, uint64_t* outHash)
+{
+	DecodedImage decoded;
+	if (std::filesystem::path(file).extension() != COOKED_TEXTURE_EXTENSION || !decodeImage(file, fileData, decoded))
+		return false;
 
+	outFormat = decoded.format;
+	outMipLevels = static_cast<uint32_t>(decoded.mips.size());
+	if (outHash)
+		*outHash = decoded.contentHash;
+	uploadDecodedImage(engine, file, decoded, outImage);
+	return true;
+}
+
+bool vkutil::loadTextureFromFile(VulkanEngine& engine, const char* file, Texture& outTexture)
+{
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+	uint32_t mipLevels = 1;
+
+	const std::string cookedPath = getCookedPath(file, COOKED_TEXTURE_EXTENSION);
+	const bool loaded = (assetExists(cookedPath) && isCookedUpToDate(file, cookedPath) && loadCookedImageFromFile(engine, cookedPath.c_str(), outTexture.image, format, mipLevels, &outTexture.contentHash))
+		|| loadImageFromFile(engine, file, outTexture.image, &outTexture.contentHash);
+	if (!loaded)
+		return false;
 
-	std::cout << "Texture file " << file << "successfully loaded" << std::endl;
+	createTextureView(engine, format, mipLevels, outTexture);
+	return true;
+}
 
-	outImage = newImage;
+bool vkutil::loadTextureFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, Texture& outTexture)
+{
+	DecodedImage decoded;
+	if (!decodeImage(file, fileData, decoded))
+		return false;
 
+	outTexture.contentHash = decoded.contentHash;
+	uploadDecodedImage(engine, file, decoded, outTexture.image);
+	createTextureView(engine, decoded.format, static_cast<uint32_t>(decoded.mips.size()), outTexture);
 	return true;
 }
+
+Task<void> vkutil::uploadTextureAsync(VulkanEngine& engine, const DecodedImage& decoded, Texture& outTexture)
+{
+	outTexture.contentHash = decoded.contentHash;
+	if (const AllocatedImage* cached = engine.m_imageCache.acquire(decoded.contentHash))
+		outTexture.image = *cached;
+	else
+	{
+		AllocatedBuffer stagingBuffer;
+		AllocatedImage image = createStagedImage(engine, decoded, stagingBuffer);
+		co_await engine.submitUploadAsync([&](VkCommandBuffer cmd) { recordImageUpload(cmd, stagingBuffer, image, decoded.mips); });
+		vmaDestroyBuffer(engine.m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+
+		//the same image may have been uploaded by another load meanwhile, keep a single copy
+		if (const AllocatedImage* cached = engine.m_imageCache.acquire(decoded.contentHash))
+		{
+			vmaDestroyImage(engine.m_allocator, image.image, image.allocation);
+			outTexture.image = *cached;
+		}
+		else
+		{
+			engine.m_imageCache.insert(decoded.contentHash, image, decoded.size);
+			outTexture.image = image;
+		}
+	}
+
+	createTextureView(engine, decoded.format, static_cast<uint32_t>(decoded.mips.size()), outTexture);
+}
+
+std::string vkutil::getTextureLoadPath(const char* file)
+{
+	const std::string cookedPath = getCookedPath(file, COOKED_TEXTURE_EXTENSION);
+	return assetExists(cookedPath) && isCookedUpToDate(file, cookedPath) ? cookedPath : std::string(file);
+}
@@ -2,9 +2,44 @@
 
 #include "vk_types.h"
 #include "vk_engine.h"
+#include "vk_pack.h"
+#include "vk_task.h"
+#include "vk_asset.h"
+
+#include <memory>
 
 namespace vkutil
 {
+	// CPU side of a texture load, ready to be copied into a staging buffer
+	struct DecodedImage
+	{
+		VkFormat format{ VK_FORMAT_UNDEFINED };
+		std::vector<CookedMipLevel> mips;
+		// points into the file data for cooked textures, into decodedPixels for source images
+		const uint8_t* pixels{ nullptr };
+		VkDeviceSize size{ 0 };
+		uint64_t contentHash{ 0 };
+		std::shared_ptr<void> decodedPixels;
+	};
+
+	// decodes a source image or parses a cooked one (picked from the extension of file), touches no GPU state so it can run on a worker.
+	// A cooked image keeps pointing into fileData, which has to outlive it
+	bool decodeImage(const char* file, const FileData& fileData, DecodedImage& outImage);
+
+	// images with the same pixels are only uploaded once, outHash receives the content hash used to release it
+	bool loadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage, uint64_t* outHash = nullptr);
+	bool loadCookedImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage, VkFormat& outFormat, uint32_t& outMipLevels, uint64_t* outHash = nullptr);
+
+	// same as above for files already read in memory, file is only used for the messages
+	bool loadImageFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, AllocatedImage& outImage, uint64_t* outHash = nullptr);
+	bool loadCookedImageFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, AllocatedImage& outImage, VkFormat& outFormat, uint32_t& outMipLevels, uint64_t* outHash = nullptr);
+
+	// loads the cooked mip chain from the cooked folder when there is one, the source image otherwise, and creates its view
+	bool loadTextureFromFile(VulkanEngine& engine, const char* file, Texture& outTexture);
+	// file is the path returned by getTextureLoadPath, its extension tells a cooked texture from a source image
+	bool loadTextureFromMemory(VulkanEngine& engine, const char* file, const FileData& fileData, Texture& outTexture);
+	std::string getTextureLoadPath(const char* file);
 
-	bool loadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
+	// uploads without blocking and creates the view, must be started from the main thread
+	Task<void> uploadTextureAsync(VulkanEngine& engine, const DecodedImage& decoded, Texture& outTexture);
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include <deque>
 #include <functional>
+#include <vector>
 #include <glm/glm.hpp>
 
 #define GPU_DATA __declspec(align(16))
@@ -45,16 +46,21 @@ struct DeletionQueue
 	}
 };
 
-struct MeshPushConstants
-{
-	glm::mat4 renderMatrix;
-};
-
 struct Material
 {
 	VkDescriptorSet textureSet{ VK_NULL_HANDLE };
 	VkPipeline pipeline{};
 	VkPipelineLayout pipelineLayout{};
+	// variant drawing the instances kept by the GPU culling, null when the material has none
+	VkPipeline indirectPipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout indirectPipelineLayout{ VK_NULL_HANDLE };
+	// variants shading the opaque pixels written by the depth prepass, depth tested for equality without writing it.
+	// Null when the material is always drawn without prepass
+	VkPipeline depthEqualPipeline{ VK_NULL_HANDLE };
+	VkPipeline indirectDepthEqualPipeline{ VK_NULL_HANDLE };
+	// variants writing the G-buffer of the deferred path, null when the material can not be deferred
+	VkPipeline gbufferPipeline{ VK_NULL_HANDLE };
+	VkPipeline indirectGbufferPipeline{ VK_NULL_HANDLE };
 };
 
 
@@ -63,6 +69,8 @@ GPU_DATA struct GPUCameraData {
 	glm::mat4 proj{};
 	glm::mat4 viewproj{};
 	glm::vec4 cameraPosition{};
+	// the deferred lighting reconstructs the positions from the depth
+	glm::mat4 inverseViewproj{};
 };
 
 GPU_DATA struct GPUSceneData {
@@ -72,6 +80,8 @@ GPU_DATA struct GPUSceneData {
 	float metallic = 0.f; //x for min, y for max, zw unused.
 	glm::vec3 albedo = glm::vec3(1.f, 0.f, 0.f); // w is for exponent
 	float roughness = 0.f;
+	// x the intensity of the environment lighting, 0 without any, y the mip of its roughest specular level
+	glm::vec4 environment = glm::vec4(0.f);
 };
 
 GPU_DATA struct GPULightData
@@ -79,7 +89,8 @@ GPU_DATA struct GPULightData
 	glm::vec3 color{1.f, 1.f, 1.f };
 	float intensity{1.f};
 	glm::vec3 position{1.f, 1.f, 1.f};
-	
+	// distance at which the light fades out, 0 derives it from the intensity
+	float radius{0.f};
 };
 
 
@@ -87,6 +98,16 @@ struct UploadContext {
 	VkFence uploadFence;
 	VkCommandPool commandPool;
 	VkCommandBuffer commandBuffer;
+	// command buffers of the uploads in flight, each one is freed once its fence signaled
+	VkCommandPool asyncCommandPool;
+};
+
+// secondary command buffers recorded by one thread during one frame, reset all at once with their pool
+struct SecondaryCommands
+{
+	VkCommandPool pool;
+	std::vector<VkCommandBuffer> buffers;
+	uint32_t usedCount{ 0 };
 };
 
 struct FrameData {
@@ -95,6 +116,16 @@ struct FrameData {
 
 	VkCommandPool commandPool;
 	VkCommandBuffer mainCommandBuffer;
+	// one per JobSystem thread, indexed by JobSystem::getWorkerIndex()
+	std::vector<SecondaryCommands> secondaryCommands;
+	// draws that do not depend on the camera, recorded again only when their scene version is outdated.
+	// One per GPU culling phase, the early draws and the late ones
+	VkCommandPool cachedCommandPool;
+	VkCommandBuffer cachedCommands[2];
+	uint64_t cachedCommandsVersion{ 0 };
+	// the timestamps around the frame commands were written, and whether the depth prepass was on
+	bool timestampsWritten{ false };
+	bool timestampsDepthPrepass{ false };
 
 	AllocatedBuffer cameraBuffer;
 	VkDescriptorSet globalDescriptor;
@@ -104,6 +135,9 @@ struct FrameData {
 
 	AllocatedBuffer lightBuffer;
 	VkDescriptorSet lightDescriptor;
+	// cluster grid and ranges, then the light indices the ranges point to
+	AllocatedBuffer clusterBuffer;
+	AllocatedBuffer lightIndexBuffer;
 };
 
 struct GPUObjectData {
@@ -114,4 +148,5 @@ struct Texture
 {
 	AllocatedImage image;
 	VkImageView imageView;
+	uint64_t contentHash{ 0 };
 };
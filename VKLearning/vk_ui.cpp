@@ -2,6 +2,10 @@
 #include "vk_ui.h"
 #include "vk_utils.h"
 #include "string"
+#include <algorithm>
+
+// the light editors shown below the light count
+constexpr int MAX_EDITED_LIGHTS = 16;
 
 void VulkanUI::init(VulkanEngine* engine)
 {
@@ -100,9 +104,92 @@ void VulkanUI::appMainMenuBar()
 void VulkanUI::bottomInfo(VulkanEngine* engine)
 {
 	ImGui::Text("GPU + CPU : %3.1f ms, %3.1f fps", engine->getMeanDeltaTime(), 1000.f / engine->getMeanDeltaTime());
+	if (engine->m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		ImGui::Text("GPU frame : %.3f ms", engine->m_gpuFrameMilliseconds);
+		ImGui::Text("Mean : %.3f ms without prepass, %.3f ms with", engine->m_gpuFrameMillisecondsByMode[0], engine->m_gpuFrameMillisecondsByMode[1]);
+	}
+	bool depthPrepass = engine->m_depthPrepass;
+	if (ImGui::Checkbox("Depth prepass", &depthPrepass))
+		engine->setDepthPrepass(depthPrepass);
+	const char* shadingPaths[] = { "Forward", "Deferred", "Visibility buffer" };
+	int shadingPath = static_cast<int>(engine->m_shadingPath);
+	if (ImGui::Combo("Shading", &shadingPath, shadingPaths, IM_ARRAYSIZE(shadingPaths)))
+		engine->setShadingPath(static_cast<ShadingPath>(shadingPath));
+	LightSampler& lightSampler = engine->m_lightSampler;
+	if (engine->m_shadingPath == ShadingPath::Deferred && lightSampler.isSupported())
+	{
+		ImGui::Checkbox("Sampled lights", &lightSampler.m_enabled);
+		if (lightSampler.m_enabled)
+		{
+			ImGui::SliderInt("candidates", &lightSampler.m_candidateCount, 1, 32);
+			ImGui::SliderInt("spatial reuse", &lightSampler.m_spatialSampleCount, 0, 8);
+			ImGui::SliderInt("exhaustive below", &lightSampler.m_exhaustiveLightCount, 0, 64);
+		}
+	}
+	if (engine->m_shadingPath == ShadingPath::VisibilityBuffer)
+	{
+		const VisibilityStats& visibilityStats = engine->m_visibilityRenderer.getStats();
+		ImGui::Text("Visibility : %u meshes, %u vertices, %u triangles", visibilityStats.meshCount, visibilityStats.vertexCount, visibilityStats.triangleCount);
+	}
 	ImGui::Separator();
 }
 
+void VulkanUI::dedupInfo(VulkanEngine* engine)
+{
+	const DedupStats& meshStats = engine->m_meshBufferCache.getStats();
+	const DedupStats& imageStats = engine->m_imageCache.getStats();
+	ImGui::Text("Meshes : %u unique, %u shared, %.1f KB saved", meshStats.uniqueCount, meshStats.sharedCount, static_cast<float>(meshStats.savedBytes) / 1024.f);
+	ImGui::Text("Images : %u unique, %u shared, %.1f KB saved", imageStats.uniqueCount, imageStats.sharedCount, static_cast<float>(imageStats.savedBytes) / 1024.f);
+}
+
+void VulkanUI::renderQueueInfo(VulkanEngine* engine)
+{
+	const RenderQueueStats& stats = engine->m_renderQueue.getStats();
+	ImGui::Text("Draws : %u for %u objects", stats.drawCount, stats.objectCount);
+	ImGui::Text("Binds : %u pipelines, %u descriptor sets, %u meshes", stats.pipelineBinds, stats.descriptorSetBinds, stats.meshBinds);
+	ImGui::Text("Recording : %zu chunks on %u threads, %.3f ms", engine->m_drawChunkCommands.size(), engine->m_jobSystem.getThreadCount(), engine->m_recordMilliseconds);
+
+	const StaticBatchStats& batchStats = engine->m_staticBatcher.getStats();
+	ImGui::Text("Static batches : %u for %u objects", batchStats.batchCount, batchStats.sourceObjectCount);
+}
+
+void VulkanUI::cullingInfo(VulkanEngine* engine)
+{
+	const CullingStats& stats = engine->m_frustumCuller.getStats();
+	ImGui::Text("Culling (%s) : %u / %u visible, %.3f ms", FrustumCuller::getInstructionSet(), stats.visibleCount, stats.testedCount, stats.cullMilliseconds);
+
+	OcclusionCuller& occlusion = engine->m_occlusionCuller;
+	ImGui::Checkbox("Software occlusion", &occlusion.m_enabled);
+	if (occlusion.m_enabled)
+	{
+		const OcclusionStats& occlusionStats = occlusion.getStats();
+		ImGui::Text("Occluders (%s) : %u, %u triangles, %.3f ms", OcclusionCuller::getInstructionSet(), occlusionStats.occluderCount, occlusionStats.triangleCount, occlusionStats.rasterMilliseconds);
+		ImGui::Text("Occluded : %u / %u, %.3f ms", occlusionStats.occludedCount, occlusionStats.testedCount, occlusionStats.testMilliseconds);
+	}
+}
+
+void VulkanUI::gpuCullingInfo(VulkanEngine* engine)
+{
+	GPUCuller& culler = engine->m_gpuCuller;
+	if (!culler.isSupported())
+	{
+		ImGui::Text("GPU culling : unsupported");
+		return;
+	}
+
+	ImGui::Checkbox("GPU culling", &engine->m_gpuDriven);
+	if (engine->m_gpuDriven)
+	{
+		const GPUCullingStats& stats = culler.getStats();
+		ImGui::Text("%s : %u instances, %u groups", culler.getDrawPathName(), stats.instanceCount, stats.groupCount);
+		ImGui::Text("%u draw calls for %u indirect commands", stats.recordedDraws, stats.drawCommandCount);
+		ImGui::Text("Cached pass commands recorded %u times", engine->m_cachedCommandsRecordCount);
+		ImGui::DragFloat("lod distance", &culler.m_lodDistanceScale, 0.1f, 1.f, 100.f, "%.1f");
+		ImGui::Checkbox("Occlusion culling", &culler.m_occlusionCulling);
+	}
+}
+
 void VulkanUI::leftPanel(VulkanEngine* engine)
 {
 	const ImGuiWindowFlags window_flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoCollapse;
@@ -121,27 +208,100 @@ void VulkanUI::leftPanel(VulkanEngine* engine)
 	if (ImGui::Begin("LeftPanel", nullptr, window_flags))
 	{
 		bottomInfo(engine);
+		dedupInfo(engine);
+		renderQueueInfo(engine);
+		cullingInfo(engine);
+		gpuCullingInfo(engine);
 		ImGui::Separator();
 		ImGui::Text("GGX Params");
 		GPUSceneData *params = &engine->m_sceneParameters;
 		ImGui::DragFloat3("albedo", &(params->albedo[0]),0.01f, 0.0f, 1.0f, "%.3f");
 		ImGui::DragFloat("metallic", &(params->metallic),0.01f, 0.0f, 1.0f, "%.3f");
 		ImGui::DragFloat("roughness", &(params->roughness),0.01f, 0.0f, 1.0f, "%.3f");
-		ImGui::DragInt("light number", &(params->lightNb),1, 1, 1000, "%.3f");
-		for (int i = 0; i < params->lightNb; ++i)
+		ImGui::DragInt("light number", &(params->lightNb),1, 1, static_cast<int>(engine->m_lightData.size()), "%d");
+		ImGui::DragFloat3("sun direction", &(params->lightDirection[0]), 0.1f, -100.f, 100.f, "%.1f");
+		ImGui::ColorEdit3("sun color", &(params->lightColor[0]), ImGuiColorEditFlags_Float | ImGuiColorEditFlags_HDR);
+		CascadedShadows& shadows = engine->m_shadows;
+		const ShadowStats& shadowStats = shadows.getStats();
+		ImGui::Checkbox("Sun shadows", &shadows.m_enabled);
+		ImGui::SameLine();
+		ImGui::SliderInt("cascades per frame", &shadows.m_updateBudget, 1, static_cast<int>(CascadedShadows::CASCADE_COUNT));
+		ImGui::DragFloat("shadow distance", &shadows.m_maxDistance, 1.f, 1.f, 1000.f, "%.0f");
+		ImGui::Text("Shadows : %u cascades updated, %u pending, %u static and %u dynamic casters, %.3f ms", shadowStats.cascadeUpdates,
+			shadowStats.pendingCascades, shadowStats.staticCasterCount, shadowStats.dynamicCasterCount, shadowStats.fitMilliseconds);
+		PointShadowAtlas& pointShadows = engine->m_pointShadows;
+		const ShadowAtlasStats& atlasStats = pointShadows.getStats();
+		ImGui::Checkbox("Point shadows", &pointShadows.m_enabled);
+		ImGui::SameLine();
+		ImGui::SliderInt("faces per frame", &pointShadows.m_faceBudget, 0, 64);
+		ImGui::DragFloat("face texels per pixel", &pointShadows.m_resolutionScale, 0.05f, 0.1f, 4.f, "%.2f");
+		ImGui::Text("Atlas : %u lights, %u faces rendered, %u pending, %u cached, %.0f%% used, %.3f ms", atlasStats.shadowLightCount,
+			atlasStats.renderedFaces, atlasStats.pendingFaces, atlasStats.cachedFaces, atlasStats.atlasUsage * 100.f, atlasStats.scheduleMilliseconds);
+		BakedLighting& bakedLighting = engine->m_bakedLighting;
+		const BakedLightingStats& bakeStats = bakedLighting.getStats();
+		ImGui::Checkbox("Baked lights", &bakedLighting.m_enabled);
+		ImGui::SameLine();
+		ImGui::DragFloat("probe spacing", &bakedLighting.m_probeSpacing, 0.05f, 0.25f, 16.f, "%.2f m");
+		if (ImGui::Button("Bake static lighting"))
+			engine->bakeStaticLighting();
+		ImGui::SameLine();
+		if (ImGui::Button("Export bake input"))
+			engine->exportBakeScene();
+		ImGui::SameLine();
+		ImGui::Text("Probes (%s) : %s, %u probes, %u lights, %u triangles, %llu rays, %.1f ms", LightBaker::getInstructionSet(),
+			bakeStats.active ? (bakeStats.fromCache ? "cooked" : "baked") : "stale", bakeStats.probeCount, bakeStats.bakedLightCount,
+			bakeStats.triangleCount, static_cast<unsigned long long>(bakeStats.rayCount), bakeStats.bakeMilliseconds);
+		EnvironmentLighting& environmentLighting = engine->m_environmentLighting;
+		const EnvironmentLightingStats& environmentStats = environmentLighting.getStats();
+		const EnvironmentFilterStats& filterStats = environmentLighting.getFilterStats();
+		ImGui::Checkbox("Environment", &environmentLighting.m_enabled);
+		ImGui::SameLine();
+		ImGui::DragFloat("environment intensity", &environmentLighting.m_intensity, 0.01f, 0.f, 10.f, "%.2f");
+		if (!environmentStats.loaded)
+			ImGui::Text("Environment : none, ../assets/environment.hdr is missing");
+		else if (environmentStats.fromCache)
+			ImGui::Text("Environment : cooked, loaded in %.1f ms", environmentStats.loadMilliseconds);
+		else
+			ImGui::Text("Environment (%s) : %ux%u filtered in %.1f ms, irradiance %.1f ms, specular %.1f ms, BRDF %.1f ms", EnvironmentFilter::getInstructionSet(),
+				environmentStats.sourceWidth, environmentStats.sourceHeight, environmentStats.loadMilliseconds, filterStats.irradianceMilliseconds,
+				filterStats.specularMilliseconds, filterStats.brdfMilliseconds);
+		const CullingStats& lightStats = engine->m_lightCuller.getStats();
+		ImGui::Text("Lights : %u / %u uploaded, %.3f ms", lightStats.visibleCount, lightStats.testedCount, lightStats.cullMilliseconds);
+		const LightClusterStats& clusterStats = engine->m_lightClusterer.getStats();
+		ImGui::Text("Clusters (%s) : %u light indices, at most %u per cluster%s, %.3f ms", LightClusterer::getInstructionSet(),
+			clusterStats.indexCount, clusterStats.maxClusterLights, clusterStats.overflow ? " (overflow)" : "", clusterStats.buildMilliseconds);
+		LightAnimator& lightAnimator = engine->m_lightAnimator;
+		const LightAnimationStats& animationStats = lightAnimator.getStats();
+		ImGui::Checkbox("Animate lights", &lightAnimator.m_playing);
+		ImGui::SameLine();
+		ImGui::DragFloat("speed", &lightAnimator.m_timeScale, 0.01f, 0.f, 10.f, "%.2f");
+		ImGui::Text("Animation : %u lights evaluated, %u keyframes, %u bytes uploaded", animationStats.evaluatedCount,
+			animationStats.keyframeCount, animationStats.uploadedBytes);
+		//thousands of lights, only the first ones can be edited
+		for (int i = 0; i < std::min(params->lightNb, MAX_EDITED_LIGHTS); ++i)
 		{
 			ImGui::Separator();
 			std::string label0 = "Light" + std::to_string(i);
 			ImGui::Text(label0.c_str());
 
+			//the position is the rest one, the center of its animation
+			bool changed = false;
 			std::string label1 = "position" + std::to_string(i);
-			ImGui::DragFloat3(label1.c_str(), &(engine->m_lightData[i].position[0]));
+			changed |= ImGui::DragFloat3(label1.c_str(), &(engine->m_lightData[i].position[0]));
 
 			std::string label2 = "intensity" + std::to_string(i);
-			ImGui::DragFloat(label2.c_str(), &(engine->m_lightData[i].intensity),0.01f, 0.f, 100.f, "%.2f");
+			changed |= ImGui::DragFloat(label2.c_str(), &(engine->m_lightData[i].intensity),0.01f, 0.f, 100.f, "%.2f");
+
+			//0 derives the radius from the intensity
+			std::string label4 = "radius" + std::to_string(i);
+			changed |= ImGui::DragFloat(label4.c_str(), &(engine->m_lightData[i].radius), 0.1f, 0.f, 100.f, "%.1f");
 
 			std::string label3 = "color" + std::to_string(i);
-			ImGui::DragFloat3(label3.c_str(), &(engine->m_lightData[i].color[0]), 0.01f, 0.f, 1.f);
+			changed |= ImGui::DragFloat3(label3.c_str(), &(engine->m_lightData[i].color[0]), 0.01f, 0.f, 1.f);
+
+			//only the edited light is uploaded again
+			if (changed)
+				lightAnimator.setLight(static_cast<uint32_t>(i), engine->m_lightData[i]);
 		}
 
 	}
@@ -18,6 +18,10 @@ public:
 
 	static void appMainMenuBar();
 	static void bottomInfo(VulkanEngine* engine);
+	static void dedupInfo(VulkanEngine* engine);
+	static void renderQueueInfo(VulkanEngine* engine);
+	static void cullingInfo(VulkanEngine* engine);
+	static void gpuCullingInfo(VulkanEngine* engine);
 	static void leftPanel(VulkanEngine* engine);
 private:
 	
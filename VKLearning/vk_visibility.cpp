@@ -0,0 +1,380 @@
+#include "vk_visibility.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_engine.h"
+#include "vk_initializers.h"
+#include "vk_pipeline.h"
+
+namespace
+{
+	static_assert(sizeof(GPUVisibilityVertex) == 32, "must match Vertex in visibility_resolve.frag");
+
+	enum VisibilityBinding : uint32_t
+	{
+		BINDING_IDS = 0,
+		BINDING_VERTICES,
+		BINDING_INDICES,
+		BINDING_MESHES,
+		BINDING_OBJECT_MESHES,
+		BINDING_COUNT
+	};
+}
+
+void VisibilityRenderer::init(VulkanEngine& engine, const uint32_t objectSlotCount)
+{
+	m_device = engine.m_device;
+	m_allocator = engine.m_allocator;
+	m_objectSlotCount = std::min(objectSlotCount, MAX_OBJECT_SLOTS);
+
+	//the ids never leave the pass, tiled GPUs keep them in tile memory
+	const VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(ID_FORMAT,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+		{ engine.m_windowExtent.width, engine.m_windowExtent.height, 1 });
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+	if (vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &m_idImage.image, &m_idImage.allocation, nullptr) != VK_SUCCESS)
+	{
+		allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		VK_CHECK(vmaCreateImage(m_allocator, &imageInfo, &allocInfo, &m_idImage.image, &m_idImage.allocation, nullptr));
+	}
+	const VkImageViewCreateInfo viewInfo = vkinit::imageviewCreateInfo(ID_FORMAT, m_idImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(m_device, &viewInfo, nullptr, &m_idView));
+
+	//the resolve writes every pixel, the background included
+	VkAttachmentDescription attachments[ATTACHMENT_COUNT] = {};
+	attachments[0].format = engine.m_swapchainImageFormat;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	//stored for the passes loading it afterwards
+	attachments[1].format = engine.m_depthFormat;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	//cleared to 0, the id of the background
+	attachments[2].format = ID_FORMAT;
+	attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[2].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	const VkAttachmentReference idRef = { 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	const VkAttachmentReference depthRef = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	const VkAttachmentReference inputRef = { 2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	const VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpasses[2] = {};
+	subpasses[GEOMETRY_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[GEOMETRY_SUBPASS].colorAttachmentCount = 1;
+	subpasses[GEOMETRY_SUBPASS].pColorAttachments = &idRef;
+	subpasses[GEOMETRY_SUBPASS].pDepthStencilAttachment = &depthRef;
+
+	//the depth is left untouched during the resolve, the id tells the background apart
+	subpasses[RESOLVE_SUBPASS].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[RESOLVE_SUBPASS].inputAttachmentCount = 1;
+	subpasses[RESOLVE_SUBPASS].pInputAttachments = &inputRef;
+	subpasses[RESOLVE_SUBPASS].colorAttachmentCount = 1;
+	subpasses[RESOLVE_SUBPASS].pColorAttachments = &colorRef;
+	const uint32_t preservedDepth = 1;
+	subpasses[RESOLVE_SUBPASS].preserveAttachmentCount = 1;
+	subpasses[RESOLVE_SUBPASS].pPreserveAttachments = &preservedDepth;
+
+	VkSubpassDependency dependencies[3] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = GEOMETRY_SUBPASS;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	//per region, a pixel of the resolve only reads the id at the same pixel
+	dependencies[1].srcSubpass = GEOMETRY_SUBPASS;
+	dependencies[1].dstSubpass = RESOLVE_SUBPASS;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	dependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[2].dstSubpass = RESOLVE_SUBPASS;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].srcAccessMask = 0;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = ATTACHMENT_COUNT;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = 2;
+	renderPassInfo.pSubpasses = subpasses;
+	renderPassInfo.dependencyCount = 3;
+	renderPassInfo.pDependencies = dependencies;
+	VK_CHECK(vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass));
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_renderPass;
+	framebufferInfo.attachmentCount = ATTACHMENT_COUNT;
+	framebufferInfo.width = engine.m_windowExtent.width;
+	framebufferInfo.height = engine.m_windowExtent.height;
+	framebufferInfo.layers = 1;
+
+	m_framebuffers.resize(engine.m_swapchainImageViews.size());
+	for (size_t i = 0; i < m_framebuffers.size(); i++)
+	{
+		const VkImageView views[ATTACHMENT_COUNT] = { engine.m_swapchainImageViews[i], engine.m_depthImageView, m_idView };
+		framebufferInfo.pAttachments = views;
+		VK_CHECK(vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_framebuffers[i]));
+	}
+
+	VkDescriptorSetLayoutBinding bindings[BINDING_COUNT];
+	bindings[BINDING_IDS] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, BINDING_IDS);
+	for (uint32_t i = BINDING_VERTICES; i < BINDING_COUNT; i++)
+		bindings[i] = vkinit::descriptorsetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, i);
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.bindingCount = BINDING_COUNT;
+	setInfo.pBindings = bindings;
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &setInfo, nullptr, &m_setLayout));
+
+	m_sets.resize(FRAME_OVERLAP);
+	const std::vector<VkDescriptorSetLayout> layouts(FRAME_OVERLAP, m_setLayout);
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = engine.m_descriptorPool;
+	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(FRAME_OVERLAP);
+	setAllocInfo.pSetLayouts = layouts.data();
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &setAllocInfo, m_sets.data()));
+
+	//the meshes of the slots are written every frame, the ids never change of image
+	m_objectMeshBuffers.resize(FRAME_OVERLAP);
+	for (uint32_t i = 0; i < FRAME_OVERLAP; i++)
+	{
+		m_objectMeshBuffers[i] = engine.createBuffer(m_objectSlotCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+		VkDescriptorImageInfo idInfo = { VK_NULL_HANDLE, m_idView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		VkDescriptorBufferInfo objectMeshInfo;
+		objectMeshInfo.buffer = m_objectMeshBuffers[i].buffer;
+		objectMeshInfo.offset = 0;
+		objectMeshInfo.range = m_objectSlotCount * sizeof(uint32_t);
+
+		const VkWriteDescriptorSet writes[] = {
+			vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, m_sets[i], &idInfo, BINDING_IDS),
+			vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_sets[i], &objectMeshInfo, BINDING_OBJECT_MESHES)
+		};
+		vkUpdateDescriptorSets(m_device, 2, writes, 0, nullptr);
+	}
+
+	//the sets are complete once the geometry is built, an empty one until then
+	buildScene(engine, nullptr, 0, 0);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			destroyGeometry();
+			for (const AllocatedBuffer& buffer : m_objectMeshBuffers)
+				vmaDestroyBuffer(m_allocator, buffer.buffer, buffer.allocation);
+			vkDestroyDescriptorSetLayout(m_device, m_setLayout, nullptr);
+			for (const VkFramebuffer framebuffer : m_framebuffers)
+				vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+			vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+			vkDestroyImageView(m_device, m_idView, nullptr);
+			vmaDestroyImage(m_allocator, m_idImage.image, m_idImage.allocation);
+		});
+}
+
+void VisibilityRenderer::initPipelines(VulkanEngine& engine, const VkShaderModule idVertShader, const VkShaderModule idFragShader,
+	const VkShaderModule fullscreenVertShader, const VkShaderModule resolveFragShader)
+{
+	const VkDescriptorSetLayout setLayouts[] = { engine.m_globalSetLayout, engine.m_objectSetLayout, m_setLayout };
+	VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipelineLayoutCreateInfo();
+	layoutInfo.setLayoutCount = 2;
+	layoutInfo.pSetLayouts = setLayouts;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_idPipelineLayout));
+	layoutInfo.setLayoutCount = 3;
+	VK_CHECK(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_resolvePipelineLayout));
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.m_inputAssembly = vkinit::inputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
+	pipelineBuilder.m_viewport = { 0.f, 0.f, static_cast<float>(engine.m_windowExtent.width), static_cast<float>(engine.m_windowExtent.height), 0.f, 1.f };
+	pipelineBuilder.m_scissor = { { 0, 0 }, engine.m_windowExtent };
+	pipelineBuilder.m_rasterizer = vkinit::rasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+	pipelineBuilder.m_multisampling = vkinit::multisamplingStateCreateInfo();
+	pipelineBuilder.m_colorBlendAttachment = vkinit::colorBlendAttachementState();
+
+	//the ids read the positions only, the triangle is found again from gl_PrimitiveID
+	const VertexInputDescription vertexDescription = Vertex::getVertexDescription();
+	pipelineBuilder.m_vertexInputInfo = vkinit::vertexInputStateCreateInfo();
+	pipelineBuilder.m_vertexInputInfo.pVertexAttributeDescriptions = &vertexDescription.attributes[0];
+	pipelineBuilder.m_vertexInputInfo.vertexAttributeDescriptionCount = 1;
+	pipelineBuilder.m_vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
+	pipelineBuilder.m_vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexDescription.bindings.size());
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	pipelineBuilder.m_pipelineLayout = m_idPipelineLayout;
+	pipelineBuilder.m_subpass = GEOMETRY_SUBPASS;
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, idVertShader));
+	pipelineBuilder.m_shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, idFragShader));
+	m_idPipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+
+	//a single triangle covering the screen, generated from the vertex index
+	pipelineBuilder.m_vertexInputInfo = vkinit::vertexInputStateCreateInfo();
+	pipelineBuilder.m_rasterizer.cullMode = VK_CULL_MODE_NONE;
+	pipelineBuilder.m_depthStencil = vkinit::depthStencilCreateInfo(false, false, VK_COMPARE_OP_ALWAYS);
+	pipelineBuilder.m_pipelineLayout = m_resolvePipelineLayout;
+	pipelineBuilder.m_subpass = RESOLVE_SUBPASS;
+	pipelineBuilder.m_shaderStages[0] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, fullscreenVertShader);
+	pipelineBuilder.m_shaderStages[1] = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, resolveFragShader);
+	m_resolvePipeline = pipelineBuilder.buildPipeline(m_device, m_renderPass);
+
+	engine.m_mainDeletionQueue.push_function([=, this]()
+		{
+			vkDestroyPipeline(m_device, m_idPipeline, nullptr);
+			vkDestroyPipeline(m_device, m_resolvePipeline, nullptr);
+			vkDestroyPipelineLayout(m_device, m_idPipelineLayout, nullptr);
+			vkDestroyPipelineLayout(m_device, m_resolvePipelineLayout, nullptr);
+		});
+}
+
+void VisibilityRenderer::destroyGeometry()
+{
+	for (AllocatedBuffer* buffer : { &m_vertexBuffer, &m_indexBuffer, &m_meshBuffer })
+	{
+		if (buffer->buffer != VK_NULL_HANDLE)
+			vmaDestroyBuffer(m_allocator, buffer->buffer, buffer->allocation);
+		*buffer = {};
+	}
+}
+
+void VisibilityRenderer::buildScene(VulkanEngine& engine, const RenderObject* objects, const uint32_t count, const uint64_t sceneVersion)
+{
+	//the previous frames may still read the buffers
+	vkDeviceWaitIdle(m_device);
+	destroyGeometry();
+	m_meshIds.clear();
+	m_sceneObjectCount = count;
+	m_sceneVersion = sceneVersion;
+
+	//the full level of detail of every mesh, its indices stay relative to its first vertex
+	std::vector<GPUVisibilityVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<glm::uvec2> meshes;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const RenderObject& object = objects[i];
+		if (!object.mesh || !object.material || object.material->gbufferPipeline == VK_NULL_HANDLE || object.pass != DrawPass::Opaque
+			|| object.mesh->m_lods.empty() || object.mesh->m_lods[0].indexCount / 3 > MAX_TRIANGLES)
+			continue;
+
+		const auto [it, inserted] = m_meshIds.try_emplace(object.mesh, static_cast<uint32_t>(meshes.size()));
+		if (!inserted)
+			continue;
+
+		const Mesh& mesh = *object.mesh;
+		meshes.emplace_back(static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(indices.size()));
+		for (const Vertex& vertex : mesh.m_vertices)
+			vertices.push_back({ glm::vec4(vertex.position, 1.f), glm::vec4(vertex.normal, 0.f) });
+		indices.insert(indices.end(), mesh.m_indices.begin() + mesh.m_lods[0].firstIndex,
+			mesh.m_indices.begin() + mesh.m_lods[0].firstIndex + mesh.m_lods[0].indexCount);
+	}
+	m_stats.meshCount = static_cast<uint32_t>(meshes.size());
+	m_stats.vertexCount = static_cast<uint32_t>(vertices.size());
+	m_stats.triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+	//empty buffers cannot be bound, an empty scene keeps one unused element
+	const size_t vertexSize = std::max<size_t>(vertices.size(), 1) * sizeof(GPUVisibilityVertex);
+	const size_t indexSize = std::max<size_t>(indices.size(), 1) * sizeof(uint32_t);
+	const size_t meshSize = std::max<size_t>(meshes.size(), 1) * sizeof(glm::uvec2);
+	m_vertexBuffer = engine.createBuffer(vertexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_indexBuffer = engine.createBuffer(indexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	m_meshBuffer = engine.createBuffer(meshSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	//one staging buffer holds the vertices, the indices and the meshes
+	const size_t vertexBytes = vertices.size() * sizeof(GPUVisibilityVertex);
+	const size_t indexBytes = indices.size() * sizeof(uint32_t);
+	const size_t meshBytes = meshes.size() * sizeof(glm::uvec2);
+	if (vertexBytes > 0)
+	{
+		AllocatedBuffer stagingBuffer = engine.createBuffer(vertexBytes + indexBytes + meshBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+		char* data;
+		vmaMapMemory(m_allocator, stagingBuffer.allocation, reinterpret_cast<void**>(&data));
+		memcpy(data, vertices.data(), vertexBytes);
+		memcpy(data + vertexBytes, indices.data(), indexBytes);
+		memcpy(data + vertexBytes + indexBytes, meshes.data(), meshBytes);
+		vmaUnmapMemory(m_allocator, stagingBuffer.allocation);
+
+		engine.immediateSubmit([&](const VkCommandBuffer cmd)
+			{
+				VkBufferCopy copy{ 0, 0, vertexBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_vertexBuffer.buffer, 1, &copy);
+				copy = { vertexBytes, 0, indexBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_indexBuffer.buffer, 1, &copy);
+				copy = { vertexBytes + indexBytes, 0, meshBytes };
+				vkCmdCopyBuffer(cmd, stagingBuffer.buffer, m_meshBuffer.buffer, 1, &copy);
+			});
+		vmaDestroyBuffer(m_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	}
+
+	const AllocatedBuffer* buffers[] = { &m_vertexBuffer, &m_indexBuffer, &m_meshBuffer };
+	const size_t sizes[] = { vertexSize, indexSize, meshSize };
+	VkDescriptorBufferInfo bufferInfos[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		bufferInfos[i].buffer = buffers[i]->buffer;
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = sizes[i];
+	}
+	for (const VkDescriptorSet set : m_sets)
+	{
+		VkWriteDescriptorSet writes[3];
+		for (uint32_t i = 0; i < 3; i++)
+			writes[i] = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, set, &bufferInfos[i], BINDING_VERTICES + i);
+		vkUpdateDescriptorSets(m_device, 3, writes, 0, nullptr);
+	}
+}
+
+bool VisibilityRenderer::canDraw(const DrawBatch& batch) const
+{
+	return batch.pass == DrawPass::Opaque && batch.material->gbufferPipeline != VK_NULL_HANDLE && m_meshIds.contains(batch.mesh);
+}
+
+void VisibilityRenderer::writeObjectMeshes(const uint32_t frameIndex, const std::vector<DrawBatch>& batches)
+{
+	uint32_t* objectMeshes;
+	vmaMapMemory(m_allocator, m_objectMeshBuffers[frameIndex].allocation, reinterpret_cast<void**>(&objectMeshes));
+	for (const DrawBatch& batch : batches)
+	{
+		if (!canDraw(batch) || batch.firstInstance + batch.instanceCount > m_objectSlotCount)
+			continue;
+		std::fill_n(objectMeshes + batch.firstInstance, batch.instanceCount, m_meshIds.at(batch.mesh));
+	}
+	vmaUnmapMemory(m_allocator, m_objectMeshBuffers[frameIndex].allocation);
+}
+
+void VisibilityRenderer::recordResolve(const VkCommandBuffer cmd, const uint32_t frameIndex, const VkDescriptorSet globalSet, const uint32_t globalOffset,
+	const VkDescriptorSet objectSet) const
+{
+	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 0, 1, &globalSet, 1, &globalOffset);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 1, 1, &objectSet, 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolvePipelineLayout, 2, 1, &m_sets[frameIndex], 0, nullptr);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+}
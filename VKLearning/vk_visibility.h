@@ -0,0 +1,103 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_mesh.h"
+#include "vk_render_queue.h"
+
+#include <unordered_map>
+#include <vector>
+
+class VulkanEngine;
+
+// vertex of the merged geometry the resolve fetches, only what the shading interpolates
+GPU_DATA struct GPUVisibilityVertex
+{
+	glm::vec4 position;
+	glm::vec4 normal;
+};
+
+struct VisibilityStats
+{
+	uint32_t meshCount = 0;
+	uint32_t vertexCount = 0;
+	uint32_t triangleCount = 0;
+};
+
+// Visibility buffer shading in a single render pass of two subpasses. The geometry subpass only writes the depth
+// and a 32 bit id per pixel, the object buffer slot of the instance and the triangle in it. The resolve subpass reads
+// the id back as an input attachment, fetches the three vertices of the triangle from a merged copy of the meshes,
+// interpolates them with perspective correct barycentrics and shades the pixel once, with the clustered lights.
+// The cost of the shading no longer depends on the overdraw nor on the number of triangles.
+// The instances are the ones of the render queue, they always draw their full level of detail.
+class VisibilityRenderer
+{
+public:
+	static constexpr uint32_t GEOMETRY_SUBPASS = 0;
+	static constexpr uint32_t RESOLVE_SUBPASS = 1;
+	static constexpr VkFormat ID_FORMAT = VK_FORMAT_R32_UINT;
+	// id = (object slot + 1) << TRIANGLE_BITS | triangle, 0 where nothing was drawn
+	static constexpr uint32_t TRIANGLE_BITS = 17;
+	static constexpr uint32_t MAX_TRIANGLES = 1u << TRIANGLE_BITS;
+	static constexpr uint32_t MAX_OBJECT_SLOTS = (1u << (32 - TRIANGLE_BITS)) - 1;
+	// the swapchain image, the depth and the ids
+	static constexpr uint32_t ATTACHMENT_COUNT = 3;
+
+	// creates the id attachment, the render pass, one framebuffer per swapchain image and one set per frame.
+	// objectSlotCount is the size of the object buffer
+	void init(VulkanEngine& engine, uint32_t objectSlotCount);
+	// the pipeline writing the ids reads the positions only, its sets are the global and object sets of the engine.
+	// The resolve pipeline adds the set of the geometry
+	void initPipelines(VulkanEngine& engine, VkShaderModule idVertShader, VkShaderModule idFragShader,
+		VkShaderModule fullscreenVertShader, VkShaderModule resolveFragShader);
+
+	// waits for the GPU to be idle and merges the meshes of the objects the resolve can shade. Meshes with more than
+	// MAX_TRIANGLES triangles are skipped. sceneVersion is the version of the static objects the geometry is built from
+	void buildScene(VulkanEngine& engine, const RenderObject* objects, uint32_t count, uint64_t sceneVersion);
+	// whether the geometry of the batch is in the merged buffers, with a material whose BRDF the resolve matches
+	bool canDraw(const DrawBatch& batch) const;
+	// writes the mesh of every object slot the batches draw, for the resolve of this frame
+	void writeObjectMeshes(uint32_t frameIndex, const std::vector<DrawBatch>& batches);
+
+	// moves to the resolve subpass and draws it, recorded inline in the primary command buffer
+	void recordResolve(VkCommandBuffer cmd, uint32_t frameIndex, VkDescriptorSet globalSet, uint32_t globalOffset, VkDescriptorSet objectSet) const;
+
+	VkRenderPass getRenderPass() const { return m_renderPass; }
+	VkFramebuffer getFramebuffer(uint32_t swapchainImageIndex) const { return m_framebuffers[swapchainImageIndex]; }
+	VkPipeline getIdPipeline() const { return m_idPipeline; }
+	VkPipelineLayout getIdPipelineLayout() const { return m_idPipelineLayout; }
+	// number of render objects the current geometry was built from
+	uint32_t getSceneObjectCount() const { return m_sceneObjectCount; }
+	uint64_t getSceneVersion() const { return m_sceneVersion; }
+	const VisibilityStats& getStats() const { return m_stats; }
+
+private:
+	void destroyGeometry();
+
+	VkDevice m_device{ VK_NULL_HANDLE };
+	VmaAllocator m_allocator{ VK_NULL_HANDLE };
+	uint32_t m_objectSlotCount{ 0 };
+
+	AllocatedImage m_idImage{};
+	VkImageView m_idView{ VK_NULL_HANDLE };
+
+	VkRenderPass m_renderPass{ VK_NULL_HANDLE };
+	std::vector<VkFramebuffer> m_framebuffers;
+
+	// the ids as input attachment, the merged geometry and the mesh of every object slot, one set per frame in flight
+	VkDescriptorSetLayout m_setLayout{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorSet> m_sets;
+	std::vector<AllocatedBuffer> m_objectMeshBuffers;
+	VkPipelineLayout m_idPipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_idPipeline{ VK_NULL_HANDLE };
+	VkPipelineLayout m_resolvePipelineLayout{ VK_NULL_HANDLE };
+	VkPipeline m_resolvePipeline{ VK_NULL_HANDLE };
+
+	AllocatedBuffer m_vertexBuffer{};
+	AllocatedBuffer m_indexBuffer{};
+	// first vertex and first index of every merged mesh
+	AllocatedBuffer m_meshBuffer{};
+	std::unordered_map<const Mesh*, uint32_t> m_meshIds;
+	uint32_t m_sceneObjectCount{ 0 };
+	uint64_t m_sceneVersion{ 0 };
+	VisibilityStats m_stats;
+};